@@ -5,6 +5,8 @@ const through = require("through2");
 const path = require("path");
 const fs = require("fs");
 const readline = require("readline");
+const zlib = require("zlib");
+const crypto = require("crypto");
 
 const destination = "new_http.c";
 
@@ -17,21 +19,51 @@ function dumpFileSize() {
   });
 }
 
-/** This function injects C for a const field in new_http.c */
-function generateCode(field_name, is_script) {
+/**
+ * Returns C code of a gzipped asset: byte array, its length and ETag.
+ * ETag is made from content, so it changes only when asset changes.
+ */
+function generateAssetCode(field_name, file_name, contents) {
+  const gzipped = zlib.gzipSync(contents, { level: 9 });
+  const etag = crypto
+    .createHash("sha1")
+    .update(contents)
+    .digest("hex")
+    .substring(0, 16);
+  const lines = [];
+
+  lines.push(
+    `// ${file_name}: ${contents.length} bytes minified, ${gzipped.length} bytes gzipped`
+  );
+  lines.push(`const unsigned char ${field_name}[] = {`);
+  for (let i = 0; i < gzipped.length; i += 24) {
+    const row = [];
+    for (let j = i; j < i + 24 && j < gzipped.length; j++) {
+      row.push("0x" + gzipped[j].toString(16).padStart(2, "0"));
+    }
+    lines.push("\t" + row.join(",") + ",");
+  }
+  lines.push("};");
+  lines.push(`const int ${field_name}_len = ${gzipped.length};`);
+  lines.push(`const char ${field_name}_etag[] = "${etag}";`);
+  return { code: lines.join("\r\n"), gzippedLength: gzipped.length };
+}
+
+/** This function injects C for a gzipped asset in new_http.c */
+function generateCode(field_name, pages) {
   return through.obj(function (file, enc, cb) {
     if (file.isBuffer()) {
       const contents = file.contents;
 
-      let output = String(contents);
-      output = output.replace(/\"/g, '\\"');
+      const asset = generateAssetCode(field_name, file.basename, contents);
+      const output = asset.code;
       console.log(
-        `Processing ${file.basename}, reduced length ${contents.length}`
+        `Processing ${file.basename}, reduced length ${contents.length}, gzipped ${asset.gzippedLength}`
+      );
+      // it was inlined in each page before, now it's sent once and then cached
+      console.log(
+        `${file.basename}: ${contents.length} bytes saved per ${pages} after first load, first load sends ${contents.length - asset.gzippedLength} bytes less`
       );
-
-      const prefix = is_script ? "<script type='text/javascript'>" : "<style>";
-      const suffix = is_script ? "</script>" : "</style>";
-      output = `const char ${field_name}[] = "${prefix}${output}${suffix}";`;
 
       const target_path = path.join(path.dirname(file.path), destination);
       //console.log(`Updated ${target_path}`);
@@ -100,7 +132,7 @@ function minifyJs() {
     .src("./src/httpserver/script.js")
     .pipe(dumpFileSize())
     .pipe(uglify())
-    .pipe(generateCode("pageScript", true));
+    .pipe(generateCode("pageScript", "page"));
 }
 
 function minifyHassDiscoveryJs() {
@@ -108,7 +140,7 @@ function minifyHassDiscoveryJs() {
     .src("./src/httpserver/script_ha_discovery.js")
     .pipe(dumpFileSize())
     .pipe(uglify())
-    .pipe(generateCode("ha_discovery_script", true));
+    .pipe(generateCode("ha_discovery_script", "Home Assistant config page"));
 }
 
 function minifyCss() {
@@ -116,7 +148,8 @@ function minifyCss() {
     .src("./src/httpserver/style.css")
     .pipe(dumpFileSize())
     .pipe(cssnano())
-    .pipe(generateCode("htmlHeadStyle", false));
+    .pipe(generateCode("htmlHeadStyle", "page"));
 }
 
+exports.generateAssetCode = generateAssetCode;
 exports.default = gulp.series(minifyJs, minifyHassDiscoveryJs, minifyCss);
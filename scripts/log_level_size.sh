@@ -0,0 +1,42 @@
+#!/bin/sh
+# Reports how much code and rodata each log level costs.
+# Firmware is built once for every OBK_LOG_MIN_LEVEL (see src/obk_config.h)
+# and sizes of text and rodata sections of the result are compared.
+#
+# usage: scripts/log_level_size.sh "<build command>" <elf file>
+# example:
+#   SIZE=arm-none-eabi-size scripts/log_level_size.sh "make OpenBL602" \
+#     sdk/OpenBL602/customer_app/bl602_sharedApp/build_out/bl602_sharedApp.elf
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 \"<build command>\" <elf file>"
+	exit 1
+fi
+BUILD="$1"
+ELF="$2"
+SIZE="${SIZE:-size}"
+CONFIG="$(dirname "$0")/../src/obk_config.h"
+NAMES="None Error Warn Info Debug ExtraDebug"
+
+cp "$CONFIG" "$CONFIG.bak" || exit 1
+trap 'mv "$CONFIG.bak" "$CONFIG"' EXIT INT TERM
+
+prevText=""
+prevRodata=""
+for level in 0 1 2 3 4 5; do
+	sed "s/^#define OBK_LOG_MIN_LEVEL.*/#define OBK_LOG_MIN_LEVEL\t\t$level/" "$CONFIG.bak" > "$CONFIG"
+	if ! sh -c "$BUILD" > /dev/null 2>&1; then
+		echo "build failed for OBK_LOG_MIN_LEVEL $level"
+		exit 1
+	fi
+	# sum .text* and .rodata* sections
+	set -- $("$SIZE" -A "$ELF" | awk '$1 ~ /^\.text/ { t += $2 } $1 ~ /^\.rodata/ { r += $2 } END { print t + 0, r + 0 }')
+	name=$(echo $NAMES | cut -d' ' -f$((level + 1)))
+	if [ -z "$prevText" ]; then
+		printf "level %d %-10s text %8d rodata %8d\n" $level $name $1 $2
+	else
+		printf "level %d %-10s text %8d rodata %8d, level costs text %6d rodata %6d\n" $level $name $1 $2 $(($1 - prevText)) $(($2 - prevRodata))
+	fi
+	prevText=$1
+	prevRodata=$2
+done
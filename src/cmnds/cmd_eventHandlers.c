@@ -261,46 +261,129 @@ typedef struct eventHandler_s {
 	int requiredArgument3;
 	// command to execute when it happens
 	char *command;
+	// the same command, parsed once for fast execution
+	compiledCommand_t compiled;
 	// for UART event handlers?
 	char *requiredArgumentText;
 
 	struct eventHandler_s *next;
 } eventHandler_t;
 
-static eventHandler_t *g_eventHandlers = 0;
-
+// Handlers are bucketed by event code, so firing an event
+// only looks at handlers for this very event.
+typedef struct eventBucket_s {
+	// integer argument handlers (addEventHandler with number),
+	// sorted by arguments, so the walk can stop early
+	eventHandler_t *ints;
+	// string argument and change handlers
+	eventHandler_t *others;
+} eventBucket_t;
+
+// allocated with the first handler
+static eventBucket_t *g_eventBuckets = 0;
+// statistics for listEventHandlers
+static int g_eventFires = 0;
+static int g_eventMatches = 0;
+static int g_eventScanned = 0;
+
+static eventBucket_t *EventHandlers_GetBucket(byte eventCode) {
+	if (eventCode >= CMD_EVENT_MAX_TYPES) {
+		return 0;
+	}
+	if (g_eventBuckets == 0) {
+		g_eventBuckets = (eventBucket_t*)malloc(sizeof(eventBucket_t) * CMD_EVENT_MAX_TYPES);
+		if (g_eventBuckets == 0) {
+			return 0;
+		}
+		memset(g_eventBuckets, 0, sizeof(eventBucket_t) * CMD_EVENT_MAX_TYPES);
+	}
+	return &g_eventBuckets[eventCode];
+}
+// used when firing - does not allocate anything
+static eventBucket_t *EventHandlers_FindBucket(byte eventCode) {
+	g_eventFires++;
+	if (g_eventBuckets == 0 || eventCode >= CMD_EVENT_MAX_TYPES) {
+		return 0;
+	}
+	return &g_eventBuckets[eventCode];
+}
+static int EventHandlers_CompareArgs(eventHandler_t *ev, int argument, int argument2, int argument3) {
+	if (ev->requiredArgument != argument)
+		return ev->requiredArgument < argument ? -1 : 1;
+	if (ev->requiredArgument2 != argument2)
+		return ev->requiredArgument2 < argument2 ? -1 : 1;
+	if (ev->requiredArgument3 != argument3)
+		return ev->requiredArgument3 < argument3 ? -1 : 1;
+	return 0;
+}
+static void EventHandlers_Run(eventHandler_t *ev, const char *from) {
+	g_eventMatches++;
+	ADDLOG_INFO(LOG_FEATURE_EVENT, "%s: executing command %s", from, ev->command);
+	CMD_ExecuteCompiled(&ev->compiled, COMMAND_FLAG_SOURCE_SCRIPT);
+}
 
 void EventHandlers_ProcessVariableChange_Integer(byte eventCode, int oldValue, int newValue) {
 	struct eventHandler_s *ev;
+	eventBucket_t *b;
 
-	ev = g_eventHandlers;
+	b = EventHandlers_FindBucket(eventCode);
+	if (b == 0)
+		return;
+	ev = b->others;
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(EVENT_EvaluateChangeCondition(ev->eventType, ev->requiredArgument, oldValue, newValue)) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_ProcessVariableChange_Integer: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
+		g_eventScanned++;
+		if(EVENT_EvaluateChangeCondition(ev->eventType, ev->requiredArgument, oldValue, newValue)) {
+			EventHandlers_Run(ev, "EventHandlers_ProcessVariableChange_Integer");
 		}
 		ev = ev->next;
 	}
 }
 
+static void EventHandlers_AddToBucket(eventHandler_t *ev) {
+	eventBucket_t *b;
+	eventHandler_t **p;
+
+	b = EventHandlers_GetBucket(ev->eventCode);
+	if (b == 0) {
+		// should not happen, but do not leak
+		ADDLOG_ERROR(LOG_FEATURE_EVENT, "Can't add handler for event %i", ev->eventCode);
+		free(ev->command);
+		free(ev->requiredArgumentText);
+		CMD_FreeCompiled(&ev->compiled);
+		free(ev);
+		return;
+	}
+	if (ev->requiredArgumentText != 0 || ev->eventType != EVENT_DEFAULT) {
+		// newest first, like before
+		ev->next = b->others;
+		b->others = ev;
+		return;
+	}
+	// keep sorted, newest first among the same arguments, so they run in the same order as before
+	p = &b->ints;
+	while (*p && EventHandlers_CompareArgs(*p, ev->requiredArgument, ev->requiredArgument2, ev->requiredArgument3) < 0) {
+		p = &(*p)->next;
+	}
+	ev->next = *p;
+	*p = ev;
+}
+
 void EventHandlers_AddEventHandler_Integer(byte eventCode, int type, int requiredArgument, int requiredArgument2, int requiredArgument3, const char *commandToRun)
 {
 	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
 	memset(ev,0,sizeof(eventHandler_t));
 
-	ev->next = g_eventHandlers;
-	g_eventHandlers = ev;
-
 	ev->requiredArgumentText = NULL;
 	ev->eventType = type;
 	ev->command = strdup(commandToRun);
+	CMD_Compile(&ev->compiled, commandToRun);
 	ev->eventCode = eventCode;
 	ev->requiredArgument = requiredArgument;
 	ev->requiredArgument2 = requiredArgument2;
 	ev->requiredArgument3 = requiredArgument3;
+
+	EventHandlers_AddToBucket(ev);
 }
 
 void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *requiredArgument, const char *commandToRun)
@@ -308,73 +391,70 @@ void EventHandlers_AddEventHandler_String(byte eventCode, int type, const char *
 	eventHandler_t *ev = malloc(sizeof(eventHandler_t));
 	memset(ev,0,sizeof(eventHandler_t));
 
-	ev->next = g_eventHandlers;
-	g_eventHandlers = ev;
-
 	ev->requiredArgumentText = strdup(requiredArgument);
 	ev->eventType = type;
 	ev->command = strdup(commandToRun);
+	CMD_Compile(&ev->compiled, commandToRun);
 	ev->eventCode = eventCode;
 	ev->requiredArgument = 0;
 	ev->requiredArgument2 = 0;
+
+	EventHandlers_AddToBucket(ev);
 }
-void EventHandlers_FireEvent3(byte eventCode, int argument, int argument2, int argument3) {
+static void EventHandlers_FireIntegers(byte eventCode, int argument, int argument2, int argument3, int argsCount, const char *from) {
 	struct eventHandler_s *ev;
+	eventBucket_t *b;
+	int res;
 
-	ev = g_eventHandlers;
+	b = EventHandlers_FindBucket(eventCode);
+	if (b == 0)
+		return;
+	ev = b->ints;
 
 	while (ev) {
-		if (eventCode == ev->eventCode) {
-			if (argument == ev->requiredArgument && argument2 == ev->requiredArgument2 && argument3 == ev->requiredArgument3) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent3: executing command %s", ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
+		g_eventScanned++;
+		if (ev->requiredArgument > argument) {
+			// sorted, so nothing more can match
+			break;
+		}
+		if (argsCount == 1) {
+			res = (ev->requiredArgument == argument) ? 0 : -1;
+		}
+		else if (argsCount == 2) {
+			res = EventHandlers_CompareArgs(ev, argument, argument2, ev->requiredArgument3);
+		}
+		else {
+			res = EventHandlers_CompareArgs(ev, argument, argument2, argument3);
+		}
+		if (res == 0) {
+			EventHandlers_Run(ev, from);
 		}
 		ev = ev->next;
 	}
 }
+void EventHandlers_FireEvent3(byte eventCode, int argument, int argument2, int argument3) {
+	EventHandlers_FireIntegers(eventCode, argument, argument2, argument3, 3, "EventHandlers_FireEvent3");
+}
 void EventHandlers_FireEvent2(byte eventCode, int argument, int argument2) {
-	struct eventHandler_s *ev;
-
-	ev = g_eventHandlers;
-
-	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(argument == ev->requiredArgument && argument2 == ev->requiredArgument2) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent2: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
-		}
-		ev = ev->next;
-	}
+	EventHandlers_FireIntegers(eventCode, argument, argument2, 0, 2, "EventHandlers_FireEvent2");
 }
 void EventHandlers_FireEvent(byte eventCode, int argument) {
-	struct eventHandler_s *ev;
-
-	ev = g_eventHandlers;
-
-	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(argument == ev->requiredArgument) {
-				ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent: executing command %s",ev->command);
-				CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
-		}
-		ev = ev->next;
-	}
+	EventHandlers_FireIntegers(eventCode, argument, 0, 0, 1, "EventHandlers_FireEvent");
 }
 void EventHandlers_FireEvent_String(byte eventCode, const char *argument) {
 	struct eventHandler_s *ev;
+	eventBucket_t *b;
 
-	ev = g_eventHandlers;
+	b = EventHandlers_FindBucket(eventCode);
+	if (b == 0)
+		return;
+	ev = b->others;
 
 	while(ev) {
-		if(eventCode==ev->eventCode) {
-			if(ev->requiredArgumentText != 0) {
-				if(!stricmp(argument,ev->requiredArgumentText)) {
-					ADDLOG_INFO(LOG_FEATURE_EVENT, "EventHandlers_FireEvent_String: executing command %s",ev->command);
-					CMD_ExecuteCommand(ev->command, COMMAND_FLAG_SOURCE_SCRIPT);
-				}
+		g_eventScanned++;
+		if(ev->requiredArgumentText != 0) {
+			if(!stricmp(argument,ev->requiredArgumentText)) {
+				EventHandlers_Run(ev, "EventHandlers_FireEvent_String");
 			}
 		}
 		ev = ev->next;
@@ -446,25 +526,38 @@ static commandResult_t CMD_AddEventHandler(const void *context, const char *cmd,
 
 	return CMD_RES_OK;
 }
-commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const char *args, int cmdFlags){
-
+static int EventHandlers_FreeList(eventHandler_t *ev) {
+	eventHandler_t *next;
 	int c = 0;
-	eventHandler_t *ev, *next;
-
-	ev = g_eventHandlers;
 
 	while(ev != 0) {
 		next = ev->next;
 
 		free(ev->command);
+		free(ev->requiredArgumentText);
+		CMD_FreeCompiled(&ev->compiled);
 		free(ev);
 
 		ev = next;
 		c++;
 	}
+	return c;
+}
+commandResult_t CMD_ClearAllHandlers(const void *context, const char *cmd, const char *args, int cmdFlags){
+
+	int c = 0;
+	int i;
+
+	if (g_eventBuckets) {
+		for (i = 0; i < CMD_EVENT_MAX_TYPES; i++) {
+			c += EventHandlers_FreeList(g_eventBuckets[i].ints);
+			c += EventHandlers_FreeList(g_eventBuckets[i].others);
+		}
+		free(g_eventBuckets);
+		g_eventBuckets = 0;
+	}
 
 	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, "Fried %i handlers", c);
-	g_eventHandlers = 0;
 
 	return CMD_RES_OK;
 }
@@ -511,29 +604,45 @@ static commandResult_t CMD_AddChangeHandler(const void *context, const char *cmd
 static commandResult_t CMD_ListEventHandlers(const void *context, const char *cmd, const char *args, int cmdFlags){
 	struct eventHandler_s *ev;
 	int c;
+	int i, j;
 
-	ev = g_eventHandlers;
 	c = 0;
 
-	while(ev) {
+	for (i = 0; g_eventBuckets && i < CMD_EVENT_MAX_TYPES; i++) {
+		for (j = 0; j < 2; j++) {
+			ev = j ? g_eventBuckets[i].others : g_eventBuckets[i].ints;
+			while(ev) {
 
-		ADDLOG_INFO(LOG_FEATURE_EVENT, "Event %i has code %i and command %s",c,ev->eventCode,ev->command);
-		ev = ev->next;
-		c++;
+				ADDLOG_INFO(LOG_FEATURE_EVENT, "Event %i has code %i and command %s",c,ev->eventCode,ev->command);
+				ev = ev->next;
+				c++;
+			}
+		}
 	}
+	ADDLOG_INFO(LOG_FEATURE_EVENT, "Fired %i events, %i matched handlers, avg scan length %.2f",
+		g_eventFires, g_eventMatches, g_eventFires ? ((float)g_eventScanned / g_eventFires) : 0.0f);
 
 	return CMD_RES_OK;
 }
+void EventHandlers_GetStats(int *fires, int *matches, int *scanned) {
+	*fires = g_eventFires;
+	*matches = g_eventMatches;
+	*scanned = g_eventScanned;
+}
 int EventHandlers_GetActiveCount() {
 	struct eventHandler_s *ev;
 	int c;
+	int i;
 
-	ev = g_eventHandlers;
 	c = 0;
 
-	while (ev) {
-		ev = ev->next;
-		c++;
+	for (i = 0; g_eventBuckets && i < CMD_EVENT_MAX_TYPES; i++) {
+		for (ev = g_eventBuckets[i].ints; ev; ev = ev->next) {
+			c++;
+		}
+		for (ev = g_eventBuckets[i].others; ev; ev = ev->next) {
+			c++;
+		}
 	}
 	return c;
 }
@@ -550,7 +659,7 @@ void EventHandlers_Init() {
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("AddChangeHandler", CMD_AddChangeHandler, NULL);
 	//cmddetail:{"name":"listEventHandlers","args":"",
-	//cmddetail:"descr":"Prints full list of added event handlers",
+	//cmddetail:"descr":"Prints full list of added event handlers, along with the count of fired events, matched handlers and the average number of handlers checked per event",
 	//cmddetail:"fn":"CMD_ListEventHandlers","file":"cmnds/cmd_eventHandlers.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("listEventHandlers", CMD_ListEventHandlers, NULL);
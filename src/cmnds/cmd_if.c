@@ -343,7 +343,7 @@ static int g_totalConstants = sizeof(g_constants) / sizeof(g_constants[0]);
 // Etc etc
 // Returns true if constant matches
 // Returns false if no constants found
-const char *CMD_ExpandConstant(const char *s, const char *stop, float *out) {
+static const char *CMD_MatchConstant(const char *s, const char *stop, int *index) {
 	const constant_t *var;
 	int i;
 	var = g_constants;
@@ -351,11 +351,22 @@ const char *CMD_ExpandConstant(const char *s, const char *stop, float *out) {
 		bool bAllowWildCard = strstr(var->constantName, "*");
 		const char *ret = strCompareBound(s, var->constantName, stop, bAllowWildCard);
 		if (ret) {
-			*out = var->getValue(s);
-			ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstant: %s", var->name);
+			*index = i;
 			return ret;
 		}
 	}
+	return 0;
+}
+const char *CMD_ExpandConstant(const char *s, const char *stop, float *out) {
+	const char *ret;
+	int i;
+
+	ret = CMD_MatchConstant(s, stop, &i);
+	if (ret) {
+		*out = g_constants[i].getValue(s);
+		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_ExpandConstant: %s", g_constants[i].constantName);
+		return ret;
+	}
 	return false;
 }
 #if WINDOWS
@@ -544,7 +555,9 @@ char *CMD_ExpandingStrdup(const char *in) {
 	CMD_ExpandConstantsWithinString(in, ret, realLen);
 	return ret;
 }
-float CMD_EvaluateExpression(const char *s, const char *stop) {
+// Old recursive evaluator, parses the text on every call.
+// Only used when expression is too big to be compiled.
+static float CMD_EvaluateExpressionRecursive(const char *s, const char *stop) {
 	byte opCode;
 	const char *op;
 	float a, b, c;
@@ -573,6 +586,8 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 	}
 	if(1) {
 		idx = stop - s;
+		if (idx >= EXPRESSION_DEBUG_BUFFER_SIZE)
+			idx = EXPRESSION_DEBUG_BUFFER_SIZE - 1;
 		memcpy(g_expDebugBuffer,s,idx);
 		g_expDebugBuffer[idx] = 0;
 		ADDLOG_IF_MATHEXP_DBG(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: will run '%s'",g_expDebugBuffer);
@@ -588,8 +603,8 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 		// second token block begins at 'p2' and ends at NULL
 		p2 = op + g_operators[opCode].len;
 
-		a = CMD_EvaluateExpression(s, op);
-		b = CMD_EvaluateExpression(p2, stop);
+		a = CMD_EvaluateExpressionRecursive(s, op);
+		b = CMD_EvaluateExpressionRecursive(p2, stop);
 
 		// Why, again, %f crashes?
 		//ADDLOG_INFO(LOG_FEATURE_EVENT, "CMD_EvaluateExpression: a = %f, b = %f", a, b);
@@ -642,7 +657,7 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 		return c;
 	}
 	if(s[0] == '!') {
-		return !CMD_EvaluateExpression(s+1,stop);
+		return !CMD_EvaluateExpressionRecursive(s+1,stop);
 	}
 	if(CMD_ExpandConstant(s,stop,&c)) {
 		return c;
@@ -650,6 +665,8 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 
 	if(1) {
 		idx = stop - s;
+		if (idx >= EXPRESSION_DEBUG_BUFFER_SIZE)
+			idx = EXPRESSION_DEBUG_BUFFER_SIZE - 1;
 		memcpy(g_expDebugBuffer,s,idx);
 		g_expDebugBuffer[idx] = 0;
 	}
@@ -657,6 +674,316 @@ float CMD_EvaluateExpression(const char *s, const char *stop) {
 	return atof(g_expDebugBuffer);
 }
 
+
+/*
+Expressions are compiled once into postfix bytecode and kept in a small cache
+keyed by the expression text, so 'if' in a script loop does not parse again.
+Compiler follows exactly the same steps as recursive evaluator above,
+but instead of calculating, it emits instructions:
+	$CH1*10>5
+becomes
+	PUSH_CHANNEL 1, PUSH_NUMBER 10, MUL, PUSH_NUMBER 5, GREATER
+Binary operators use opCode_t values.
+*/
+#define EXPR_PUSH_NUMBER		32
+#define EXPR_PUSH_CHANNEL		33
+#define EXPR_PUSH_CONSTANT		34
+#define EXPR_NOT				35
+
+#define EXPR_MAX_INSTRUCTIONS	32
+#define EXPR_MAX_STACK			16
+#define EXPR_CACHE_SIZE			16
+
+typedef struct exprInstr_s {
+	byte op;
+	// index in g_constants for EXPR_PUSH_CONSTANT
+	byte constant;
+	union {
+		float value;
+		int channel;
+		// offset of constant name within expression, passed to getter
+		int offset;
+	};
+} exprInstr_t;
+
+typedef struct exprCompiler_s {
+	const char *base;
+	exprInstr_t code[EXPR_MAX_INSTRUCTIONS];
+	int count;
+	int depth;
+	int maxDepth;
+	bool bFailed;
+} exprCompiler_t;
+
+typedef struct exprCacheEntry_s {
+	// expression text, used as key and as base for constant getters
+	char *text;
+	int len;
+	exprInstr_t *code;
+	int count;
+} exprCacheEntry_t;
+
+// Expressions are evaluated by many tasks (HTTP, MQTT, scripts, quick tick).
+// Cache is only read and replaced under the mutex, code is copied out and run
+// without it, because constant getters may evaluate expressions as well.
+static exprCacheEntry_t g_exprCache[EXPR_CACHE_SIZE];
+static SemaphoreHandle_t g_exprCacheMutex = 0;
+int g_expr_cacheHits = 0;
+int g_expr_cacheMisses = 0;
+
+static void Expr_Emit(exprCompiler_t *c, byte op, int stackChange) {
+	if (c->count >= EXPR_MAX_INSTRUCTIONS) {
+		c->bFailed = true;
+		return;
+	}
+	c->code[c->count].op = op;
+	c->code[c->count].constant = 0;
+	c->code[c->count].value = 0;
+	c->count++;
+	c->depth += stackChange;
+	if (c->depth > c->maxDepth) {
+		c->maxDepth = c->depth;
+	}
+}
+static void Expr_EmitNumber(exprCompiler_t *c, float value) {
+	Expr_Emit(c, EXPR_PUSH_NUMBER, 1);
+	if (c->bFailed == false) {
+		c->code[c->count - 1].value = value;
+	}
+}
+static void Expr_Compile(exprCompiler_t *c, const char *s, const char *stop) {
+	byte opCode;
+	const char *op;
+	char tmp[32];
+	int idx;
+	const char *ret;
+
+	if (c->bFailed)
+		return;
+	if (s == 0 || *s == 0) {
+		Expr_EmitNumber(c, 0);
+		return;
+	}
+	// cull whitespaces at the end of expression
+	if (stop == 0) {
+		stop = s + strlen(s);
+	}
+	while (stop > s && isspace(((int)stop[-1]))) {
+		stop--;
+	}
+	while (isspace(((int)*s))) {
+		s++;
+		if (s >= stop) {
+			Expr_EmitNumber(c, 0);
+			return;
+		}
+	}
+	op = CMD_FindOperator(s, stop, &opCode);
+	if (op) {
+		Expr_Compile(c, s, op);
+		Expr_Compile(c, op + g_operators[opCode].len, stop);
+		Expr_Emit(c, opCode, -1);
+		return;
+	}
+	if (s[0] == '!') {
+		Expr_Compile(c, s + 1, stop);
+		Expr_Emit(c, EXPR_NOT, 0);
+		return;
+	}
+	ret = CMD_MatchConstant(s, stop, &idx);
+	if (ret) {
+		if (g_constants[idx].getValue == getChannelValue) {
+			Expr_Emit(c, EXPR_PUSH_CHANNEL, 1);
+			if (c->bFailed == false) {
+				c->code[c->count - 1].channel = atoi(s + 3);
+			}
+		}
+		else {
+			Expr_Emit(c, EXPR_PUSH_CONSTANT, 1);
+			if (c->bFailed == false) {
+				c->code[c->count - 1].constant = idx;
+				c->code[c->count - 1].offset = s - c->base;
+			}
+		}
+		return;
+	}
+	idx = stop - s;
+	if (idx < 0) {
+		idx = 0;
+	}
+	if (idx >= sizeof(tmp)) {
+		c->bFailed = true;
+		return;
+	}
+	memcpy(tmp, s, idx);
+	tmp[idx] = 0;
+	Expr_EmitNumber(c, atof(tmp));
+}
+static float Expr_Run(const exprInstr_t *code, int count, const char *base) {
+	float stack[EXPR_MAX_STACK];
+	int sp = 0;
+	float a, b, c;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		switch (code[i].op) {
+		case EXPR_PUSH_NUMBER:
+			stack[sp++] = code[i].value;
+			continue;
+		case EXPR_PUSH_CHANNEL:
+			stack[sp++] = CHANNEL_Get(code[i].channel);
+			continue;
+		case EXPR_PUSH_CONSTANT:
+			stack[sp++] = g_constants[code[i].constant].getValue(base + code[i].offset);
+			continue;
+		case EXPR_NOT:
+			stack[sp - 1] = !stack[sp - 1];
+			continue;
+		}
+		b = stack[--sp];
+		a = stack[sp - 1];
+		switch (code[i].op)
+		{
+		case OP_EQUAL:
+			c = a == b;
+			break;
+		case OP_EQUAL_OR_GREATER:
+			c = a >= b;
+			break;
+		case OP_EQUAL_OR_LESS:
+			c = a <= b;
+			break;
+		case OP_NOT_EQUAL:
+			c = a != b;
+			break;
+		case OP_GREATER:
+			c = a > b;
+			break;
+		case OP_LESS:
+			c = a < b;
+			break;
+		case OP_AND:
+			c = ((int)a) && ((int)b);
+			break;
+		case OP_OR:
+			c = ((int)a) || ((int)b);
+			break;
+		case OP_ADD:
+			c = a + b;
+			break;
+		case OP_SUB:
+			c = a - b;
+			break;
+		case OP_MUL:
+			c = a * b;
+			break;
+		case OP_DIV:
+			c = a / b;
+			break;
+		default:
+			c = 0;
+			break;
+		}
+		stack[sp - 1] = c;
+	}
+	return stack[0];
+}
+static int Expr_Hash(const char *s, int len) {
+	int hash = 0;
+	while (len--) {
+		hash = hash * 31 + (byte)*s;
+		s++;
+	}
+	return hash & (EXPR_CACHE_SIZE - 1);
+}
+void CMD_InitExpressionCache() {
+	if (g_exprCacheMutex == 0) {
+		g_exprCacheMutex = xSemaphoreCreateMutex();
+	}
+}
+// copies compiled code of cached expression, returns false if it's not cached
+static bool Expr_CacheGet(exprCacheEntry_t *e, const char *s, int len, exprCompiler_t *c) {
+	bool bFound = false;
+
+	if (xSemaphoreTake(g_exprCacheMutex, 100) != pdTRUE) {
+		return false;
+	}
+	if (e->text && e->len == len && !memcmp(e->text, s, len)) {
+		memcpy(c->code, e->code, e->count * sizeof(exprInstr_t));
+		c->count = e->count;
+		bFound = true;
+	}
+	xSemaphoreGive(g_exprCacheMutex);
+	return bFound;
+}
+// new copies are made first, so on failure the old entry is kept as it was
+static void Expr_CachePut(exprCacheEntry_t *e, const char *s, int len, const exprCompiler_t *c) {
+	char *text, *oldText;
+	exprInstr_t *code, *oldCode;
+
+	text = malloc(len + 1);
+	code = malloc(c->count * sizeof(exprInstr_t));
+	if (text == 0 || code == 0) {
+		free(text);
+		free(code);
+		return;
+	}
+	memcpy(text, s, len);
+	text[len] = 0;
+	memcpy(code, c->code, c->count * sizeof(exprInstr_t));
+	if (xSemaphoreTake(g_exprCacheMutex, 100) != pdTRUE) {
+		free(text);
+		free(code);
+		return;
+	}
+	oldText = e->text;
+	oldCode = e->code;
+	e->text = text;
+	e->code = code;
+	e->len = len;
+	e->count = c->count;
+	xSemaphoreGive(g_exprCacheMutex);
+	free(oldText);
+	free(oldCode);
+}
+float CMD_EvaluateExpression(const char *s, const char *stop) {
+	exprCompiler_t c;
+	exprCacheEntry_t *e;
+	int len;
+
+	if (s == 0)
+		return 0;
+	if (*s == 0)
+		return 0;
+	len = stop ? (stop - s) : strlen(s);
+	if (len <= 0) {
+		return CMD_EvaluateExpressionRecursive(s, stop);
+	}
+
+	e = &g_exprCache[Expr_Hash(s, len)];
+	if (Expr_CacheGet(e, s, len, &c)) {
+		g_expr_cacheHits++;
+		// same text, so offsets of constant names are valid in s as well
+		return Expr_Run(c.code, c.count, s);
+	}
+	g_expr_cacheMisses++;
+
+	c.base = s;
+	c.count = 0;
+	c.depth = 0;
+	c.maxDepth = 0;
+	c.bFailed = false;
+	Expr_Compile(&c, s, stop);
+	if (c.bFailed || c.maxDepth > EXPR_MAX_STACK) {
+		return CMD_EvaluateExpressionRecursive(s, stop);
+	}
+	// plain numbers (like command arguments) are not worth caching
+	if (c.count > 1 || c.code[0].op != EXPR_PUSH_NUMBER) {
+		Expr_CachePut(e, s, len, &c);
+	}
+	return Expr_Run(c.code, c.count, s);
+}
+
 // if MQTTOnline then "qq" else "qq"
 commandResult_t CMD_If(const void *context, const char *cmd, const char *args, int cmdFlags){
 	const char *cmdA;
@@ -10,13 +10,49 @@ typedef struct command_s {
 	struct command_s *next;
 } command_t;
 
+// command string parsed and resolved once, for strings that are executed many times
+typedef struct compiledCommand_s {
+	// owned copy of the command, verb is null-terminated in place
+	char *text;
+	// first argument within text, never NULL
+	const char *args;
+	// resolved command (or NULL if not found)
+	command_t *cmd;
+	// registry generation at the time of resolving
+	int generation;
+} compiledCommand_t;
+
+// lookup structure statistics, see CMD_FreezeRegistry
+typedef struct cmdRegistryStats_s {
+	// commands in sorted array
+	int frozen;
+	// max binary search steps
+	int frozenProbes;
+	// commands still in hash chains
+	int hashed;
+	int usedBuckets;
+	int longestChain;
+} cmdRegistryStats_t;
+
+extern int g_cmd_lookupsDone;
+extern int g_cmd_lookupsAvoided;
+
 command_t *CMD_Find(const char *name);
+bool CMD_Compile(compiledCommand_t *c, const char *s);
+void CMD_FreeCompiled(compiledCommand_t *c);
+commandResult_t CMD_ExecuteCompiled(compiledCommand_t *c, int cmdFlags);
 // for autocompletion?
 void CMD_ListAllCommands(void *userData, void (*callback)(command_t *cmd, void *userData));
+void CMD_FreezeRegistry();
+void CMD_GetRegistryStats(cmdRegistryStats_t *st);
 int get_cmd(const char *s, char *dest, int maxlen, int stripnum);
 
 
+void CMD_InitExpressionCache();
 float CMD_EvaluateExpression(const char *s, const char *stop);
+// compiled expressions cache statistics
+extern int g_expr_cacheHits;
+extern int g_expr_cacheMisses;
 commandResult_t CMD_If(const void *context, const char *cmd, const char *args, int cmdFlags);
 void CMD_ExpandConstantsWithinString(const char *in, char *out, int outLen);
 const char *CMD_ExpandConstant(const char *s, const char *stop, float *out);
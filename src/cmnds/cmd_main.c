@@ -42,6 +42,17 @@ static int generateHashValue(const char* fname) {
 }
 
 command_t* g_commands[HASH_SIZE] = { NULL };
+// incremented every time the registry changes, so compiled commands
+// know when their resolved command_t pointer can no longer be trusted
+static int g_commandsGeneration = 1;
+// hash lookups done while resolving commands / lookups skipped thanks to compiled commands
+int g_cmd_lookupsDone = 0;
+int g_cmd_lookupsAvoided = 0;
+// commands packed by CMD_FreezeRegistry, sorted by name
+static command_t* g_frozenCommands = 0;
+static int g_frozenCount = 0;
+static cmdRegistryStats_t g_cmdStatsBeforeFreeze;
+static commandResult_t CMD_ListCmds(const void* context, const char* cmd, const char* args, int cmdFlags);
 bool g_powersave;
 
 static commandResult_t CMD_PowerSave(const void* context, const char* cmd, const char* args, int cmdFlags) {
@@ -243,11 +254,11 @@ static commandResult_t CMD_ClearConfig(const void* context, const char* cmd, con
 static commandResult_t CMD_Echo(const void* context, const char* cmd, const char* args, int cmdFlags) {
 
 #if 0
-	ADDLOG_INFO(LOG_FEATURE_CMD, args);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "%s", args);
 #else
 	// we want $CH40 etc expanded
 	Tokenizer_TokenizeString(args, TOKENIZER_ALTERNATE_EXPAND_AT_START | TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE);
-	ADDLOG_INFO(LOG_FEATURE_CMD, Tokenizer_GetArgFrom(0));
+	ADDLOG_INFO(LOG_FEATURE_CMD, "%s", Tokenizer_GetArgFrom(0));
 #endif
 
 	return CMD_RES_OK;
@@ -375,18 +386,13 @@ void CMD_RunUartCmndIfRequired() {
 
 // run an aliased command
 static commandResult_t runcmd(const void* context, const char* cmd, const char* args, int cmdFlags) {
-	char* c = (char*)context;
-	//   char *p = c;
+	compiledCommand_t* c = (compiledCommand_t*)context;
 
-	//   while (*p && !isWhiteSpace(*p)) {
-	//       p++;
-	   //}
-	//   if (*p) p++;
-	return CMD_ExecuteCommand(c, cmdFlags);
+	return CMD_ExecuteCompiled(c, cmdFlags);
 }
 
 commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
-	char* cmdMem;
+	compiledCommand_t* cmdMem;
 	char* aliasMem;
 	command_t* existing;
 
@@ -396,7 +402,8 @@ commandResult_t CMD_CreateAliasHelper(const char *alias, const char *ocmd) {
 		return CMD_RES_BAD_ARGUMENT;
 	}
 
-	cmdMem = strdup(ocmd);
+	cmdMem = (compiledCommand_t*)malloc(sizeof(compiledCommand_t));
+	CMD_Compile(cmdMem, ocmd);
 	aliasMem = strdup(alias);
 
 	ADDLOG_INFO(LOG_FEATURE_CMD, "New alias has been set: %s runs %s", alias, ocmd);
@@ -438,6 +445,10 @@ static commandResult_t CMD_SimonTest(const void* context, const char* cmd, const
 	return CMD_RES_OK;
 }
 void CMD_Init_Early() {
+	Tokenizer_Init();
+	CMD_InitExpressionCache();
+	Timers_Init();
+
 	//cmddetail:{"name":"alias","args":"[Alias][Command with spaces]",
 	//cmddetail:"descr":"add an aliased command, so a command with spaces can be called with a short, nospaced alias",
 	//cmddetail:"fn":"alias","file":"cmnds/cmd_test.c","requires":"",
@@ -543,6 +554,11 @@ void CMD_Init_Early() {
 	//cmddetail:"fn":"CMD_PingHost","file":"cmnds/cmd_main.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("PingHost", CMD_PingHost, NULL);
+	//cmddetail:{"name":"listCmds","args":"",
+	//cmddetail:"descr":"Prints all registered commands, along with the lookup statistics (sorted array size, hash chain lengths) before and after the registry was frozen",
+	//cmddetail:"fn":"CMD_ListCmds","file":"cmnds/cmd_main.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("listCmds", CMD_ListCmds, NULL);
 	
 #if (defined WINDOWS) || (defined PLATFORM_BEKEN)
 	CMD_InitScripting();
@@ -561,11 +577,90 @@ void CMD_Init_Delayed() {
 	}
 }
 
+// binary search steps needed for given count
+static int CMD_GetMaxProbes(int count) {
+	int probes = 0;
+	while (count > 0) {
+		count >>= 1;
+		probes++;
+	}
+	return probes;
+}
+static int CMD_CompareByName(const void* a, const void* b) {
+	return stricmp(((const command_t*)a)->name, ((const command_t*)b)->name);
+}
+// Move all commands from the hash chains into a single array sorted by name.
+// Lookups in frozen part are done by binary search, without any heap nodes.
+// Commands registered later (drivers started from autoexec, aliases)
+// go to the hash chains, which are searched after the frozen array.
+// Can be called again to pack them as well.
+// Array is reallocated and hash nodes are freed with no lock, so this must
+// only be called when no other task can run commands (see Main_Init).
+void CMD_FreezeRegistry() {
+	int i;
+	int count;
+	command_t* cmd, * next;
+	command_t* arr;
+
+	CMD_GetRegistryStats(&g_cmdStatsBeforeFreeze);
+	count = g_cmdStatsBeforeFreeze.hashed;
+	if (count == 0) {
+		return;
+	}
+	arr = (command_t*)realloc(g_frozenCommands, (g_frozenCount + count) * sizeof(command_t));
+	if (arr == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "CMD_FreezeRegistry: failed to alloc %i commands", g_frozenCount + count);
+		return;
+	}
+	g_commandsGeneration++;
+	g_frozenCommands = arr;
+	for (i = 0; i < HASH_SIZE; i++) {
+		cmd = g_commands[i];
+		while (cmd) {
+			next = cmd->next;
+			g_frozenCommands[g_frozenCount] = *cmd;
+			g_frozenCommands[g_frozenCount].next = 0;
+			g_frozenCount++;
+			free(cmd);
+			cmd = next;
+		}
+		g_commands[i] = 0;
+	}
+	qsort(g_frozenCommands, g_frozenCount, sizeof(command_t), CMD_CompareByName);
+
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Froze %i commands (%i new), longest chain was %i, now %i probes max",
+		g_frozenCount, count, g_cmdStatsBeforeFreeze.longestChain, CMD_GetMaxProbes(g_frozenCount));
+}
+void CMD_GetRegistryStats(cmdRegistryStats_t* st) {
+	int i;
+	int len;
+	command_t* cmd;
+
+	memset(st, 0, sizeof(cmdRegistryStats_t));
+	st->frozen = g_frozenCount;
+	st->frozenProbes = CMD_GetMaxProbes(g_frozenCount);
+	for (i = 0; i < HASH_SIZE; i++) {
+		len = 0;
+		for (cmd = g_commands[i]; cmd; cmd = cmd->next) {
+			len++;
+		}
+		if (len) {
+			st->usedBuckets++;
+		}
+		if (len > st->longestChain) {
+			st->longestChain = len;
+		}
+		st->hashed += len;
+	}
+}
 
 void CMD_ListAllCommands(void* userData, void (*callback)(command_t* cmd, void* userData)) {
 	int i;
 	command_t* newCmd;
 
+	for (i = 0; i < g_frozenCount; i++) {
+		callback(&g_frozenCommands[i], userData);
+	}
 	for (i = 0; i < HASH_SIZE; i++) {
 		newCmd = g_commands[i];
 		while (newCmd) {
@@ -575,10 +670,32 @@ void CMD_ListAllCommands(void* userData, void (*callback)(command_t* cmd, void*
 	}
 
 }
+static void CMD_PrintStats(const char* when, cmdRegistryStats_t* st) {
+	ADDLOG_INFO(LOG_FEATURE_CMD, "%s: %i sorted (max %i probes), %i hashed in %i/%i buckets, longest chain %i",
+		when, st->frozen, st->frozenProbes, st->hashed, st->usedBuckets, HASH_SIZE, st->longestChain);
+}
+static void CMD_ListCommandCallback(command_t* cmd, void* userData) {
+	int* count = (int*)userData;
+	(*count)++;
+	ADDLOG_INFO(LOG_FEATURE_CMD, "%s", cmd->name);
+}
+static commandResult_t CMD_ListCmds(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	int count = 0;
+	cmdRegistryStats_t st;
+
+	CMD_ListAllCommands(&count, CMD_ListCommandCallback);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Total %i commands", count);
+	CMD_PrintStats("Before freeze", &g_cmdStatsBeforeFreeze);
+	CMD_GetRegistryStats(&st);
+	CMD_PrintStats("Now", &st);
+	return CMD_RES_OK;
+}
 void CMD_FreeAllCommands() {
 	int i;
 	command_t* cmd, * next;
 
+	g_commandsGeneration++;
+
 	for (i = 0; i < HASH_SIZE; i++) {
 		cmd = g_commands[i];
 		while (cmd) {
@@ -588,7 +705,10 @@ void CMD_FreeAllCommands() {
 		}
 		g_commands[i] = 0;
 	}
-
+	free(g_frozenCommands);
+	g_frozenCommands = 0;
+	g_frozenCount = 0;
+	memset(&g_cmdStatsBeforeFreeze, 0, sizeof(g_cmdStatsBeforeFreeze));
 }
 void CMD_RegisterCommand(const char* name, commandHandler_t handler, void* context) {
 	int hash;
@@ -602,6 +722,7 @@ void CMD_RegisterCommand(const char* name, commandHandler_t handler, void* conte
 	}
 	ADDLOG_DEBUG(LOG_FEATURE_CMD, "Adding command %s", name);
 
+	g_commandsGeneration++;
 	hash = generateHashValue(name);
 	newCmd = (command_t*)malloc(sizeof(command_t));
 	newCmd->handler = handler;
@@ -613,8 +734,25 @@ void CMD_RegisterCommand(const char* name, commandHandler_t handler, void* conte
 
 command_t* CMD_Find(const char* name) {
 	int hash;
+	int lo, hi, mid, res;
 	command_t* newCmd;
 
+	lo = 0;
+	hi = g_frozenCount - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		res = stricmp(name, g_frozenCommands[mid].name);
+		if (res == 0) {
+			return &g_frozenCommands[mid];
+		}
+		if (res < 0) {
+			hi = mid - 1;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+
 	hash = generateHashValue(name);
 
 	newCmd = g_commands[hash];
@@ -650,35 +788,50 @@ int get_cmd(const char* s, char* dest, int maxlen, int stripnum) {
 }
 
 
-// execute a command from cmd and args - used below and in MQTT
-commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cmdFlags) {
+// find command by full name, and if that fails, by name without trailing numbers (POWER1 -> POWER)
+static command_t* CMD_Resolve(const char* cmd) {
 	command_t* newCmd;
-	//int len;
+	char nonums[32];
 
 	// look for complete commmand
+	g_cmd_lookupsDone++;
 	newCmd = CMD_Find(cmd);
-	if (!newCmd) {
-		// not found, so...
-		char nonums[32];
-		// get the complete string up to numbers.
-		//len =
-		get_cmd(cmd, nonums, 32, 1);
-		newCmd = CMD_Find(nonums);
-		if (!newCmd) {
-			// if still not found, then error
-			ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", cmd, args);
-			return CMD_RES_UNKNOWN_COMMAND;
-		}
+	if (newCmd) {
+		return newCmd;
 	}
-	else {
+	// not found, so get the complete string up to numbers.
+	get_cmd(cmd, nonums, 32, 1);
+	g_cmd_lookupsDone++;
+	return CMD_Find(nonums);
+}
+
+// each handler gets its own tokenizer, so commands executed from within
+// a handler do not clobber its arguments
+static commandResult_t CMD_CallHandler(command_t* newCmd, const char* cmd, const char* args, int cmdFlags) {
+	commandResult_t res;
+	tokenizerFrame_t frame;
+
+	if (newCmd->handler == 0) {
+		return CMD_RES_UNKNOWN_COMMAND;
 	}
+	Tokenizer_EnterCommand(&frame);
+	res = newCmd->handler(newCmd->context, cmd, args, cmdFlags);
+	Tokenizer_LeaveCommand(&frame);
+	return res;
+}
+
+// execute a command from cmd and args - used below and in MQTT
+commandResult_t CMD_ExecuteCommandArgs(const char* cmd, const char* args, int cmdFlags) {
+	command_t* newCmd;
 
-	if (newCmd->handler) {
-		commandResult_t res;
-		res = newCmd->handler(newCmd->context, cmd, args, cmdFlags);
-		return res;
+	newCmd = CMD_Resolve(cmd);
+	if (!newCmd) {
+		// if still not found, then error
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", cmd, args);
+		return CMD_RES_UNKNOWN_COMMAND;
 	}
-	return CMD_RES_UNKNOWN_COMMAND;
+
+	return CMD_CallHandler(newCmd, cmd, args, cmdFlags);
 }
 
 
@@ -720,4 +873,65 @@ commandResult_t CMD_ExecuteCommand(const char* s, int cmdFlags) {
 	return CMD_ExecuteCommandArgs(copy, args, cmdFlags);
 }
 
+// Parse a command string once, so it can be executed many times
+// without copying the verb and walking the hash chains again.
+// Used by repeating events, event handlers, aliases and script lines.
+bool CMD_Compile(compiledCommand_t* c, const char* s) {
+	char* p;
 
+	memset(c, 0, sizeof(compiledCommand_t));
+	if (s == 0) {
+		return false;
+	}
+	while (isWhiteSpace(*s)) {
+		s++;
+	}
+	if (*s == 0) {
+		return false;
+	}
+	c->text = strdup(s);
+	if (c->text == 0) {
+		return false;
+	}
+	// split verb and arguments in place
+	p = c->text;
+	while (*p && !isWhiteSpace(*p)) {
+		p++;
+	}
+	if (*p) {
+		*p = 0;
+		p++;
+		while (*p && isWhiteSpace(*p)) {
+			p++;
+		}
+	}
+	c->args = p;
+	// resolved lazily on first execution
+	c->cmd = 0;
+	c->generation = 0;
+	return true;
+}
+void CMD_FreeCompiled(compiledCommand_t* c) {
+	if (c->text) {
+		free(c->text);
+	}
+	memset(c, 0, sizeof(compiledCommand_t));
+}
+commandResult_t CMD_ExecuteCompiled(compiledCommand_t* c, int cmdFlags) {
+	if (c->text == 0) {
+		return CMD_RES_EMPTY_STRING;
+	}
+	if (c->generation == g_commandsGeneration) {
+		// still valid - also valid for 'not found' result, registry did not change since
+		g_cmd_lookupsAvoided++;
+	}
+	else {
+		c->cmd = CMD_Resolve(c->text);
+		c->generation = g_commandsGeneration;
+	}
+	if (c->cmd == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "cmd %s NOT found (args %s)", c->text, c->args);
+		return CMD_RES_UNKNOWN_COMMAND;
+	}
+	return CMD_CallHandler(c->cmd, c->text, c->args, cmdFlags);
+}
@@ -182,7 +182,7 @@ static void sendFullRGBCW_IfEnabled() {
 
 	snprintf(s, sizeof(s),"%02X%02X%02X%02X%02X",c[0],c[1],c[2],c[3],c[4]);
 
-	MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_FINALCOLOR_RGBCW,DEDUP_EXPIRE_TIME,"led_finalcolor_rgbcw",s, 0);
+	MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME, "led_finalcolor_rgbcw",s, 0);
 }
 
 float led_rawLerpCurrent[5] = { 0 };
@@ -247,6 +247,22 @@ void LED_I2CDriver_WriteRGBCW(float* finalRGBCW) {
 #endif
 }
 
+// true if last lerp step still moved something
+static bool led_lerpActive = false;
+
+bool LED_IsRunningQuickColorLerp() {
+	int i;
+
+	if (led_lerpActive) {
+		return true;
+	}
+	for (i = 0; i < 5; i++) {
+		if (led_rawLerpCurrent[i] != finalColors[i]) {
+			return true;
+		}
+	}
+	return false;
+}
 void LED_RunQuickColorLerp(int deltaMS) {
 	int i;
 	int firstChannelIndex;
@@ -296,6 +312,9 @@ void LED_RunQuickColorLerp(int deltaMS) {
 
 	led_current_value_brightness = Mathf_MoveTowards(led_current_value_brightness, target_value_brightness, deltaSeconds * led_lerpSpeedUnitsPerSecond);
 	led_current_value_cold_or_warm = Mathf_MoveTowards(led_current_value_cold_or_warm, target_value_cold_or_warm, deltaSeconds * led_lerpSpeedUnitsPerSecond );
+	// keep ticking until both have reached their targets
+	led_lerpActive = (led_current_value_brightness != target_value_brightness)
+		|| (led_current_value_cold_or_warm != target_value_cold_or_warm);
 
 	// OBK_FLAG_LED_ALTERNATE_CW_MODE means we have a driver that takes one PWM for brightness and second for temperature
 	if(isCWMode() && CFG_HasFlag(OBK_FLAG_LED_ALTERNATE_CW_MODE)) {
@@ -627,7 +646,8 @@ OBK_Publish_Result sendColorChange() {
 
 	snprintf(s, sizeof(s), "%02X%02X%02X",c[0],c[1],c[2]);
 
-	return MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_BASECOLOR_RGB,DEDUP_EXPIRE_TIME,"led_basecolor_rgb",s, 0);
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_DYNAMIC_LIGHTMODE);
+	return MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME, "led_basecolor_rgb",s, 0);
 }
 void LED_GetBaseColorString(char * s) {
 	byte c[3];
@@ -652,17 +672,19 @@ OBK_Publish_Result sendFinalColor() {
 
 	snprintf(s, sizeof(s),"%02X%02X%02X",c[0],c[1],c[2]);
 
-	return MQTT_PublishMain_StringString_DeDuped(DEDUP_LED_FINALCOLOR_RGB,DEDUP_EXPIRE_TIME,"led_finalcolor_rgb",s, 0);
+	return MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME, "led_finalcolor_rgb",s, 0);
 }
 OBK_Publish_Result LED_SendDimmerChange() {
 	int iValue;
 
 	iValue = g_brightness0to100;
 
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_DIMMER,DEDUP_EXPIRE_TIME,"led_dimmer", iValue, 0);
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_DYNAMIC_DIMMER);
+	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "led_dimmer", iValue, 0);
 }
 OBK_Publish_Result sendTemperatureChange(){
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_TEMPERATURE,DEDUP_EXPIRE_TIME,"led_temperature", (int)led_temperature_current,0);
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_DYNAMIC_LIGHTMODE);
+	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "led_temperature", (int)led_temperature_current,0);
 }
 float LED_GetTemperature() {
 	return led_temperature_current;
@@ -760,6 +782,10 @@ static commandResult_t temperature(const void *context, const char *cmd, const c
 
 		Tokenizer_TokenizeString(args, 0);
 
+		// no args means Tasmota-style query, leave it as it is
+		if (Tokenizer_GetArgsCount() == 0) {
+			return CMD_RES_OK;
+		}
 		tmp = Tokenizer_GetArgInteger(0);
 
 		LED_SetTemperature(tmp, 1);
@@ -769,7 +795,8 @@ static commandResult_t temperature(const void *context, const char *cmd, const c
 	//return 0;
 }
 OBK_Publish_Result LED_SendEnableAllState() {
-	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_LED_ENABLEALL,DEDUP_EXPIRE_TIME,"led_enableAll",g_lightEnableAll,0);
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_DYNAMIC_LIGHTSTATE);
+	return MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "led_enableAll",g_lightEnableAll,0);
 }
 
 void LED_ToggleEnabled() {
@@ -1067,6 +1094,10 @@ static commandResult_t dimmer(const void *context, const char *cmd, const char *
 		} else {
 			Tokenizer_TokenizeString(args, 0);
 
+			// no args means Tasmota-style query, leave it as it is
+			if (Tokenizer_GetArgsCount() == 0) {
+				return CMD_RES_OK;
+			}
 			iVal = Tokenizer_GetArgInteger(0);
 
 			LED_SetDimmer(iVal);
@@ -148,7 +148,51 @@ enum LightMode {
 // force single argument mode
 #define TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE	8
 
+#define TOKENIZER_MAX_CMD_LEN 512
+#define TOKENIZER_MAX_ARGS 32
+
+// Tokenizer state owned by the caller, so tokenizing in one place
+// does not clobber the tokens of the other.
+// Arguments are kept as slices (offset+length) of the source string,
+// they are only copied out to the buffer when asked for as a C string.
+typedef struct tokenizer_s {
+	// string the slices point to - caller's string, or buffer when expanded
+	const char *src;
+	// original string, for Tokenizer_GetArgFrom
+	const char *from;
+	short argOfs[TOKENIZER_MAX_ARGS];
+	short argLen[TOKENIZER_MAX_ARGS];
+	// bit set for each argument already copied and terminated in buffer
+	unsigned int argReady;
+	int numArgs;
+	int flags;
+	char argsExpanded[TOKENIZER_MAX_ARGS][8];
+	char buffer[TOKENIZER_MAX_CMD_LEN];
+} tokenizer_t;
+
 // cmd_tokenizer.c
+void Tokenizer_Ctx_TokenizeString(tokenizer_t *t, const char* s, int flags);
+int Tokenizer_Ctx_GetArgsCount(tokenizer_t *t);
+bool Tokenizer_Ctx_CheckArgsCountAndPrintWarning(tokenizer_t *t, const char* cmdStr, int reqCount);
+const char* Tokenizer_Ctx_GetArg(tokenizer_t *t, int i);
+// returns pointer to argument within source string (not terminated!) and its length
+const char* Tokenizer_Ctx_GetArgSlice(tokenizer_t *t, int i, int *len);
+const char* Tokenizer_Ctx_GetArgFrom(tokenizer_t *t, int i);
+int Tokenizer_Ctx_GetArgInteger(tokenizer_t *t, int i);
+int Tokenizer_Ctx_GetArgIntegerDefault(tokenizer_t *t, int i, int def);
+bool Tokenizer_Ctx_IsArgInteger(tokenizer_t *t, int i);
+float Tokenizer_Ctx_GetArgFloat(tokenizer_t *t, int i);
+int Tokenizer_Ctx_GetArgIntegerRange(tokenizer_t *t, int i, int rangeMin, int rangeMax);
+// each command handler call gets its own tokenizer, kept in a frame on caller's stack
+typedef struct tokenizerFrame_s {
+	void *task;
+	tokenizer_t *tokenizer;
+	struct tokenizerFrame_s *next;
+} tokenizerFrame_t;
+void Tokenizer_Init();
+void Tokenizer_EnterCommand(tokenizerFrame_t *f);
+void Tokenizer_LeaveCommand(tokenizerFrame_t *f);
+// global API, works on the tokenizer of current command
 int Tokenizer_GetArgsCount();
 bool Tokenizer_CheckArgsCountAndPrintWarning(const char* cmdStr, int reqCount);
 const char* Tokenizer_GetArg(int i);
@@ -159,9 +203,43 @@ bool Tokenizer_IsArgInteger(int i);
 float Tokenizer_GetArgFloat(int i);
 int Tokenizer_GetArgIntegerRange(int i, int rangeMax, int rangeMin);
 void Tokenizer_TokenizeString(const char* s, int flags);
+// cmd_timers.c
+struct obkTimer_s;
+typedef void (*timerCallback_t)(struct obkTimer_s *t);
+// a single deadline, usually embedded in the owner structure
+typedef struct obkTimer_s {
+	// absolute time, in units of the heap it's scheduled in
+	unsigned int deadline;
+	// position in heap, or -1 if not scheduled
+	int heapIndex;
+	timerCallback_t callback;
+	void *userData;
+} obkTimer_t;
+// min-heap of timers, ordered by deadline
+typedef struct timerHeap_s {
+	obkTimer_t **items;
+	int count;
+	int size;
+} timerHeap_t;
+void Timer_Init(obkTimer_t *t, timerCallback_t callback, void *userData);
+bool Timer_IsScheduled(obkTimer_t *t);
+bool TimerHeap_Insert(timerHeap_t *h, obkTimer_t *t, unsigned int deadline);
+void TimerHeap_Remove(timerHeap_t *h, obkTimer_t *t);
+// fires all timers with deadline <= now, returns count of fired timers
+int TimerHeap_RunExpired(timerHeap_t *h, unsigned int now);
+obkTimer_t *TimerHeap_Peek(timerHeap_t *h);
+void TimerHeap_Free(timerHeap_t *h);
+// shared millisecond scheduler, advanced by quick tick
+void Timers_Init();
+void Timers_Schedule(obkTimer_t *t, int delayMS);
+void Timers_Cancel(obkTimer_t *t);
+int Timers_GetRemainingMS(obkTimer_t *t);
+void Timers_RunQuickTick(int deltaMS);
+// milliseconds until the first scheduled timer, or -1 if there are none
+int Timers_GetNextDeadlineMS();
+int Timers_GetActiveCount();
 // cmd_repeatingEvents.c
 void RepeatingEvents_Init();
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds);
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen);
 // cmd_eventHandlers.c
 void EventHandlers_Init();
@@ -177,6 +255,7 @@ void EventHandlers_FireEvent3(byte eventCode, int argument, int argument2, int a
 // For example, you can watch for Voltage from BL0942 to change below 230, and it will fire event only when it becomes below 230.
 void EventHandlers_ProcessVariableChange_Integer(byte eventCode, int oldValue, int newValue);
 int EventHandlers_GetActiveCount();
+void EventHandlers_GetStats(int *fires, int *matches, int *scanned);
 // cmd_tasmota.c
 int taslike_commands_init();
 // cmd_newLEDDriver.c
@@ -218,6 +297,7 @@ float LED_GetGreen255();
 float LED_GetRed255();
 float LED_GetBlue255();
 void LED_RunQuickColorLerp(int deltaMS);
+bool LED_IsRunningQuickColorLerp();
 OBK_Publish_Result sendFinalColor();
 OBK_Publish_Result sendColorChange();
 OBK_Publish_Result LED_SendEnableAllState();
@@ -241,6 +321,7 @@ int CMD_GetCountActiveScriptThreads();
 const char* CMD_GetResultString(commandResult_t r);
 
 void SVM_RunThreads(int deltaMS);
+int SVM_GetNextWakeMS();
 void CMD_InitScripting();
 byte* LFS_ReadFile(const char* fname);
 
@@ -14,11 +14,13 @@
 typedef struct repeatingEvent_s {
 	// command string to execute
 	char *command;
+	// the same command, parsed once for fast execution
+	compiledCommand_t compiled;
 	//char *condition;
 	// how often event repeats
 	float intervalSeconds;
-	// current value until next repeat (decremented every second)
-	float currentInterval;
+	// next run, scheduled in shared timers
+	obkTimer_t timer;
 	// number of times to repeat.
 	// If set to -1, then it's infinite repeater
 	// If set to EVENT_CANCELED_TIMES, then event structure is ready to be reused
@@ -32,6 +34,27 @@ typedef struct repeatingEvent_s {
 
 static repeatingEvent_t *g_repeatingEvents = 0;
 
+static int RepeatingEvents_GetIntervalMS(repeatingEvent_t *ev) {
+	return (int)(ev->intervalSeconds * 1000.0f + 0.5f);
+}
+static void RepeatingEvents_OnTimer(obkTimer_t *t) {
+	repeatingEvent_t *ev = (repeatingEvent_t*)t->userData;
+
+	// -1 means 'forever'
+	if (ev->times != -1) {
+		ev->times -= 1;
+		if (ev->times <= 0) {
+			// if finished all calls, mark as empty so we can reuse later
+			ev->times = EVENT_CANCELED_TIMES;
+		}
+	}
+	if (ev->times != EVENT_CANCELED_TIMES) {
+		Timers_Schedule(&ev->timer, RepeatingEvents_GetIntervalMS(ev));
+	}
+	// done last, because command may as well clear all events
+	CMD_ExecuteCompiled(&ev->compiled, COMMAND_FLAG_SOURCE_SCRIPT);
+}
+
 void RepeatingEvents_CancelRepeatingEvents(int userID)
 {
 	repeatingEvent_t *ev;
@@ -41,6 +64,7 @@ void RepeatingEvents_CancelRepeatingEvents(int userID)
 		if(ev->userID == userID) {
 			// mark as finished
 			ev->times = EVENT_CANCELED_TIMES;
+			Timers_Cancel(&ev->timer);
 			addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"Event with id %i and cmd %s has been canceled",ev->userID,ev->command);
 		}
 	}
@@ -57,9 +81,9 @@ void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterva
 		if(ev->times == EVENT_CANCELED_TIMES) {
 			if(!strcmp(ev->command,command)) {
 				ev->intervalSeconds = secondsInterval;
-				// fire after delay
-				ev->currentInterval = secondsInterval;
 				ev->times = times;
+				// fire after delay
+				Timers_Schedule(&ev->timer, RepeatingEvents_GetIntervalMS(ev));
 				return;
 			}
 		}
@@ -80,14 +104,16 @@ void RepeatingEvents_AddRepeatingEvent(const char *command, float secondsInterva
 	ev->next = g_repeatingEvents;
 	g_repeatingEvents = ev;
 	ev->command = cmd_copy;
+	CMD_Compile(&ev->compiled, cmd_copy);
 	ev->intervalSeconds = secondsInterval;
 	ev->times = times;
 	ev->userID = userID;
+	Timer_Init(&ev->timer, RepeatingEvents_OnTimer, ev);
 	// fire next frame
 	// TODO: is this what we want? or do we want to fire after full interval?
-	//ev->currentInterval = 1;
+	//Timers_Schedule(&ev->timer, 0);
 	// fire after full interval
-	ev->currentInterval = secondsInterval;
+	Timers_Schedule(&ev->timer, RepeatingEvents_GetIntervalMS(ev));
 }
 void SIM_GenerateRepeatingEventsDesc(char *o, int outLen) {
 	repeatingEvent_t *cur;
@@ -101,7 +127,7 @@ void SIM_GenerateRepeatingEventsDesc(char *o, int outLen) {
 			snprintf(buffer, outLen,"ID %i, repeats %i",(int) cur->userID, (int)cur->times);
 			strcat_safe(o, buffer, outLen);
 			snprintf(buffer, outLen, ", interval %i", (int)cur->intervalSeconds);
-			snprintf(buffer, outLen, " (cur left %i), cmd: ", (int)cur->currentInterval);
+			snprintf(buffer, outLen, " (cur left %i), cmd: ", Timers_GetRemainingMS(&cur->timer) / 1000);
 			strcat_safe(o, buffer, outLen);
 			strcat_safe(o, cur->command, outLen);
 		}
@@ -123,42 +149,6 @@ int RepeatingEvents_GetActiveCount() {
 	}
 	return c_active;
 }
-void RepeatingEvents_RunUpdate(float deltaTimeSeconds) {
-	repeatingEvent_t *cur;
-	int c_checked = 0;
-	int c_ran = 0;
-
-	cur = g_repeatingEvents;
-	while(cur) {
-		c_checked++;
-		// debug only check
-		if(cur == cur->next) {
-			addLogAdv(LOG_ERROR, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond: single linked list was broken?");
-			cur->next = 0;
-			return;
-		}
-		// -1 means 'forever'
-		if(cur->times > 0 || cur->times == -1) {
-			cur->currentInterval-= deltaTimeSeconds;
-			if(cur->currentInterval<=0){
-				c_ran++;
-				// -1 means 'forever'
-				if(cur->times != -1) {
-					cur->times -= 1;
-					if (cur->times <= 0) {
-						// if finished all calls, mark as empty so we can reuse later
-						cur->times = EVENT_CANCELED_TIMES;
-					}
-				}
-				cur->currentInterval = cur->intervalSeconds;
-				CMD_ExecuteCommand(cur->command, COMMAND_FLAG_SOURCE_SCRIPT);
-			}
-		}
-		cur = cur->next;
-	}
-
-	//addLogAdv(LOG_INFO, LOG_FEATURE_CMD,"RepeatingEvents_OnEverySecond checked %i events, ran %i\n",c_checked,c_ran);
-}
 // addRepeatingEventID 1234 5 -1 DGR_SendPower "testgr" 1 1 
 // cancelRepeatingEvent 1234
 #define MIN_REPEATING_INTERVAL 0.001f
@@ -205,7 +195,9 @@ commandResult_t RepeatingEvents_Cmd_ClearRepeatingEvents(const void *context, co
 	while (cur) {
 		rem = cur;
 		cur = cur->next;
+		Timers_Cancel(&rem->timer);
 		free(rem->command);
+		CMD_FreeCompiled(&rem->compiled);
 		free(rem);
 		c++;
 	}
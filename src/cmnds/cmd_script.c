@@ -225,23 +225,57 @@ addEventHandler OnHold 20 backlog AddChannel 10 2 0 255; DGR_SendBrightness room
 
 */
 
+// executable line of script file, found when file is loaded
+typedef struct scriptLine_s {
+	// offset of line start within file data
+	int offset;
+	int len;
+	// compiled on first execution
+	compiledCommand_t compiled;
+} scriptLine_t;
+
+// label to line lookup, open addressing
+typedef struct scriptLabel_s {
+	// offset of label name within file data
+	int nameOffset;
+	// 0 if slot is empty
+	int nameLen;
+	// index of first executable line after label
+	int line;
+} scriptLabel_t;
+
 typedef struct scriptFile_s {
 	char *fname;
 	char *data;
+	// only lines with commands, without comments, labels and empty lines
+	scriptLine_t *lines;
+	int numLines;
+	// size is a power of two
+	scriptLabel_t *labels;
+	int labelsSize;
 
 	struct scriptFile_s *next;
 } scriptFile_t;
 
 typedef struct scriptInstance_s {
+	// NULL if thread is not running
 	scriptFile_t *curFile;
 	int uniqueID;
-	const char *curLine;
+	// index in curFile->lines
+	int curLine;
+	// delay requested by the line being executed
 	int currentDelayMS;
+	// scheduled while thread is sleeping
+	obkTimer_t delayTimer;
+	// max lines executed per single SVM_RunThreads call
+	int budget;
 
 	struct scriptInstance_s *next;
 } scriptInstance_t;
 
 #define MAX_SCRIPT_LINE 512
+// default lines per tick for each thread
+#define SVM_DEFAULT_BUDGET 10
 
 char *g_scrBuffer = 0;
 int svm_deltaMS;
@@ -255,7 +289,7 @@ scriptInstance_t *SVM_RegisterThread() {
 	r = g_scriptThreads;
 
 	while(r) {
-		if(r->curLine == 0) {
+		if(r->curFile == 0) {
 			break;
 		}
 		r = r->next;
@@ -263,6 +297,7 @@ scriptInstance_t *SVM_RegisterThread() {
 	if(r == 0) {
 		r = malloc(sizeof(scriptInstance_t));
 		memset(r,0,sizeof(scriptInstance_t));
+		Timer_Init(&r->delayTimer, 0, r);
 		r->next = g_scriptThreads;
 		g_scriptThreads = r;
 	}
@@ -270,8 +305,162 @@ scriptInstance_t *SVM_RegisterThread() {
 	r->curLine = 0;
 	r->curFile = 0;
 	r->currentDelayMS = 0;
+	r->budget = SVM_DEFAULT_BUDGET;
 	return r;
 }
+const char *SVM_SkipWS(const char *p) {
+	if(p==0)
+		return 0;
+	// skip also whitespaces
+	while(*p == ' ' || *p == '\r' || *p == '\t') {
+		p++;
+	}
+	return p;
+}
+const char *SVM_SkipLine(const char *p) {
+	if(p==0)
+		return 0;
+	while(*p) {
+		if(*p == '\n') {
+			p++;
+			return p;
+		}
+		p++;
+	}
+	return p;
+}
+static int SVM_HashLabel(const char *s, int len) {
+	int hash = 0;
+	while (len--) {
+		hash = hash * 31 + (byte)*s;
+		s++;
+	}
+	return hash;
+}
+// label is a 'name:' at the start of line
+static int SVM_GetLabelLen(const char *p) {
+	int len = 0;
+	while (p[len] && p[len] != ':') {
+		if (isspace((byte)p[len])) {
+			return 0;
+		}
+		len++;
+	}
+	if (p[len] != ':') {
+		return 0;
+	}
+	return len;
+}
+static void SVM_AddLabel(scriptFile_t *f, const char *name, int nameLen, int line) {
+	scriptLabel_t *l;
+	int i;
+
+	i = SVM_HashLabel(name, nameLen) & (f->labelsSize - 1);
+	while (1) {
+		l = &f->labels[i];
+		if (l->nameLen == 0) {
+			break;
+		}
+		// first one in file wins, just like with the linear search
+		if (l->nameLen == nameLen && !strncmp(f->data + l->nameOffset, name, nameLen)) {
+			return;
+		}
+		i = (i + 1) & (f->labelsSize - 1);
+	}
+	l->nameOffset = name - f->data;
+	l->nameLen = nameLen;
+	l->line = line;
+}
+// Walk the file text once and build lines and labels tables.
+// With bFill false, only counts them.
+static void SVM_ScanFile(scriptFile_t *f, bool bFill, int *numLabels) {
+	const char *p, *start, *end;
+	int len, labelLen;
+
+	f->numLines = 0;
+	*numLabels = 0;
+	p = f->data;
+	while (1) {
+		p = SVM_SkipWS(p);
+		if (*p == 0) {
+			break;
+		}
+		if (p[0] == '/' && p[1] == '/') {
+			p = SVM_SkipLine(p);
+			continue;
+		}
+		start = p;
+		end = SVM_SkipLine(start);
+		p = end;
+
+		labelLen = SVM_GetLabelLen(start);
+		if (labelLen > 0) {
+			if (bFill) {
+				SVM_AddLabel(f, start, labelLen, f->numLines);
+			}
+			(*numLabels)++;
+		}
+		while (end > start && (end[-1] == ' ' || end[-1] == '\r' || end[-1] == '\n' || end[-1] == '\t')) {
+			end--;
+		}
+		len = (end - start);
+		// skip empty lines and skip labels
+		if (len > 0 && start[len - 1] != ':') {
+			if (bFill) {
+				if (len >= MAX_SCRIPT_LINE) {
+					len = MAX_SCRIPT_LINE - 1;
+				}
+				f->lines[f->numLines].offset = start - f->data;
+				f->lines[f->numLines].len = len;
+			}
+			f->numLines++;
+		}
+	}
+}
+static bool SVM_IndexFile(scriptFile_t *f) {
+	int numLabels;
+	int size;
+
+	SVM_ScanFile(f, false, &numLabels);
+	// keep the hash table at most half full
+	size = 4;
+	while (size < numLabels * 2) {
+		size *= 2;
+	}
+	f->labelsSize = size;
+	f->labels = malloc(sizeof(scriptLabel_t) * size);
+	f->lines = malloc(sizeof(scriptLine_t) * (f->numLines + 1));
+	if (f->labels == 0 || f->lines == 0) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "SVM_IndexFile: failed to alloc index for %s", f->fname);
+		free(f->labels);
+		free(f->lines);
+		f->labels = 0;
+		f->lines = 0;
+		f->numLines = 0;
+		f->labelsSize = 0;
+		return false;
+	}
+	memset(f->labels, 0, sizeof(scriptLabel_t) * size);
+	memset(f->lines, 0, sizeof(scriptLine_t) * (f->numLines + 1));
+	SVM_ScanFile(f, true, &numLabels);
+	ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "SVM_IndexFile: %s has %i lines and %i labels", f->fname, f->numLines, numLabels);
+	return true;
+}
+static void SVM_FreeIndex(scriptFile_t *f) {
+	int i;
+
+	if (f->lines) {
+		for (i = 0; i < f->numLines; i++) {
+			CMD_FreeCompiled(&f->lines[i].compiled);
+		}
+	}
+	free(f->lines);
+	free(f->labels);
+	f->lines = 0;
+	f->labels = 0;
+	f->numLines = 0;
+	f->labelsSize = 0;
+}
 
 scriptFile_t *SVM_RegisterFile(const char *fname) {
 	scriptFile_t *r;
@@ -297,119 +486,112 @@ scriptFile_t *SVM_RegisterFile(const char *fname) {
 	r->fname = strdup(fname);
 	// cast from byte* to char*
 	r->data = (char*)LFS_ReadFile(fname);
+	if (r->data != 0 && !SVM_IndexFile(r)) {
+		// don't keep a file without index, it can be retried later
+		free(r->data);
+		free(r->fname);
+		free(r);
+		return 0;
+	}
 	r->next = g_scriptFiles;
 	g_scriptFiles = r;
 	if(r->data == 0)
 		return 0;
 	return r;
 }
-const char *SVM_SkipWS(const char *p) {
-	if(p==0)
-		return 0;
-	// skip also whitespaces
-	while(*p == ' ' || *p == '\r' || *p == '\t') {
-		p++;
-	}
-	return p;
-}
-const char *SVM_SkipLine(const char *p) {
-	if(p==0)
-		return 0;
-	while(*p) {
-		if(*p == '\n') {
-			p++;
-			return p;
-		}
-		p++;
-	}
-	return p;
-}
 
-const char *SVM_FindLabel(const char *text, const char *label, const char *fname) {
+// returns index of line to continue from
+int SVM_FindLabel(scriptFile_t *f, const char *label) {
+	scriptLabel_t *l;
 	int labLen;
+	int i;
 
 	if(label == 0)
-		return text;
+		return 0;
 	if (!strcmp(label, "*"))
-		return text;
+		return 0;
 	if (*label == 0)
-		return text;
+		return 0;
+	if (f->labelsSize == 0)
+		return f->numLines;
 
 	labLen = strlen(label);
 
-	while(*text) {
-		text = SVM_SkipWS(text); 
-		if(strncmp(text,label,labLen) == 0 && text[labLen] == ':') {
-			return text;
+	i = SVM_HashLabel(label, labLen) & (f->labelsSize - 1);
+	while (1) {
+		l = &f->labels[i];
+		if (l->nameLen == 0) {
+			break;
 		}
-		if(text[0] == '/' && text[1] == '/') {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
-		} else {
-			text = SVM_SkipLine(text); 
-			text = SVM_SkipWS(text); 
+		if (l->nameLen == labLen && !strncmp(f->data + l->nameOffset, label, labLen)) {
+			return l->line;
+		}
+		i = (i + 1) & (f->labelsSize - 1);
+	}
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the end of file",label,f->fname);
+	return f->numLines;
+}
+static compiledCommand_t *SVM_GetCompiledLine(scriptFile_t *f, int index) {
+	scriptLine_t *l;
+
+	l = &f->lines[index];
+	if (l->compiled.text == 0) {
+		memcpy(g_scrBuffer, f->data + l->offset, l->len);
+		g_scrBuffer[l->len] = 0;
+		if (CMD_Compile(&l->compiled, g_scrBuffer) == false) {
+			return 0;
 		}
 	}
-	ADDLOG_INFO(LOG_FEATURE_CMD, "Label %s not found in %s - will go to the start of file",label,fname);
-	return text;
+	return &l->compiled;
 }
 void SVM_RunThread(scriptInstance_t *t) {
-	int maxLoops = 10;
 	int loop = 0;
-	const char *start, *end;
-	int len, p;
+	scriptFile_t *f;
+	compiledCommand_t *c;
 
 	while(1) {
-		loop++;
-		if(t->curLine == 0) {
-			t->curLine = 0;
-			t->curFile = 0;
+		f = t->curFile;
+		if(f == 0) {
 			return;
 		}
-		if (loop > maxLoops) {
+		if (loop >= t->budget) {
 			return;
 		}
-		t->curLine = SVM_SkipWS(t->curLine); 
-		if(t->curLine[0] == 0) {
+		if (t->curLine >= f->numLines) {
 			t->curLine = 0;
 			t->curFile = 0;
 			return;
 		}
-		if(t->curLine[0] == '/' && t->curLine[1] == '/') {
-			t->curLine = SVM_SkipLine(t->curLine); 
-			t->curLine = SVM_SkipWS(t->curLine); 
-		} else {
-			start = t->curLine;
-			end = SVM_SkipLine(start);
-			t->curLine = SVM_SkipWS(end); 
-
-			while(end > start && (end[-1]==' '||end[-1]=='\r'||end[-1]=='\n'||end[-1]=='\t')) {
-				end--;
-			}
-			len = (end - start);
-			//ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "Script len: %i",len);
-
-			// skip empty lines and skip labels
-			if(len > 0 && start[len-1] != ':') {
-				if(len >= MAX_SCRIPT_LINE) {
-					len = MAX_SCRIPT_LINE-1;
-				}
-				memcpy(g_scrBuffer,start,len);
-				g_scrBuffer[len] = 0;
+		loop++;
+		c = SVM_GetCompiledLine(f, t->curLine);
+		// advance first, so goto can override it
+		t->curLine++;
+		if (c) {
+			CMD_ExecuteCompiled(c, 0);
+		}
+		// did we get a sleep?
+		if(t->currentDelayMS > 0) {
+			// will be runnable again once the timer is popped
+			Timers_Schedule(&t->delayTimer, t->currentDelayMS);
+			t->currentDelayMS = 0;
+			return;
+		}
+		t->currentDelayMS = 0;
+	}
+}
 
-				p = start-t->curFile->data;
-				///ADDLOG_EXTRADEBUG(LOG_FEATURE_CMD, "[Loop %i] Script line: %s, char index %i",loop,g_scrBuffer,p);
-				CMD_ExecuteCommand(g_scrBuffer,0);
+// 0 if any thread is ready to run, -1 if all are sleeping or idle
+// (sleeping threads are woken by their timers)
+int SVM_GetNextWakeMS() {
+	scriptInstance_t *t;
 
-				// did we get a sleep?
-				if(t->currentDelayMS > 0) {
-					return;
-				}	
-			}
+	for (t = g_scriptThreads; t; t = t->next) {
+		if (t->curFile && !Timer_IsScheduled(&t->delayTimer)) {
+			return 0;
 		}
 	}
+	return -1;
 }
-
 void SVM_RunThreads(int deltaMS) {
 	int c_sleep, c_run;
 
@@ -423,12 +605,7 @@ void SVM_RunThreads(int deltaMS) {
 
 	g_activeThread = g_scriptThreads;
 	while(g_activeThread) {
-		if(g_activeThread->currentDelayMS > 0) {
-			g_activeThread->currentDelayMS -= deltaMS;
-			// the following block is needed to handle with long freezes on simulator
-			if (g_activeThread->currentDelayMS < 0) {
-				g_activeThread->currentDelayMS = 0;
-			}
+		if(Timer_IsScheduled(&g_activeThread->delayTimer)) {
 			c_sleep++;
 		} else {
 			SVM_RunThread(g_activeThread);
@@ -456,7 +633,7 @@ void SVM_GoTo(scriptInstance_t *th, const char *fname, const char *label) {
 		return;
 	}
 	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	th->curLine = SVM_FindLabel(f,label);
 
 	return;
 }
@@ -469,6 +646,7 @@ void SVM_FreeAllFiles() {
 
 		n = f->next;
 
+		SVM_FreeIndex(f);
 		free(f->data);
 		free(f->fname);
 		free(f);
@@ -486,6 +664,7 @@ void SVM_StopAllScripts() {
 		t->curFile = 0;
 		t->uniqueID = 0;
 		t->currentDelayMS = 0;
+		Timers_Cancel(&t->delayTimer);
 
 		t = t->next;
 	}
@@ -503,6 +682,7 @@ void SVM_StopScripts(int id, int bExcludeSelf) {
 				t->curFile = 0;
 				t->uniqueID = 0;
 				t->currentDelayMS = 0;
+				Timers_Cancel(&t->delayTimer);
 			} 
 		}
 		t = t->next;
@@ -510,15 +690,15 @@ void SVM_StopScripts(int id, int bExcludeSelf) {
 }
 void SVM_GoToLocal(scriptInstance_t *th, const char *label) {
 
-	if(th == 0) {
+	if(th == 0 || th->curFile == 0) {
 
 		return;
 	}
-	th->curLine = SVM_FindLabel(th->curFile->data,label,th->curFile->fname);
+	th->curLine = SVM_FindLabel(th->curFile,label);
 
 	return;
 }
-void SVM_StartScript(const char *fname, const char *label, int uniqueID) {
+void SVM_StartScript(const char *fname, const char *label, int uniqueID, int budget) {
 	scriptFile_t *f;
 	scriptInstance_t *th;
 
@@ -541,7 +721,10 @@ void SVM_StartScript(const char *fname, const char *label, int uniqueID) {
 	}
 	th->uniqueID = uniqueID;
 	th->curFile = f;
-	th->curLine = SVM_FindLabel(f->data,label,f->fname);
+	th->curLine = SVM_FindLabel(f,label);
+	if (budget > 0) {
+		th->budget = budget;
+	}
 
 	if(label==0) {
 		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_StartScript: started %s at the beginning",fname);
@@ -589,6 +772,7 @@ static commandResult_t CMD_StartScript(const void *context, const char *cmd, con
 	const char *fname;
 	const char *label;
 	int uniqueID;
+	int budget;
 
 	Tokenizer_TokenizeString(args,0);
 	// following check must be done after 'Tokenizer_TokenizeString',
@@ -601,9 +785,10 @@ static commandResult_t CMD_StartScript(const void *context, const char *cmd, con
 	fname = Tokenizer_GetArg(0);
 	label = Tokenizer_GetArg(1);
 	uniqueID = Tokenizer_GetArgInteger(2);
+	budget = Tokenizer_GetArgInteger(3);
 
 
-	SVM_StartScript(fname,label,uniqueID);
+	SVM_StartScript(fname,label,uniqueID,budget);
 
 
 	return CMD_RES_OK;
@@ -688,6 +873,35 @@ static commandResult_t CMD_StopScript(const void *context, const char *cmd, cons
 
 	return CMD_RES_OK;
 }
+static commandResult_t CMD_SetScriptBudget(const void *context, const char *cmd, const char *args, int cmdFlags){
+	scriptInstance_t *t;
+	int id, budget;
+
+	Tokenizer_TokenizeString(args,0);
+	// following check must be done after 'Tokenizer_TokenizeString',
+	// so we know arguments count in Tokenizer. 'cmd' argument is
+	// only for warning display
+	if (Tokenizer_CheckArgsCountAndPrintWarning(cmd, 2)) {
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+
+	id = Tokenizer_GetArgInteger(0);
+	budget = Tokenizer_GetArgInteger(1);
+	if (budget <= 0) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "CMD_SetScriptBudget: budget must be positive");
+		return CMD_RES_BAD_ARGUMENT;
+	}
+
+	t = g_scriptThreads;
+	while(t) {
+		if(t->curFile && t->uniqueID == id) {
+			t->budget = budget;
+		}
+		t = t->next;
+	}
+
+	return CMD_RES_OK;
+}
 int CMD_GetCountActiveScriptThreads() {
 	scriptInstance_t *t;
 	int cnt;
@@ -713,7 +927,8 @@ static commandResult_t CMD_ListScripts(const void *context, const char *cmd, con
 	t = g_scriptThreads;
 	while(t) {
 		if(t->curFile) {
-			ADDLOG_INFO(LOG_FEATURE_CMD, "[%i] Thread UID %i - at file %s",cnt,t->uniqueID,t->curFile->fname);
+			ADDLOG_INFO(LOG_FEATURE_CMD, "[%i] Thread UID %i - at file %s line %i/%i, budget %i",cnt,t->uniqueID,t->curFile->fname,
+				t->curLine,t->curFile->numLines,t->budget);
 		} else {
 			ADDLOG_INFO(LOG_FEATURE_CMD, "[%i] Empty thread.",cnt);
 		}
@@ -742,8 +957,8 @@ commandResult_t CMD_resetSVM(const void *context, const char *cmd, const char *a
 	return CMD_RES_OK;
 }
 void CMD_InitScripting(){
-	//cmddetail:{"name":"startScript","args":"[FileName][Label][UniqueID]",
-	//cmddetail:"descr":"Starts a script thread from given file, at given label - can be * for whole file, with given unique ID",
+	//cmddetail:{"name":"startScript","args":"[FileName][Label][UniqueID][OptionalBudget]",
+	//cmddetail:"descr":"Starts a script thread from given file, at given label - can be * for whole file, with given unique ID. Optional budget is the max number of lines that thread can run per tick, default is 10",
 	//cmddetail:"fn":"CMD_StartScript","file":"cmnds/cmd_script.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("startScript", CMD_StartScript, NULL);
@@ -752,6 +967,11 @@ void CMD_InitScripting(){
 	//cmddetail:"fn":"CMD_StopScript","file":"cmnds/cmd_script.c","requires":"",
 	//cmddetail:"examples":""}
     CMD_RegisterCommand("stopScript", CMD_StopScript, NULL);
+	//cmddetail:{"name":"setScriptBudget","args":"[UniqueID][Budget]",
+	//cmddetail:"descr":"Sets the max number of lines that running script threads with given ID can execute per tick, before giving time to the rest of the system",
+	//cmddetail:"fn":"CMD_SetScriptBudget","file":"cmnds/cmd_script.c","requires":"",
+	//cmddetail:"examples":""}
+    CMD_RegisterCommand("setScriptBudget", CMD_SetScriptBudget, NULL);
 	//cmddetail:{"name":"stopAllScripts","args":"",
 	//cmddetail:"descr":"Stops all running scripts",
 	//cmddetail:"fn":"CMD_StopAllScripts","file":"cmnds/cmd_script.c","requires":"",
@@ -0,0 +1,207 @@
+#include "../new_common.h"
+#include "cmd_local.h"
+#include "../logging/logging.h"
+
+// Deadlines are kept in a binary min-heap, so a tick only has to look
+// at the timers that actually expired, not at all of them.
+// Comparisons are done on the signed difference, so it's safe to wrap.
+#define TIMER_BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+// shared scheduler for repeating events and script delays
+static timerHeap_t g_timers;
+// milliseconds since first tick, wraps around
+static unsigned int g_timersNow = 0;
+// timers are scheduled from command handlers on HTTP, MQTT and main task,
+// while quick tick runs them, so every heap access must hold this
+static SemaphoreHandle_t g_timersMutex = 0;
+
+void Timer_Init(obkTimer_t *t, timerCallback_t callback, void *userData) {
+	t->deadline = 0;
+	t->heapIndex = -1;
+	t->callback = callback;
+	t->userData = userData;
+}
+bool Timer_IsScheduled(obkTimer_t *t) {
+	return t->heapIndex >= 0;
+}
+static void TimerHeap_Set(timerHeap_t *h, int i, obkTimer_t *t) {
+	h->items[i] = t;
+	t->heapIndex = i;
+}
+static void TimerHeap_SiftUp(timerHeap_t *h, int i) {
+	obkTimer_t *t;
+	int parent;
+
+	t = h->items[i];
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!TIMER_BEFORE(t->deadline, h->items[parent]->deadline))
+			break;
+		TimerHeap_Set(h, i, h->items[parent]);
+		i = parent;
+	}
+	TimerHeap_Set(h, i, t);
+}
+static void TimerHeap_SiftDown(timerHeap_t *h, int i) {
+	obkTimer_t *t;
+	int child;
+
+	t = h->items[i];
+	while (1) {
+		child = i * 2 + 1;
+		if (child >= h->count)
+			break;
+		if (child + 1 < h->count && TIMER_BEFORE(h->items[child + 1]->deadline, h->items[child]->deadline))
+			child++;
+		if (!TIMER_BEFORE(h->items[child]->deadline, t->deadline))
+			break;
+		TimerHeap_Set(h, i, h->items[child]);
+		i = child;
+	}
+	TimerHeap_Set(h, i, t);
+}
+bool TimerHeap_Insert(timerHeap_t *h, obkTimer_t *t, unsigned int deadline) {
+	obkTimer_t **n;
+	int newSize;
+
+	TimerHeap_Remove(h, t);
+	if (h->count >= h->size) {
+		newSize = h->size ? h->size * 2 : 8;
+		n = (obkTimer_t**)realloc(h->items, sizeof(obkTimer_t*) * newSize);
+		if (n == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_CMD, "TimerHeap_Insert: failed to grow heap");
+			return false;
+		}
+		h->items = n;
+		h->size = newSize;
+	}
+	t->deadline = deadline;
+	TimerHeap_Set(h, h->count, t);
+	h->count++;
+	TimerHeap_SiftUp(h, t->heapIndex);
+	return true;
+}
+void TimerHeap_Remove(timerHeap_t *h, obkTimer_t *t) {
+	int i;
+
+	i = t->heapIndex;
+	if (i < 0 || i >= h->count || h->items[i] != t)
+		return;
+	t->heapIndex = -1;
+	h->count--;
+	if (i == h->count)
+		return;
+	// move last one into the hole and restore the order
+	TimerHeap_Set(h, i, h->items[h->count]);
+	TimerHeap_SiftDown(h, i);
+	TimerHeap_SiftUp(h, h->items[i]->heapIndex);
+}
+obkTimer_t *TimerHeap_Peek(timerHeap_t *h) {
+	if (h->count == 0)
+		return 0;
+	return h->items[0];
+}
+int TimerHeap_RunExpired(timerHeap_t *h, unsigned int now) {
+	obkTimer_t *t;
+	int c = 0;
+
+	// callbacks may add or remove timers, so always look at the current top
+	while ((t = TimerHeap_Peek(h)) != 0 && !TIMER_BEFORE(now, t->deadline)) {
+		TimerHeap_Remove(h, t);
+		c++;
+		if (t->callback) {
+			t->callback(t);
+		}
+	}
+	return c;
+}
+void TimerHeap_Free(timerHeap_t *h) {
+	int i;
+
+	for (i = 0; i < h->count; i++) {
+		h->items[i]->heapIndex = -1;
+	}
+	free(h->items);
+	h->items = 0;
+	h->count = 0;
+	h->size = 0;
+}
+
+void Timers_Init() {
+	if (g_timersMutex == 0) {
+		g_timersMutex = xSemaphoreCreateMutex();
+	}
+}
+static void Timers_Lock() {
+	// only heap operations are done under it, callbacks run unlocked
+	while (xSemaphoreTake(g_timersMutex, 1000) != pdTRUE) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "Timers mutex wait is too long");
+	}
+}
+static void Timers_Unlock() {
+	xSemaphoreGive(g_timersMutex);
+}
+void Timers_Schedule(obkTimer_t *t, int delayMS) {
+	if (delayMS < 0)
+		delayMS = 0;
+	Timers_Lock();
+	TimerHeap_Insert(&g_timers, t, g_timersNow + delayMS);
+	Timers_Unlock();
+}
+void Timers_Cancel(obkTimer_t *t) {
+	Timers_Lock();
+	TimerHeap_Remove(&g_timers, t);
+	Timers_Unlock();
+}
+static int Timers_GetRemainingMS_Locked(obkTimer_t *t) {
+	int left;
+
+	if (!Timer_IsScheduled(t))
+		return 0;
+	left = (int)(t->deadline - g_timersNow);
+	return left < 0 ? 0 : left;
+}
+int Timers_GetRemainingMS(obkTimer_t *t) {
+	int left;
+
+	Timers_Lock();
+	left = Timers_GetRemainingMS_Locked(t);
+	Timers_Unlock();
+	return left;
+}
+void Timers_RunQuickTick(int deltaMS) {
+	obkTimer_t *t;
+
+	g_timersNow += deltaMS;
+	// same as TimerHeap_RunExpired, but the lock is dropped for each callback,
+	// because they may schedule or cancel timers themselves
+	while (1) {
+		if (xSemaphoreTake(g_timersMutex, 10) != pdTRUE) {
+			// deadlines are absolute, so next tick will catch up
+			return;
+		}
+		t = TimerHeap_Peek(&g_timers);
+		if (t == 0 || TIMER_BEFORE(g_timersNow, t->deadline)) {
+			Timers_Unlock();
+			return;
+		}
+		TimerHeap_Remove(&g_timers, t);
+		Timers_Unlock();
+		if (t->callback) {
+			t->callback(t);
+		}
+	}
+}
+int Timers_GetNextDeadlineMS() {
+	obkTimer_t *t;
+	int left;
+
+	Timers_Lock();
+	t = TimerHeap_Peek(&g_timers);
+	left = t ? Timers_GetRemainingMS_Locked(t) : -1;
+	Timers_Unlock();
+	return left;
+}
+int Timers_GetActiveCount() {
+	return g_timers.count;
+}
@@ -7,18 +7,22 @@
 #include "../new_cfg.h"
 #include "../logging/logging.h"
 
-#define MAX_CMD_LEN 512
-#define MAX_ARGS 32
+// how many unused tokenizers are kept for next commands, the rest is freed
+#define TOKENIZER_POOL_SIZE 4
 
-static char g_buffer[MAX_CMD_LEN];
-static const char *g_args[MAX_ARGS];
-static char g_argsExpanded[MAX_ARGS][8];
-static const char *g_argsFrom[MAX_ARGS];
-static int g_numArgs = 0;
-static int tok_flags = 0;
+// Commands are executed from many tasks. Each handler call pushes a frame
+// (on caller's stack) with its own tokenizer, and global API uses the newest
+// frame of current task. Tokenizers come from a small pool, so there is
+// no per-task storage and nothing is allocated in the usual case.
+static tokenizerFrame_t *g_tokenizerFrames = 0;
+static tokenizer_t *g_tokenizerPool[TOKENIZER_POOL_SIZE];
+static int g_tokenizerPoolCount = 0;
+// used outside of commands and when allocation fails
+static tokenizer_t g_tokenizer;
+static SemaphoreHandle_t g_tokenizerMutex = 0;
 
-#define g_bAllowQuotes (tok_flags&TOKENIZER_ALLOW_QUOTES)
-#define g_bAllowExpand (!(tok_flags&TOKENIZER_DONT_EXPAND))
+#define TOK_ALLOW_QUOTES(t) ((t)->flags&TOKENIZER_ALLOW_QUOTES)
+#define TOK_ALLOW_EXPAND(t) (!((t)->flags&TOKENIZER_DONT_EXPAND))
 
 bool isWhiteSpace(char ch) {
 	if(ch == ' ')
@@ -34,47 +38,148 @@ bool isWhiteSpace(char ch) {
 		return true;
 	return false;
 }
-bool Tokenizer_CheckArgsCountAndPrintWarning(const char *cmdString, int reqCount) {
-	if (g_numArgs >= reqCount)
+void Tokenizer_Init() {
+	if (g_tokenizerMutex == 0) {
+		g_tokenizerMutex = xSemaphoreCreateMutex();
+	}
+}
+static void Tokenizer_Lock() {
+	// before CMD_Init_Early only the main task runs
+	if (g_tokenizerMutex == 0)
+		return;
+	while (xSemaphoreTake(g_tokenizerMutex, 1000) != pdTRUE) {
+		ADDLOG_ERROR(LOG_FEATURE_CMD, "Tokenizer mutex wait is too long");
+	}
+}
+static void Tokenizer_Unlock() {
+	if (g_tokenizerMutex == 0)
+		return;
+	xSemaphoreGive(g_tokenizerMutex);
+}
+void Tokenizer_EnterCommand(tokenizerFrame_t *f) {
+	f->task = (void*)xTaskGetCurrentTaskHandle();
+	f->tokenizer = 0;
+	Tokenizer_Lock();
+	if (g_tokenizerPoolCount > 0) {
+		g_tokenizerPoolCount--;
+		f->tokenizer = g_tokenizerPool[g_tokenizerPoolCount];
+	}
+	Tokenizer_Unlock();
+	if (f->tokenizer == 0) {
+		f->tokenizer = (tokenizer_t*)malloc(sizeof(tokenizer_t));
+		if (f->tokenizer == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_CMD, "Failed to alloc tokenizer, using shared one");
+			f->tokenizer = &g_tokenizer;
+		}
+	}
+	f->tokenizer->numArgs = 0;
+	Tokenizer_Lock();
+	f->next = g_tokenizerFrames;
+	g_tokenizerFrames = f;
+	Tokenizer_Unlock();
+}
+void Tokenizer_LeaveCommand(tokenizerFrame_t *f) {
+	tokenizerFrame_t **p;
+	tokenizer_t *t = f->tokenizer;
+
+	Tokenizer_Lock();
+	for (p = &g_tokenizerFrames; *p; p = &(*p)->next) {
+		if (*p == f) {
+			*p = f->next;
+			break;
+		}
+	}
+	if (t != &g_tokenizer && g_tokenizerPoolCount < TOKENIZER_POOL_SIZE) {
+		g_tokenizerPool[g_tokenizerPoolCount] = t;
+		g_tokenizerPoolCount++;
+		t = 0;
+	}
+	Tokenizer_Unlock();
+	if (t != &g_tokenizer) {
+		free(t);
+	}
+}
+static tokenizer_t *Tokenizer_GetCurrent() {
+	void *task = (void*)xTaskGetCurrentTaskHandle();
+	tokenizerFrame_t *f;
+	tokenizer_t *t = &g_tokenizer;
+
+	// frames are pushed on head, so first match is the innermost command
+	Tokenizer_Lock();
+	for (f = g_tokenizerFrames; f; f = f->next) {
+		if (f->task == task) {
+			t = f->tokenizer;
+			break;
+		}
+	}
+	Tokenizer_Unlock();
+	return t;
+}
+bool Tokenizer_Ctx_CheckArgsCountAndPrintWarning(tokenizer_t *t, const char *cmdString, int reqCount) {
+	if (t->numArgs >= reqCount)
 		return false;
-	ADDLOG_ERROR(LOG_FEATURE_CMD, "Cant run '%s', expected at least %i args (given %i)", cmdString, reqCount, g_numArgs);
+	ADDLOG_ERROR(LOG_FEATURE_CMD, "Cant run '%s', expected at least %i args (given %i)", cmdString, reqCount, t->numArgs);
 	return true;
 }
-int Tokenizer_GetArgsCount() {
-	return g_numArgs;
+int Tokenizer_Ctx_GetArgsCount(tokenizer_t *t) {
+	return t->numArgs;
 }
-bool Tokenizer_IsArgInteger(int i) {
-	if(i >= g_numArgs)
-		return false;
-	return strIsInteger(g_args[i]);
+const char *Tokenizer_Ctx_GetArgSlice(tokenizer_t *t, int i, int *len) {
+	if (i < 0 || i >= t->numArgs) {
+		*len = 0;
+		return 0;
+	}
+	*len = t->argLen[i];
+	return t->src + t->argOfs[i];
 }
-const char *Tokenizer_GetArg(int i) {
-	const char *s;
+// get argument as a null terminated string, without constants expansion
+static const char *Tokenizer_Ctx_GetArgRaw(tokenizer_t *t, int i) {
+	char *d;
 
-	if(i >= g_numArgs)
+	if (i < 0 || i >= t->numArgs)
 		return 0;
+	d = t->buffer + t->argOfs[i];
+	if ((t->argReady & (1u << i)) == 0) {
+		// copy only this argument, at the same offset, so arguments never overlap
+		if (t->src != t->buffer) {
+			memcpy(d, t->src + t->argOfs[i], t->argLen[i]);
+		}
+		d[t->argLen[i]] = 0;
+		t->argReady |= (1u << i);
+	}
+	return d;
+}
+bool Tokenizer_Ctx_IsArgInteger(tokenizer_t *t, int i) {
+	return strIsInteger(Tokenizer_Ctx_GetArgRaw(t, i));
+}
+const char *Tokenizer_Ctx_GetArg(tokenizer_t *t, int i) {
+	const char *s;
 
-	s = g_args[i];
+	s = Tokenizer_Ctx_GetArgRaw(t, i);
+	if (s == 0)
+		return 0;
 
-	if(g_bAllowExpand && s[0] == '$' && s[1] == 'C' && s[2] == 'H') {
+	if(TOK_ALLOW_EXPAND(t) && s[0] == '$' && s[1] == 'C' && s[2] == 'H') {
 		int channelIndex;
 		int value;
 
 		channelIndex = atoi(s+3);
 		value = CHANNEL_Get(channelIndex);
 		
-		sprintf(g_argsExpanded[i],"%i",value);
+		sprintf(t->argsExpanded[i],"%i",value);
 
-		return g_argsExpanded[i];
+		return t->argsExpanded[i];
 	}
 
-	return g_args[i];
+	return s;
 }
-const char *Tokenizer_GetArgFrom(int i) {
-	return g_argsFrom[i];
+const char *Tokenizer_Ctx_GetArgFrom(tokenizer_t *t, int i) {
+	if (i < 0 || i >= t->numArgs)
+		return 0;
+	return t->from + t->argOfs[i];
 }
-int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
-	int ret = Tokenizer_GetArgInteger(i);
+int Tokenizer_Ctx_GetArgIntegerRange(tokenizer_t *t, int i, int rangeMin, int rangeMax) {
+	int ret = Tokenizer_Ctx_GetArgInteger(t, i);
 	if(ret < rangeMin) {
 		ret = rangeMin;
 		ADDLOG_ERROR(LOG_FEATURE_CMD, "Argument %i (val=%i) was out of range [%i,%i], clamped",i,ret,rangeMax,rangeMin);
@@ -85,21 +190,21 @@ int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
 	}
 	return ret;
 }
-int Tokenizer_GetArgIntegerDefault(int i, int def) {
+int Tokenizer_Ctx_GetArgIntegerDefault(tokenizer_t *t, int i, int def) {
 	int r;
 
-	if (g_numArgs <= i) {
+	if (t->numArgs <= i) {
 		return def;
 	}
-	r = Tokenizer_GetArgInteger(i);
+	r = Tokenizer_Ctx_GetArgInteger(t, i);
 
 	return r;
 }
-int Tokenizer_GetArgInteger(int i) {
+int Tokenizer_Ctx_GetArgInteger(tokenizer_t *t, int i) {
 	const char *s;
 	int ret;
 
-	s = g_args[i];
+	s = Tokenizer_Ctx_GetArgRaw(t, i);
 	if (s == 0)
 		return 0;
 	if(s[0] == '0' && s[1] == 'x') {
@@ -107,7 +212,7 @@ int Tokenizer_GetArgInteger(int i) {
 		return ret;
 	}
 #if (!PLATFORM_BEKEN && !WINDOWS)
-	if(g_bAllowExpand && s[0] == '$') {
+	if(TOK_ALLOW_EXPAND(t) && s[0] == '$') {
 		// constant
 		int channelIndex;
 		if(s[1] == 'C' && s[2] == 'H') {
@@ -121,21 +226,23 @@ int Tokenizer_GetArgInteger(int i) {
 	// - 5*10
 	// - $CH5+$CH11
 	// - $CH8*10
-	if(g_bAllowExpand) {
+	if(TOK_ALLOW_EXPAND(t)) {
 		ret = CMD_EvaluateExpression(s,0);
 		return ret;
 	}
 #endif
 	return atoi(s);
 }
-float Tokenizer_GetArgFloat(int i) {
+float Tokenizer_Ctx_GetArgFloat(tokenizer_t *t, int i) {
 #if !PLATFORM_BEKEN
 	int channelIndex;
 #endif
 	const char *s;
-	s = g_args[i];
+	s = Tokenizer_Ctx_GetArgRaw(t, i);
+	if (s == 0)
+		return 0;
 #if (!PLATFORM_BEKEN && !WINDOWS)
-	if(g_bAllowExpand && s[0] == '$') {
+	if(TOK_ALLOW_EXPAND(t) && s[0] == '$') {
 		// constant
 		if(s[1] == 'C' && s[2] == 'H') {
 			channelIndex = atoi(s+3);
@@ -148,17 +255,37 @@ float Tokenizer_GetArgFloat(int i) {
 	// - 5*10
 	// - $CH5+$CH11
 	// - $CH8*10
-	if(g_bAllowExpand) {
+	if(TOK_ALLOW_EXPAND(t)) {
 		return CMD_EvaluateExpression(s,0);
 	}
 #endif
 	return atof(s);
 }
-void Tokenizer_TokenizeString(const char *s, int flags) {
-	char *p;
+static void Tokenizer_AddArg(tokenizer_t *t, const char *p) {
+	if (t->numArgs >= TOKENIZER_MAX_ARGS) {
+		return;
+	}
+	t->argOfs[t->numArgs] = p - t->src;
+	t->argLen[t->numArgs] = -1;
+	t->numArgs++;
+}
+// Separator found at p - all arguments started so far end there.
+// (this is where old tokenizer was writing 0 into its copy)
+static void Tokenizer_CloseArgs(tokenizer_t *t, const char *p, int *firstOpen) {
+	while (*firstOpen < t->numArgs) {
+		t->argLen[*firstOpen] = (p - t->src) - t->argOfs[*firstOpen];
+		(*firstOpen)++;
+	}
+}
+void Tokenizer_Ctx_TokenizeString(tokenizer_t *t, const char *s, int flags) {
+	const char *p;
+	const char *end;
+	int firstOpen;
+	int len;
 
-	tok_flags = flags;
-	g_numArgs = 0;
+	t->flags = flags;
+	t->numArgs = 0;
+	t->argReady = 0;
 
 	if(s == 0) {
 		return;
@@ -172,70 +299,103 @@ void Tokenizer_TokenizeString(const char *s, int flags) {
 		return;
 	}
 
-	// not really needed, but nice for testing
-	memset(g_args, 0, sizeof(g_args));
-	memset(g_argsFrom, 0, sizeof(g_argsFrom));
-
+	t->from = s;
 	if (flags & TOKENIZER_ALTERNATE_EXPAND_AT_START) {
-		CMD_ExpandConstantsWithinString(s, g_buffer, sizeof(g_buffer));
+		CMD_ExpandConstantsWithinString(s, t->buffer, sizeof(t->buffer));
+		t->src = t->buffer;
 	} else {
-		strcpy_safe(g_buffer, s, sizeof(g_buffer));
+		// no copy, arguments are sliced from caller's string
+		t->src = s;
+	}
+	// arguments must fit in buffer once they are copied out
+	len = 0;
+	while (t->src[len] && len < TOKENIZER_MAX_CMD_LEN - 1) {
+		len++;
 	}
+	end = t->src + len;
+	firstOpen = 0;
+
 	if (flags & TOKENIZER_FORCE_SINGLE_ARGUMENT_MODE) {
-		g_args[g_numArgs] = g_buffer;
-		g_argsFrom[g_numArgs] = g_buffer;
-		g_numArgs = 1;
+		Tokenizer_AddArg(t, t->src);
+		Tokenizer_CloseArgs(t, end, &firstOpen);
 		return;
 	}
-	p = g_buffer;
+	p = t->src;
 	// we need to rewrite this function and check it well with unit tests
 	if (*p == '"') {
 		goto quote;
 	}
-	g_args[g_numArgs] = p;
-	g_argsFrom[g_numArgs] = (s+(p-g_buffer));
-	g_numArgs++;
-	while(*p != 0) {
+	Tokenizer_AddArg(t, p);
+	while(p < end) {
 		if(isWhiteSpace(*p)) {
-			*p = 0;
-			if(p[1] != 0 && isWhiteSpace(p[1])==false) {
+			Tokenizer_CloseArgs(t, p, &firstOpen);
+			if(p + 1 < end && isWhiteSpace(p[1])==false) {
 				// we need to rewrite this function and check it well with unit tests
-				if(g_bAllowQuotes && p[1] == '"') { 
+				if(TOK_ALLOW_QUOTES(t) && p[1] == '"') { 
 					p++;
 					goto quote;
 				}
-				g_args[g_numArgs] = p+1;
-				g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
-				g_numArgs++;
+				Tokenizer_AddArg(t, p + 1);
 			}
 		}
 		if(*p == ',') {
-			*p = 0;
-			g_args[g_numArgs] = p+1;
-			g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
-			g_numArgs++;
+			Tokenizer_CloseArgs(t, p, &firstOpen);
+			Tokenizer_AddArg(t, p + 1);
 		}
-		if(g_bAllowQuotes && *p == '"') {
+		if(TOK_ALLOW_QUOTES(t) && *p == '"') {
 quote:
-			*p = 0;
-			g_argsFrom[g_numArgs] = (s+((p+1)-g_buffer));
+			Tokenizer_CloseArgs(t, p, &firstOpen);
 			p++;
-			g_args[g_numArgs] = p;
-			g_numArgs++;
-			while(*p != 0) {
+			Tokenizer_AddArg(t, p);
+			while(p < end) {
 				if(*p == '"') {
-					*p = 0;
+					Tokenizer_CloseArgs(t, p, &firstOpen);
 					break;
 				}
 				p++;
 			}
+			if (p >= end) {
+				// unterminated quote
+				break;
+			}
 		}
-		if(g_numArgs>=MAX_ARGS) {
+		if(t->numArgs>=TOKENIZER_MAX_ARGS) {
 			ADDLOG_ERROR(LOG_FEATURE_CMD, "Too many args, skipped all after 32nd.");
 			break;
 		}
 		p++;
 	}
+	Tokenizer_CloseArgs(t, end, &firstOpen);
+}
 
-
+// global API - thin wrappers over tokenizer of currently executed command
+bool Tokenizer_CheckArgsCountAndPrintWarning(const char *cmdString, int reqCount) {
+	return Tokenizer_Ctx_CheckArgsCountAndPrintWarning(Tokenizer_GetCurrent(), cmdString, reqCount);
+}
+int Tokenizer_GetArgsCount() {
+	return Tokenizer_Ctx_GetArgsCount(Tokenizer_GetCurrent());
+}
+bool Tokenizer_IsArgInteger(int i) {
+	return Tokenizer_Ctx_IsArgInteger(Tokenizer_GetCurrent(), i);
+}
+const char *Tokenizer_GetArg(int i) {
+	return Tokenizer_Ctx_GetArg(Tokenizer_GetCurrent(), i);
+}
+const char *Tokenizer_GetArgFrom(int i) {
+	return Tokenizer_Ctx_GetArgFrom(Tokenizer_GetCurrent(), i);
+}
+int Tokenizer_GetArgIntegerRange(int i, int rangeMin, int rangeMax) {
+	return Tokenizer_Ctx_GetArgIntegerRange(Tokenizer_GetCurrent(), i, rangeMin, rangeMax);
+}
+int Tokenizer_GetArgIntegerDefault(int i, int def) {
+	return Tokenizer_Ctx_GetArgIntegerDefault(Tokenizer_GetCurrent(), i, def);
+}
+int Tokenizer_GetArgInteger(int i) {
+	return Tokenizer_Ctx_GetArgInteger(Tokenizer_GetCurrent(), i);
+}
+float Tokenizer_GetArgFloat(int i) {
+	return Tokenizer_Ctx_GetArgFloat(Tokenizer_GetCurrent(), i);
+}
+void Tokenizer_TokenizeString(const char *s, int flags) {
+	Tokenizer_Ctx_TokenizeString(Tokenizer_GetCurrent(), s, flags);
 }
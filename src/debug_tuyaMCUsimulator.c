@@ -92,6 +92,12 @@ int curString = 0;
 const char *curP = 0;
 int current_delay_to_wait_ms = 100;
 
+int NewTuyaMCUSimulator_GetNextWakeMS() {
+	if (g_totalStrings <= 0 || g_bDoingUnitTestsNow) {
+		return -1;
+	}
+	return 0;
+}
 void NewTuyaMCUSimulator_RunQuickTick(int deltaMS) {
 	byte b;
 	int c_added = 0;
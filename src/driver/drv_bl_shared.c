@@ -409,6 +409,13 @@ commandResult_t BL09XX_SetupConsumptionThreshold(const void *context, const char
     return CMD_RES_OK;
 }
 
+// Counters below are resent with every energy update, but most of them (yesterday, today,
+// last hour) rarely change, so let deduper skip unchanged ones until the 'send always' time.
+static void BL_PublishCounter(const char *name, float value)
+{
+    MQTT_PublishMain_StringFloat_DeDuped(changeSendAlwaysFrames * 1000, name, value, -1, 0);
+}
+
 void BL_ProcessUpdate(float voltage, float current, float power,
 					  float frequency) 
 {
@@ -486,7 +493,7 @@ void BL_ProcessUpdate(float voltage, float current, float power,
 
             dailyStats[0] = 0.0;
             actual_mday = ltm->tm_mday;
-            MQTT_PublishMain_StringFloat(counter_mqttNames[3], dailyStats[1]);
+            BL_PublishCounter(counter_mqttNames[3], dailyStats[1]);
             stat_updatesSent++;
 #if WINDOWS
 #elif PLATFORM_BL602
@@ -602,7 +609,7 @@ void BL_ProcessUpdate(float voltage, float current, float power,
 
             if (MQTT_IsReady() == true)
             {
-                MQTT_PublishMain_StringFloat(counter_mqttNames[1], DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
+                BL_PublishCounter(counter_mqttNames[1], DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
                 EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_CONSUMPTION_LAST_HOUR, lastSentEnergyCounterLastHour, DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
                 lastSentEnergyCounterLastHour = DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR);
                 stat_updatesSent++;
@@ -667,15 +674,15 @@ void BL_ProcessUpdate(float voltage, float current, float power,
             lastSentEnergyCounterValue = energyCounter;
             noChangeFrameEnergyCounter = 0;
             stat_updatesSent++;
-            MQTT_PublishMain_StringFloat(counter_mqttNames[1], DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
+            BL_PublishCounter(counter_mqttNames[1], DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
             EventHandlers_ProcessVariableChange_Integer(CMD_EVENT_CHANGE_CONSUMPTION_LAST_HOUR, lastSentEnergyCounterLastHour, DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR));
             lastSentEnergyCounterLastHour = DRV_GetReading(OBK_CONSUMPTION_LAST_HOUR);
             stat_updatesSent++;
             if(NTP_IsTimeSynced() == true)
             {
-                MQTT_PublishMain_StringFloat(counter_mqttNames[3], dailyStats[1]);
+                BL_PublishCounter(counter_mqttNames[3], dailyStats[1]);
                 stat_updatesSent++;
-                MQTT_PublishMain_StringFloat(counter_mqttNames[4], dailyStats[0]);
+                BL_PublishCounter(counter_mqttNames[4], dailyStats[0]);
                 stat_updatesSent++;
                 ltm = localtime(&ConsumptionResetTime);
                 snprintf(datetime,sizeof(datetime), "%04i-%02i-%02i %02i:%02i:%02i",
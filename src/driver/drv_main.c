@@ -318,6 +318,17 @@ void DRV_RunQuickTick() {
 	}
 	DRV_Mutex_Free();
 }
+// 0 if any running driver has a quick tick, -1 otherwise
+int DRV_GetNextWakeMS() {
+	int i;
+
+	for (i = 0; i < g_numDrivers; i++) {
+		if (g_drivers[i].bLoaded && g_drivers[i].runQuickTick != 0) {
+			return 0;
+		}
+	}
+	return -1;
+}
 void DRV_OnChannelChanged(int channel, int iVal) {
 	int i;
 
@@ -22,41 +22,75 @@ typedef struct ntpEvent_s {
 	byte weekDayFlags;
 	int id;
 	char *command;
+	// next occurence, in g_ntpEventsHeap (unix time)
+	obkTimer_t timer;
 	struct ntpEvent_s *next;
 } ntpEvent_t;
 
 ntpEvent_t *ntp_events = 0;
+// events ordered by next occurence, so we only check the first one every second
+static timerHeap_t g_ntpEventsHeap;
 
-
-void NTP_RunEventsForSecond(unsigned int runTime) {
-	ntpEvent_t *e;
+// returns first time >= from when event should run, or 0 if never
+static unsigned int NTP_GetNextEventTime(ntpEvent_t *e, unsigned int from) {
 	struct tm *ltm;
+	time_t t;
+	int now, at, d, wday;
 
-	// NOTE: on windows, you need _USE_32BIT_TIME_T 
-	ltm = localtime((time_t*)&runTime);
-	
+	if (e->hour > 23 || e->minute > 59 || e->second > 59) {
+		return 0;
+	}
+	t = (time_t)from;
+	ltm = localtime(&t);
 	if (ltm == 0) {
+		return 0;
+	}
+	now = ltm->tm_hour * 3600 + ltm->tm_min * 60 + ltm->tm_sec;
+	at = e->hour * 3600 + e->minute * 60 + e->second;
+	// up to a week later, if only the same weekday is set
+	for (d = 0; d <= 7; d++) {
+		if (d == 0 && at < now) {
+			continue;
+		}
+		wday = (ltm->tm_wday + d) % 7;
+		if (BIT_CHECK(e->weekDayFlags, wday)) {
+			return from - now + d * 86400 + at;
+		}
+	}
+	return 0;
+}
+static void NTP_ScheduleEvent(ntpEvent_t *e, unsigned int from) {
+	unsigned int next;
+
+	TimerHeap_Remove(&g_ntpEventsHeap, &e->timer);
+	// no valid time yet, will be scheduled once we get it
+	if (from == 0) {
+		return;
+	}
+	next = NTP_GetNextEventTime(e, from);
+	if (next == 0) {
 		return;
 	}
+	TimerHeap_Insert(&g_ntpEventsHeap, &e->timer, next);
+}
+static void NTP_ScheduleAllEvents(unsigned int from) {
+	ntpEvent_t *e;
 
-	e = ntp_events;
+	for (e = ntp_events; e; e = e->next) {
+		NTP_ScheduleEvent(e, from);
+	}
+}
+static void NTP_OnEventTimer(obkTimer_t *t) {
+	ntpEvent_t *e = (ntpEvent_t*)t->userData;
 
-	while (e) {
-		if (e->command) {
-			// base check
-			if (e->hour == ltm->tm_hour && e->second == ltm->tm_sec && e->minute == ltm->tm_min) {
-				// weekday check
-				if (BIT_CHECK(e->weekDayFlags, ltm->tm_wday)) {
-					CMD_ExecuteCommand(e->command, 0);
-				}
-			}
-		}
-		e = e->next;
+	// schedule next one first, command might remove this event
+	NTP_ScheduleEvent(e, t->deadline + 1);
+	if (e->command) {
+		CMD_ExecuteCommand(e->command, 0);
 	}
 }
 void NTP_RunEvents(unsigned int newTime, bool bTimeValid) {
 	unsigned int delta;
-	unsigned int i;
 
 	// new time invalid?
 	if (bTimeValid == false) {
@@ -64,23 +98,24 @@ void NTP_RunEvents(unsigned int newTime, bool bTimeValid) {
 		return;
 	}
 	// old time invalid, but new one ok?
-	if (ntp_eventsTime == 0) {
-		ntp_eventsTime = newTime;
-		return;
-	}
-	// time went backwards
-	if (newTime < ntp_eventsTime) {
+	// or time went backwards
+	if (ntp_eventsTime == 0 || newTime < ntp_eventsTime) {
 		ntp_eventsTime = newTime;
+		NTP_ScheduleAllEvents(ntp_eventsTime);
 		return;
 	}
 	if (ntp_events) {
 		// NTP resynchronization could cause us to skip some seconds in some rare cases?
 		delta = newTime - ntp_eventsTime;
 		// a large shift in time is not expected, so limit to a constant number of seconds
-		if (delta > 100)
-			delta = 100;
-		for (i = 0; i < delta; i++) {
-			NTP_RunEventsForSecond(ntp_eventsTime + i);
+		if (delta > 100) {
+			TimerHeap_RunExpired(&g_ntpEventsHeap, ntp_eventsTime + 99);
+			// the rest is skipped
+			NTP_ScheduleAllEvents(newTime);
+		}
+		else if (delta > 0) {
+			// seconds from ntp_eventsTime up to newTime-1
+			TimerHeap_RunExpired(&g_ntpEventsHeap, newTime - 1);
 		}
 	}
 	ntp_eventsTime = newTime;
@@ -99,8 +134,10 @@ void NTP_AddClockEvent(int hour, int minute, int second, int weekDayFlags, int i
 	newEvent->id = id;
 	newEvent->command = strdup(command);
 	newEvent->next = ntp_events;
+	Timer_Init(&newEvent->timer, NTP_OnEventTimer, newEvent);
 
 	ntp_events = newEvent;
+	NTP_ScheduleEvent(newEvent, ntp_eventsTime);
 }
 int NTP_RemoveClockEvent(int id) {
 	int ret = 0;
@@ -115,6 +152,7 @@ int NTP_RemoveClockEvent(int id) {
 			else {
 				prev->next = curr->next;
 			}
+			TimerHeap_Remove(&g_ntpEventsHeap, &curr->timer);
 			free(curr->command);
 			free(curr);
 			ret++;
@@ -248,6 +286,9 @@ int NTP_ClearEvents() {
 	ntpEvent_t* e;
 	int t;
 
+	// before events are freed
+	TimerHeap_Free(&g_ntpEventsHeap);
+
 	e = ntp_events;
 	t = 0;
 
@@ -37,6 +37,7 @@ void DRV_OnEverySecond();
 void DHT_OnEverySecond();
 void DHT_OnPinsConfigChanged();
 void DRV_RunQuickTick();
+int DRV_GetNextWakeMS();
 void DRV_StartDriver(const char* name);
 void DRV_StopDriver(const char* name);
 // right now only used by simulator
@@ -1,5 +1,6 @@
 #include "../new_common.h"
 #include "../new_pins.h"
+#include "../quicktick.h"
 #include "../new_cfg.h"
 // Commands register, execution API and cmd tokenizer
 #include "../cmnds/cmd_public.h"
@@ -142,6 +143,7 @@ void UART_AppendByteToCircularBuffer(int rc) {
             g_recvBufIn = 0;
         }
    }
+   QuickTick_RequestWakeup();
 }
 #if PLATFORM_BK7231T | PLATFORM_BK7231N
 void test_ty_read_uart_data_to_buffer(int port, void* param)
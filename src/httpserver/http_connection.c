@@ -0,0 +1,463 @@
+#include "../new_common.h"
+#include "../logging/logging.h"
+#include "../cmnds/cmd_public.h"
+#include "new_http.h"
+#include "http_connection.h"
+
+// set in lineLen when chunk size was read and extension after ';' is skipped
+#define HTTP_CHUNK_SIZE_READ		0x100
+
+static httpConnection_t g_connections[HTTP_MAX_CONNECTIONS];
+static httpConnStats_t g_stats;
+static int g_lastConnections = 0;
+static int g_lastRequests = 0;
+
+int my_strnicmp(const char* a, const char* b, int len);
+
+static bool HTTP_Conn_LineContains(const char* line, const char* end, const char* what) {
+	int len = strlen(what);
+
+	while (line + len <= end) {
+		if (!my_strnicmp(line, what, len)) {
+			return true;
+		}
+		line++;
+	}
+	return false;
+}
+// gets what is needed to find where request ends and if client wants connection kept
+static void HTTP_Conn_ParseHeaders(httpConnection_t* c, int* contentLength) {
+	const char* s = c->received;
+	const char* stop = s + c->headersLen;
+	const char* line;
+	const char* end;
+	const char* value;
+
+	*contentLength = 0;
+	c->bClientKeepAlive = 0;
+	c->bChunkedBody = 0;
+	line = s;
+	while (line < stop) {
+		end = line;
+		while (end < stop && *end != '\r') {
+			end++;
+		}
+		if (line == s) {
+			// only HTTP/1.1 client can read chunked reply
+			c->bClientKeepAlive = HTTP_Conn_LineContains(line, end, "HTTP/1.1");
+		}
+		else {
+			switch (HTTP_GetHeaderId(line, &value)) {
+			case HTTP_HEADER_CONTENT_LENGTH:
+				*contentLength = atoi(value);
+				break;
+			case HTTP_HEADER_TRANSFER_ENCODING:
+				c->bChunkedBody = HTTP_Conn_LineContains(value, end, "chunked");
+				break;
+			case HTTP_HEADER_CONNECTION:
+				if (HTTP_Conn_LineContains(value, end, "close")) {
+					c->bClientKeepAlive = 0;
+				}
+				break;
+			}
+		}
+		line = end + 2;
+	}
+	if (*contentLength < 0) {
+		*contentLength = 0;
+	}
+}
+static void HTTP_Conn_ResetParser(httpConnection_t* c) {
+	c->state = HTTP_STATE_HEADERS;
+	c->scanPos = 0;
+	c->headersLen = 0;
+	c->parsePos = 0;
+	c->bodyLen = 0;
+	c->bodyLeft = 0;
+	c->lineLen = 0;
+}
+static int HTTP_Conn_HexDigit(char ch) {
+	if (ch >= '0' && ch <= '9') {
+		return ch - '0';
+	}
+	ch |= 0x20;
+	if (ch >= 'a' && ch <= 'f') {
+		return ch - 'a' + 10;
+	}
+	return -1;
+}
+static void HTTP_Conn_OnChunkSizeChar(httpConnection_t* c, char ch) {
+	int digit;
+
+	if (ch == '\n') {
+		if (c->lineLen == 0) {
+			c->state = HTTP_STATE_ERROR;
+		}
+		else if (c->bodyLeft == 0) {
+			// last chunk, trailer follows
+			c->state = HTTP_STATE_CHUNK_TRAILER;
+		}
+		else {
+			c->state = HTTP_STATE_CHUNK_DATA;
+		}
+		c->lineLen = 0;
+		return;
+	}
+	if (ch == '\r' || (c->lineLen & HTTP_CHUNK_SIZE_READ)) {
+		return;
+	}
+	digit = HTTP_Conn_HexDigit(ch);
+	if (digit >= 0) {
+		// more than 7 digits would not fit anyway
+		if (c->lineLen >= 7) {
+			c->state = HTTP_STATE_ERROR;
+			return;
+		}
+		c->bodyLeft = c->bodyLeft * 16 + digit;
+		c->lineLen++;
+	}
+	else if (c->lineLen > 0 && (ch == ';' || ch == ' ' || ch == '\t')) {
+		c->lineLen |= HTTP_CHUNK_SIZE_READ;
+	}
+	else {
+		c->state = HTTP_STATE_ERROR;
+	}
+}
+// Decodes body from in to out, out may point to the same memory as in, or before it.
+// Returns how many input bytes were used, adds decoded bytes to outLen.
+static int HTTP_Conn_DecodeBody(httpConnection_t* c, const char* in, int inLen, char* out, int* outLen) {
+	int used = 0;
+	int n;
+	char ch;
+
+	while (used < inLen && c->state != HTTP_STATE_DONE && c->state != HTTP_STATE_ERROR) {
+		if (c->state == HTTP_STATE_BODY || c->state == HTTP_STATE_CHUNK_DATA) {
+			n = inLen - used;
+			if (n > c->bodyLeft) {
+				n = c->bodyLeft;
+			}
+			memmove(out + *outLen, in + used, n);
+			*outLen += n;
+			used += n;
+			c->bodyLeft -= n;
+			if (c->bodyLeft == 0) {
+				c->state = c->state == HTTP_STATE_BODY ? HTTP_STATE_DONE : HTTP_STATE_CHUNK_DATA_END;
+			}
+			continue;
+		}
+		ch = in[used++];
+		switch (c->state) {
+		case HTTP_STATE_CHUNK_SIZE:
+			HTTP_Conn_OnChunkSizeChar(c, ch);
+			break;
+		case HTTP_STATE_CHUNK_DATA_END:
+			// CRLF after chunk data
+			if (ch == '\n') {
+				c->state = HTTP_STATE_CHUNK_SIZE;
+			}
+			else if (ch != '\r') {
+				c->state = HTTP_STATE_ERROR;
+			}
+			break;
+		case HTTP_STATE_CHUNK_TRAILER:
+			// trailer lines are skipped, empty line ends the body
+			if (ch == '\n') {
+				if (c->lineLen == 0) {
+					c->state = HTTP_STATE_DONE;
+				}
+				c->lineLen = 0;
+			}
+			else if (ch != '\r') {
+				c->lineLen++;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return used;
+}
+// parses what was received so far, returns 1 if whole request is there
+static int HTTP_Conn_Parse(httpConnection_t* c) {
+	int contentLength, i;
+	char* s = c->received;
+
+	if (c->state == HTTP_STATE_HEADERS) {
+		for (i = c->scanPos; i < c->receivedLen; i++) {
+			if (i >= 3 && s[i] == '\n' && s[i - 1] == '\r' && s[i - 2] == '\n' && s[i - 3] == '\r') {
+				break;
+			}
+		}
+		if (i >= c->receivedLen) {
+			c->scanPos = i;
+			return 0;
+		}
+		c->headersLen = i + 1;
+		c->parsePos = c->headersLen;
+		c->bodyLen = 0;
+		HTTP_Conn_ParseHeaders(c, &contentLength);
+		if (c->bChunkedBody) {
+			c->state = HTTP_STATE_CHUNK_SIZE;
+			c->bodyLeft = 0;
+			c->lineLen = 0;
+		}
+		else if (contentLength > 0) {
+			c->state = HTTP_STATE_BODY;
+			c->bodyLeft = contentLength;
+		}
+		else {
+			c->state = HTTP_STATE_DONE;
+		}
+	}
+	// body is decoded in place, so it follows headers without chunk framing
+	c->parsePos += HTTP_Conn_DecodeBody(c, s + c->parsePos, c->receivedLen - c->parsePos,
+		s + c->headersLen, &c->bodyLen);
+	if (c->state == HTTP_STATE_DONE) {
+		return 1;
+	}
+	// all received data was used, framing doesn't have to be kept
+	c->receivedLen = c->headersLen + c->bodyLen;
+	c->parsePos = c->receivedLen;
+	c->received[c->receivedLen] = 0;
+	return 0;
+}
+static void HTTP_Conn_Consume(httpConnection_t* c, int len) {
+	memmove(c->received, c->received + len, c->receivedLen - len);
+	c->receivedLen -= len;
+	c->received[c->receivedLen] = 0;
+}
+// reads and drops body that handler didn't read, returns false if connection failed
+// or if there is more than HTTP_SKIP_BODY_MAX of it, reading it all would block others
+static bool HTTP_Conn_SkipBody(httpConnection_t* c) {
+	http_request_t tmp;
+	int skipped = 0;
+	int len;
+
+	tmp.conn = c;
+	while (c->state != HTTP_STATE_DONE) {
+		// with Content-Length it's known upfront, chunks are counted as they come
+		if (c->state == HTTP_STATE_BODY && skipped + c->bodyLeft > HTTP_SKIP_BODY_MAX) {
+			return false;
+		}
+		if (skipped >= HTTP_SKIP_BODY_MAX) {
+			return false;
+		}
+		len = HTTP_ReadBody(&tmp, c->received, HTTP_INCOMING_BUFFER_SIZE - 2);
+		if (len < 0) {
+			return false;
+		}
+		skipped += len;
+	}
+	return true;
+}
+// processes one request of given length from start of buffer, returns 1 if reply kept connection open
+static int HTTP_Conn_ProcessRequest(httpConnection_t* c, int requestLen, int bKeepAlive) {
+	http_request_t request;
+	int lenret, bKept;
+	char saved;
+
+	saved = c->received[requestLen];
+	c->received[requestLen] = 0;
+
+	os_memset(&request, 0, sizeof(request));
+	request.fd = c->fd;
+	request.sendFn = c->send;
+	request.conn = c;
+	request.received = c->received;
+	request.receivedLen = requestLen;
+	request.receivedLenmax = HTTP_INCOMING_BUFFER_SIZE - 2;
+	request.responseCode = HTTP_RESPONSE_OK;
+	request.reply = c->reply;
+	request.replylen = 0;
+	request.replymaxlen = HTTP_REPLY_BUFFER_SIZE - 1;
+	c->reply[0] = '\0';
+	request.bKeepAlive = bKeepAlive && c->bKeepAliveAllowed && c->bCloseWhenIdle == 0
+		&& c->requests + 1 < HTTP_KEEPALIVE_MAX_REQUESTS;
+
+	if (c->requests > 0) {
+		g_stats.reusedRequests++;
+	}
+	c->requests++;
+	g_stats.requests++;
+
+	lenret = HTTP_ProcessPacket(&request);
+	// connection can stay open only if client knows where reply ends
+	bKept = request.bDelimited;
+	HTTP_FinishReply(&request, lenret);
+
+	c->received[requestLen] = saved;
+	return bKept;
+}
+int HTTP_ReadBody(http_request_t* request, char* buf, int maxLen) {
+	httpConnection_t* c = (httpConnection_t*)request->conn;
+	int got = 0;
+	int want, len;
+
+	if (c == 0) {
+		// request faked by selftest, whole body is already in bodystart
+		return 0;
+	}
+	while (got == 0) {
+		if (c->state == HTTP_STATE_DONE) {
+			return 0;
+		}
+		if (c->state == HTTP_STATE_ERROR || c->recv == 0) {
+			return -1;
+		}
+		// read only what belongs to body, so next request stays in socket
+		if (c->state == HTTP_STATE_BODY || c->state == HTTP_STATE_CHUNK_DATA) {
+			want = c->bodyLeft < maxLen ? c->bodyLeft : maxLen;
+		}
+		else {
+			want = 1;
+		}
+		len = c->recv(c->fd, buf, want, HTTP_BODY_TIMEOUT_MS);
+		if (len <= 0) {
+			c->state = HTTP_STATE_ERROR;
+			return -1;
+		}
+		HTTP_Conn_DecodeBody(c, buf, len, buf, &got);
+	}
+	return got;
+}
+// httpstats
+static commandResult_t HTTP_Conn_Stats(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "HTTP %i/s connections, %i/s requests, %i active of %i",
+		g_stats.connectionsPerSecond, g_stats.requestsPerSecond, g_stats.active, HTTP_MAX_CONNECTIONS);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "HTTP total %i connections, %i requests, %i on kept connection, %i idle timeouts, %i waited for slot",
+		g_stats.connections, g_stats.requests, g_stats.reusedRequests, g_stats.idleTimeouts, g_stats.waitedForSlot);
+	ADDLOG_INFO(LOG_FEATURE_HTTP, "HTTP %i streamed bodies, %i bad requests",
+		g_stats.streamedBodies, g_stats.badRequests);
+	return CMD_RES_OK;
+}
+void HTTP_Conn_Init() {
+	//cmddetail:{"name":"httpstats","args":"",
+	//cmddetail:"descr":"Prints HTTP server connections and requests, also per second, and how many requests reused kept-alive connection.",
+	//cmddetail:"fn":"HTTP_Conn_Stats","file":"httpserver/http_connection.c","requires":"",
+	//cmddetail:"examples":""}
+	CMD_RegisterCommand("httpstats", HTTP_Conn_Stats, NULL);
+}
+bool HTTP_Conn_HasFreeSlot() {
+	return g_stats.active < HTTP_MAX_CONNECTIONS;
+}
+httpConnection_t* HTTP_Conn_Alloc(int fd, httpSend_t send, httpRecv_t recv, int bKeepAliveAllowed) {
+	httpConnection_t* c;
+	int i;
+
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		c = &g_connections[i];
+		if (c->bUsed) {
+			continue;
+		}
+		// buffers are allocated on first use and kept
+		if (c->received == 0) {
+			c->received = (char*)os_malloc(HTTP_INCOMING_BUFFER_SIZE);
+		}
+		if (c->reply == 0) {
+			c->reply = (char*)os_malloc(HTTP_REPLY_BUFFER_SIZE);
+		}
+		if (c->received == 0 || c->reply == 0) {
+			ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP connection failed to malloc buffer");
+			return 0;
+		}
+		c->bUsed = 1;
+		c->bCloseWhenIdle = 0;
+		c->bKeepAliveAllowed = bKeepAliveAllowed;
+		c->fd = fd;
+		c->send = send;
+		c->recv = recv;
+		c->receivedLen = 0;
+		c->received[0] = 0;
+		c->idleMS = 0;
+		c->requests = 0;
+		HTTP_Conn_ResetParser(c);
+		g_stats.connections++;
+		g_stats.active++;
+		return c;
+	}
+	return 0;
+}
+void HTTP_Conn_Free(httpConnection_t* c) {
+	if (c->bUsed) {
+		c->bUsed = 0;
+		g_stats.active--;
+	}
+}
+void HTTP_Conn_CloseIdle() {
+	int i;
+
+	g_stats.waitedForSlot++;
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		g_connections[i].bCloseWhenIdle = 1;
+	}
+}
+char* HTTP_Conn_GetReceiveBuffer(httpConnection_t* c, int* maxLen) {
+	*maxLen = HTTP_INCOMING_BUFFER_SIZE - 2 - c->receivedLen;
+	return c->received + c->receivedLen;
+}
+int HTTP_Conn_OnReceived(httpConnection_t* c, int len) {
+	int requestLen, used;
+
+	c->receivedLen += len;
+	c->received[c->receivedLen] = 0;
+	c->idleMS = 0;
+	while (c->receivedLen > 0) {
+		if (HTTP_Conn_Parse(c) == 0) {
+			if (c->state == HTTP_STATE_ERROR) {
+				g_stats.badRequests++;
+				return HTTP_CONN_CLOSE;
+			}
+			if (c->receivedLen < HTTP_INCOMING_BUFFER_SIZE - 2) {
+				// wait for rest of headers or body
+				return HTTP_CONN_KEEP;
+			}
+			if (c->state == HTTP_STATE_HEADERS) {
+				// headers don't fit, handle what is there and close
+				HTTP_Conn_ProcessRequest(c, c->receivedLen, 0);
+				return HTTP_CONN_CLOSE;
+			}
+			// bigger body (like OTA) is read by handler itself with HTTP_ReadBody
+			g_stats.streamedBodies++;
+			if (HTTP_Conn_ProcessRequest(c, c->receivedLen, c->bClientKeepAlive) == 0) {
+				return HTTP_CONN_CLOSE;
+			}
+			if (HTTP_Conn_SkipBody(c) == false) {
+				return HTTP_CONN_CLOSE;
+			}
+			// body was read exactly to its end, next request is still in socket
+			c->receivedLen = 0;
+			c->received[0] = 0;
+			HTTP_Conn_ResetParser(c);
+			return HTTP_CONN_KEEP;
+		}
+		requestLen = c->headersLen + c->bodyLen;
+		used = c->parsePos;
+		if (HTTP_Conn_ProcessRequest(c, requestLen, c->bClientKeepAlive) == 0) {
+			return HTTP_CONN_CLOSE;
+		}
+		// next pipelined request may be already there
+		HTTP_Conn_Consume(c, used);
+		HTTP_Conn_ResetParser(c);
+	}
+	return HTTP_CONN_KEEP;
+}
+int HTTP_Conn_OnIdle(httpConnection_t* c, int deltaMS) {
+	c->idleMS += deltaMS;
+	if (c->bCloseWhenIdle && c->receivedLen == 0) {
+		return HTTP_CONN_CLOSE;
+	}
+	if (c->idleMS >= HTTP_KEEPALIVE_TIMEOUT_MS) {
+		g_stats.idleTimeouts++;
+		return HTTP_CONN_CLOSE;
+	}
+	return HTTP_CONN_KEEP;
+}
+void HTTP_Conn_RunEverySecond() {
+	g_stats.connectionsPerSecond = g_stats.connections - g_lastConnections;
+	g_stats.requestsPerSecond = g_stats.requests - g_lastRequests;
+	g_lastConnections = g_stats.connections;
+	g_lastRequests = g_stats.requests;
+}
+void HTTP_Conn_GetStats(httpConnStats_t* stats) {
+	*stats = g_stats;
+}
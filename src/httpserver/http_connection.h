@@ -0,0 +1,115 @@
+#ifndef __HTTP_CONNECTION_H__
+#define __HTTP_CONNECTION_H__
+
+#include "new_http.h"
+
+// Connection contexts shared by HTTP servers. There is a fixed pool of them, each one
+// keeps its buffers between requests, and a connection can stay open (keep-alive)
+// for more requests, also pipelined ones.
+// Requests are parsed as data comes, so headers and body can be split across reads.
+// Body can have Content-Length or come in chunks. Body that fits in the buffer is waited
+// for, bigger one is read by handler with HTTP_ReadBody.
+// HTTP_ReadBody blocks: while a handler reads a big body (OTA, LFS upload), other
+// connections are not served. Each wait for data is limited by HTTP_BODY_TIMEOUT_MS,
+// and a big body that handler didn't read is not drained, connection is closed instead.
+
+// how many clients can be served at once
+#ifndef HTTP_MAX_CONNECTIONS
+#define HTTP_MAX_CONNECTIONS			3
+#endif
+// keep-alive connection without new request for this long is closed
+#define HTTP_KEEPALIVE_TIMEOUT_MS		5000
+// after so many requests connection is closed, so it's not kept forever by one client
+#define HTTP_KEEPALIVE_MAX_REQUESTS		100
+#define HTTP_REPLY_BUFFER_SIZE			2048
+#define HTTP_INCOMING_BUFFER_SIZE		1024
+// how long handler waits for next part of body
+#define HTTP_BODY_TIMEOUT_MS			5000
+// body left unread by handler is skipped only up to this size, so next request on
+// kept connection can be served, bigger one closes connection
+#define HTTP_SKIP_BODY_MAX				4096
+
+typedef int (*httpSend_t)(int fd, const char* data, int len);
+// waits up to timeoutMS for data, returns number of bytes, 0 if closed, -1 on error or timeout
+typedef int (*httpRecv_t)(int fd, char* data, int maxLen, int timeoutMS);
+
+typedef enum httpParseState_e {
+	HTTP_STATE_HEADERS,
+	HTTP_STATE_BODY,
+	HTTP_STATE_CHUNK_SIZE,
+	HTTP_STATE_CHUNK_DATA,
+	HTTP_STATE_CHUNK_DATA_END,
+	HTTP_STATE_CHUNK_TRAILER,
+	HTTP_STATE_DONE,
+	HTTP_STATE_ERROR,
+} httpParseState_t;
+
+typedef struct httpConnection_s {
+	byte bUsed;
+	// set when slot is needed for new client, connection is closed when it's idle
+	byte bCloseWhenIdle;
+	// 0 for servers that can't wait for next request without blocking others
+	byte bKeepAliveAllowed;
+	// client wants connection kept
+	byte bClientKeepAlive;
+	// body comes with Transfer-Encoding: chunked
+	byte bChunkedBody;
+	byte state;
+	int fd;
+	httpSend_t send;
+	httpRecv_t recv;
+	// request being received, then data of next pipelined request
+	char* received;
+	int receivedLen;
+	// where search for end of headers goes on
+	int scanPos;
+	int headersLen;
+	// received data before this are parsed, body is moved to follow headers
+	int parsePos;
+	int bodyLen;
+	// bytes left of Content-Length or current chunk, or size of chunk being read
+	int bodyLeft;
+	int lineLen;
+	char* reply;
+	int idleMS;
+	int requests;
+} httpConnection_t;
+
+typedef struct httpConnStats_s {
+	int connections;
+	int requests;
+	// requests that came on already used connection
+	int reusedRequests;
+	// new connections that had to wait for free slot
+	int waitedForSlot;
+	int idleTimeouts;
+	// requests with body that didn't fit in buffer
+	int streamedBodies;
+	int badRequests;
+	int active;
+	int connectionsPerSecond;
+	int requestsPerSecond;
+} httpConnStats_t;
+
+enum {
+	HTTP_CONN_KEEP,
+	HTTP_CONN_CLOSE,
+};
+
+void HTTP_Conn_Init();
+// returns 0 if all slots are used
+httpConnection_t* HTTP_Conn_Alloc(int fd, httpSend_t send, httpRecv_t recv, int bKeepAliveAllowed);
+bool HTTP_Conn_HasFreeSlot();
+void HTTP_Conn_Free(httpConnection_t* c);
+// asks idle keep-alive connections to close, so new client can get their slot
+void HTTP_Conn_CloseIdle();
+// where to put next received data and how much fits
+char* HTTP_Conn_GetReceiveBuffer(httpConnection_t* c, int* maxLen);
+// call after len bytes were received into buffer, processes all complete requests
+int HTTP_Conn_OnReceived(httpConnection_t* c, int len);
+// call when nothing was received for deltaMS
+int HTTP_Conn_OnIdle(httpConnection_t* c, int deltaMS);
+void HTTP_Conn_RunEverySecond();
+void HTTP_Conn_GetStats(httpConnStats_t* stats);
+
+#endif
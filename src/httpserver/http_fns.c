@@ -848,8 +848,21 @@ int http_fn_index(http_request_t* request) {
 		hprintf255(request, "<h5>MQTT State: <span style=\"color:%s\">%s</span> RES: %d(%s)<br>", colorStr,
 			stateStr, MQTT_GetConnectResult(), get_error_name(MQTT_GetConnectResult()));
 		hprintf255(request, "MQTT ErrMsg: %s <br>", (MQTT_GetStatusMessage() != NULL) ? MQTT_GetStatusMessage() : "");
-		hprintf255(request, "MQTT Stats:CONN: %d PUB: %d RECV: %d ERR: %d </h5>", MQTT_GetConnectEvents(),
+		hprintf255(request, "MQTT Stats:CONN: %d PUB: %d RECV: %d ERR: %d ", MQTT_GetConnectEvents(),
 			MQTT_GetPublishEventCounter(), MQTT_GetReceivedEventCounter(), MQTT_GetPublishErrorCounter());
+		hprintf255(request, "RX DROP: %d RX PEAK: %d/%d ", MQTT_GetRxDropCounter(),
+			MQTT_GetRxHighWatermark(), MQTT_GetRxBufferSize());
+		hprintf255(request, "IN FLIGHT: %d PEAK: %d ", MQTT_GetInFlightCounter(), MQTT_GetInFlightPeak());
+		hprintf255(request, "BATCH: %d queued, last flush %d items/%d bytes, %d flushes, %d coalesced</h5>",
+			MQTT_GetBatchQueuedCount(), MQTT_GetBatchLastFlushItems(), MQTT_GetBatchLastFlushBytes(),
+			MQTT_GetBatchFlushCounter(), MQTT_GetBatchCoalescedCounter());
+		hprintf255(request, "<h5>MQTT Queue: %d items, %d/%d bytes, peak %d, dropped %d ",
+			MQTT_GetQueuedCount(), MQTT_GetQueueUsedBytes(), MQTT_GetQueueSize(),
+			MQTT_GetQueuePeakBytes(), MQTT_GetQueueDropCounter());
+		hprintf255(request, "BROADCAST: saved %d publishes/hour, %d total ",
+			MQTT_GetBroadcastSavedPerHour(), MQTT_GetBroadcastSavedCounter());
+		hprintf255(request, "SUB: %d packets, first publish %d ms after WiFi</h5>",
+			MQTT_GetSubscribePacketsCounter(), MQTT_GetWiFiToFirstPublishMS());
 	}
 	/* Format current PINS input state for all unused pins */
 	if (CFG_HasFlag(OBK_FLAG_HTTP_PINMONITOR))
@@ -1577,7 +1590,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 				else {
 					dev_info = hass_init_relay_device_info(i, RELAY);
 				}
-				MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+				MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 				hass_free_device_info(dev_info);
 				dev_info = NULL;
 				discoveryQueued = true;
@@ -1589,7 +1602,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 		for (i = 0; i < CHANNEL_MAX; i++) {
 			if (h_isChannelDigitalInput(i)) {
 				dev_info = hass_init_binary_sensor_device_info(i);
-				MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+				MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 				hass_free_device_info(dev_info);
 				dev_info = NULL;
 				discoveryQueued = true;
@@ -1602,7 +1615,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 			dev_info = hass_init_light_device_info(LIGHT_RGBCW);
 		}
 		// Enable + RGB control + CW control
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 		hass_free_device_info(dev_info);
 		dev_info = NULL;
 		discoveryQueued = true;
@@ -1624,7 +1637,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 		}
 
 		if (dev_info != NULL) {
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 			hass_free_device_info(dev_info);
 			dev_info = NULL;
 			discoveryQueued = true;
@@ -1636,7 +1649,7 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 		for (i = 0; i < OBK_NUM_SENSOR_COUNT; i++)
 		{
 			dev_info = hass_init_power_sensor_device_info(i);
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 			hass_free_device_info(dev_info);
 			discoveryQueued = true;
 		}
@@ -1645,11 +1658,11 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 
 	if (measuringBattery == true) {
 		dev_info = hass_init_sensor_device_info(BATTERY_SENSOR, 0);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 		hass_free_device_info(dev_info);
 
 		dev_info = hass_init_sensor_device_info(BATTERY_VOLTAGE_SENSOR, 0);
-		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+		MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 		hass_free_device_info(dev_info);
 
 		discoveryQueued = true;
@@ -1658,11 +1671,11 @@ void doHomeAssistantDiscovery(const char* topic, http_request_t* request) {
 	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
 		if (IS_PIN_DHT_ROLE(g_cfg.pins.roles[i]) || IS_PIN_TEMP_HUM_SENSOR_ROLE(g_cfg.pins.roles[i])) {
 			dev_info = hass_init_sensor_device_info(TEMPERATURE_SENSOR, PIN_GetPinChannelForPinIndex(i));
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 			hass_free_device_info(dev_info);
 
 			dev_info = hass_init_sensor_device_info(HUMIDITY_SENSOR, PIN_GetPinChannel2ForPinIndex(i));
-			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN);
+			MQTT_QueuePublish(topic, dev_info->channel, hass_build_discovery_json(dev_info), OBK_PUBLISH_FLAG_RETAIN | OBK_PUBLISH_FLAG_DISCOVERY);
 			hass_free_device_info(dev_info);
 
 			discoveryQueued = true;
@@ -1908,7 +1921,7 @@ int http_fn_ha_cfg(http_request_t* request) {
 	poststr(request, "<br/><div><label for=\"ha_disc_topic\">Discovery topic:</label><input id=\"ha_disc_topic\" value=\"homeassistant\"><button onclick=\"send_ha_disc();\">Start Home Assistant Discovery</button>&nbsp;<form action=\"cfg_mqtt\" class='disp-inline'><button type=\"submit\">Configure MQTT</button></form></div><br/>");
 	poststr(request, htmlFooterReturnToCfgLink);
 	http_html_end(request);
-	poststr(request, ha_discovery_script);
+	hprintf255(request, "<script src=\"/ha_discovery.js?v=%s\"></script>", ha_discovery_script_etag);
 	poststr(request, NULL);
 	return 0;
 }
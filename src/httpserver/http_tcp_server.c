@@ -1,14 +1,25 @@
-
 #include "../new_common.h"
 #include "lwip/sockets.h"
 #include "lwip/ip_addr.h"
 #include "lwip/inet.h"
 #include "../logging/logging.h"
 #include "new_http.h"
+#include "http_connection.h"
+#include "http_tcp_server.h"
+#ifdef WINDOWS
+#include <timeapi.h>
+#endif
+
+// One server for all platforms. Listening socket and all clients are watched by
+// single select(), so one task serves all connections, each one is a state machine
+// in http_connection.c that parses request as data comes. Memory is bounded by
+// HTTP_MAX_CONNECTIONS preallocated contexts.
+// Devices run it in its own task, simulator calls it from quick tick.
 
-#define HTTP_SERVER_PORT            80
-#define REPLY_BUFFER_SIZE			2048
-#define INCOMING_BUFFER_SIZE		1024
+// how long one poll waits for data on devices
+#define HTTP_POLL_MS				100
+// how long reply send may wait for client to read
+#define HTTP_SEND_TIMEOUT_MS		1000
 
 
 // it was 0x800 - 2048 - until 23 10 2022
@@ -22,38 +33,22 @@
 #define HTTP_CLIENT_STACK_SIZE 2048
 #endif
 
-#define CREATE_THREAD_PER_EACH_HTTP_CLIENT
-
-#ifdef CREATE_THREAD_PER_EACH_HTTP_CLIENT
-
-
-#if PLATFORM_XR809
-
-#define DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT 1
-
+#ifdef WINDOWS
+#define HTTP_CloseSocket(fd)	closesocket((SOCKET)(fd))
+#define HTTP_GetTimeMS()		((int)timeGetTime())
+#else
+#define HTTP_CloseSocket(fd)	lwip_close(fd)
+#define HTTP_GetTimeMS()		((int)(xTaskGetTickCount() * portTICK_PERIOD_MS))
+xTaskHandle g_http_thread = NULL;
 #endif
 
-static void tcp_server_thread(beken_thread_arg_t arg);
-static void tcp_client_thread(beken_thread_arg_t arg);
-
-
-xTaskHandle g_http_thread = NULL;
-
-void HTTPServer_Start()
-{
-	OSStatus err = kNoErr;
-
-	err = rtos_create_thread(&g_http_thread, BEKEN_APPLICATION_PRIORITY,
-		"TCP_server",
-		(beken_thread_function_t)tcp_server_thread,
-		0x800,
-		(beken_thread_arg_t)0);
-	if (err != kNoErr)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "create \"TCP_server\" thread failed with %i!\r\n", err);
-	}
-}
+int g_port = 80;
 
+static int g_listenSocket = -1;
+static httpConnection_t* g_clients[HTTP_MAX_CONNECTIONS];
+static int g_lastPollTime = 0;
+// set when a client is waiting in backlog for a free slot, cleared when it gets accepted
+static int g_clientWaitsForSlot = 0;
 
 int sendfn(int fd, char* data, int len) {
 	if (fd) {
@@ -62,277 +57,219 @@ int sendfn(int fd, char* data, int len) {
 	return -1;
 }
 
-static void tcp_client_thread(beken_thread_arg_t arg)
-{
-	OSStatus err = kNoErr;
-	int fd = (int)arg;
-	//fd_set readfds, errfds, readfds2;
-	char* buf = NULL;
-	char* reply = NULL;
-	int replyBufferSize = REPLY_BUFFER_SIZE;
-	//int res;
-	//char reply[8192];
-
-  //my_fd = fd;
-	rtos_delay_milliseconds(20);
-
-	reply = (char*)os_malloc(replyBufferSize);
-	buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
-
-	if (buf == 0 || reply == 0)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client failed to malloc buffer");
-		goto exit;
+// waits until socket is readable or writable, returns 0 on timeout
+static int HTTPServer_Wait(int fd, int bWrite, int timeoutMS) {
+	fd_set fds;
+	struct timeval tv;
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	tv.tv_sec = timeoutMS / 1000;
+	tv.tv_usec = (timeoutMS % 1000) * 1000;
+	if (bWrite) {
+		return select(fd + 1, NULL, &fds, NULL, &tv);
 	}
-	http_request_t request;
-	os_memset(&request, 0, sizeof(request));
-
-	request.fd = fd;
-	request.received = buf;
-	request.receivedLenmax = INCOMING_BUFFER_SIZE - 2;
-	request.responseCode = HTTP_RESPONSE_OK;
-	request.receivedLen = recv(fd, request.received, request.receivedLenmax, 0);
-	request.received[request.receivedLen] = 0;
-
-	request.reply = reply;
-	request.replylen = 0;
-	reply[0] = '\0';
-
-	request.replymaxlen = replyBufferSize - 1;
-
-	if (request.receivedLen <= 0)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
-		goto exit;
+	return select(fd + 1, &fds, NULL, NULL, &tv);
+}
+static int HTTPServer_Send(int fd, const char* data, int len) {
+	int sent = 0;
+	int res;
+
+	while (sent < len) {
+		if (HTTPServer_Wait(fd, 1, HTTP_SEND_TIMEOUT_MS) <= 0) {
+			ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP send to %i timed out", fd);
+			return -1;
+		}
+		res = send(fd, data + sent, len - sent, 0);
+		if (res <= 0) {
+			return -1;
+		}
+		sent += res;
 	}
-
-	//addLog( "TCP received string %s\n",buf );
-	// returns length to be sent if any
-	 // ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP will process packet of len %i\n", request.receivedLen );
-	int lenret = HTTP_ProcessPacket(&request);
-	if (lenret > 0) {
-		ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP sending reply len %i\n", lenret);
-		send(fd, reply, lenret, 0);
+	return sent;
+}
+// used by handlers reading body that didn't fit in buffer, like OTA
+static int HTTPServer_Recv(int fd, char* data, int maxLen, int timeoutMS) {
+	if (HTTPServer_Wait(fd, 0, timeoutMS) <= 0) {
+		return -1;
 	}
-
-	//rtos_delay_milliseconds(10);
-
-exit:
-	if (err != kNoErr)
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP client thread exit with err: %d", err);
-
-	if (buf != NULL)
-		os_free(buf);
-	if (reply != NULL)
-		os_free(reply);
-
-	lwip_close(fd);;
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
-
-#else
-	rtos_delete_thread(NULL);
-#endif
+	return recv(fd, data, maxLen, 0);
 }
+static void HTTPServer_CloseClient(int i) {
+	HTTP_CloseSocket(g_clients[i]->fd);
+	HTTP_Conn_Free(g_clients[i]);
+	g_clients[i] = 0;
+}
+static int HTTPServer_FindFreeSlot() {
+	int i;
 
-/* TCP server listener thread */
-static void tcp_server_thread(beken_thread_arg_t arg)
-{
-	(void)(arg);
-	OSStatus err = kNoErr;
-	struct sockaddr_in server_addr, client_addr;
-	socklen_t sockaddr_t_size = sizeof(client_addr);
-	char client_ip_str[16];
-	int tcp_listen_fd = -1, client_fd = -1;
-	fd_set readfds;
-
-	tcp_listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-
-	server_addr.sin_family = AF_INET;
-	server_addr.sin_addr.s_addr = INADDR_ANY;/* Accept conenction request on all network interface */
-	server_addr.sin_port = htons(HTTP_SERVER_PORT);/* Server listen on port: 20000 */
-	err = bind(tcp_listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-
-	err = listen(tcp_listen_fd, 0);
-
-	while (1)
-	{
-		FD_ZERO(&readfds);
-		FD_SET(tcp_listen_fd, &readfds);
-
-		select(tcp_listen_fd + 1, &readfds, NULL, NULL, NULL);
-
-		if (FD_ISSET(tcp_listen_fd, &readfds))
-		{
-			client_fd = accept(tcp_listen_fd, (struct sockaddr*)&client_addr, &sockaddr_t_size);
-			if (client_fd >= 0)
-			{
-#if PLATFORM_XR809
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
-
-#else
-				OS_Thread_t clientThreadUnused;
-#endif
-#endif
-				os_strcpy(client_ip_str, inet_ntoa(client_addr.sin_addr));
-				//  ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd );
-#if DISABLE_SEPARATE_THREAD_FOR_EACH_TCP_CLIENT
-				// Use main server thread (blocking all other clients)
-				// right now, I am getting OS_ThreadCreate everytime on XR809 platform
-				tcp_client_thread((beken_thread_arg_t)client_fd);
-#else
-				// delay each accept by 20ms
-				// this allows previous to finish if
-				// in a loop of sends from the browser, e.g. OTA
-				// and we MUST get some IDLE thread time, else
-				// thread resources are not deleted.
-				rtos_delay_milliseconds(20);
-				// Create separate thread for client
-				if (kNoErr !=
-#if PLATFORM_XR809
-					OS_ThreadCreate(&clientThreadUnused,
-						"HTTP Client",
-						tcp_client_thread,
-						client_fd,
-						OS_THREAD_PRIO_CONSOLE,
-						0x400)
-
-#else
-					rtos_create_thread(NULL, BEKEN_APPLICATION_PRIORITY,
-						"HTTP Client",
-						(beken_thread_function_t)tcp_client_thread,
-						HTTP_CLIENT_STACK_SIZE,
-						(beken_thread_arg_t)client_fd)
-
-#endif
-					)
-				{
-					ADDLOG_DEBUG(LOG_FEATURE_HTTP, "TCP Client %s:%d thread creation failed! fd: %d", client_ip_str, client_addr.sin_port, client_fd);
-					lwip_close(client_fd);
-					client_fd = -1;
-				}
-#endif
-			}
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		if (g_clients[i] == 0) {
+			return i;
 		}
 	}
-
-	if (err != kNoErr)
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "Server listerner thread exit with err: %d", err);
-
-	lwip_close(tcp_listen_fd);
-
-	rtos_delete_thread(NULL);
-
+	return -1;
 }
+static void HTTPServer_AcceptClient(int i) {
+	struct sockaddr_in client_addr;
+	socklen_t sockaddr_t_size = sizeof(client_addr);
+	httpConnection_t* c;
+	int client_fd, opt;
 
-#else
-
-
-xTaskHandle g_http_thread = NULL;
-
-int sendfn(int fd, char* data, int len) {
-	if (fd) {
-		return send(fd, data, len, 0);
+	client_fd = accept(g_listenSocket, (struct sockaddr*)&client_addr, &sockaddr_t_size);
+	if (client_fd < 0) {
+		return;
 	}
-	return -1;
+	// reply goes in few small sends, on kept connection Nagle would hold them until client ACKs
+	opt = 1;
+	setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (const char*)&opt, sizeof(opt));
+	c = HTTP_Conn_Alloc(client_fd, HTTPServer_Send, HTTPServer_Recv, 1);
+	if (c == 0) {
+		HTTP_CloseSocket(client_fd);
+		return;
+	}
+	g_clients[i] = c;
 }
-
-static void tcp_client_thread(int fd, char* buf, char* reply)
-{
-	//OSStatus err = kNoErr;
-
-	http_request_t request;
-	os_memset(&request, 0, sizeof(request));
-
-	request.fd = fd;
-	request.received = buf;
-	request.receivedLenmax = INCOMING_BUFFER_SIZE - 1;
-	request.responseCode = HTTP_RESPONSE_OK;
-	request.receivedLen = recv(fd, request.received, request.receivedLenmax, 0);
-	request.received[request.receivedLen] = 0;
-
-	request.reply = reply;
-	request.replylen = 0;
-	reply[0] = '\0';
-
-	request.replymaxlen = REPLY_BUFFER_SIZE - 1;
-
-	if (request.receivedLen <= 0)
-	{
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "TCP Client is disconnected, fd: %d", fd);
+static void HTTPServer_ReceiveFrom(int i) {
+	httpConnection_t* c = g_clients[i];
+	char* buf;
+	int maxLen, len;
+
+	buf = HTTP_Conn_GetReceiveBuffer(c, &maxLen);
+	len = recv(c->fd, buf, maxLen, 0);
+	if (len <= 0) {
+		// closed by client
+		HTTPServer_CloseClient(i);
 		return;
 	}
-	int lenret = HTTP_ProcessPacket(&request);
-	if (lenret > 0) {
-		send(fd, reply, lenret, 0);
+	if (HTTP_Conn_OnReceived(c, len) == HTTP_CONN_CLOSE) {
+		HTTPServer_CloseClient(i);
 	}
-	rtos_delay_milliseconds(10);
-
 }
-
-/* TCP server listener thread */
-static void tcp_server_thread(beken_thread_arg_t arg)
-{
-	(void)(arg);
-	OSStatus err = kNoErr;
-	struct sockaddr_in server_addr, client_addr;
-	socklen_t sockaddr_t_size = sizeof(client_addr);
-	char client_ip_str[16];
-	int tcp_listen_fd = -1, client_fd = -1;
+// waits up to timeoutMS for anything to happen, then serves it
+void HTTPServer_Poll(int timeoutMS) {
 	fd_set readfds;
-	char* buf = NULL;
-	char* reply = NULL;
+	struct timeval tv;
+	int i, maxfd, res, now, deltaMS, freeSlot;
 
-	tcp_listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (g_listenSocket < 0) {
+		return;
+	}
+	freeSlot = HTTPServer_FindFreeSlot();
+	FD_ZERO(&readfds);
+	maxfd = -1;
+	// with all slots used, listening socket stays readable until one frees,
+	// so only watch it until first waiting client is seen
+	if (freeSlot >= 0 || g_clientWaitsForSlot == 0) {
+		FD_SET(g_listenSocket, &readfds);
+		maxfd = g_listenSocket;
+	}
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		if (g_clients[i]) {
+			FD_SET(g_clients[i]->fd, &readfds);
+			if (g_clients[i]->fd > maxfd) {
+				maxfd = g_clients[i]->fd;
+			}
+		}
+	}
+	tv.tv_sec = timeoutMS / 1000;
+	tv.tv_usec = (timeoutMS % 1000) * 1000;
+	res = select(maxfd + 1, &readfds, NULL, NULL, &tv);
+
+	now = HTTP_GetTimeMS();
+	deltaMS = g_lastPollTime ? now - g_lastPollTime : 0;
+	g_lastPollTime = now;
+	if (res < 0) {
+		return;
+	}
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		if (g_clients[i] == 0) {
+			continue;
+		}
+		if (FD_ISSET(g_clients[i]->fd, &readfds)) {
+			HTTPServer_ReceiveFrom(i);
+		}
+		else if (HTTP_Conn_OnIdle(g_clients[i], deltaMS) == HTTP_CONN_CLOSE) {
+			HTTPServer_CloseClient(i);
+		}
+	}
+	if (FD_ISSET(g_listenSocket, &readfds)) {
+		if (freeSlot >= 0) {
+			g_clientWaitsForSlot = 0;
+			HTTPServer_AcceptClient(freeSlot);
+		}
+		else {
+			// ask idle connections to close, client waits in backlog until they do
+			g_clientWaitsForSlot = 1;
+			HTTP_Conn_CloseIdle();
+		}
+	}
+}
+static int HTTPServer_Listen() {
+	struct sockaddr_in server_addr;
+	int fd, opt;
+
+	fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (fd < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP server socket failed");
+		return -1;
+	}
+	// simulator restarts server, port must be free again at once
+	opt = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
 
+	memset(&server_addr, 0, sizeof(server_addr));
 	server_addr.sin_family = AF_INET;
 	server_addr.sin_addr.s_addr = INADDR_ANY;/* Accept conenction request on all network interface */
-	server_addr.sin_port = htons(HTTP_SERVER_PORT);/* Server listen on port: 20000 */
-	err = bind(tcp_listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-
-	err = listen(tcp_listen_fd, 0);
-
-	reply = (char*)os_malloc(REPLY_BUFFER_SIZE);
-	buf = (char*)os_malloc(INCOMING_BUFFER_SIZE);
-
-	while (1)
-	{
-		FD_ZERO(&readfds);
-		FD_SET(tcp_listen_fd, &readfds);
-
-		select(tcp_listen_fd + 1, &readfds, NULL, NULL, NULL);
-
-		if (FD_ISSET(tcp_listen_fd, &readfds))
-		{
-			client_fd = accept(tcp_listen_fd, (struct sockaddr*)&client_addr, &sockaddr_t_size);
-			if (client_fd >= 0)
-			{
-				os_strcpy(client_ip_str, inet_ntoa(client_addr.sin_addr));
-				//  ADDLOG_DEBUG(LOG_FEATURE_HTTP,  "TCP Client %s:%d connected, fd: %d", client_ip_str, client_addr.sin_port, client_fd );
+	server_addr.sin_port = htons(g_port);
+	if (bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0
+		|| listen(fd, HTTP_MAX_CONNECTIONS) < 0) {
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP server failed to listen on port %i", g_port);
+		HTTP_CloseSocket(fd);
+		return -1;
+	}
+	return fd;
+}
 
-				tcp_client_thread(client_fd, reply, buf);
+#ifdef WINDOWS
 
-				lwip_close(client_fd);
-			}
-		}
+void HTTPServer_RunQuickTick() {
+	HTTPServer_Poll(0);
+}
+void HTTPServer_Start() {
+	HTTP_InitRoutes();
+	HTTP_Conn_Init();
+	if (g_listenSocket >= 0) {
+		HTTP_CloseSocket(g_listenSocket);
 	}
+	g_listenSocket = HTTPServer_Listen();
+}
 
-	if (err != kNoErr)
-		ADDLOG_ERROR(LOG_FEATURE_HTTP, "Server listerner thread exit with err: %d", err);
+#else
 
-	lwip_close(tcp_listen_fd);
+static void tcp_server_thread(beken_thread_arg_t arg)
+{
+	(void)(arg);
 
+	g_listenSocket = HTTPServer_Listen();
+	while (g_listenSocket >= 0)
+	{
+		HTTPServer_Poll(HTTP_POLL_MS);
+	}
 	rtos_delete_thread(NULL);
-
 }
 
 void HTTPServer_Start()
 {
 	OSStatus err = kNoErr;
 
+	HTTP_InitRoutes();
+	HTTP_Conn_Init();
+	// requests are handled in this thread, so it needs stack for commands
 	err = rtos_create_thread(&g_http_thread, BEKEN_APPLICATION_PRIORITY,
 		"TCP_server",
 		(beken_thread_function_t)tcp_server_thread,
-		0x800,
+		HTTP_CLIENT_STACK_SIZE,
 		(beken_thread_arg_t)0);
 	if (err != kNoErr)
 	{
@@ -340,6 +277,4 @@ void HTTPServer_Start()
 	}
 }
 
-
 #endif
-
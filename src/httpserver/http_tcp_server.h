@@ -1,2 +1,6 @@
-
 void HTTPServer_Start();
+// serves all clients, waits up to timeoutMS for something to happen
+void HTTPServer_Poll(int timeoutMS);
+#ifdef WINDOWS
+void HTTPServer_RunQuickTick();
+#endif
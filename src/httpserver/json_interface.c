@@ -21,24 +21,131 @@
 #include "../driver/drv_local.h"
 #include "../driver/drv_bl_shared.h"
 
-void JSON_PrintKeyValue_String(void* request, jsonCb_t printer, const char *key, const char *value, bool bComma) {
-	printer(request, "\"%s\":\"%s\"", key, value);
-	if (bComma) {
-		printer(request, ",");
+// Streaming JSON writer.
+// Text goes straight into HTTP reply buffer or MQTT reply buffer, so constant parts
+// and numbers don't have to pass through vsnprintf and a 256 byte stack copy.
+// Any other printer still gets the text through its format string.
+void JSON_Write(void* request, jsonCb_t printer, const char *s, int len) {
+	if (printer == (jsonCb_t)hprintf255) {
+		postany((http_request_t*)request, s, len);
+	}
+	else if (printer == (jsonCb_t)mqtt_printf255) {
+		MQTT_Printer_Append((obk_mqtt_publishReplyPrinter_t*)request, s, len);
+	}
+	else {
+		// printers format into 256 byte buffer, so long text goes in parts
+		while (len > 0) {
+			int part = len > 200 ? 200 : len;
+			printer(request, "%.*s", part, s);
+			s += part;
+			len -= part;
+		}
 	}
 }
+void JSON_WriteStr(void* request, jsonCb_t printer, const char *s) {
+	JSON_Write(request, printer, s, strlen(s));
+}
+// same as "%i", returns length
+int JSON_FormatInt(char *out, int value) {
+	char tmp[12];
+	unsigned int u;
+	int n, len;
+
+	len = 0;
+	if (value < 0) {
+		out[len++] = '-';
+		u = 0u - (unsigned int)value;
+	}
+	else {
+		u = value;
+	}
+	n = 0;
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	while (n) {
+		out[len++] = tmp[--n];
+	}
+	out[len] = 0;
+	return len;
+}
+// same as "%f", returns length, out must hold 48 chars
+int JSON_FormatFloat(char *out, float value) {
+	double d;
+	unsigned long long whole;
+	unsigned int ip, fp;
+	double rest;
+	int len, i;
+
+	d = value;
+	// NaN, inf and big values are left to sprintf
+	if (!(d > -1e9 && d < 1e9)) {
+		return sprintf(out, "%f", d);
+	}
+	len = 0;
+	if (d < 0 || (d == 0 && 1.0 / d < 0)) {
+		out[len++] = '-';
+		d = -d;
+	}
+	// float times 10^6 is exact in double, so this rounds like printf, half to even
+	d *= 1000000.0;
+	whole = (unsigned long long)d;
+	rest = d - (double)whole;
+	if (rest > 0.5 || (rest == 0.5 && (whole & 1))) {
+		whole++;
+	}
+	ip = (unsigned int)(whole / 1000000);
+	fp = (unsigned int)(whole % 1000000);
+	len += JSON_FormatInt(out + len, ip);
+	out[len++] = '.';
+	for (i = 5; i >= 0; i--) {
+		out[len + i] = '0' + fp % 10;
+		fp /= 10;
+	}
+	len += 6;
+	out[len] = 0;
+	return len;
+}
+void JSON_WriteInt(void* request, jsonCb_t printer, int value) {
+	char tmp[12];
+	JSON_Write(request, printer, tmp, JSON_FormatInt(tmp, value));
+}
+void JSON_WriteFloat(void* request, jsonCb_t printer, float value) {
+	char tmp[48];
+	JSON_Write(request, printer, tmp, JSON_FormatFloat(tmp, value));
+}
+static void JSON_WriteKey(void* request, jsonCb_t printer, const char *key) {
+	JSON_WriteLiteral(request, printer, "\"");
+	JSON_WriteStr(request, printer, key);
+	JSON_WriteLiteral(request, printer, "\":");
+}
+void JSON_PrintKeyValue_String(void* request, jsonCb_t printer, const char *key, const char *value, bool bComma) {
+	JSON_WriteKey(request, printer, key);
+	JSON_WriteLiteral(request, printer, "\"");
+	JSON_WriteStr(request, printer, value);
+	JSON_Write(request, printer, "\",", bComma ? 2 : 1);
+}
 void JSON_PrintKeyValue_Int(void* request, jsonCb_t printer, const char *key, int value, bool bComma) {
-	printer(request, "\"%s\":%i", key, value);
+	JSON_WriteKey(request, printer, key);
+	JSON_WriteInt(request, printer, value);
 	if (bComma) {
-		printer(request, ",");
+		JSON_WriteLiteral(request, printer, ",");
 	}
 }
 void JSON_PrintKeyValue_Float(void* request, jsonCb_t printer, const char *key, float value, bool bComma) {
-	printer(request, "\"%s\":%f", key, value);
+	JSON_WriteKey(request, printer, key);
+	JSON_WriteFloat(request, printer, value);
 	if (bComma) {
-		printer(request, ",");
+		JSON_WriteLiteral(request, printer, ",");
 	}
 }
+// "before" value "after", for keys that are formatted differently from JSON_PrintKeyValue_Float
+static void JSON_WriteFloatBetween(void* request, jsonCb_t printer, const char *before, float value, const char *after) {
+	JSON_WriteStr(request, printer, before);
+	JSON_WriteFloat(request, printer, value);
+	JSON_WriteStr(request, printer, after);
+}
 
 static int http_tasmota_json_Dimmer(void* request, jsonCb_t printer) {
 	int dimmer;
@@ -88,7 +195,7 @@ static int http_tasmota_json_power(void* request, jsonCb_t printer) {
 	// LED driver (if has PWMs)
 	if (LED_IsLEDRunning()) {
 		http_tasmota_json_Dimmer(request, printer);
-		printer(request, ",");
+		JSON_WriteLiteral(request, printer, ",");
 		// Temperature 
 		JSON_PrintKeyValue_String(request, printer, "Fade", "OFF", true);
 		JSON_PrintKeyValue_Int(request, printer, "Speed", 1, true);
@@ -125,12 +232,18 @@ static int http_tasmota_json_power(void* request, jsonCb_t printer) {
 			JSON_PrintKeyValue_String(request, printer, "Color", buff32, true);
 			sprintf(buff32, "%i,%i,%i", (int)hsv[0], (int)hsv[1], (int)hsv[2]);
 			JSON_PrintKeyValue_String(request, printer, "HSBColor", buff32, true);
-			printer(request, "\"Channel\":[%i,%i,%i],", (int)channels[0], (int)channels[1], (int)channels[2]);
+			JSON_WriteLiteral(request, printer, "\"Channel\":[");
+			JSON_WriteInt(request, printer, channels[0]);
+			JSON_WriteLiteral(request, printer, ",");
+			JSON_WriteInt(request, printer, channels[1]);
+			JSON_WriteLiteral(request, printer, ",");
+			JSON_WriteInt(request, printer, channels[2]);
+			JSON_WriteLiteral(request, printer, "],");
 
 		}
 		if (LED_IsLedDriverChipRunning() || numPWMs == 5 || numPWMs == 2) {
 			http_tasmota_json_CT(request, printer);
-			printer(request, ",");
+			JSON_WriteLiteral(request, printer, ",");
 		}
 		if (LED_GetEnableAll() == 0) {
 			JSON_PrintKeyValue_String(request, printer, "POWER", "OFF", false);
@@ -172,7 +285,7 @@ static int http_tasmota_json_power(void* request, jsonCb_t printer) {
 					}
 					lastRelayState = CHANNEL_Get(i);
 					if (c_posted) {
-						printer(request, ",");
+						JSON_WriteLiteral(request, printer, ",");
 					}
 					sprintf(buff32, "POWER%i", indexStartingFrom1);
 					if (lastRelayState) {
@@ -209,11 +322,11 @@ static int http_tasmota_json_ENERGY(void* request, jsonCb_t printer) {
 		voltage = Battery_lastreading(OBK_BATT_VOLTAGE) / 1000.00;
 		batterypercentage = Battery_lastreading(OBK_BATT_LEVEL);
 #endif
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		printer(request, "\"Voltage\":%.4f,", voltage);
 		printer(request, "\"Batterypercentage\":%.0f", batterypercentage);
 		// close ENERGY block
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else {
 		// following check will clear NaN values
@@ -224,17 +337,17 @@ static int http_tasmota_json_ENERGY(void* request, jsonCb_t printer) {
 			energy_hour = 0;
 		}
 
-		printer(request, "{");
-		printer(request, "\"Power\": %f,", power);
-		printer(request, "\"ApparentPower\": %f,", g_apparentPower);
-		printer(request, "\"ReactivePower\": %f,", g_reactivePower);
-		printer(request, "\"Factor\":%f,", g_powerFactor);
-		printer(request, "\"Voltage\":%f,", voltage);
-		printer(request, "\"Current\":%f,", current);
-		printer(request, "\"ConsumptionTotal\":%f,", energy);
-		printer(request, "\"ConsumptionLastHour\":%f", energy_hour);
+		JSON_WriteLiteral(request, printer, "{");
+		JSON_WriteFloatBetween(request, printer, "\"Power\": ", power, ",");
+		JSON_WriteFloatBetween(request, printer, "\"ApparentPower\": ", g_apparentPower, ",");
+		JSON_WriteFloatBetween(request, printer, "\"ReactivePower\": ", g_reactivePower, ",");
+		JSON_PrintKeyValue_Float(request, printer, "Factor", g_powerFactor, true);
+		JSON_PrintKeyValue_Float(request, printer, "Voltage", voltage, true);
+		JSON_PrintKeyValue_Float(request, printer, "Current", current, true);
+		JSON_PrintKeyValue_Float(request, printer, "ConsumptionTotal", energy, true);
+		JSON_PrintKeyValue_Float(request, printer, "ConsumptionLastHour", energy_hour, false);
 		// close ENERGY block
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	return 0;
 }
@@ -262,7 +375,7 @@ static int http_tasmota_json_ENERGY(void* request, jsonCb_t printer) {
 static int http_tasmota_json_SENSOR(void* request, jsonCb_t printer) {
 	float temperature, humidity;
 	int channel_1, channel_2, g_pin_1 = 0;
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 	if (DRV_IsRunning("SHT3X")) {
 		g_pin_1 = PIN_FindPinIndexForRole(IOR_SHT3X_DAT, g_pin_1);
 		channel_1 = g_cfg.pins.channels[g_pin_1];
@@ -272,13 +385,13 @@ static int http_tasmota_json_SENSOR(void* request, jsonCb_t printer) {
 		humidity = CHANNEL_GetFloat(channel_2);
 
 		// writer header
-		printer(request, "\"SHT3X\":");
+		JSON_WriteLiteral(request, printer, "\"SHT3X\":");
 		// following check will clear NaN values
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		printer(request, "\"Temperature\": %.1f,", temperature);
 		printer(request, "\"Humidity\": %.0f", humidity);
 		// close ENERGY block
-		printer(request, "},");
+		JSON_WriteLiteral(request, printer, "},");
 	}
 	if (DRV_IsRunning("CHT8305")) {
 		g_pin_1 = PIN_FindPinIndexForRole(IOR_CHT8305_DAT, g_pin_1);
@@ -289,13 +402,13 @@ static int http_tasmota_json_SENSOR(void* request, jsonCb_t printer) {
 		humidity = CHANNEL_GetFloat(channel_2);
 
 		// writer header
-		printer(request, "\"CHT8305\":");
+		JSON_WriteLiteral(request, printer, "\"CHT8305\":");
 		// following check will clear NaN values
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		printer(request, "\"Temperature\": %.1f,", temperature);
 		printer(request, "\"Humidity\": %.0f", humidity);
 		// close ENERGY block
-		printer(request, "},");
+		JSON_WriteLiteral(request, printer, "},");
 	}
 	return 0;
 }
@@ -308,9 +421,9 @@ static int http_tasmota_json_status_SNS(void* request, jsonCb_t printer, bool bA
 	char buff[20];
 
 	if (bAppendHeader) {
-		printer(request, "\"StatusSNS\":");
+		JSON_WriteLiteral(request, printer, "\"StatusSNS\":");
 	}
-	printer(request, "{");
+	JSON_WriteLiteral(request, printer, "{");
 
 	time_t localTime = (time_t)NTP_GetCurrentTime();
 	strftime(buff, sizeof(buff), "%Y-%m-%dT%H:%M:%S", localtime(&localTime));
@@ -321,8 +434,8 @@ static int http_tasmota_json_status_SNS(void* request, jsonCb_t printer, bool bA
 	if (DRV_IsMeasuringPower() || DRV_IsMeasuringBattery()) {
 
 		// begin ENERGY block
-		printer(request, ",");
-		printer(request, "\"ENERGY\":");
+		JSON_WriteLiteral(request, printer, ",");
+		JSON_WriteLiteral(request, printer, "\"ENERGY\":");
 		http_tasmota_json_ENERGY(request, printer);
 	}
 	if (DRV_IsSensor()) {
@@ -331,7 +444,7 @@ static int http_tasmota_json_status_SNS(void* request, jsonCb_t printer, bool bA
 	}
 #endif
 
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, "}");
 
 	return 0;
 }
@@ -391,9 +504,9 @@ static int http_tasmota_json_status_STS(void* request, jsonCb_t printer, bool bA
 	time_t localTime = (time_t)NTP_GetCurrentTime();
 
 	if (bAppendHeader) {
-		printer(request, "\"StatusSTS\":");
+		JSON_WriteLiteral(request, printer, "\"StatusSTS\":");
 	}
-	printer(request, "{");
+	JSON_WriteLiteral(request, printer, "{");
 	strftime(buff, sizeof(buff), "%Y-%m-%dT%H:%M:%S", localtime(&localTime));
 	JSON_PrintKeyValue_String(request, printer, "Time", buff, true);
 	format_time(Time_getUpTimeSeconds(), buff, sizeof(buff));
@@ -411,8 +524,8 @@ static int http_tasmota_json_status_STS(void* request, jsonCb_t printer, bool bA
 	}
 #endif
 	http_tasmota_json_power(request, printer);
-	printer(request, ",");
-	printer(request, "\"Wifi\":{"); // open WiFi
+	JSON_WriteLiteral(request, printer, ",");
+	JSON_WriteLiteral(request, printer, "\"Wifi\":{"); // open WiFi
 	JSON_PrintKeyValue_Int(request, printer, "AP", 1, true);
 	JSON_PrintKeyValue_String(request, printer, "SSId", CFG_GetWiFiSSID(), true);
 	JSON_PrintKeyValue_String(request, printer, "BSSId", "30:B5:C2:5D:70:72", true);
@@ -422,8 +535,8 @@ static int http_tasmota_json_status_STS(void* request, jsonCb_t printer, bool bA
 	JSON_PrintKeyValue_Int(request, printer, "Signal", HAL_GetWifiStrength(), true);
 	JSON_PrintKeyValue_Int(request, printer, "LinkCount", 21, true);
 	JSON_PrintKeyValue_String(request, printer, "Downtime", "0T06:13:34", false);
-	printer(request, "}"); // close WiFi
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, "}"); // close WiFi
+	JSON_WriteLiteral(request, printer, "}");
 	return 0;
 }
 static int http_tasmota_json_status_TIM(void* request, jsonCb_t printer) {
@@ -431,7 +544,7 @@ static int http_tasmota_json_status_TIM(void* request, jsonCb_t printer) {
 
 	time_t localTime = (time_t)NTP_GetCurrentTime();
 	time_t localUTC = (time_t)NTP_GetCurrentTimeWithoutOffset();
-	printer(request, "\"StatusTIM\":{");
+	JSON_WriteLiteral(request, printer, "\"StatusTIM\":{");
 	strftime(buff, sizeof(buff), "%Y-%m-%dT%H:%M:%S", localtime(&localUTC));
 	JSON_PrintKeyValue_String(request, printer, "UTC", buff, true);
 	strftime(buff, sizeof(buff), "%Y-%m-%dT%H:%M:%S", localtime(&localTime));
@@ -441,76 +554,116 @@ static int http_tasmota_json_status_TIM(void* request, jsonCb_t printer) {
 	JSON_PrintKeyValue_String(request, printer, "Timezone", "+01:00", true);
 	JSON_PrintKeyValue_String(request, printer, "Sunrise", "07:50", true);
 	JSON_PrintKeyValue_String(request, printer, "Sunset", "17:17", false);
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, "}");
 	return 0;
 }
 // Test command: http://192.168.0.159/cm?cmnd=STATUS%202
-static int http_tasmota_json_status_FWR(void* request, jsonCb_t printer) {
-
-	printer(request, "\"StatusFWR\":{");
-	JSON_PrintKeyValue_String(request, printer, "Version", DEVICENAME_PREFIX_FULL"_"USER_SW_VER, true);
-	JSON_PrintKeyValue_String(request, printer, "BuildDateTime", __DATE__" "__TIME__, true);
+// Whole section is constant, so it's put together by compiler
+static const char g_jsonStatusFWR[] =
+	"\"StatusFWR\":{"
+	"\"Version\":\"" DEVICENAME_PREFIX_FULL "_" USER_SW_VER "\","
+	"\"BuildDateTime\":\"" __DATE__ " " __TIME__ "\","
 	// NOTE: what is this value? It's not a reboot count
-	JSON_PrintKeyValue_Int(request, printer, "Boot", 7, true);
-	JSON_PrintKeyValue_String(request, printer, "Core", "0.0", true);
-	JSON_PrintKeyValue_String(request, printer, "SDK", "obk", true);
-	JSON_PrintKeyValue_Int(request, printer, "CpuFrequency", 80, true);
-	JSON_PrintKeyValue_String(request, printer, "Hardware", PLATFORM_MCU_NAME, true);
-	JSON_PrintKeyValue_String(request, printer, "CR", "465/699", false);
-	printer(request, "}");
+	"\"Boot\":7,"
+	"\"Core\":\"0.0\","
+	"\"SDK\":\"obk\","
+	"\"CpuFrequency\":80,"
+	"\"Hardware\":\"" PLATFORM_MCU_NAME "\","
+	"\"CR\":\"465/699\""
+	"}";
+static int http_tasmota_json_status_FWR(void* request, jsonCb_t printer) {
+	JSON_WriteLiteral(request, printer, g_jsonStatusFWR);
 	return 0;
 }
 // Test command: http://192.168.0.159/cm?cmnd=STATUS%204
+static const char g_jsonStatusMEM[] =
+	"\"StatusMEM\":{"
+	"\"ProgramSize\":616,"
+	"\"Free\":384,"
+	"\"Heap\":25,"
+	"\"ProgramFlashSize\":1024,"
+	"\"FlashSize\":2048,"
+	"\"FlashChipId\":\"1540A1\","
+	"\"FlashFrequency\":40,"
+	"\"FlashMode\":3,"
+	"\"Features\":["
+	"\"00000809\","
+	"\"8FDAC787\","
+	"\"04368001\","
+	"\"000000CF\","
+	"\"010013C0\","
+	"\"C000F981\","
+	"\"00004004\","
+	"\"00001000\","
+	"\"00000020\""
+	"],"
+	"\"Drivers\":\"1,2,3,4,5,6,7,8,9,10,12,16,18,19,20,21,22,24,26,27,29,30,35,37,45\","
+	"\"Sensors\":\"1,2,3,4,5,6\""
+	"}";
 static int http_tasmota_json_status_MEM(void* request, jsonCb_t printer) {
-	printer(request, "\"StatusMEM\":{");
-	JSON_PrintKeyValue_Int(request, printer, "ProgramSize", 616, true);
-	JSON_PrintKeyValue_Int(request, printer, "Free", 384, true);
-	JSON_PrintKeyValue_Int(request, printer, "Heap", 25, true);
-	JSON_PrintKeyValue_Int(request, printer, "ProgramFlashSize", 1024, true);
-	JSON_PrintKeyValue_Int(request, printer, "FlashSize", 2048, true);
-	JSON_PrintKeyValue_String(request, printer, "FlashChipId", "1540A1", true);
-	JSON_PrintKeyValue_Int(request, printer, "FlashFrequency", 40, true);
-	JSON_PrintKeyValue_Int(request, printer, "FlashMode", 3, true);
-	printer(request, "\"Features\":[");
-	printer(request, "\"00000809\",");
-	printer(request, "\"8FDAC787\",");
-	printer(request, "\"04368001\",");
-	printer(request, "\"000000CF\",");
-	printer(request, "\"010013C0\",");
-	printer(request, "\"C000F981\",");
-	printer(request, "\"00004004\",");
-	printer(request, "\"00001000\",");
-	printer(request, "\"00000020\"");
-	printer(request, "],");
-	JSON_PrintKeyValue_String(request, printer, "Drivers", "1,2,3,4,5,6,7,8,9,10,12,16,18,19,20,21,22,24,26,27,29,30,35,37,45", true);
-	JSON_PrintKeyValue_String(request, printer, "Sensors", "1,2,3,4,5,6", false);
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, g_jsonStatusMEM);
 	return 0;
 }
+// StatusNET depends only on host name, IP and MAC, so it's formatted once
+// and formatted again only if name or IP changes.
+// Status can be requested by HTTP and MQTT at once, so cache is used under mutex.
+static char *g_jsonStatusNET = 0;
+static int g_jsonStatusNETLen = 0;
+static char g_jsonStatusNETKey[96];
+static SemaphoreHandle_t g_jsonStatusNETMutex = 0;
 // Test command: http://192.168.0.159/cm?cmnd=STATUS%205
 static int http_tasmota_json_status_NET(void* request, jsonCb_t printer) {
+	char key[sizeof(g_jsonStatusNETKey)];
+	char tmp[512];
 	char tmpMac[16];
-	HAL_GetMACStr(tmpMac);
+	int len;
 
-	printer(request, "\"StatusNET\":{");
-	JSON_PrintKeyValue_String(request, printer, "Hostname", CFG_GetShortDeviceName(), true);
-	JSON_PrintKeyValue_String(request, printer, "IPAddress", HAL_GetMyIPString(), true);
-	JSON_PrintKeyValue_String(request, printer, "Gateway", "192.168.0.1", true);
-	JSON_PrintKeyValue_String(request, printer, "Subnetmask", "255.255.255.0", true);
-	JSON_PrintKeyValue_String(request, printer, "DNSServer1", "192.168.0.1", true);
-	JSON_PrintKeyValue_String(request, printer, "DNSServer2", "0.0.0.0", true);
-	JSON_PrintKeyValue_String(request, printer, "Mac", tmpMac, true);
-	JSON_PrintKeyValue_Int(request, printer, "Webserver", 2, true);
-	JSON_PrintKeyValue_Int(request, printer, "HTTP_API", 1, true);
-	JSON_PrintKeyValue_Int(request, printer, "WifiConfig", 4, true);
-	printer(request, "\"WifiPower\":17.0");
-	printer(request, "}");
+	if (g_jsonStatusNETMutex == 0) {
+		g_jsonStatusNETMutex = xSemaphoreCreateMutex();
+	}
+	snprintf(key, sizeof(key), "%s|%s", CFG_GetShortDeviceName(), HAL_GetMyIPString());
+	if (xSemaphoreTake(g_jsonStatusNETMutex, 100) == pdTRUE) {
+		if (g_jsonStatusNET && !strcmp(key, g_jsonStatusNETKey)) {
+			JSON_Write(request, printer, g_jsonStatusNET, g_jsonStatusNETLen);
+			xSemaphoreGive(g_jsonStatusNETMutex);
+			return 0;
+		}
+		xSemaphoreGive(g_jsonStatusNETMutex);
+	}
+	HAL_GetMACStr(tmpMac);
+	len = snprintf(tmp, sizeof(tmp), "\"StatusNET\":{"
+		"\"Hostname\":\"%s\","
+		"\"IPAddress\":\"%s\","
+		"\"Gateway\":\"192.168.0.1\","
+		"\"Subnetmask\":\"255.255.255.0\","
+		"\"DNSServer1\":\"192.168.0.1\","
+		"\"DNSServer2\":\"0.0.0.0\","
+		"\"Mac\":\"%s\","
+		"\"Webserver\":2,"
+		"\"HTTP_API\":1,"
+		"\"WifiConfig\":4,"
+		"\"WifiPower\":17.0"
+		"}", CFG_GetShortDeviceName(), HAL_GetMyIPString(), tmpMac);
+	if (len >= sizeof(tmp)) {
+		len = sizeof(tmp) - 1;
+	}
+	JSON_Write(request, printer, tmp, len);
+	// if mutex is busy, just don't cache it this time
+	if (xSemaphoreTake(g_jsonStatusNETMutex, 0) == pdTRUE) {
+		if (g_jsonStatusNET) {
+			free(g_jsonStatusNET);
+		}
+		g_jsonStatusNET = strdup(tmp);
+		g_jsonStatusNETLen = len;
+		strcpy(g_jsonStatusNETKey, key);
+		xSemaphoreGive(g_jsonStatusNETMutex);
+	}
 	return 0;
 }
 // Test command: http://192.168.0.159/cm?cmnd=STATUS%206
 static int http_tasmota_json_status_MQT(void* request, jsonCb_t printer) {
 
-	printer(request, "\"StatusMQT\":{");
+	JSON_WriteLiteral(request, printer, "\"StatusMQT\":{");
 	JSON_PrintKeyValue_String(request, printer, "MqttHost", CFG_GetMQTTHost(), true);
 	JSON_PrintKeyValue_Int(request, printer, "MqttPort", CFG_GetMQTTPort(), true);
 	JSON_PrintKeyValue_String(request, printer, "MqttClientMask", "core", true);
@@ -520,7 +673,7 @@ static int http_tasmota_json_status_MQT(void* request, jsonCb_t printer) {
 	JSON_PrintKeyValue_Int(request, printer, "MAX_PACKET_SIZE", 1200, true);
 	JSON_PrintKeyValue_Int(request, printer, "KEEPALIVE", 30, true);
 	JSON_PrintKeyValue_Int(request, printer, "SOCKET_TIMEOUT", 4, false);
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, "}");
 	return 0;
 }
 /*
@@ -571,13 +724,15 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 		}
 	}
 
-	printer(request, "{");
+	JSON_WriteLiteral(request, printer, "{");
 	// Status section
-	printer(request, "\"Status\":{\"Module\":0,");
+	JSON_WriteLiteral(request, printer, "\"Status\":{\"Module\":0,");
 	JSON_PrintKeyValue_String(request, printer, "DeviceName", deviceName, true);
-	printer(request, "\"FriendlyName\":[");
+	JSON_WriteLiteral(request, printer, "\"FriendlyName\":[");
 	if (relayCount == 0) {
-		printer(request, "\"%s\"", deviceName);
+		JSON_WriteLiteral(request, printer, "\"");
+		JSON_WriteStr(request, printer, deviceName);
+		JSON_WriteLiteral(request, printer, "\"");
 	}
 	else {
 		int c_printed = 0;
@@ -593,25 +748,32 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 					useIdx = i;
 				}
 				if (c_printed) {
-					printer(request, ",");
+					JSON_WriteLiteral(request, printer, ",");
 				}
-				printer(request, "\"%s_%i\"", deviceName, useIdx);
+				JSON_WriteLiteral(request, printer, "\"");
+				JSON_WriteStr(request, printer, deviceName);
+				JSON_WriteLiteral(request, printer, "_");
+				JSON_WriteInt(request, printer, useIdx);
+				JSON_WriteLiteral(request, printer, "\"");
 				c_printed++;
 			}
 		}
 	}
-	printer(request, "]");
-	printer(request, ",\"Topic\":\"%s\",\"ButtonTopic\":\"0\"", clientId);
-	printer(request, ",\"Power\":%i,\"PowerOnState\":3,\"LedState\":1", powerCode);
-	printer(request, ",\"LedMask\":\"FFFF\",\"SaveData\":1,\"SaveState\":1");
-	printer(request, ",\"SwitchTopic\":\"0\",\"SwitchMode\":[0,0,0,0,0,0,0,0]");
-	printer(request, ",\"ButtonRetain\":0,\"SwitchRetain\":0,\"SensorRetain\":0");
-	printer(request, ",\"PowerRetain\":0,\"InfoRetain\":0,\"StateRetain\":0");
-	printer(request, "}");
-
-	printer(request, ",");
-
-	printer(request, "\"StatusPRM\":{");
+	JSON_WriteLiteral(request, printer, "]");
+	JSON_WriteLiteral(request, printer, ",\"Topic\":\"");
+	JSON_WriteStr(request, printer, clientId);
+	JSON_WriteLiteral(request, printer, "\",\"ButtonTopic\":\"0\",\"Power\":");
+	JSON_WriteInt(request, printer, powerCode);
+	JSON_WriteLiteral(request, printer, ",\"PowerOnState\":3,\"LedState\":1"
+		",\"LedMask\":\"FFFF\",\"SaveData\":1,\"SaveState\":1"
+		",\"SwitchTopic\":\"0\",\"SwitchMode\":[0,0,0,0,0,0,0,0]"
+		",\"ButtonRetain\":0,\"SwitchRetain\":0,\"SensorRetain\":0"
+		",\"PowerRetain\":0,\"InfoRetain\":0,\"StateRetain\":0"
+		"}");
+
+	JSON_WriteLiteral(request, printer, ",");
+
+	JSON_WriteLiteral(request, printer, "\"StatusPRM\":{");
 	JSON_PrintKeyValue_Int(request, printer, "Baudrate", 115200, true);
 	JSON_PrintKeyValue_String(request, printer, "SerialConfig", "8N1", true);
 	JSON_PrintKeyValue_String(request, printer, "GroupTopic", CFG_DeviceGroups_GetName(), true);
@@ -634,68 +796,70 @@ static int http_tasmota_json_status_generic(void* request, jsonCb_t printer) {
 	JSON_PrintKeyValue_String(request, printer, "BCResetTime", "2022-01-27T16:10:56", true);
 	JSON_PrintKeyValue_Int(request, printer, "SaveCount", 1235, true);
 	JSON_PrintKeyValue_String(request, printer, "SaveAddress", "F9000", false);
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, "}");
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 	http_tasmota_json_status_FWR(request, printer);
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 
 	// Test command: http://192.168.0.159/cm?cmnd=STATUS%203
-	printer(request, "\"StatusLOG\":{");
-	printer(request, "\"SerialLog\":2,");
-	printer(request, "\"WebLog\":2,");
-	printer(request, "\"MqttLog\":0,");
-	printer(request, "\"SysLog\":0,");
-	printer(request, "\"LogHost\":\"\",");
-	printer(request, "\"LogPort\":514,");
-	printer(request, "\"SSId1\":\"%s\",", CFG_GetWiFiSSID());
-	printer(request, "\"SSId2\":\"\",");
-	printer(request, "\"TelePeriod\":300,");
-	printer(request, "\"Resolution\":\"558180C0\",");
-	printer(request, "\"SetOption\":[");
-	printer(request, "\"000A8009\",");
-	printer(request, "\"2805C80001000600003C5A0A000000000000\",");
-	printer(request, "\"00000280\",");
-	printer(request, "\"00006008\",");
-	printer(request, "\"00004000\"");
-	printer(request, "]");
-	printer(request, "}");
-
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, "\"StatusLOG\":{"
+		"\"SerialLog\":2,"
+		"\"WebLog\":2,"
+		"\"MqttLog\":0,"
+		"\"SysLog\":0,"
+		"\"LogHost\":\"\","
+		"\"LogPort\":514,"
+		"\"SSId1\":\"");
+	JSON_WriteStr(request, printer, CFG_GetWiFiSSID());
+	JSON_WriteLiteral(request, printer, "\","
+		"\"SSId2\":\"\","
+		"\"TelePeriod\":300,"
+		"\"Resolution\":\"558180C0\","
+		"\"SetOption\":["
+		"\"000A8009\","
+		"\"2805C80001000600003C5A0A000000000000\","
+		"\"00000280\","
+		"\"00006008\","
+		"\"00004000\""
+		"]"
+		"}");
+
+	JSON_WriteLiteral(request, printer, ",");
 
 
 
 	http_tasmota_json_status_MEM(request, printer);
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 	http_tasmota_json_status_NET(request, printer);
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 
 	http_tasmota_json_status_MQT(request, printer);
 
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 	http_tasmota_json_status_TIM(request, printer);
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 
 	http_tasmota_json_status_SNS(request, printer, true);
 
-	printer(request, ",");
+	JSON_WriteLiteral(request, printer, ",");
 
 
 	http_tasmota_json_status_STS(request, printer, true);
 
 	// end
-	printer(request, "}");
+	JSON_WriteLiteral(request, printer, "}");
 
 
 
@@ -705,15 +869,15 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 
 	if (!wal_strnicmp(cmd, "POWER", 5)) {
 
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		http_tasmota_json_power(request, printer);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 		if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 			MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "RESULT");
 		}
 	}
 	else if (!wal_strnicmp(cmd, "SensorRetain", 12)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		if (CFG_HasFlag(OBK_PUBLISH_FLAG_RETAIN))
 		{
 			JSON_PrintKeyValue_String(request, printer, "SensorRetain", "ON", false);
@@ -723,7 +887,7 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 			JSON_PrintKeyValue_String(request, printer, "SensorRetain", "OFF", false);
 		}
 
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "Prefix1", 7)) {
 		//TODO 
@@ -733,19 +897,19 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 		// <value> = set MQTT status prefix and restart
 		// Prefix3 	1 = Reset MQTT telemetry prefix to firmware default (PUB_PREFIX2) and restart
 		// <value> = set MQTT telemetry prefix and restart
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "Prefix1", "cmnd", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "Prefix2", 7)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "Prefix2", "stat", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "Prefix3", 7)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "Prefix3", "tele", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "StateText1", 10)) {
 		//TODO 
@@ -754,85 +918,85 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 		//	2 = ON state text
 		//	3 = TOGGLE state text
 		//	4 = HOLD state text
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "StateText1", "OFF", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "StateText2", 10)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "StateText2", "ON", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "StateText3", 10)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "StateText3", "TOGGLE", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "StateText4", 10)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "StateText4", "HOLD", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "FullTopic", 9)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "FullTopic", "%%prefix%%/%%topic%%", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "SwitchTopic", 11)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "SwitchTopic", "0", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "ButtonTopic", 11)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "ButtonTopic", "0", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "MqttRetry", 9)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "MqttRetry", "1", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "TelePeriod", 10)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "TelePeriod", "300", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "CT", 2)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		if (*arg == 0) {
 			http_tasmota_json_CT(request, printer);
 		}
 		else {
 			http_tasmota_json_power(request, printer);
 		}
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 		if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 			MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "RESULT");
 		}
 	}
 	else if (!wal_strnicmp(cmd, "Dimmer", 6)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		if (*arg == 0) {
 			http_tasmota_json_Dimmer(request, printer);
 		}
 		else {
 			http_tasmota_json_power(request, printer);
 		}
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 		if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 			MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "RESULT");
 		}
 	}
 	else if (!wal_strnicmp(cmd, "Color", 5)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		//if (*arg == 0) {
 		//	http_tasmota_json_Colo(request, printer);
 		//}
 		//else {
 		http_tasmota_json_power(request, printer);
 		//}
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 		if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 			MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "RESULT");
 		}
@@ -855,9 +1019,9 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 	}
 	else if (!wal_strnicmp(cmd, "STATUS", 6)) {
 		if (!stricmp(arg, "8") || !stricmp(arg, "10")) {
-			printer(request, "{");
+			JSON_WriteLiteral(request, printer, "{");
 			http_tasmota_json_status_SNS(request, printer, true);
-			printer(request, "}");
+			JSON_WriteLiteral(request, printer, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				if (arg[0] == '8') {
 					MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "STATUS8");
@@ -868,41 +1032,41 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 			}
 		}
 		else if (!stricmp(arg, "6")) {
-			printer(request, "{");
+			JSON_WriteLiteral(request, printer, "{");
 			http_tasmota_json_status_MQT(request, printer);
-			printer(request, "}");
+			JSON_WriteLiteral(request, printer, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "STATUS6");
 			}
 		}
 		else if (!stricmp(arg, "7")) {
-			printer(request, "{");
+			JSON_WriteLiteral(request, printer, "{");
 			http_tasmota_json_status_TIM(request, printer);
-			printer(request, "}");
+			JSON_WriteLiteral(request, printer, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "STATUS7");
 			}
 		}
 		else if (!stricmp(arg, "5")) {
-			printer(request, "{");
+			JSON_WriteLiteral(request, printer, "{");
 			http_tasmota_json_status_NET(request, printer);
-			printer(request, "}");
+			JSON_WriteLiteral(request, printer, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "STATUS5");
 			}
 		}
 		else if (!stricmp(arg, "4")) {
-			printer(request, "{");
+			JSON_WriteLiteral(request, printer, "{");
 			http_tasmota_json_status_MEM(request, printer);
-			printer(request, "}");
+			JSON_WriteLiteral(request, printer, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "STATUS4");
 			}
 		}
 		else if (!stricmp(arg, "2")) {
-			printer(request, "{");
+			JSON_WriteLiteral(request, printer, "{");
 			http_tasmota_json_status_FWR(request, printer);
-			printer(request, "}");
+			JSON_WriteLiteral(request, printer, "}");
 			if (flags == COMMAND_FLAG_SOURCE_MQTT) {
 				MQTT_PublishPrinterContentsToStat((struct obk_mqtt_publishReplyPrinter_s*)request, "STATUS2");
 			}
@@ -932,49 +1096,49 @@ int JSON_ProcessCommandReply(const char* cmd, const char* arg, void* request, js
 		// OBK-specific
 		char tmp[16];
 		LED_GetBaseColorString(tmp);
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "led_basecolor_rgb", tmp, false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "MQTTClient", 8)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "MQTTClient", CFG_GetMQTTClientId(), false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "MQTTHost", 8)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "MQTTHost", CFG_GetMQTTHost(), false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "MQTTUser", 8)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "MQTTUser", CFG_GetMQTTUserName(), false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "MqttPassword", 12)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request, printer, "MqttPassword", "****", false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "SSID1", 5)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		JSON_PrintKeyValue_String(request,printer,"SSID1", CFG_GetWiFiSSID(),false);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "LED_Map", 7)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		printer(request, "\"Map\":[%i,%i,%i,%i,%i]",
 			(int)g_cfg.ledRemap.r, (int)g_cfg.ledRemap.g, (int)g_cfg.ledRemap.b, (int)g_cfg.ledRemap.c, (int)g_cfg.ledRemap.w);
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else if (!wal_strnicmp(cmd, "Flags", 5)) {
-		printer(request, "{");
+		JSON_WriteLiteral(request, printer, "{");
 		printer(request, "\"Flags\":\"%ld\"", *((long int*)&g_cfg.genericFlags));
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 	else {
-		printer(request, "{");
-		printer(request, "}");
+		JSON_WriteLiteral(request, printer, "{");
+		JSON_WriteLiteral(request, printer, "}");
 	}
 
 	return 0;
@@ -73,47 +73,266 @@ const char* methodNames[] = {
 void misc_formatUpTimeString(int totalSeconds, char* o);
 int Time_getUpTimeSeconds();
 
-typedef struct http_callback_tag {
-	char* url;
-	int method;
+// Style and scripts shared by all pages. They are stored gzipped by gulp and
+// pages link them with ETag in URL, so browser downloads them once per build.
+typedef struct httpAsset_s {
+	const char* path;
+	const char* type;
+	const unsigned char* data;
+	const int* len;
+	const char* etag;
+} httpAsset_t;
+
+static const httpAsset_t g_assets[] = {
+	{ "ha_discovery.js", "application/javascript", ha_discovery_script, &ha_discovery_script_len, ha_discovery_script_etag },
+	{ "script.js", "application/javascript", pageScript, &pageScript_len, pageScript_etag },
+	{ "style.css", "text/css", htmlHeadStyle, &htmlHeadStyle_len, htmlHeadStyle_etag },
+};
+
+static int http_fn_asset(http_request_t* request) {
+	const httpAsset_t* asset = 0;
+	char headers[128];
+	int i, len;
+
+	len = strcspn(request->url, "?");
+	for (i = 0; i < sizeof(g_assets) / sizeof(g_assets[0]); i++) {
+		if (!strncmp(g_assets[i].path, request->url, len) && g_assets[i].path[len] == 0) {
+			asset = &g_assets[i];
+			break;
+		}
+	}
+	if (asset == 0) {
+		return http_fn_other(request);
+	}
+	// content never changes for this ETag, new build links new URL
+	snprintf(headers, sizeof(headers), "ETag: \"%s\"\r\nCache-Control: public, max-age=31536000, immutable\r\n", asset->etag);
+	if (request->ifNoneMatch && strstr(request->ifNoneMatch, asset->etag)) {
+		request->responseCode = HTTP_RESPONSE_NOT_MODIFIED;
+		http_setup_sized(request, asset->type, headers, 0);
+		poststr(request, NULL);
+		return 0;
+	}
+	// there is no inflate on device, but all browsers accept gzip
+	strcat_safe(headers, "Content-Encoding: gzip\r\n", sizeof(headers));
+	http_setup_sized(request, asset->type, headers, *asset->len);
+	postany(request, (const char*)asset->data, *asset->len);
+	poststr(request, NULL);
+	return 0;
+}
+
+// Route table, built-in pages and registered callbacks sorted by path (without leading '/'),
+// so page is found by binary search instead of comparing URL with all of them.
+typedef struct httpRoute_s {
+	const char* path;
+	// HTTP_ANY or METHODS
+	signed char method;
+	// registered callbacks match also longer paths, like /api/...
+	byte bPrefix;
 	http_callback_fn callback;
-} http_callback_t;
+} httpRoute_t;
+
+static const httpRoute_t g_builtInRoutes[] = {
+	{ "", HTTP_ANY, 0, http_fn_empty_url },
+	{ "about", HTTP_ANY, 0, http_fn_about },
+	{ "cfg", HTTP_ANY, 0, http_fn_cfg },
+	{ "cfg_dgr", HTTP_ANY, 0, http_fn_cfg_dgr },
+	{ "cfg_generic", HTTP_ANY, 0, http_fn_cfg_generic },
+	{ "cfg_loglevel_set", HTTP_ANY, 0, http_fn_cfg_loglevel_set },
+	{ "cfg_mac", HTTP_ANY, 0, http_fn_cfg_mac },
+	{ "cfg_mqtt", HTTP_ANY, 0, http_fn_cfg_mqtt },
+	{ "cfg_mqtt_set", HTTP_ANY, 0, http_fn_cfg_mqtt_set },
+	{ "cfg_name", HTTP_ANY, 0, http_fn_cfg_name },
+	{ "cfg_pins", HTTP_ANY, 0, http_fn_cfg_pins },
+	{ "cfg_ping", HTTP_ANY, 0, http_fn_cfg_ping },
+	{ "cfg_startup", HTTP_ANY, 0, http_fn_cfg_startup },
+	{ "cfg_webapp", HTTP_ANY, 0, http_fn_cfg_webapp },
+	{ "cfg_webapp_set", HTTP_ANY, 0, http_fn_cfg_webapp_set },
+	{ "cfg_wifi", HTTP_ANY, 0, http_fn_cfg_wifi },
+	{ "cfg_wifi_set", HTTP_ANY, 0, http_fn_cfg_wifi_set },
+	{ "cm", HTTP_ANY, 0, http_fn_cm },
+	{ "cmd_tool", HTTP_ANY, 0, http_fn_cmd_tool },
+	{ "flash_read_tool", HTTP_ANY, 0, http_fn_flash_read_tool },
+	{ "ha_cfg", HTTP_ANY, 0, http_fn_ha_cfg },
+	{ "ha_discovery", HTTP_ANY, 0, http_fn_ha_discovery },
+	{ "ha_discovery.js", HTTP_GET, 0, http_fn_asset },
+	{ "index", HTTP_ANY, 0, http_fn_index },
+	{ "ota", HTTP_ANY, 0, http_fn_ota },
+	{ "ota_exec", HTTP_ANY, 0, http_fn_ota_exec },
+	{ "script.js", HTTP_GET, 0, http_fn_asset },
+	{ "startup_command", HTTP_ANY, 0, http_fn_startup_command },
+	{ "style.css", HTTP_GET, 0, http_fn_asset },
+	{ "testmsg", HTTP_ANY, 0, http_fn_testmsg },
+	{ "uart_tool", HTTP_ANY, 0, http_fn_uart_tool },
+};
 
 #define MAX_HTTP_CALLBACKS 32
-static http_callback_t* callbacks[MAX_HTTP_CALLBACKS];
+#define MAX_HTTP_ROUTES (sizeof(g_builtInRoutes) / sizeof(g_builtInRoutes[0]) + MAX_HTTP_CALLBACKS)
+// sorted by path, then registered callbacks go before built-in page with the same path
+static const httpRoute_t* g_routes[MAX_HTTP_ROUTES];
+static int g_numRoutes = 0;
 static int numCallbacks = 0;
+// Drivers register callbacks at runtime, while HTTP thread searches the table.
+// Created by HTTP_InitRoutes before the server starts, until then
+// only main thread touches the table.
+static SemaphoreHandle_t g_routesMutex = 0;
+static bool g_routesInitDone = false;
+
+// compares route path with first len characters of path, like strcmp
+static int HTTP_ComparePath(const char* routePath, const char* path, int len) {
+	int res = strncmp(routePath, path, len);
+
+	if (res != 0) {
+		return res;
+	}
+	return routePath[len] ? 1 : 0;
+}
+// returns index of first route with path not less than given one
+static int HTTP_LowerBound(const char* path, int len) {
+	int low = 0;
+	int high = g_numRoutes;
+	int mid;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (HTTP_ComparePath(g_routes[mid]->path, path, len) < 0) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return low;
+}
+static void HTTP_LockRoutes() {
+	if (g_routesMutex == 0) {
+		return;
+	}
+	while (xSemaphoreTake(g_routesMutex, 1000) != pdTRUE) {
+		ADDLOG_ERROR(LOG_FEATURE_HTTP, "HTTP routes mutex wait is too long");
+	}
+}
+static void HTTP_UnlockRoutes() {
+	if (g_routesMutex == 0) {
+		return;
+	}
+	xSemaphoreGive(g_routesMutex);
+}
+// inserts after registered callbacks with the same path, but before built-in page
+static void HTTP_InsertRoute(const httpRoute_t* route) {
+	int i;
+
+	i = HTTP_LowerBound(route->path, strlen(route->path));
+	while (i < g_numRoutes && g_routes[i]->bPrefix && !strcmp(g_routes[i]->path, route->path)) {
+		i++;
+	}
+	memmove(&g_routes[i + 1], &g_routes[i], (g_numRoutes - i) * sizeof(g_routes[0]));
+	g_routes[i] = route;
+	g_numRoutes++;
+}
+// called from HTTPServer_Start, before HTTP thread runs
+void HTTP_InitRoutes() {
+	int i;
+
+	if (g_routesInitDone) {
+		return;
+	}
+	for (i = 0; i < sizeof(g_builtInRoutes) / sizeof(g_builtInRoutes[0]); i++) {
+		HTTP_InsertRoute(&g_builtInRoutes[i]);
+	}
+	g_routesMutex = xSemaphoreCreateMutex();
+	g_routesInitDone = true;
+}
+// among routes from index i with exactly this path, returns first for this method
+// sets bPathFound if path matched, but method did not
+static const httpRoute_t* HTTP_FindMethod(int i, const char* path, int len, int method, int bPrefixOnly, int* bPathFound) {
+	for (; i < g_numRoutes && HTTP_ComparePath(g_routes[i]->path, path, len) == 0; i++) {
+		if (bPrefixOnly && g_routes[i]->bPrefix == 0) {
+			continue;
+		}
+		if (g_routes[i]->method == HTTP_ANY || g_routes[i]->method == method) {
+			return g_routes[i];
+		}
+		*bPathFound = 1;
+	}
+	return 0;
+}
+// finds route with the same path, or registered callback with longest path that path starts with
+static const httpRoute_t* HTTP_FindRoute(const char* path, int len, int method, int* bPathFound) {
+	const httpRoute_t* r;
+	const char* p;
+	int i, common;
+
+	*bPathFound = 0;
+	r = HTTP_FindMethod(HTTP_LowerBound(path, len), path, len, method, 0, bPathFound);
+	if (r) {
+		return r;
+	}
+	while (len > 0) {
+		// last route not greater than path, any route that is prefix of path is this one or before it
+		i = HTTP_LowerBound(path, len);
+		if (i < g_numRoutes && HTTP_ComparePath(g_routes[i]->path, path, len) == 0) {
+			i++;
+		}
+		if (i == 0) {
+			break;
+		}
+		p = g_routes[i - 1]->path;
+		for (common = 0; common < len && p[common] == path[common]; common++) {
+		}
+		if (p[common] == 0) {
+			// it's a prefix of path, is there one for this method?
+			i = HTTP_LowerBound(path, common);
+			r = HTTP_FindMethod(i, path, common, method, 1, bPathFound);
+			if (r) {
+				return r;
+			}
+			if (common == 0) {
+				break;
+			}
+			len = common - 1;
+		}
+		else {
+			len = common;
+		}
+	}
+	return 0;
+}
 
 int HTTP_RegisterCallback(const char* url, int method, http_callback_fn callback) {
+	httpRoute_t* route;
 	int i;
 
 	if (!url || !callback) {
 		return -1;
 	}
+	HTTP_LockRoutes();
 	if (numCallbacks >= MAX_HTTP_CALLBACKS) {
+		HTTP_UnlockRoutes();
 		return -4;
 	}
-	for (i = 0; i < MAX_HTTP_CALLBACKS; i++) {
-		if (callbacks[i]) {
-			if (callbacks[i]->callback == callback && !strcmp(callbacks[i]->url, url)
-				&& callbacks[i]->method == method) {
-				return i;
-			}
+	for (i = 0; i < g_numRoutes; i++) {
+		if (g_routes[i]->callback == callback && !strcmp(g_routes[i]->path, url + 1)
+			&& g_routes[i]->method == method) {
+			HTTP_UnlockRoutes();
+			return i;
 		}
 	}
-	callbacks[numCallbacks] = (http_callback_t*)os_malloc(sizeof(http_callback_t));
-	if (!callbacks[numCallbacks]) {
+	route = (httpRoute_t*)os_malloc(sizeof(httpRoute_t) + strlen(url));
+	if (!route) {
+		HTTP_UnlockRoutes();
 		return -2;
 	}
-	callbacks[numCallbacks]->url = (char*)os_malloc(strlen(url) + 1);
-	if (!callbacks[numCallbacks]->url) {
-		os_free(callbacks[numCallbacks]);
-		return -3;
-	}
-	strcpy(callbacks[numCallbacks]->url, url);
-	callbacks[numCallbacks]->callback = callback;
-	callbacks[numCallbacks]->method = method;
+	// path is kept right after route, without leading '/'
+	strcpy((char*)(route + 1), url + 1);
+	route->path = (const char*)(route + 1);
+	route->callback = callback;
+	route->method = method;
+	route->bPrefix = 1;
+	// after callbacks registered earlier for the same path
+	HTTP_InsertRoute(route);
 
 	numCallbacks++;
+	HTTP_UnlockRoutes();
 
 	// success
 	return 0;
@@ -131,6 +350,46 @@ int my_strnicmp(const char* a, const char* b, int len) {
 	}
 	return 0;
 }
+// one compare for most lines, as name is first checked by first letter
+static const char* HTTP_MatchHeaderName(const char* line, const char* name, int len) {
+	if (my_strnicmp(line, name, len)) {
+		return 0;
+	}
+	line += len;
+	while (*line == ' ') {
+		line++;
+	}
+	return line;
+}
+int HTTP_GetHeaderId(const char* line, const char** value) {
+	switch (*line | 0x20) {
+	case 'a':
+		if ((*value = HTTP_MatchHeaderName(line, "Authorization:", 14)) != 0) {
+			return HTTP_HEADER_AUTHORIZATION;
+		}
+		break;
+	case 'c':
+		if ((*value = HTTP_MatchHeaderName(line, "Content-Length:", 15)) != 0) {
+			return HTTP_HEADER_CONTENT_LENGTH;
+		}
+		if ((*value = HTTP_MatchHeaderName(line, "Connection:", 11)) != 0) {
+			return HTTP_HEADER_CONNECTION;
+		}
+		break;
+	case 'i':
+		if ((*value = HTTP_MatchHeaderName(line, "If-None-Match:", 14)) != 0) {
+			return HTTP_HEADER_IF_NONE_MATCH;
+		}
+		break;
+	case 't':
+		if ((*value = HTTP_MatchHeaderName(line, "Transfer-Encoding:", 18)) != 0) {
+			return HTTP_HEADER_TRANSFER_ENCODING;
+		}
+		break;
+	}
+	*value = 0;
+	return HTTP_HEADER_OTHER;
+}
 
 
 /// @brief Write escaped data to the response.
@@ -202,21 +461,8 @@ bool http_startsWith(const char* base, const char* substr) {
 	return true;
 }
 
-bool http_checkUrlBase(const char* base, const char* fileName) {
-	while (*base != 0 && *base != '?' && *base != ' ') {
-		if (*base != *fileName)
-			return false;
-		if (*base == 0)
-			return false;
-		base++;
-		fileName++;
-	}
-	if (*fileName != 0)
-		return false;
-	return true;
-}
-
-void http_setup(http_request_t* request, const char* type) {
+// contentLength is -1 if body length is not known in advance
+static void http_setupHeaders(http_request_t* request, const char* type, const char* extraHeaders, int contentLength) {
 	hprintf255(request, httpHeader, request->responseCode, type);
 	poststr(request, "\r\n"); // next header
 	poststr(request, httpCorsHeaders);
@@ -234,9 +480,37 @@ void http_setup(http_request_t* request, const char* type) {
 	poststr(request, "Transfer-Encoding: chunked");
 #endif
 	poststr(request, "\r\n");
-	poststr(request, "Connection: close");
+	if (extraHeaders) {
+		poststr(request, extraHeaders);
+	}
+	if (contentLength >= 0) {
+		hprintf255(request, "Content-Length: %i\r\n", contentLength);
+	}
+	else if (request->bKeepAlive) {
+		// length is not known in advance, so body goes in chunks
+		poststr(request, "Transfer-Encoding: chunked\r\n");
+	}
+	if (request->bKeepAlive) {
+		poststr(request, "Connection: keep-alive");
+	}
+	else {
+		poststr(request, "Connection: close");
+	}
 	poststr(request, "\r\n"); // end headers with double CRLF
 	poststr(request, "\r\n");
+	if (request->bKeepAlive) {
+		request->bDelimited = 1;
+		if (contentLength < 0) {
+			request->bChunked = 1;
+			request->headersLen = request->replylen;
+		}
+	}
+}
+void http_setup(http_request_t* request, const char* type) {
+	http_setupHeaders(request, type, 0, -1);
+}
+void http_setup_sized(http_request_t* request, const char* type, const char* extraHeaders, int contentLength) {
+	http_setupHeaders(request, type, extraHeaders, contentLength);
 }
 
 void http_html_start(http_request_t* request, const char* pagename) {
@@ -249,7 +523,7 @@ void http_html_start(http_request_t* request, const char* pagename) {
 	poststr(request, "</title>");
 	poststr(request, htmlShortcutIcon);
 	poststr(request, htmlHeadMeta);
-	poststr(request, htmlHeadStyle);
+	hprintf255(request, "<link rel=\"stylesheet\" href=\"/style.css?v=%s\">", htmlHeadStyle_etag);
 	poststr(request, "</head>");
 	poststr(request, htmlBodyStart);
 	poststr(request, CFG_GetDeviceName());
@@ -275,7 +549,7 @@ void http_html_end(http_request_t* request) {
 	poststr(request, upTimeStr);
 
 	poststr(request, htmlBodyEnd);
-	poststr(request, pageScript);
+	hprintf255(request, "<script src=\"/script.js?v=%s\"></script>", pageScript_etag);
 }
 
 const char* http_checkArg(const char* p, const char* n) {
@@ -491,12 +765,47 @@ void setupAllWB2SPinsAsButtons() {
 	PIN_SetPinChannelForPinIndex(27, 1);
 }
 
+static void http_sendRaw(http_request_t* request, const char* data, int len) {
+	if (request->sendFn) {
+		request->sendFn(request->fd, data, len);
+	}
+	else {
+		send(request->fd, data, len, 0);
+	}
+}
+// sends part of body, as a chunk if reply is chunked
+static void http_sendBody(http_request_t* request, const char* data, int len) {
+	char tmp[12];
+
+	if (request->bChunked == 0) {
+		http_sendRaw(request, data, len);
+		return;
+	}
+	// empty chunk would end the reply
+	if (len <= 0) {
+		return;
+	}
+	sprintf(tmp, "%X\r\n", len);
+	http_sendRaw(request, tmp, strlen(tmp));
+	http_sendRaw(request, data, len);
+	http_sendRaw(request, "\r\n", 2);
+}
+// sends reply buffer, headers go as they are and the rest as body
+static void http_sendReplyBuffer(http_request_t* request) {
+	if (request->headersLen > 0) {
+		http_sendRaw(request, request->reply, request->headersLen);
+	}
+	http_sendBody(request, request->reply + request->headersLen, request->replylen - request->headersLen);
+	request->headersLen = 0;
+	request->reply[0] = 0;
+	request->replylen = 0;
+}
 // add some more output safely, sending if necessary.
 // call with str == NULL to force send. - can be binary.
 // supply length
 int postany(http_request_t* request, const char* str, int len) {
 #if PLATFORM_BL602
-	send(request->fd, str, len, 0);
+	http_sendBody(request, str, len);
 	return 0;
 #else
 	int currentlen;
@@ -504,11 +813,11 @@ int postany(http_request_t* request, const char* str, int len) {
 
 	if (NULL == str) {
 		// fd will be NULL for unit tests where HTTP packet is faked locally
-		if (request->fd == 0) {
+		if (request->fd == 0 && request->sendFn == 0) {
 			return request->replylen;
 		}
 		if (request->replylen > 0) {
-			send(request->fd, request->reply, request->replylen, 0);
+			http_sendReplyBuffer(request);
 		}
 		request->reply[0] = 0;
 		request->replylen = 0;
@@ -517,17 +826,14 @@ int postany(http_request_t* request, const char* str, int len) {
 
 	currentlen = request->replylen;
 	if (currentlen + addlen >= request->replymaxlen) {
-		send(request->fd, request->reply, request->replylen, 0);
-		request->reply[0] = 0;
-		request->replylen = 0;
+		http_sendReplyBuffer(request);
 		currentlen = 0;
 	}
 	while (addlen >= request->replymaxlen) {
 		if (request->replylen > 0) {
-			send(request->fd, request->reply, request->replylen, 0);
-			request->replylen = 0;
+			http_sendReplyBuffer(request);
 		}
-		send(request->fd, str, (request->replymaxlen - 1), 0);
+		http_sendBody(request, str, (request->replymaxlen - 1));
 		addlen -= (request->replymaxlen - 1);
 		str += (request->replymaxlen - 1);
 
@@ -539,6 +845,15 @@ int postany(http_request_t* request, const char* str, int len) {
 	return (currentlen + addlen);
 #endif
 }
+void HTTP_FinishReply(http_request_t* request, int lenret) {
+	if (lenret > 0) {
+		postany(request, NULL, 0);
+	}
+	if (request->bChunked) {
+		http_sendRaw(request, "0\r\n\r\n", 5);
+		request->bChunked = 0;
+	}
+}
 
 
 // add some more output safely, sending if necessary.
@@ -563,7 +878,9 @@ int hprintf255(http_request_t* request, const char* fmt, ...) {
 
 
 int HTTP_ProcessPacket(http_request_t* request) {
-	int i;
+	const httpRoute_t* route;
+	const char* value;
+	int i, bPathFound;
 	char* p;
 	char* headers;
 	char* protocol;
@@ -576,6 +893,7 @@ int HTTP_ProcessPacket(http_request_t* request) {
 		return 0;
 	}
 	recvbuf = request->received;
+	request->method = -1;
 	for (i = 0; i < sizeof(methodNames) / sizeof(*methodNames); i++) {
 		if (http_startsWith(recvbuf, methodNames[i])) {
 			urlStr = recvbuf + strlen(methodNames[i]) + 2; // skip method name plus space, plus slash
@@ -637,38 +955,43 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	}
 	// i.e. not received
 	request->contentLength = -1;
+	// one pass over header lines, picks the ones server and handlers need
 	headers = p;
-	if (headers != 0) {
-		do {
-			p = strchr(headers, '\r');
-			if (p != headers) {
-				if (p) {
-					if (request->numheaders < MAX_HEADERS) {
-						request->headers[request->numheaders] = headers;
-						request->numheaders++;
-					}
-					// pick out contentLength
-					if (!my_strnicmp(headers, "Content-Length:", 15)) {
-						request->contentLength = atoi(headers + 15);
-					}
-
-					*p = 0;
-					p++; // past \r
-					p++; // past \n
-					headers = p;
-				}
-				else {
-					break;
-				}
-			}
-			if (*p == '\r') {
-				// end of headers
-				*p = 0;
-				p++;
-				p++;
-				break;
-			}
-		} while (1);
+	while (headers != 0 && *headers != '\r' && *headers != 0) {
+		p = strchr(headers, '\r');
+		if (p == 0) {
+			// last line is not complete
+			headers = 0;
+			break;
+		}
+		*p = 0;
+		if (request->numheaders < MAX_HEADERS) {
+			request->headers[request->numheaders] = headers;
+			request->numheaders++;
+		}
+		switch (HTTP_GetHeaderId(headers, &value)) {
+		case HTTP_HEADER_CONTENT_LENGTH:
+			request->contentLength = atoi(value);
+			break;
+		case HTTP_HEADER_CONNECTION:
+			request->connection = (char*)value;
+			break;
+		case HTTP_HEADER_AUTHORIZATION:
+			request->authorization = (char*)value;
+			break;
+		case HTTP_HEADER_IF_NONE_MATCH:
+			request->ifNoneMatch = (char*)value;
+			break;
+		}
+		headers = p + 2; // past \r\n
+	}
+	if (headers != 0 && *headers == '\r') {
+		// end of headers
+		*headers = 0;
+		p = headers + 2;
+	}
+	else {
+		p = 0;
 	}
 
 	if (p == 0) {
@@ -686,55 +1009,21 @@ int HTTP_ProcessPacket(http_request_t* request) {
 	return http_fn_empty_url(request);
 #endif
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	for (i = 0; i < numCallbacks; i++) {
-		char* url = callbacks[i]->url;
-		if (http_startsWith(urlStr, &url[1])) {
-			int method = callbacks[i]->method;
-			if (method == HTTP_ANY || method == request->method) {
-				return callbacks[i]->callback(request);
-			}
-		}
+	// look for a page or callback with this URL and method, or HTTP_ANY.
+	// Routes are never removed, so found one can be used without the lock
+	HTTP_LockRoutes();
+	route = HTTP_FindRoute(urlStr, strcspn(urlStr, "?"), request->method, &bPathFound);
+	HTTP_UnlockRoutes();
+	if (route) {
+		return route->callback(request);
+	}
+	if (bPathFound) {
+		request->responseCode = HTTP_RESPONSE_METHOD_NOT_ALLOWED;
+		http_setup(request, httpMimeTypeText);
+		poststr(request, "Method not allowed");
+		poststr(request, NULL);
+		return 0;
 	}
-	if (http_checkUrlBase(urlStr, "")) return http_fn_empty_url(request);
-
-	if (http_checkUrlBase(urlStr, "testmsg")) return http_fn_testmsg(request);
-	if (http_checkUrlBase(urlStr, "index")) return http_fn_index(request);
-
-	if (http_checkUrlBase(urlStr, "about")) return http_fn_about(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_mqtt")) return http_fn_cfg_mqtt(request);
-	if (http_checkUrlBase(urlStr, "cfg_mqtt_set")) return http_fn_cfg_mqtt_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_webapp")) return http_fn_cfg_webapp(request);
-	if (http_checkUrlBase(urlStr, "cfg_webapp_set")) return http_fn_cfg_webapp_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_wifi")) return http_fn_cfg_wifi(request);
-	if (http_checkUrlBase(urlStr, "cfg_name")) return http_fn_cfg_name(request);
-	if (http_checkUrlBase(urlStr, "cfg_wifi_set")) return http_fn_cfg_wifi_set(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_loglevel_set")) return http_fn_cfg_loglevel_set(request);
-	if (http_checkUrlBase(urlStr, "cfg_mac")) return http_fn_cfg_mac(request);
-
-	if (http_checkUrlBase(urlStr, "flash_read_tool")) return http_fn_flash_read_tool(request);
-	if (http_checkUrlBase(urlStr, "uart_tool")) return http_fn_uart_tool(request);
-	if (http_checkUrlBase(urlStr, "cmd_tool")) return http_fn_cmd_tool(request);
-	if (http_checkUrlBase(urlStr, "startup_command")) return http_fn_startup_command(request);
-	if (http_checkUrlBase(urlStr, "cfg_generic")) return http_fn_cfg_generic(request);
-	if (http_checkUrlBase(urlStr, "cfg_startup")) return http_fn_cfg_startup(request);
-	if (http_checkUrlBase(urlStr, "cfg_dgr")) return http_fn_cfg_dgr(request);
-
-	if (http_checkUrlBase(urlStr, "ha_cfg")) return http_fn_ha_cfg(request);
-	if (http_checkUrlBase(urlStr, "ha_discovery")) return http_fn_ha_discovery(request);
-	if (http_checkUrlBase(urlStr, "cfg")) return http_fn_cfg(request);
-
-	if (http_checkUrlBase(urlStr, "cfg_pins")) return http_fn_cfg_pins(request);
-	if (http_checkUrlBase(urlStr, "cfg_ping")) return http_fn_cfg_ping(request);
-
-	if (http_checkUrlBase(urlStr, "ota")) return http_fn_ota(request);
-	if (http_checkUrlBase(urlStr, "ota_exec")) return http_fn_ota_exec(request);
-	if (http_checkUrlBase(urlStr, "cm")) return http_fn_cm(request);
-
 	return http_fn_other(request);
 }
 
@@ -748,13 +1037,96 @@ See https://github.com/openshwprojects/OpenBK7231T_App/blob/main/BUILDING.md for
 */
 
 //region_start htmlHeadStyle
-const char htmlHeadStyle[] = "<style>div,fieldset,input,select{padding:5px;font-size:1em;margin:0 0 .2em}fieldset{background:#4f4f4f}p{margin:.5em 0}input{width:100%;box-sizing:border-box;-webkit-box-sizing:border-box;-moz-box-sizing:border-box;background:#ddd;color:#000}form{margin-bottom:.5em}input[type=checkbox],input[type=radio]{width:1em;margin-right:6px;vertical-align:-1px}input[type=range]{width:99%}select{width:100%;background:#ddd;color:#000}textarea{resize:vertical;width:98%;height:318px;padding:5px;overflow:auto;background:#1f1f1f;color:#65c115}body{text-align:center;font-family:verdana,sans-serif}body,h1 a{background:#21333e;color:#eaeaea}td{padding:0}button,input[type=submit]{border:0;border-radius:.3rem;background:#1fa3ec;color:#faffff;line-height:2.4rem;font-size:1.2rem;cursor:pointer}input[type=submit]{width:100%;transition-duration:.4s}input[type=submit]:hover{background:#0e70a4}.bred{background:#d43535!important}.bred:hover{background:#931f1f!important}.bgrn{background:#47c266!important}.bgrn:hover{background:#5aaf6f!important}a{color:#1fa3ec;text-decoration:none}.p{float:left;text-align:left}.q{float:right;text-align:right}.r{border-radius:.3em;padding:2px;margin:6px 2px;background:linear-gradient(90deg,#ffa000,#a6d1ff)}.hf{display:none}.hdiv{width:95%;white-space:nowrap}.hele{width:210px;display:inline-block;margin-left:2px}div#state{padding:0}div#changed{padding:0;height:23px}div#main{text-align:left;display:inline-block;color:#eaeaea;min-width:340px;max-width:800px}table{table-layout:fixed;width:100%}.disp-none{display:none}.disp-inline{display:inline-block}.safe{color:red}form.indent{padding-left:16px}li{margin:5px 0}.off,.on{text-align:center;font-size:54px}.on{font-weight:700}</style>";
+// style.css: 1693 bytes minified, 761 bytes gzipped
+const unsigned char htmlHeadStyle[] = {
+	0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x75,0x55,0x61,0x8f,0xa3,0x2c,0x10,0xfe,0x2b,0xbd,0x34,0x9b,0xdc,0x25,
+	0x4a,0xb0,0xd6,0xee,0x2e,0xe6,0xfd,0x25,0x97,0xfd,0x30,0xca,0xa0,0x64,0x15,0x78,0x11,0x5b,0x7a,0x86,0xff,0x7e,0xc1,0xea,
+	0x9e,0x6d,0xba,0x21,0x69,0xca,0xc0,0xcc,0xf3,0xcc,0x33,0x33,0xc8,0xe5,0x39,0x11,0x12,0x3b,0x3e,0xa0,0x4b,0xa4,0x32,0xa3,
+	0x4b,0x06,0xec,0xb0,0x76,0x93,0x01,0xce,0xa5,0x6a,0x58,0x61,0x7c,0x29,0xb4,0x72,0xe9,0x20,0xff,0x20,0xcb,0xb0,0x2f,0x7b,
+	0xb0,0x8d,0x54,0x8c,0xee,0xe8,0x8e,0x1c,0xb0,0x0f,0xab,0xff,0x54,0x41,0xfd,0xd9,0x58,0x3d,0x2a,0xce,0xf6,0x47,0x11,0x57,
+	0x30,0xd3,0x72,0x9b,0x14,0xd8,0xef,0x68,0x98,0x21,0xa6,0x8b,0xe4,0xae,0x65,0x19,0xa5,0x2f,0x65,0xa5,0x7d,0x8c,0x1c,0x91,
+	0x2a,0x6d,0x39,0xda,0xb4,0xd2,0xbe,0x4c,0x2f,0x58,0x7d,0x4a,0x97,0x7e,0x73,0xda,0xeb,0x3f,0xdf,0x1c,0x6d,0x29,0x70,0xce,
+	0xcb,0x5a,0x77,0xda,0xb2,0x3d,0xa5,0x34,0x08,0x6d,0xfb,0x85,0x4d,0x5a,0x69,0xe7,0x74,0x3f,0x93,0xba,0x51,0xfa,0xed,0xae,
+	0x06,0xff,0xab,0x5b,0xac,0x3f,0x2b,0xed,0x3f,0x92,0x8d,0xd1,0x02,0x97,0xfa,0x63,0xe5,0xfc,0x95,0x7f,0x6a,0x65,0xd3,0x3a,
+	0x76,0x32,0xbe,0x3c,0xa3,0x75,0xb2,0x86,0x2e,0x85,0x4e,0x36,0x8a,0xa5,0x99,0xf1,0xe1,0x2e,0x80,0x6a,0x70,0x0d,0xf0,0xfe,
+	0xfe,0x12,0x16,0x85,0xb7,0x2a,0x7c,0x4f,0xdb,0xa1,0x77,0x60,0x11,0x26,0x8b,0x73,0x05,0x56,0xb0,0x72,0x89,0xf7,0xf6,0x52,
+	0xb6,0x38,0x53,0xc9,0xb3,0x37,0xe3,0xcb,0x6d,0xdd,0xf4,0x19,0xad,0xe8,0xf4,0x85,0xc1,0xe8,0xf4,0x1d,0x48,0x26,0xe2,0x5a,
+	0x71,0x4e,0x45,0x9d,0x65,0x45,0xa8,0x34,0xbf,0x4e,0x11,0x6f,0x49,0xa4,0x46,0xe5,0xd0,0xde,0xaa,0x2f,0xa0,0x97,0xdd,0x35,
+	0xa2,0x73,0x50,0x90,0x0c,0xa0,0x86,0x74,0x40,0x2b,0xc5,0xec,0x95,0xb4,0xd9,0x0e,0xee,0xea,0x7f,0xc8,0xf2,0x3c,0xc7,0x15,
+	0x00,0x21,0xae,0xe0,0xf8,0x57,0x5b,0xd1,0x50,0x8d,0xce,0x69,0xb5,0x55,0x7a,0x18,0xab,0x5e,0xba,0x8f,0xe9,0x56,0x4f,0x46,
+	0xcb,0xa5,0xb0,0xb1,0x02,0xe3,0xc0,0x48,0x6e,0xb1,0x7f,0xc8,0x02,0x72,0xac,0x57,0x10,0x01,0x42,0x08,0x51,0x76,0x52,0x61,
+	0xba,0x48,0x72,0x20,0xc7,0xe8,0xb3,0xe9,0x5f,0x72,0x88,0x86,0x7a,0xb4,0x83,0xb6,0xcc,0x68,0x19,0x33,0x0c,0x4f,0x38,0x6c,
+	0x8a,0xe3,0x2c,0xa8,0x41,0x3a,0xa9,0x55,0xca,0x47,0x0b,0xf1,0x0f,0x23,0xc7,0xe1,0x89,0x17,0x6b,0xa3,0xe2,0x77,0x3a,0x50,
+	0x7c,0xa5,0x70,0x0c,0xa4,0xb2,0xc8,0xef,0x0e,0xf8,0x31,0x2f,0xf2,0xe2,0x87,0xec,0x8d,0xb6,0x0e,0x94,0xbb,0x5d,0x79,0x12,
+	0xe1,0x3d,0x8f,0xa5,0xba,0xbb,0xd8,0x58,0x75,0x3f,0x6c,0xaf,0xf5,0xe1,0x74,0x7a,0xbc,0xf2,0x24,0x56,0x01,0x20,0x4e,0xdb,
+	0x58,0x30,0x2d,0xe2,0x2d,0x52,0xce,0xd5,0xe7,0x58,0xeb,0x25,0x4f,0xa5,0x15,0x06,0x62,0x26,0xd1,0x69,0x70,0xac,0x43,0xe1,
+	0xca,0x4d,0x83,0xc4,0x7d,0x20,0xff,0x2f,0xa7,0xf3,0x40,0x6c,0x8f,0x67,0x43,0x20,0x76,0x7a,0xac,0x23,0xf6,0x5f,0x6d,0x7a,
+	0x30,0x7e,0x7d,0x50,0x4e,0xc6,0xef,0xe2,0x76,0x43,0x38,0xd6,0x12,0x6c,0xda,0x44,0x4f,0x54,0xee,0xe7,0x3b,0xe5,0xd8,0x24,
+	0x7b,0x21,0x80,0x52,0x9a,0xec,0xe1,0xc4,0x33,0x21,0x7e,0x05,0xd2,0x8a,0x89,0xcb,0xc1,0x74,0x70,0x5d,0x18,0xb7,0x5c,0x9e,
+	0xd7,0x89,0x2b,0x5e,0xca,0x4b,0x2b,0x1d,0xa6,0x83,0x81,0x1a,0x99,0xd2,0x17,0x0b,0x26,0x90,0x16,0x3b,0x5c,0xae,0x1c,0x32,
+	0x6a,0x7c,0xb9,0x46,0x90,0x6a,0x6e,0xa1,0xaa,0xd3,0xf5,0xe7,0x3a,0xec,0x31,0xd3,0xc8,0x35,0x70,0x79,0xde,0x0f,0x0e,0x1c,
+	0x6e,0x3a,0x39,0xda,0xea,0x36,0x4e,0xf9,0xa6,0xbf,0xd7,0xa9,0x3c,0xe4,0x8b,0x57,0x0f,0x52,0x4d,0x0f,0xe2,0x3d,0xc7,0xbc,
+	0x1b,0x9a,0xb2,0x97,0x2a,0xbd,0xd1,0xcc,0x8f,0x74,0x56,0xcb,0x2f,0xfb,0x37,0x4a,0x8d,0x0f,0x0e,0xaa,0x0e,0xa7,0xf9,0x37,
+	0xed,0xe0,0xaa,0x47,0xc7,0x84,0xf4,0xc8,0xcb,0x7f,0x2d,0x1c,0x48,0xc4,0x49,0xa3,0x34,0x0f,0x3a,0xcd,0xf6,0x1b,0xf8,0xf4,
+	0x8c,0x4b,0x20,0x03,0x08,0x5c,0x9a,0xc4,0x22,0x9f,0x5f,0x51,0x22,0x15,0x47,0xf5,0xf5,0x89,0xb8,0x89,0x93,0x9d,0x8c,0x0f,
+	0x9d,0x5c,0xdf,0xfb,0xc2,0xf8,0x1d,0x0d,0x44,0x0b,0x91,0x10,0xad,0xbe,0x7b,0x55,0xe6,0x99,0x2c,0x8e,0xc6,0x87,0x78,0x69,
+	0x36,0x5d,0x6e,0xb2,0xbd,0x52,0x1a,0xfe,0x02,0xb0,0xd4,0x79,0x7e,0x9d,0x06,0x00,0x00,
+};
+const int htmlHeadStyle_len = 761;
+const char htmlHeadStyle_etag[] = "21a9d1953265aca2";
 //region_end htmlHeadStyle
 
 //region_start pageScript
-const char pageScript[] = "<script type='text/javascript'>var firstTime,lastTime,onlineFor,req=null,onlineForEl=null,getElement=e=>document.getElementById(e);function showState(){clearTimeout(firstTime),clearTimeout(lastTime),null!=req&&req.abort(),(req=new XMLHttpRequest).onreadystatechange=()=>{var e;4==req.readyState&&\"OK\"==req.statusText&&((\"INPUT\"!=document.activeElement.tagName||\"number\"!=document.activeElement.type&&\"color\"!=document.activeElement.type)&&(e=getElement(\"state\"))&&(e.innerHTML=req.responseText),clearTimeout(firstTime),clearTimeout(lastTime),lastTime=setTimeout(showState,3e3))},req.open(\"GET\",\"index?state=1\",!0),req.send(),firstTime=setTimeout(showState,3e3)}function fmtUpTime(e){var t,n,o=Math.floor(e/86400);return e%=86400,t=Math.floor(e/3600),e%=3600,n=Math.floor(e/60),e=e%60,0<o?o+` days, ${t} hours, ${n} minutes and ${e} seconds`:0<t?t+` hours, ${n} minutes and ${e} seconds`:0<n?n+` minutes and ${e} seconds`:`just ${e} seconds`}function updateOnlineFor(){onlineForEl.textContent=fmtUpTime(++onlineFor)}function onLoad(){(onlineForEl=getElement(\"onlineFor\"))&&(onlineFor=parseInt(onlineForEl.dataset.initial,10))&&setInterval(updateOnlineFor,1e3),showState()}function submitTemperature(e){var t=getElement(\"form132\");getElement(\"kelvin132\").value=Math.round(1e6/parseInt(e.value)),t.submit()}window.addEventListener(\"load\",onLoad),history.pushState(null,\"\",window.location.pathname.slice(1)),setTimeout(()=>{var e=getElement(\"changed\");e&&(e.innerHTML=\"\")},5e3);</script>";
+// script.js: 1443 bytes minified, 694 bytes gzipped
+const unsigned char pageScript[] = {
+	0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x8d,0x54,0x6d,0x4f,0xdb,0x30,0x10,0xfe,0x2b,0xc1,0x1a,0x95,0xad,0x5a,
+	0x26,0x5d,0x59,0x35,0xad,0x04,0xa4,0x4d,0x6c,0xa0,0xc1,0x36,0x6d,0x45,0xda,0xc7,0x9a,0xf8,0x4a,0xbd,0x25,0xe7,0x60,0x9f,
+	0x0b,0x55,0xd7,0xff,0x3e,0x25,0x81,0xb4,0x45,0x1a,0xec,0xdb,0xf9,0xb9,0xc7,0xbe,0xe7,0xde,0xbc,0xd0,0x3e,0x99,0x59,0x1f,
+	0x68,0x62,0x4b,0x90,0x85,0x7e,0x30,0x1c,0x16,0x16,0xe1,0xa3,0xf3,0xd2,0xc3,0x6d,0x86,0xb1,0x28,0x36,0xd0,0x69,0xd1,0x02,
+	0x37,0x40,0xa7,0x05,0x94,0x80,0x94,0x41,0x76,0x6c,0x5c,0x1e,0x6b,0x5b,0x6d,0xe0,0xf7,0xcb,0x73,0xc3,0x41,0x8c,0x67,0x11,
+	0x73,0xb2,0x0e,0x93,0x30,0x77,0x77,0x3f,0x48,0x13,0x70,0xb1,0xca,0x0b,0xd0,0xbe,0x8e,0xe5,0x22,0xf1,0x4e,0x81,0x90,0x3b,
+	0xf8,0xa3,0x1e,0x21,0xeb,0x88,0x7b,0x99,0x87,0xdb,0x5e,0xcf,0xc3,0xad,0xd2,0xd7,0xce,0x13,0x17,0x92,0x37,0xf2,0xe0,0x2e,
+	0xf9,0x79,0x79,0x71,0x46,0x54,0x7d,0x87,0xdb,0x08,0x81,0x84,0x72,0xe8,0x41,0x9b,0x65,0xa8,0xa3,0xe5,0x73,0x8d,0x37,0x90,
+	0x71,0x91,0x1d,0xaf,0x16,0xda,0x27,0x30,0x3e,0xcc,0xea,0xa7,0x54,0x43,0x69,0x04,0xf5,0x7a,0xec,0xeb,0x67,0xd6,0xa2,0xf5,
+	0x9d,0x18,0x26,0x70,0x4f,0xbd,0x1e,0xe7,0xec,0xfc,0xcb,0xb7,0xab,0x09,0xdb,0xcb,0xba,0x04,0x75,0x4e,0x76,0x01,0x0f,0x39,
+	0x2a,0xd2,0x37,0x5f,0x74,0x09,0x7f,0xfe,0x30,0x8c,0xe5,0x35,0xf8,0x67,0x98,0xcb,0xaa,0x8e,0x93,0xbb,0xc2,0xbd,0xc0,0x12,
+	0xbd,0x1e,0x87,0x6c,0x53,0x48,0xce,0x9a,0x3c,0x98,0x68,0x1c,0xca,0x22,0x82,0x3f,0x9b,0x5c,0x5e,0x3c,0x24,0x11,0x2a,0x87,
+	0x01,0x6a,0xc1,0x4f,0xca,0xf7,0x72,0x59,0x1f,0xad,0x2c,0x00,0x3d,0x7a,0xbb,0x2e,0xc9,0x21,0x0c,0x85,0x58,0xd7,0x23,0xa0,
+	0x5c,0x05,0xc8,0xd9,0xa7,0xd3,0x09,0x93,0xcc,0xa2,0x81,0xfb,0x93,0x46,0x52,0x36,0x60,0x72,0x2f,0x15,0x0d,0x25,0x00,0x1a,
+	0x2e,0x64,0x17,0xf4,0xdf,0x6f,0xae,0xbb,0x89,0x98,0x95,0x74,0x55,0xd5,0x24,0x0e,0xa2,0xe9,0x0d,0x49,0x94,0x2e,0xbb,0xd4,
+	0x34,0x57,0xb3,0xc2,0x39,0xcf,0xe1,0xe0,0xed,0xe8,0x30,0x4d,0xc5,0xd8,0x03,0x45,0x8f,0x09,0xec,0x67,0x0d,0x20,0x69,0x97,
+	0x35,0x1c,0xa5,0xa9,0x90,0xb0,0x9f,0xd5,0x86,0xc4,0x5d,0xe7,0xa8,0x76,0x65,0xb0,0x3f,0x4a,0x65,0x7a,0xe4,0x4e,0x5c,0x7f,
+	0x9a,0x18,0xbd,0x0c,0x32,0x79,0xb5,0xa2,0x75,0x32,0x77,0xd1,0x37,0x36,0xae,0x93,0xd2,0x62,0x24,0x08,0x89,0x46,0x93,0xbc,
+	0x5a,0xc1,0x3a,0x09,0x90,0x3b,0x34,0x61,0xfa,0x2e,0x3d,0xa2,0x13,0xea,0x4f,0xff,0x9b,0x8d,0x27,0xd8,0x9f,0x3e,0xc3,0x98,
+	0xfe,0x8a,0x81,0x76,0xb1,0x4d,0x5d,0x62,0x65,0x34,0xc1,0xd7,0xc7,0x95,0xe3,0x62,0xb5,0xb5,0x7e,0x8a,0xe0,0x9e,0x3e,0x38,
+	0xa4,0x7a,0xf5,0x36,0x15,0xec,0xf7,0x3b,0xce,0x56,0x85,0x1d,0x5e,0x38,0x6d,0xb8,0x58,0xf1,0xed,0x05,0xde,0x9e,0xad,0x0e,
+	0x6f,0xe7,0xab,0x3b,0x66,0x95,0xf6,0x01,0xce,0x91,0xb6,0x6f,0x2a,0xa3,0x49,0x07,0x20,0x65,0xd1,0x92,0xd5,0x85,0x1c,0xa4,
+	0xf5,0xad,0x00,0x74,0x8e,0x04,0x7e,0xa1,0x0b,0xfe,0x44,0xbb,0x1c,0xc0,0x50,0xc8,0xad,0xd5,0xdf,0x68,0x0b,0xf1,0xba,0xb4,
+	0x34,0x81,0xb2,0x02,0xaf,0x29,0xfa,0xcd,0x14,0xec,0x08,0x9c,0x39,0x5f,0x0e,0x86,0xaf,0x99,0x18,0x6f,0xa3,0xbf,0xa1,0x58,
+	0x58,0x6c,0x70,0xb5,0xd0,0x45,0x84,0xb6,0xe5,0xde,0x45,0x34,0x7c,0x00,0xa3,0x83,0x4e,0x3e,0xb4,0x7e,0x21,0x24,0xa9,0x36,
+	0x24,0x17,0xeb,0x3b,0x8b,0xc6,0xdd,0x29,0x6d,0xcc,0xe9,0x02,0x90,0x2e,0x6c,0x20,0x40,0xf0,0x9c,0x15,0x4e,0x1b,0x26,0xdb,
+	0xb2,0x09,0x39,0xb7,0x81,0x9c,0x5f,0xaa,0x2a,0x86,0x79,0xab,0xbf,0xf9,0xfb,0x18,0x93,0x0f,0x0f,0x14,0x2e,0xd7,0x75,0x32,
+	0xaa,0xd2,0x34,0x47,0x5d,0x82,0x0a,0x85,0xcd,0x81,0x0f,0x84,0x90,0x5b,0x0b,0xb0,0xf9,0x7c,0x76,0x52,0x6b,0xbf,0x26,0xc3,
+	0xc4,0x18,0x9e,0xac,0x36,0x63,0x62,0x2d,0xdf,0xc0,0x50,0x8c,0xff,0x02,0xc1,0x19,0x54,0x13,0xa3,0x05,0x00,0x00,
+};
+const int pageScript_len = 694;
+const char pageScript_etag[] = "47298af7ba3701e9";
 //region_end pageScript
 
 //region_start ha_discovery_script
-const char ha_discovery_script[] = "<script type='text/javascript'>function send_ha_disc(){var e=new XMLHttpRequest;e.open(\"GET\",\"/ha_discovery?prefix=\"+document.getElementById(\"ha_disc_topic\").value,!1),e.onload=function(){200===e.status?alert(e.responseText):404===e.status&&alert(\"Error invoking ha_discovery\")},e.onerror=function(){alert(\"Error invoking ha_discovery\")},e.send()}</script>";
+// script_ha_discovery.js: 316 bytes minified, 222 bytes gzipped
+const unsigned char ha_discovery_script[] = {
+	0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x8d,0x90,0xc1,0x4b,0xc3,0x30,0x1c,0x85,0xff,0x95,0x98,0xc3,0x48,0xb0,
+	0xc4,0x3a,0x76,0x52,0xc2,0x40,0x28,0x2a,0xe8,0x45,0x76,0xf0,0x56,0x42,0xf3,0x3a,0x83,0x35,0x89,0xc9,0x2f,0x75,0x63,0xec,
+	0x7f,0x1f,0xd5,0x1e,0x7a,0xf4,0xf6,0x0e,0xdf,0xe3,0x7b,0xbc,0xbe,0xf8,0x8e,0x5c,0xf0,0x2c,0xc3,0xdb,0xf6,0xc3,0xb4,0xd6,
+	0xe5,0x4e,0xc8,0xd3,0x68,0x12,0x83,0xf6,0xf8,0x61,0xef,0xaf,0x2f,0x4f,0x44,0xf1,0x0d,0xdf,0x05,0x99,0xee,0xa1,0x42,0x84,
+	0x17,0xfc,0xb1,0xd9,0xf1,0x8a,0xdf,0xcc,0x8d,0x30,0x22,0x1d,0xb7,0x31,0xa1,0x77,0x07,0xcd,0xaf,0x6d,0xe8,0xca,0x17,0x3c,
+	0xa9,0x3d,0xa8,0x19,0x30,0xc5,0x87,0xe3,0xb3,0x15,0x7c,0xc6,0x5b,0x0a,0xd1,0x75,0x5c,0xaa,0xd1,0x0c,0x05,0xd5,0xd5,0xad,
+	0xac,0xa0,0x82,0x1f,0x82,0xb1,0xba,0x9f,0x17,0x09,0x79,0x5a,0xd7,0xb5,0xd6,0x1a,0x2a,0x93,0xa1,0x92,0xb7,0x66,0x40,0x22,
+	0x01,0x95,0x90,0x63,0xf0,0x19,0x3b,0x1c,0x48,0xde,0x6d,0xea,0xcd,0x02,0x5a,0xad,0xfe,0x28,0xde,0xa4,0x14,0x12,0x73,0x7e,
+	0x0c,0x9f,0xce,0xef,0xd9,0x72,0x27,0x97,0xe7,0x5f,0x1d,0x26,0x64,0xe9,0xfb,0x6f,0x75,0xfa,0x4a,0xc8,0xf3,0x05,0x6d,0x45,
+	0x1a,0xc7,0x3c,0x01,0x00,0x00,
+};
+const int ha_discovery_script_len = 222;
+const char ha_discovery_script_etag[] = "1ab921f71ac76e3a";
 //region_end ha_discovery_script
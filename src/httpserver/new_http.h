@@ -21,12 +21,21 @@ extern const char* htmlPinRoleNames[];
 
 extern const char* g_build_str;
 
-extern const char htmlHeadStyle[];
-extern const char pageScript[];
-extern const char ha_discovery_script[];
+// gzipped by gulp, served as /style.css, /script.js and /ha_discovery.js
+extern const unsigned char htmlHeadStyle[];
+extern const int htmlHeadStyle_len;
+extern const char htmlHeadStyle_etag[];
+extern const unsigned char pageScript[];
+extern const int pageScript_len;
+extern const char pageScript_etag[];
+extern const unsigned char ha_discovery_script[];
+extern const int ha_discovery_script_len;
+extern const char ha_discovery_script_etag[];
 
 #define HTTP_RESPONSE_OK 200
+#define HTTP_RESPONSE_NOT_MODIFIED 304
 #define HTTP_RESPONSE_NOT_FOUND 404
+#define HTTP_RESPONSE_METHOD_NOT_ALLOWED 405
 #define HTTP_RESPONSE_SERVER_ERROR 500
 
 #define MAX_QUERY 16
@@ -47,6 +56,10 @@ typedef struct http_request_tag {
 	char* bodystart; /// start start of the body (maybe all of it)
 	int bodylen;
 	int contentLength;
+	// values of these headers, or 0 if there were none
+	char* connection;
+	char* authorization;
+	char* ifNoneMatch;
 	int responseCode;
 
 	// used to respond
@@ -54,19 +67,51 @@ typedef struct http_request_tag {
 	int replylen;
 	int replymaxlen;
 	int fd;
+
+	// set by server if connection can stay open, then http_setup starts chunked reply
+	int bKeepAlive;
+	// reply after headers is sent as chunks, server must end it with HTTP_FinishReply
+	int bChunked;
+	// client can tell where reply ends, from chunks or Content-Length, so connection can stay open
+	int bDelimited;
+	// bytes at start of reply buffer that are headers and were not sent yet
+	int headersLen;
+	// used instead of send() if set, for example by selftests
+	int (*sendFn)(int fd, const char* data, int len);
+	// connection the request came on, see HTTP_ReadBody
+	void* conn;
 } http_request_t;
 
 
 int HTTP_ProcessPacket(http_request_t* request);
 void http_setup(http_request_t* request, const char* type);
+// like http_setup, but body length is known, extraHeaders are 0 or lines ending with \r\n
+void http_setup_sized(http_request_t* request, const char* type, const char* extraHeaders, int contentLength);
 void http_html_start(http_request_t* request, const char* pagename);
 void http_html_end(http_request_t* request);
 int poststr(http_request_t* request, const char* str);
 void poststr_escaped(http_request_t* request, char* str);
 int postany(http_request_t* request, const char* str, int len);
+// sends what is left of reply, lenret is what handler returned
+void HTTP_FinishReply(http_request_t* request, int lenret);
+void HTTP_InitRoutes();
+// reads next part of body after bodystart/bodylen, also when body is chunked
+// returns number of bytes, 0 after end of body, -1 if connection failed
+// blocks until data comes or HTTP_BODY_TIMEOUT_MS passes, other clients are not served meanwhile
+int HTTP_ReadBody(http_request_t* request, char* buf, int maxLen);
 void misc_formatUpTimeString(int totalSeconds, char* o);
 // void HTTP_AddBuildFooter(http_request_t *request);
 // void HTTP_AddHeader(http_request_t *request);
+typedef enum {
+	HTTP_HEADER_OTHER,
+	HTTP_HEADER_CONTENT_LENGTH,
+	HTTP_HEADER_CONNECTION,
+	HTTP_HEADER_AUTHORIZATION,
+	HTTP_HEADER_TRANSFER_ENCODING,
+	HTTP_HEADER_IF_NONE_MATCH,
+} httpHeaderId_t;
+// tells which of headers needed by server the line is, value is set to where its value starts
+int HTTP_GetHeaderId(const char* line, const char** value);
 int http_getArg(const char* base, const char* name, char* o, int maxSize);
 int http_getArgInteger(const char* base, const char* name);
 
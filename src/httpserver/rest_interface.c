@@ -576,14 +576,15 @@ static int http_rest_post_lfs_file(http_request_t* request) {
 				//ADDLOG_DEBUG(LOG_FEATURE_API, "%d bytes written", len);
 			}
 			towrite -= len;
-			if (towrite > 0) {
+			// chunked body has no Content-Length, it's read until it ends
+			if (towrite > 0 || request->contentLength < 0) {
 				writebuf = request->received;
-				writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
+				writelen = HTTP_ReadBody(request, writebuf, request->receivedLenmax);
 				if (writelen < 0) {
-					ADDLOG_DEBUG(LOG_FEATURE_API, "recv returned %d - end of data - remaining %d", writelen, towrite);
+					ADDLOG_DEBUG(LOG_FEATURE_API, "HTTP_ReadBody returned %d - end of data - remaining %d", writelen, towrite);
 				}
 			}
-		} while ((towrite > 0) && (writelen >= 0));
+		} while ((towrite > 0 || request->contentLength < 0) && (writelen > 0));
 
 		// no more data
 		lfs_file_truncate(&lfs, file, total);
@@ -736,7 +737,15 @@ static int http_rest_get_logconfig(http_request_t* request) {
 			hprintf255(request, "\"%s\"", logfeaturenames[i]);
 		}
 	}
-	poststr(request, "]}");
+	poststr(request, "],\"readers\":{");
+	for (i = 0; i < LOG_READER_MAX; i++) {
+		unsigned int lag, maxLag, lost, read;
+
+		LOG_GetReaderStats(i, &lag, &maxLag, &lost, &read);
+		hprintf255(request, "%s\"%s\":{\"lag\":%u,\"maxLag\":%u,\"lost\":%u,\"read\":%u}",
+			i ? "," : "", logreadernames[i], lag, maxLag, lost, read);
+	}
+	poststr(request, "}}");
 	poststr(request, NULL);
 	return 0;
 }
@@ -1230,9 +1239,9 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 		if (towrite > 0) {
 			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				sprintf(error_message, "recv returned %d - end of data - remaining %d", writelen, towrite);
+			writelen = HTTP_ReadBody(request, writebuf, request->receivedLenmax);
+			if (writelen <= 0) {
+				sprintf(error_message, "HTTP_ReadBody returned %d - end of data - remaining %d", writelen, towrite);
 				nRetCode = -17;
 			}
 		}
@@ -1241,7 +1250,7 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 	tls_mem_free(Buffer);
 
 	if (nRetCode != 0) {
-		ADDLOG_ERROR(LOG_FEATURE_OTA, error_message);
+		ADDLOG_ERROR(LOG_FEATURE_OTA, "%s", error_message);
 		socket_fwup_err(0, nRetCode);
 		return http_rest_error(request, nRetCode, error_message);
 	}
@@ -1386,12 +1395,12 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 
 		if (towrite > 0) {
 			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				ADDLOG_DEBUG(LOG_FEATURE_OTA, "recv returned %d - end of data - remaining %d", writelen, towrite);
+			writelen = HTTP_ReadBody(request, writebuf, request->receivedLenmax);
+			if (writelen <= 0) {
+				ADDLOG_DEBUG(LOG_FEATURE_OTA, "HTTP_ReadBody returned %d - end of data - remaining %d", writelen, towrite);
 			}
 		}
-	} while ((towrite > 0) && (writelen >= 0));
+	} while ((towrite > 0) && (writelen > 0));
 
 	if (ota_header == 0) {
 		return http_rest_error(request, -20, "No header found");
@@ -1439,12 +1448,12 @@ static int http_rest_post_flash(http_request_t* request, int startaddr, int maxa
 		towrite -= writelen;
 		if (towrite > 0) {
 			writebuf = request->received;
-			writelen = recv(request->fd, writebuf, request->receivedLenmax, 0);
-			if (writelen < 0) {
-				ADDLOG_DEBUG(LOG_FEATURE_OTA, "recv returned %d - end of data - remaining %d", writelen, towrite);
+			writelen = HTTP_ReadBody(request, writebuf, request->receivedLenmax);
+			if (writelen <= 0) {
+				ADDLOG_DEBUG(LOG_FEATURE_OTA, "HTTP_ReadBody returned %d - end of data - remaining %d", writelen, towrite);
 			}
 		}
-	} while ((towrite > 0) && (writelen >= 0));
+	} while ((towrite > 0) && (writelen > 0));
 	close_ota();
 #endif
 
@@ -82,9 +82,18 @@ struct lfs_config cfg = {
     .block_cycles = 500,
 };
 
+static int lfs_bytesWritten = 0;
+static int lfs_blocksErased = 0;
+
 int lfs_present(){
     return lfs_initialised;
 }
+int LFS_GetBytesWritten(){
+    return lfs_bytesWritten;
+}
+int LFS_GetBlocksErased(){
+    return lfs_blocksErased;
+}
 
 static commandResult_t CMD_LFS_Size(const void *context, const char *cmd, const char *args, int cmdFlags){
     if (!args || !args[0]){
@@ -462,6 +471,7 @@ static int lfs_write(const struct lfs_config *c, lfs_block_t block,
     protect = FLASH_PROTECT_ALL;
     flash_ctrl(CMD_FLASH_SET_PROTECT, &protect);
     GLOBAL_INT_RESTORE();
+    lfs_bytesWritten += size;
 
     return res;
 }
@@ -484,6 +494,7 @@ static int lfs_erase(const struct lfs_config *c, lfs_block_t block){
     protect = FLASH_PROTECT_ALL;
     flash_ctrl(CMD_FLASH_SET_PROTECT, &protect);
     GLOBAL_INT_RESTORE();
+    lfs_blocksErased++;
     return res;
 }
 
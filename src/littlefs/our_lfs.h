@@ -37,4 +37,7 @@ void LFSAddCmds();
 void init_lfs(int create);
 void release_lfs();
 int lfs_present();
+// flash usage statistics, since boot
+int LFS_GetBytesWritten();
+int LFS_GetBlocksErased();
 #endif
\ No newline at end of file
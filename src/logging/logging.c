@@ -110,20 +110,104 @@ static void log_serial_thread(beken_thread_arg_t arg);
 static void startSerialLog();
 static void startLogServer();
 
+// must be a power of two
 #define LOGSIZE 4096
 #define LOGPORT 9000
 
 int logTcpPort = LOGPORT;
 
+// Log memory holds records, each starts with LOG_RECORD_HEADER bytes:
+// 2 bytes of total record length, record type, level and feature.
+// Text record is followed by ready line (with prefix and \r\n, without \0).
+// Deferred record is followed by format pointer and raw arguments, it's
+// formatted only when a reader gets to it.
+#define LOG_RECORD_HEADER		5
+#define LOG_RECORD_TEXT			0
+#define LOG_RECORD_DEFERRED		1
+
+// deferred record can't be bigger than that, otherwise line is formatted at once
+#define LOG_DEFERRED_MAX_RECORD	256
+#define LOG_DEFERRED_MAX_ARGS	8
+// cache of parsed format strings, power of two
+#define LOG_FORMAT_CACHE_SIZE	32
+
+typedef enum logArgType_e {
+	LOG_ARG_INT,
+	LOG_ARG_INT64,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STR,
+} logArgType_t;
+
+typedef struct logArg_s {
+	union {
+		int i;
+		long long ll;
+		double d;
+		const void *p;
+		const char *s;
+	} v;
+	// for strings
+	int len;
+} logArg_t;
+
+typedef struct logFormat_s {
+	const char *fmt;
+	byte bDeferrable;
+	byte count;
+	byte types[LOG_DEFERRED_MAX_ARGS];
+} logFormat_t;
+
+// Readers don't take the log mutex. Writer never waits for readers, reader
+// that was too slow sees that its tail is older than logMemory.first and
+// reports lost bytes. Reader state has its own lock, because a reader can be
+// used by more than one task, for example HTTP log by many clients at once.
+typedef struct logReader_s {
+	// sequence number of next record to read
+	unsigned int tail;
+	// number of characters of that record line already read
+	int pos;
+	// formatted deferred line, followed by space for record copy,
+	// allocated when reader gets its first deferred record
+	char* line;
+	int lineLen;
+	// "lost N bytes" line to send before next record
+	char marker[32];
+	int markerLen;
+	int markerPos;
+	unsigned int maxLag;
+	unsigned int lost;
+	unsigned int read;
+	SemaphoreHandle_t mutex;
+} logReader_t;
+
+// must match logReader_e in logging.h
+const char* logreadernames[] = {
+	"serial",
+	"tcp",
+	"http",
+};
+
 static struct tag_logMemory {
 	char log[LOGSIZE];
-	int head;
-	int tailserial;
-	int tailtcp;
-	int tailhttp;
+	// Sequence numbers, that is count of all bytes ever written.
+	// Position in log is sequence modulo LOGSIZE.
+	// head is where next record goes, first is the oldest record still kept.
+	volatile unsigned int head;
+	volatile unsigned int first;
+	logReader_t readers[LOG_READER_MAX];
 	SemaphoreHandle_t mutex;
 } logMemory;
 
+#define LOG_POS(seq) ((seq) & (LOGSIZE - 1))
+
+// store lines of ADDLOG_ macros without formatting them, see logdeferred command
+static int g_logDeferred = 0;
+static int g_logDeferredCount = 0;
+static int g_logFormattedCount = 0;
+static logFormat_t g_logFormats[LOG_FORMAT_CACHE_SIZE];
+static byte g_deferredRecord[LOG_DEFERRED_MAX_RECORD];
+
 
 static int initialised = 0;
 static int tcpLogStarted = 0;
@@ -141,9 +225,17 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 
 static void initLog(void)
 {
+	int i;
+
 	bk_printf("Entering initLog()...\r\n");
-	logMemory.head = logMemory.tailserial = logMemory.tailtcp = logMemory.tailhttp = 0;
+	for (i = 0; i < LOG_READER_MAX; i++) {
+		free(logMemory.readers[i].line);
+	}
+	memset(&logMemory, 0, sizeof(logMemory));
 	logMemory.mutex = xSemaphoreCreateMutex();
+	for (i = 0; i < LOG_READER_MAX; i++) {
+		logMemory.readers[i].mutex = xSemaphoreCreateMutex();
+	}
 	initialised = 1;
 	startSerialLog();
 	HTTP_RegisterCallback("/logs", HTTP_GET, http_getlog);
@@ -169,6 +261,11 @@ static void initLog(void)
 	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("logdelay", log_command, NULL);
+	//cmddetail:{"name":"logdeferred","args":"[0or1]",
+	//cmddetail:"descr":"When enabled, lines logged with ADDLOG_ macros are stored in log memory as format pointer and raw arguments, and they are formatted only when serial, TCP or HTTP log reader gets to them. This makes log calls cheaper and fits more lines in log memory. Without arguments, prints how many lines were deferred and formatted.",
+	//cmddetail:"fn":"log_command","file":"logging/logging.c","requires":"",
+	//cmddetail:"examples":"logdeferred 1"}
+	CMD_RegisterCommand("logdeferred", log_command, NULL);
 
 	bk_printf("Commands registered!\r\n");
 	bk_printf("initLog() done!\r\n");
@@ -227,16 +324,408 @@ void LOG_SetCommandHTTPRedirectReply(http_request_t* request) {
 	}
 #endif
 
-// adds a log to the log memory
-// if head collides with either tail, move the tails on.
-void addLogAdv(int level, int feature, const char* fmt, ...)
+static void LOG_RingWrite(unsigned int seq, const void* data, int len) {
+	int pos, part;
+
+	pos = LOG_POS(seq);
+	part = LOGSIZE - pos;
+	if (part > len) {
+		part = len;
+	}
+	memcpy(logMemory.log + pos, data, part);
+	memcpy(logMemory.log, (const byte*)data + part, len - part);
+}
+static void LOG_RingRead(unsigned int seq, void* out, int len) {
+	int pos, part;
+
+	pos = LOG_POS(seq);
+	part = LOGSIZE - pos;
+	if (part > len) {
+		part = len;
+	}
+	memcpy(out, logMemory.log + pos, part);
+	memcpy((byte*)out + part, logMemory.log, len - part);
+}
+static int LOG_GetRecordLen(unsigned int seq) {
+	byte b[2];
+
+	LOG_RingRead(seq, b, 2);
+	return b[0] | (b[1] << 8);
+}
+// drops oldest records until there is space for len bytes after head
+static void LOG_MakeRoom(unsigned int head, int len) {
+	while (head + len - logMemory.first > LOGSIZE) {
+		logMemory.first += LOG_GetRecordLen(logMemory.first);
+	}
+}
+// puts record into log, must be called with mutex taken
+static void LOG_WriteRecord(const void* header, int headerLen, const void* data, int len) {
+	unsigned int head = logMemory.head;
+
+	LOG_MakeRoom(head, headerLen + len);
+	LOG_RingWrite(head, header, headerLen);
+	LOG_RingWrite(head + headerLen, data, len);
+	// readers can see it only now, when it's complete
+	logMemory.head = head + headerLen + len;
+}
+static void LOG_WriteHeader(byte* h, int len, int type, int level, int feature) {
+	h[0] = len & 0xff;
+	h[1] = len >> 8;
+	h[2] = type;
+	h[3] = level;
+	h[4] = feature;
+}
+
+#define LOG_SPEC_MAX 24
+
+// parses printf conversion that follows '%', returns its length or 0 if it can't be deferred.
+// Types of arguments it takes (including '*' width and precision) are appended to types.
+// If spec is given, it gets the conversion with length modifier matching the stored argument.
+static int LOG_ParseConversion(const char* s, byte* types, int* count, char* spec) {
+	const char* p = s;
+	int n = 1;
+	int lng = 0;
+	byte type;
+
+#define LOG_SPEC_COPY() { if (n >= LOG_SPEC_MAX - 4) return 0; if (spec) spec[n] = *p; n++; p++; }
+	if (spec) {
+		spec[0] = '%';
+	}
+	while (*p && strchr("-+ #0", *p)) {
+		LOG_SPEC_COPY();
+	}
+	if (*p == '*') {
+		if (*count >= LOG_DEFERRED_MAX_ARGS) {
+			return 0;
+		}
+		types[(*count)++] = LOG_ARG_INT;
+		LOG_SPEC_COPY();
+	}
+	while (*p >= '0' && *p <= '9') {
+		LOG_SPEC_COPY();
+	}
+	if (*p == '.') {
+		LOG_SPEC_COPY();
+		if (*p == '*') {
+			if (*count >= LOG_DEFERRED_MAX_ARGS) {
+				return 0;
+			}
+			types[(*count)++] = LOG_ARG_INT;
+			LOG_SPEC_COPY();
+		}
+		while (*p >= '0' && *p <= '9') {
+			LOG_SPEC_COPY();
+		}
+	}
+#undef LOG_SPEC_COPY
+	// length modifiers are not copied, stored argument decides them
+	while (*p && strchr("hlqjzt", *p)) {
+		if (*p == 'l') {
+			lng++;
+		}
+		else if (*p == 'q' || *p == 'j') {
+			lng = 2;
+		}
+		else if ((*p == 'z' || *p == 't') && sizeof(size_t) == 8) {
+			lng = 2;
+		}
+		p++;
+	}
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		if (lng >= 2 || (lng == 1 && sizeof(long) == 8)) {
+			type = LOG_ARG_INT64;
+		}
+		else {
+			type = LOG_ARG_INT;
+		}
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+		type = LOG_ARG_DOUBLE;
+		break;
+	case 'c':
+		if (lng) {
+			return 0;
+		}
+		type = LOG_ARG_INT;
+		break;
+	case 'p':
+		type = LOG_ARG_PTR;
+		break;
+	case 's':
+		if (lng) {
+			return 0;
+		}
+		type = LOG_ARG_STR;
+		break;
+	default:
+		// %n, long double and anything unusual is always formatted at once
+		return 0;
+	}
+	if (*count >= LOG_DEFERRED_MAX_ARGS) {
+		return 0;
+	}
+	types[(*count)++] = type;
+	if (spec) {
+		if (type == LOG_ARG_INT64) {
+			spec[n++] = 'l';
+			spec[n++] = 'l';
+		}
+		spec[n++] = *p;
+		spec[n] = 0;
+	}
+	return p + 1 - s;
+}
+static void LOG_ParseFormat(const char* fmt, logFormat_t* f) {
+	const char* p = fmt;
+	int count = 0;
+	int len;
+
+	f->fmt = fmt;
+	f->bDeferrable = 0;
+	while (*p) {
+		if (*p != '%') {
+			p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+		len = LOG_ParseConversion(p + 1, f->types, &count, 0);
+		if (len == 0) {
+			return;
+		}
+		p += 1 + len;
+	}
+	f->count = count;
+	f->bDeferrable = 1;
+}
+// format pointer is its ID, parsed formats are cached by it
+static logFormat_t* LOG_GetFormat(const char* fmt) {
+	logFormat_t* f;
+
+	f = &g_logFormats[((size_t)fmt >> 2) & (LOG_FORMAT_CACHE_SIZE - 1)];
+	if (f->fmt != fmt) {
+		LOG_ParseFormat(fmt, f);
+	}
+	return f;
+}
+static int LOG_PrintArg(char* out, int size, const char* spec, int type, logArg_t* arg, int* stars, int starCount) {
+#define LOG_PRINT_WITH_STARS(v) \
+	(starCount == 0 ? snprintf(out, size, spec, v) : \
+	starCount == 1 ? snprintf(out, size, spec, stars[0], v) : \
+	snprintf(out, size, spec, stars[0], stars[1], v))
+	switch (type) {
+	case LOG_ARG_INT:
+		return LOG_PRINT_WITH_STARS(arg->v.i);
+	case LOG_ARG_INT64:
+		return LOG_PRINT_WITH_STARS(arg->v.ll);
+	case LOG_ARG_DOUBLE:
+		return LOG_PRINT_WITH_STARS(arg->v.d);
+	case LOG_ARG_PTR:
+		return LOG_PRINT_WITH_STARS(arg->v.p);
+	case LOG_ARG_STR:
+		return LOG_PRINT_WITH_STARS(arg->v.s);
+	}
+#undef LOG_PRINT_WITH_STARS
+	return 0;
+}
+// like vsnprintf, but with arguments already taken from the list
+static void LOG_FormatArgs(char* out, int size, const char* fmt, logArg_t* args) {
+	char spec[LOG_SPEC_MAX];
+	byte types[LOG_DEFERRED_MAX_ARGS];
+	int stars[2];
+	int count, len, n, a;
+
+	a = 0;
+	while (*fmt && size > 1) {
+		if (*fmt != '%') {
+			*out++ = *fmt++;
+			size--;
+			continue;
+		}
+		if (fmt[1] == '%') {
+			*out++ = '%';
+			size--;
+			fmt += 2;
+			continue;
+		}
+		count = 0;
+		len = LOG_ParseConversion(fmt + 1, types, &count, spec);
+		if (len == 0) {
+			break;
+		}
+		for (n = 0; n < count - 1; n++) {
+			stars[n] = args[a++].v.i;
+		}
+		n = LOG_PrintArg(out, size, spec, types[count - 1], &args[a++], stars, count - 1);
+		if (n < 0) {
+			n = 0;
+		}
+		if (n >= size) {
+			n = size - 1;
+		}
+		out += n;
+		size -= n;
+		fmt += 1 + len;
+	}
+	*out = 0;
+}
+// takes arguments from the list and builds deferred record in g_deferredRecord,
+// returns its length or 0 if it's too big - then line is formatted from args at once
+static int LOG_CaptureArgs(logFormat_t* f, int level, int feature, va_list argList, logArg_t* args) {
+	byte* p;
+	int i, size;
+
+	size = LOG_RECORD_HEADER + sizeof(const char*);
+	for (i = 0; i < f->count; i++) {
+		switch (f->types[i]) {
+		case LOG_ARG_INT:
+			args[i].v.i = va_arg(argList, int);
+			size += sizeof(int);
+			break;
+		case LOG_ARG_INT64:
+			args[i].v.ll = va_arg(argList, long long);
+			size += sizeof(long long);
+			break;
+		case LOG_ARG_DOUBLE:
+			args[i].v.d = va_arg(argList, double);
+			size += sizeof(double);
+			break;
+		case LOG_ARG_PTR:
+			args[i].v.p = va_arg(argList, void*);
+			size += sizeof(void*);
+			break;
+		case LOG_ARG_STR:
+			args[i].v.s = va_arg(argList, const char*);
+			if (args[i].v.s == 0) {
+				args[i].v.s = "(null)";
+			}
+			// no need to count further than record can hold
+			for (args[i].len = 0; args[i].v.s[args[i].len] && args[i].len < LOG_DEFERRED_MAX_RECORD; args[i].len++) {
+			}
+			size += args[i].len + 1;
+			break;
+		}
+	}
+	if (size > LOG_DEFERRED_MAX_RECORD) {
+		return 0;
+	}
+	p = g_deferredRecord;
+	LOG_WriteHeader(p, size, LOG_RECORD_DEFERRED, level, feature);
+	p += LOG_RECORD_HEADER;
+	memcpy(p, &f->fmt, sizeof(const char*));
+	p += sizeof(const char*);
+	for (i = 0; i < f->count; i++) {
+		switch (f->types[i]) {
+		case LOG_ARG_INT:
+			memcpy(p, &args[i].v.i, sizeof(int));
+			p += sizeof(int);
+			break;
+		case LOG_ARG_INT64:
+			memcpy(p, &args[i].v.ll, sizeof(long long));
+			p += sizeof(long long);
+			break;
+		case LOG_ARG_DOUBLE:
+			memcpy(p, &args[i].v.d, sizeof(double));
+			p += sizeof(double);
+			break;
+		case LOG_ARG_PTR:
+			memcpy(p, &args[i].v.p, sizeof(void*));
+			p += sizeof(void*);
+			break;
+		case LOG_ARG_STR:
+			// string may be gone by the time line is formatted, so it's copied
+			memcpy(p, args[i].v.s, args[i].len);
+			p += args[i].len;
+			*p++ = 0;
+			break;
+		}
+	}
+	return size;
+}
+static char* LOG_WritePrefix(char* t, int level, int feature) {
+	if (feature == LOG_FEATURE_RAW)
+	{
+		// raw means no prefixes
+		*t = 0;
+		return t;
+	}
+	strcpy(t, loglevelnames[level]);
+	t += strlen(t);
+	if (feature < sizeof(logfeaturenames) / sizeof(*logfeaturenames))
+	{
+		strcpy(t, logfeaturenames[feature]);
+		t += strlen(t);
+	}
+	return t;
+}
+// strips line ending given by caller and puts \r\n, returns line length
+static int LOG_EndLine(char* tmp) {
+	int len;
+
+	len = strlen(tmp);
+	if (len && tmp[len - 1] == '\n') tmp[--len] = '\0';
+	if (len && tmp[len - 1] == '\r') tmp[--len] = '\0';
+	// save 3 bytes at end for /r/n/0
+	tmp[len++] = '\r';
+	tmp[len++] = '\n';
+	tmp[len] = '\0';
+	return len;
+}
+// formats deferred record into out, which has LOGGING_BUFFER_SIZE bytes, returns line length
+static int LOG_FormatRecord(const byte* rec, char* out) {
+	logArg_t args[LOG_DEFERRED_MAX_ARGS];
+	logFormat_t f;
+	const char* fmt;
+	const byte* p;
+	char* t;
+	int i;
+
+	p = rec + LOG_RECORD_HEADER;
+	memcpy(&fmt, p, sizeof(const char*));
+	p += sizeof(const char*);
+	// format cache belongs to writers, reader parses it again
+	LOG_ParseFormat(fmt, &f);
+	for (i = 0; i < f.count; i++) {
+		switch (f.types[i]) {
+		case LOG_ARG_INT:
+			memcpy(&args[i].v.i, p, sizeof(int));
+			p += sizeof(int);
+			break;
+		case LOG_ARG_INT64:
+			memcpy(&args[i].v.ll, p, sizeof(long long));
+			p += sizeof(long long);
+			break;
+		case LOG_ARG_DOUBLE:
+			memcpy(&args[i].v.d, p, sizeof(double));
+			p += sizeof(double);
+			break;
+		case LOG_ARG_PTR:
+			memcpy(&args[i].v.p, p, sizeof(void*));
+			p += sizeof(void*);
+			break;
+		case LOG_ARG_STR:
+			args[i].v.s = (const char*)p;
+			p += strlen((const char*)p) + 1;
+			break;
+		}
+	}
+	t = LOG_WritePrefix(out, rec[3], rec[4]);
+	LOG_FormatArgs(t, (LOGGING_BUFFER_SIZE - (3 + t - out)), fmt, args);
+	return LOG_EndLine(out);
+}
+
+static void LOG_AddV(int level, int feature, bool bStaticFmt, const char* fmt, va_list argList)
 {
 	char* tmp;
 	char* t;
 	int len;
-	va_list argList;
 	BaseType_t taken;
-	int i;
+	logFormat_t* f;
+	logArg_t args[LOG_DEFERRED_MAX_ARGS];
+	byte header[LOG_RECORD_HEADER];
 
 	if (fmt == 0)
 	{
@@ -259,36 +748,36 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 
 
 	taken = xSemaphoreTake(logMemory.mutex, 100);
-	tmp = g_loggingBuffer;
-	memset(tmp, 0, LOGGING_BUFFER_SIZE);
-	t = tmp;
 
-	if (feature == LOG_FEATURE_RAW)
-	{
-		// raw means no prefixes
+	// deferred line is useless if someone wants the text right now
+	f = 0;
+	if (g_logDeferred && bStaticFmt && g_log_alsoPrintToHTTP == 0 && g_extraSocketToSendLOG == 0
+		&& direct_serial_log != LOGTYPE_DIRECT && log_delay == 0) {
+		f = LOG_GetFormat(fmt);
 	}
-	else {
-		strncpy(t, loglevelnames[level], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
-		t += strlen(t);
-		if (feature < sizeof(logfeaturenames) / sizeof(*logfeaturenames))
-		{
-			strncpy(t, logfeaturenames[feature], (LOGGING_BUFFER_SIZE - (3 + t - tmp)));
-			t += strlen(t);
+	tmp = g_loggingBuffer;
+	if (f && f->bDeferrable) {
+		len = LOG_CaptureArgs(f, level, feature, argList, args);
+		if (len) {
+			LOG_WriteRecord(g_deferredRecord, LOG_RECORD_HEADER, g_deferredRecord + LOG_RECORD_HEADER, len - LOG_RECORD_HEADER);
+			g_logDeferredCount++;
+			if (taken == pdTRUE) {
+				xSemaphoreGive(logMemory.mutex);
+			}
+#ifdef PLATFORM_BEKEN
+			trigger_log_send();
+#endif
+			return;
 		}
+		// too long to defer, and arguments are already taken
+		t = LOG_WritePrefix(tmp, level, feature);
+		LOG_FormatArgs(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, args);
 	}
-
-	va_start(argList, fmt);
-	//vsnprintf3(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
-	//vsnprintf2(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
-	vsnprintf(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
-	va_end(argList);
-	if (tmp[strlen(tmp) - 1] == '\n') tmp[strlen(tmp) - 1] = '\0';
-	if (tmp[strlen(tmp) - 1] == '\r') tmp[strlen(tmp) - 1] = '\0';
-
-	len = strlen(tmp); // save 3 bytes at end for /r/n/0
-	tmp[len++] = '\r';
-	tmp[len++] = '\n';
-	tmp[len] = '\0';
+	else {
+		t = LOG_WritePrefix(tmp, level, feature);
+		vsnprintf(t, (LOGGING_BUFFER_SIZE - (3 + t - tmp)), fmt, argList);
+	}
+	len = LOG_EndLine(tmp);
 #if WINDOWS
 	printf(tmp);
 #endif
@@ -333,23 +822,9 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 		return;
 	}
 
-	for ( i = 0; i < len; i++)
-	{
-		logMemory.log[logMemory.head] = tmp[i];
-		logMemory.head = (logMemory.head + 1) % LOGSIZE;
-		if (logMemory.tailserial == logMemory.head)
-		{
-			logMemory.tailserial = (logMemory.tailserial + 1) % LOGSIZE;
-		}
-		if (logMemory.tailtcp == logMemory.head)
-		{
-			logMemory.tailtcp = (logMemory.tailtcp + 1) % LOGSIZE;
-		}
-		if (logMemory.tailhttp == logMemory.head)
-		{
-			logMemory.tailhttp = (logMemory.tailhttp + 1) % LOGSIZE;
-		}
-	}
+	LOG_WriteHeader(header, LOG_RECORD_HEADER + len, LOG_RECORD_TEXT, level, feature);
+	LOG_WriteRecord(header, LOG_RECORD_HEADER, tmp, len);
+	g_logFormattedCount++;
 
 	if (taken == pdTRUE) {
 		xSemaphoreGive(logMemory.mutex);
@@ -374,34 +849,162 @@ void addLogAdv(int level, int feature, const char* fmt, ...)
 	}
 }
 
+// adds a log to the log memory
+// if there is no space, oldest records are dropped
+void addLogAdv(int level, int feature, const char* fmt, ...)
+{
+	va_list argList;
 
-static int getData(char* buff, int buffsize, int* tail) {
-	BaseType_t taken;
-	int count;
-	char* p;
-	if (!initialised)
-		return 0;
-	taken = xSemaphoreTake(logMemory.mutex, 100);
+	va_start(argList, fmt);
+	LOG_AddV(level, feature, false, fmt, argList);
+	va_end(argList);
+}
+// same, but fmt has static storage (ADDLOG_ macros), so line can be stored unformatted
+void addLogStaticFmt(int level, int feature, const char* fmt, ...)
+{
+	va_list argList;
+
+	va_start(argList, fmt);
+	LOG_AddV(level, feature, true, fmt, argList);
+	va_end(argList);
+}
+void LOG_GetDeferredStats(int* deferred, int* formatted) {
+	*deferred = g_logDeferredCount;
+	*formatted = g_logFormattedCount;
+}
 
+static bool LOG_ReaderIsOverwritten(logReader_t* r) {
+	return (int)(logMemory.first - r->tail) > 0;
+}
+// reader was too slow and writer has dropped records it did not read yet
+static void LOG_ReaderLost(logReader_t* r) {
+	unsigned int first = logMemory.first;
+	unsigned int lost = first - r->tail;
+
+	r->lost += lost;
+	// finish partially sent line first
+	r->markerLen = snprintf(r->marker, sizeof(r->marker), "%s[lost %u bytes]\r\n", r->pos ? "\r\n" : "", lost);
+	r->markerPos = 0;
+	r->tail = first;
+	r->pos = 0;
+}
+static bool LOG_ReaderHasData(logReader_t* r) {
+	return r->markerPos < r->markerLen || r->tail != logMemory.head;
+}
+
+// copies up to maxLen characters of next lines for given reader.
+// Text records are copied as spans, deferred records are formatted into
+// reader's own line buffer, then copied. Does not take log mutex.
+static int LOG_ReaderRead(logReader_t* r, char* out, int maxLen) {
+	byte header[LOG_RECORD_HEADER];
+	unsigned int head, lag;
+	int count, recLen, lineLen, n;
+
+	head = logMemory.head;
+	lag = head - r->tail;
+	if (lag > r->maxLag) {
+		r->maxLag = lag;
+	}
 	count = 0;
-	p = buff;
-	while (buffsize > 1) {
-		if (*tail == logMemory.head) {
+	while (count < maxLen) {
+		if (r->markerPos < r->markerLen) {
+			n = r->markerLen - r->markerPos;
+			if (n > maxLen - count) {
+				n = maxLen - count;
+			}
+			memcpy(out + count, r->marker + r->markerPos, n);
+			r->markerPos += n;
+			count += n;
+			continue;
+		}
+		if (r->tail == head) {
 			break;
 		}
-		*p = logMemory.log[*tail];
-		p++;
-		(*tail) = ((*tail) + 1) % LOGSIZE;
-		buffsize--;
-		count++;
+		if (LOG_ReaderIsOverwritten(r)) {
+			LOG_ReaderLost(r);
+			continue;
+		}
+		LOG_RingRead(r->tail, header, LOG_RECORD_HEADER);
+		recLen = header[0] | (header[1] << 8);
+		if (recLen < LOG_RECORD_HEADER || recLen > head - r->tail) {
+			// header was overwritten while we read it
+			LOG_ReaderLost(r);
+			continue;
+		}
+		if (header[2] == LOG_RECORD_TEXT) {
+			lineLen = recLen - LOG_RECORD_HEADER;
+			n = lineLen - r->pos;
+			if (n > maxLen - count) {
+				n = maxLen - count;
+			}
+			LOG_RingRead(r->tail + LOG_RECORD_HEADER + r->pos, out + count, n);
+			// writer could have reused that space while we were copying
+			if (LOG_ReaderIsOverwritten(r)) {
+				LOG_ReaderLost(r);
+				continue;
+			}
+		}
+		else {
+			if (r->pos == 0) {
+				if (r->line == 0) {
+					r->line = malloc(LOGGING_BUFFER_SIZE + LOG_DEFERRED_MAX_RECORD);
+					if (r->line == 0) {
+						// skip it, maybe there will be memory for next one
+						r->tail += recLen;
+						continue;
+					}
+				}
+				LOG_RingRead(r->tail, r->line + LOGGING_BUFFER_SIZE, recLen);
+				if (LOG_ReaderIsOverwritten(r)) {
+					LOG_ReaderLost(r);
+					continue;
+				}
+				r->lineLen = LOG_FormatRecord((const byte*)r->line + LOGGING_BUFFER_SIZE, r->line);
+			}
+			lineLen = r->lineLen;
+			n = lineLen - r->pos;
+			if (n > maxLen - count) {
+				n = maxLen - count;
+			}
+			memcpy(out + count, r->line + r->pos, n);
+		}
+		count += n;
+		r->pos += n;
+		r->read += n;
+		if (r->pos >= lineLen) {
+			r->tail += recLen;
+			r->pos = 0;
+		}
 	}
-	*p = 0;
+	return count;
+}
 
-	if (taken == pdTRUE) {
-		xSemaphoreGive(logMemory.mutex);
+static int getData(char* buff, int buffsize, logReader_t* r) {
+	int count;
+	if (!initialised)
+		return 0;
+
+	// other task is reading it now, it will get these lines
+	if (xSemaphoreTake(r->mutex, 100) != pdTRUE) {
+		buff[0] = 0;
+		return 0;
 	}
+	count = LOG_ReaderRead(r, buff, buffsize - 1);
+	xSemaphoreGive(r->mutex);
+	buff[count] = 0;
 	return count;
 }
+int LOG_GetReaderData(int reader, char* buff, int buffsize) {
+	return getData(buff, buffsize, &logMemory.readers[reader]);
+}
+void LOG_GetReaderStats(int reader, unsigned int* lag, unsigned int* maxLag, unsigned int* lost, unsigned int* read) {
+	logReader_t* r = &logMemory.readers[reader];
+
+	*lag = logMemory.head - r->tail;
+	*maxLag = r->maxLag;
+	*lost = r->lost;
+	*read = r->read;
+}
 
 #if PLATFORM_BEKEN
 
@@ -411,42 +1014,29 @@ static int getData(char* buff, int buffsize, int* tail) {
 // H/W TX fifo seems to be 256 bytes!!!
 static int getSerial2() {
 	if (!initialised) return 0;
-	int* tail = &logMemory.tailserial;
+	logReader_t* r = &logMemory.readers[LOG_READER_SERIAL];
 	char c;
-	BaseType_t taken = xSemaphoreTake(logMemory.mutex, 100);
-	char overflow = 0;
 
-	// if we hit overflow
-	if (logMemory.tailserial == (logMemory.head + 1) % LOGSIZE) {
-		overflow = 1;
+	if (xSemaphoreTake(r->mutex, 0) != pdTRUE) {
+		return 1;
 	}
-
-	while ((*tail != logMemory.head) && !uart_is_tx_fifo_full(UART_PORT)) {
-		c = logMemory.log[*tail];
-		if (overflow) {
-			c = '^'; // replace the first char with ^ if we overflowed....
-			overflow = 0;
+	while (LOG_ReaderHasData(r) && !uart_is_tx_fifo_full(UART_PORT)) {
+		if (LOG_ReaderRead(r, &c, 1) == 0) {
+			break;
 		}
-
-		(*tail) = ((*tail) + 1) % LOGSIZE;
-
 		if (direct_serial_log == LOGTYPE_THREAD) {
 			UART_WRITE_BYTE(UART_PORT_INDEX, c);
 		}
 	}
+	xSemaphoreGive(r->mutex);
 
-	int remains = (*tail != logMemory.head);
-
-	if (taken == pdTRUE) {
-		xSemaphoreGive(logMemory.mutex);
-	}
-	return remains;
+	return LOG_ReaderHasData(r);
 }
 
 #else
 
 static int getSerial(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailserial);
+	int len = getData(buff, buffsize, &logMemory.readers[LOG_READER_SERIAL]);
 	//bk_printf("got serial: %d:%s\r\n", len, buff);
 	return len;
 }
@@ -455,13 +1045,13 @@ static int getSerial(char* buff, int buffsize) {
 
 
 static int getTcp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailtcp);
+	int len = getData(buff, buffsize, &logMemory.readers[LOG_READER_TCP]);
 	//bk_printf("got tcp: %d:%s\r\n", len,buff);
 	return len;
 }
 
 static int getHttp(char* buff, int buffsize) {
-	int len = getData(buff, buffsize, &logMemory.tailhttp);
+	int len = getData(buff, buffsize, &logMemory.readers[LOG_READER_HTTP]);
 	//printf("got tcp: %d:%s\r\n", len,buff);
 	return len;
 }
@@ -707,6 +1297,9 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 					loglevel = level;
 					result = CMD_RES_OK;
 					ADDLOG_DEBUG(LOG_FEATURE_CMD, "loglevel set %d", level);
+					if (level > OBK_LOG_MIN_LEVEL) {
+						ADDLOG_WARN(LOG_FEATURE_CMD, "this build has no logs above level %d, see OBK_LOG_MIN_LEVEL", OBK_LOG_MIN_LEVEL);
+					}
 				}
 				else {
 					ADDLOG_ERROR(LOG_FEATURE_CMD, "loglevel %d out of range", level);
@@ -757,6 +1350,17 @@ commandResult_t log_command(const void* context, const char* cmd, const char* ar
 			result = CMD_RES_OK;
 			break;
 		}
+		if (!stricmp(cmd, "logdeferred")) {
+			if (*args) {
+				g_logDeferred = atoi(args);
+			}
+			else {
+				ADDLOG_INFO(LOG_FEATURE_CMD, "logdeferred %i, lines deferred %i, formatted %i",
+					g_logDeferred, g_logDeferredCount, g_logFormattedCount);
+			}
+			result = CMD_RES_OK;
+			break;
+		}
 		if (!stricmp(cmd, "logdelay")) {
 			int res, delay;
 			res = sscanf(args, "%d", &delay);
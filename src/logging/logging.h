@@ -14,20 +14,72 @@
 #ifndef _OBK_LOGGING_H
 #define _OBK_LOGGING_H
 
+#include "../obk_config.h"
+
 void addLogAdv(int level, int feature, const char *fmt, ...);
+// fmt must have static storage, so line can be kept unformatted in deferred mode (logdeferred 1)
+void addLogStaticFmt(int level, int feature, const char *fmt, ...);
 void LOG_SetRawSocketCallback(int newFD);
+void LOG_GetDeferredStats(int *deferred, int *formatted);
+
+// consumers of log memory, each one reads it at its own pace
+typedef enum logReader_e {
+	LOG_READER_SERIAL,
+	LOG_READER_TCP,
+	LOG_READER_HTTP,
+	LOG_READER_MAX,
+} logReader_e;
+
+extern const char *logreadernames[];
+int LOG_GetReaderData(int reader, char *buff, int buffsize);
+// lag is how many bytes reader is behind the writer now, maxLag is the most it was seen behind
+void LOG_GetReaderStats(int reader, unsigned int *lag, unsigned int *maxLag, unsigned int *lost, unsigned int *read);
+
+// ADDLOG_ macros take only string literals as format.
+// Features not in OBK_LOG_FEATURES and levels above OBK_LOG_MIN_LEVEL (see obk_config.h)
+// are compiled out.
+#define ADDLOG_FEATURE_ENABLED(x) (((OBK_LOG_FEATURES) >> (x)) & 1)
+#ifdef __cplusplus
+#define ADDLOG_STATIC(level, x, fmt, ...) (ADDLOG_FEATURE_ENABLED(x) ? addLogAdv(level, x, fmt, ##__VA_ARGS__) : (void)0)
+#else
+#define ADDLOG_STATIC(level, x, fmt, ...) (ADDLOG_FEATURE_ENABLED(x) ? addLogStaticFmt(level, x, "" fmt, ##__VA_ARGS__) : (void)0)
+#endif
 
-#define ADDLOG_ERROR(x, fmt, ...) addLogAdv(LOG_ERROR, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_WARN(x, fmt, ...)  addLogAdv(LOG_WARN, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_INFO(x, fmt, ...)  addLogAdv(LOG_INFO, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_DEBUG(x, fmt, ...) addLogAdv(LOG_DEBUG, x, fmt, ##__VA_ARGS__)
-#define ADDLOG_EXTRADEBUG(x, fmt, ...) addLogAdv(LOG_EXTRADEBUG, x, fmt, ##__VA_ARGS__)
-
-#define ADDLOGF_ERROR(fmt, ...) addLogAdv(LOG_ERROR, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_WARN(fmt, ...)  addLogAdv(LOG_WARN, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_INFO(fmt, ...)  addLogAdv(LOG_INFO, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_DEBUG(fmt, ...) addLogAdv(LOG_DEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
-#define ADDLOGF_EXTRADEBUG(fmt, ...) addLogAdv(LOG_EXTRADEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#if OBK_LOG_MIN_LEVEL >= 1
+#define ADDLOG_ERROR(x, fmt, ...) ADDLOG_STATIC(LOG_ERROR, x, fmt, ##__VA_ARGS__)
+#define ADDLOGF_ERROR(fmt, ...) ADDLOG_STATIC(LOG_ERROR, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#else
+#define ADDLOG_ERROR(x, fmt, ...) ((void)0)
+#define ADDLOGF_ERROR(fmt, ...) ((void)0)
+#endif
+#if OBK_LOG_MIN_LEVEL >= 2
+#define ADDLOG_WARN(x, fmt, ...)  ADDLOG_STATIC(LOG_WARN, x, fmt, ##__VA_ARGS__)
+#define ADDLOGF_WARN(fmt, ...)  ADDLOG_STATIC(LOG_WARN, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#else
+#define ADDLOG_WARN(x, fmt, ...) ((void)0)
+#define ADDLOGF_WARN(fmt, ...) ((void)0)
+#endif
+#if OBK_LOG_MIN_LEVEL >= 3
+#define ADDLOG_INFO(x, fmt, ...)  ADDLOG_STATIC(LOG_INFO, x, fmt, ##__VA_ARGS__)
+#define ADDLOGF_INFO(fmt, ...)  ADDLOG_STATIC(LOG_INFO, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#else
+#define ADDLOG_INFO(x, fmt, ...) ((void)0)
+#define ADDLOGF_INFO(fmt, ...) ((void)0)
+#endif
+#if OBK_LOG_MIN_LEVEL >= 4
+#define ADDLOG_DEBUG(x, fmt, ...) ADDLOG_STATIC(LOG_DEBUG, x, fmt, ##__VA_ARGS__)
+#define ADDLOGF_DEBUG(fmt, ...) ADDLOG_STATIC(LOG_DEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#else
+#define ADDLOG_DEBUG(x, fmt, ...) ((void)0)
+#define ADDLOGF_DEBUG(fmt, ...) ((void)0)
+#endif
+#if OBK_LOG_MIN_LEVEL >= 5
+#define ADDLOG_EXTRADEBUG(x, fmt, ...) ADDLOG_STATIC(LOG_EXTRADEBUG, x, fmt, ##__VA_ARGS__)
+#define ADDLOGF_EXTRADEBUG(fmt, ...) ADDLOG_STATIC(LOG_EXTRADEBUG, LOG_FEATURE, fmt, ##__VA_ARGS__)
+#else
+#define ADDLOG_EXTRADEBUG(x, fmt, ...) ((void)0)
+#define ADDLOGF_EXTRADEBUG(fmt, ...) ((void)0)
+#endif
 
 
 extern int loglevel;
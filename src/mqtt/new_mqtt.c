@@ -2,6 +2,7 @@
 #include "new_mqtt.h"
 #include "../new_common.h"
 #include "../new_pins.h"
+#include "../quicktick.h"
 #include "../new_cfg.h"
 #include "../logging/logging.h"
 // Commands register, execution API and cmd tokenizer
@@ -41,10 +42,15 @@ extern void MQTT_TriggerRead();
 // Variables for periodical self state broadcast
 //
 // current time left (counting down)
-static int g_secondsBeforeNextFullBroadcast = 30;
+static int g_secondsBeforeNextBroadcast = 30;
 // constant value, how much interval between self state broadcast (enabled by flag)
 // You can change it with command: mqtt_broadcastInterval 60
 static int g_intervalBetweenMQTTBroadcasts = 60;
+// Periodic broadcast sends only items that have changed since the last one,
+// but every Nth broadcast is a full refresh of all items.
+// You can change it with command: mqtt_broadcastInterval 60 10
+static int g_broadcastFullRefreshEvery = 10;
+static int g_broadcastsSinceFullRefresh = 0;
 // While doing self state broadcast, it limits the number of publishes 
 // per second in order not to overload LWIP
 static int g_maxBroadcastItemsPublishedPerSecond = 1;
@@ -53,79 +59,66 @@ static int g_maxBroadcastItemsPublishedPerSecond = 1;
 // mqtt receive buffer, so we can action in our threads, not
 // in tcp_thread
 //
+// This is a single producer (tcp_thread) and single consumer (quick tick)
+// ring, so it needs no mutex. Each record is a header followed by topic
+// and data, both zero terminated, so callbacks can use them in place.
+// Records never wrap, if there is no room at the end, a wrap marker
+// is written and record starts at beginning of buffer. So, a record
+// of up to half of the buffer always fits into empty ring.
+//
 #define MQTT_RX_BUFFER_MAX 4096
-unsigned char mqtt_rx_buffer[MQTT_RX_BUFFER_MAX];
-int mqtt_rx_buffer_head;
-int mqtt_rx_buffer_tail;
-int mqtt_rx_buffer_count;
-unsigned char temp_topic[128];
-unsigned char temp_data[2048];
-
-int addLenData(int len, const unsigned char *data){
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len >> 8) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	mqtt_rx_buffer[mqtt_rx_buffer_head] = (len) & 0xff;
-	mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count++;
-	for (int i = 0; i < len; i++){
-		mqtt_rx_buffer[mqtt_rx_buffer_head] = data[i];
-		mqtt_rx_buffer_head = (mqtt_rx_buffer_head + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count++;
-	}
-	return len + 2;
-}
-
-int getLenData(int *len, unsigned char *data, int maxlen){
-	int l;
-	l = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-	l = l<<8;
-	l |= mqtt_rx_buffer[mqtt_rx_buffer_tail];
-	mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-	mqtt_rx_buffer_count--;
-
-	for (int i = 0; i < l; i++){
-		if (i < maxlen){
-			data[i] = mqtt_rx_buffer[mqtt_rx_buffer_tail];
-		}
-		mqtt_rx_buffer_tail = (mqtt_rx_buffer_tail + 1) % MQTT_RX_BUFFER_MAX;
-		mqtt_rx_buffer_count--;
-	}
-	if (mqtt_rx_buffer_count < 0){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer underflow!!!");
-		mqtt_rx_buffer_count = 0;
-		mqtt_rx_buffer_tail = mqtt_rx_buffer_head = 0;
-	}
-
-	if (l > maxlen){
-		*len = maxlen;
-	} else {
-		*len = l;
-	}
-	return l + 2;
-}
-
-static SemaphoreHandle_t g_mutex = 0;
+#define MQTT_RX_WRAP_MARKER 0xFFFF
+#define MQTT_RX_ALIGN(x) (((x) + 3) & ~3)
+
+typedef struct mqttRxRecord_s {
+	unsigned short topicLen;
+	unsigned short dataLen;
+} mqttRxRecord_t;
+
+// int array, so records are aligned
+static unsigned int mqtt_rx_words[MQTT_RX_BUFFER_MAX / 4];
+#define mqtt_rx_buffer ((unsigned char*)mqtt_rx_words)
+// written only by producer
+static volatile int mqtt_rx_head = 0;
+// written only by consumer
+static volatile int mqtt_rx_tail = 0;
+// statistics
+static int mqtt_rx_dropped = 0;
+static int mqtt_rx_highWatermark = 0;
+
+// record data must be visible before the index that publishes it
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MQTT_RX_BARRIER() _ReadWriteBarrier()
+#else
+#define MQTT_RX_BARRIER() __sync_synchronize()
+#endif
 
-static bool MQTT_Mutex_Take(int del) {
-	int taken;
+static int MQTT_RxUsed(int head, int tail) {
+	return (head - tail + MQTT_RX_BUFFER_MAX) % MQTT_RX_BUFFER_MAX;
+}
+// returns offset to write record of given size, or -1 if there is no room
+static int MQTT_RxReserve(int need, int *outWrap) {
+	int head = mqtt_rx_head;
+	int tail = mqtt_rx_tail;
 
-	if (g_mutex == 0)
-	{
-		g_mutex = xSemaphoreCreateMutex();
+	*outWrap = 0;
+	if (tail <= head) {
+		// free space at the end, and the new head must not become tail
+		if (head + need < MQTT_RX_BUFFER_MAX || (head + need == MQTT_RX_BUFFER_MAX && tail != 0)) {
+			return head;
+		}
+		// wrap to the beginning
+		if (need < tail) {
+			*outWrap = 1;
+			return 0;
+		}
+		return -1;
 	}
-	taken = xSemaphoreTake(g_mutex, del);
-	if (taken == pdTRUE) {
-		return true;
+	if (need < tail - head) {
+		return head;
 	}
-	return false;
-}
-
-static void MQTT_Mutex_Free()
-{
-	xSemaphoreGive(g_mutex);
+	return -1;
 }
 
 // this is called from tcp_thread context to queue received mqtt,
@@ -135,47 +128,237 @@ static void MQTT_Mutex_Free()
 // system can use it to spoof MQTT packets to check if MQTT commands
 // are working...
 int MQTT_Post_Received(const char *topic, int topiclen, const unsigned char *data, int datalen){
-	MQTT_Mutex_Take(100);
-	if ((MQTT_RX_BUFFER_MAX - 1 - mqtt_rx_buffer_count) < topiclen + datalen + 2 + 2){
+	mqttRxRecord_t *rec;
+	unsigned char *p;
+	int need, at, wrap, used;
+
+	need = MQTT_RX_ALIGN(sizeof(mqttRxRecord_t) + topiclen + 1 + datalen + 1);
+	at = -1;
+	if (topiclen < MQTT_RX_WRAP_MARKER && datalen < MQTT_RX_WRAP_MARKER) {
+		at = MQTT_RxReserve(need, &wrap);
+	}
+	if (at < 0) {
+		mqtt_rx_dropped++;
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_rx buffer overflow for topic %s", topic);
-	} else {
-		addLenData(topiclen, (unsigned char *)topic);
-		addLenData(datalen, data);
+		return 0;
 	}
-	MQTT_Mutex_Free();
+	if (wrap) {
+		rec = (mqttRxRecord_t*)(mqtt_rx_buffer + mqtt_rx_head);
+		rec->topicLen = MQTT_RX_WRAP_MARKER;
+		rec->dataLen = 0;
+	}
+	rec = (mqttRxRecord_t*)(mqtt_rx_buffer + at);
+	rec->topicLen = topiclen;
+	rec->dataLen = datalen;
+	p = (unsigned char*)(rec + 1);
+	memcpy(p, topic, topiclen);
+	p[topiclen] = 0;
+	p += topiclen + 1;
+	memcpy(p, data, datalen);
+	p[datalen] = 0;
+	MQTT_RX_BARRIER();
+	mqtt_rx_head = (at + need) % MQTT_RX_BUFFER_MAX;
 
+	used = MQTT_RxUsed(mqtt_rx_head, mqtt_rx_tail);
+	if (used > mqtt_rx_highWatermark) {
+		mqtt_rx_highWatermark = used;
+	}
 
 #ifdef PLATFORM_BEKEN
 	MQTT_TriggerRead();
+#else
+	// processed in quick tick
+	QuickTick_RequestWakeup();
 #endif
 	return 1;
 }
 int MQTT_Post_Received_Str(const char *topic, const char *data) {
 	return MQTT_Post_Received(topic, strlen(topic), (const unsigned char*)data, strlen(data));
 }
-int get_received(char **topic, int *topiclen, unsigned char **data, int *datalen){
-	int res = 0;
-	MQTT_Mutex_Take(100);
-	if (mqtt_rx_buffer_tail != mqtt_rx_buffer_head){
-		getLenData(topiclen, temp_topic, sizeof(temp_topic)-1);
-		temp_topic[*topiclen] = 0;
-		getLenData(datalen, temp_data, sizeof(temp_data)-1);
-		temp_data[*datalen] = 0;
-		*topic = (char *)temp_topic;
-		*data = temp_data;
-		res = 1;
+// gives the oldest record in place, it stays valid until MQTT_RxCommit
+static mqttRxRecord_t *MQTT_RxPeek(const char **topic, const unsigned char **data) {
+	mqttRxRecord_t *rec;
+	int tail;
+
+	tail = mqtt_rx_tail;
+	if (tail == mqtt_rx_head) {
+		return 0;
 	}
-	MQTT_Mutex_Free();
-	return res;
+	MQTT_RX_BARRIER();
+	rec = (mqttRxRecord_t*)(mqtt_rx_buffer + tail);
+	if (rec->topicLen == MQTT_RX_WRAP_MARKER) {
+		mqtt_rx_tail = 0;
+		if (mqtt_rx_head == 0) {
+			return 0;
+		}
+		MQTT_RX_BARRIER();
+		rec = (mqttRxRecord_t*)mqtt_rx_buffer;
+	}
+	*topic = (const char*)(rec + 1);
+	*data = (const unsigned char*)(*topic + rec->topicLen + 1);
+	return rec;
+}
+static void MQTT_RxCommit(mqttRxRecord_t *rec) {
+	int at;
+
+	at = (unsigned char*)rec - mqtt_rx_buffer;
+	MQTT_RX_BARRIER();
+	mqtt_rx_tail = (at + MQTT_RX_ALIGN(sizeof(mqttRxRecord_t) + rec->topicLen + 1 + rec->dataLen + 1)) % MQTT_RX_BUFFER_MAX;
+}
+int MQTT_GetRxDropCounter(void) {
+	return mqtt_rx_dropped;
+}
+int MQTT_GetRxHighWatermark(void) {
+	return mqtt_rx_highWatermark;
 }
+int MQTT_GetRxBufferSize(void) {
+	return MQTT_RX_BUFFER_MAX;
+}
+
+static SemaphoreHandle_t g_mutex = 0;
+
+static bool MQTT_Mutex_Take(int del) {
+	int taken;
+
+	if (g_mutex == 0)
+	{
+		g_mutex = xSemaphoreCreateMutex();
+	}
+	taken = xSemaphoreTake(g_mutex, del);
+	if (taken == pdTRUE) {
+		return true;
+	}
+	return false;
+}
+
+static void MQTT_Mutex_Free()
+{
+	xSemaphoreGive(g_mutex);
+}
+
 //
 //////////////////////////////////////////////////////////////////////
 
-#define MQTT_QUEUE_ITEM_IS_REUSABLE(x)  (x->topic[0] == 0)
-#define MQTT_QUEUE_ITEM_SET_REUSABLE(x) (x->topic[0] = 0)
+//////////////////////////////////////////////////////////////////////
+// Publish queue (MQTT_QueuePublish), used for larger publishes like HASS discovery.
+//
+// Circular byte arena with variable-length records, each record is a header
+// followed by zero terminated topic, channel and value. Same layout rules
+// as the RX ring above: records never wrap, a wrap marker sends reader to
+// the beginning. Arena is allocated on first use.
+//
+#define MQTT_QUEUE_DEFAULT_SIZE 8192
+#define MQTT_QUEUE_WRAP_MARKER 0xFFFF
+
+typedef struct mqttQueueRecord_s {
+	unsigned short topicLen;
+	unsigned short channelLen;
+	unsigned short valueLen;
+	byte flags;
+	byte command;
+} mqttQueueRecord_t;
+
+static unsigned char *g_mqttQueue = 0;
+static int g_mqttQueueSize = MQTT_QUEUE_DEFAULT_SIZE;
+static int g_mqttQueueHead = 0;
+static int g_mqttQueueTail = 0;
+// offset of newest record, for MQTT_InvokeCommandAtEnd, -1 if none
+static int g_mqttQueueLast = -1;
+static byte g_mqttQueueDropOldest = 0;
+// set while oldest record is being published, so it's not dropped under our feet
+static byte g_mqttQueuePublishing = 0;
+int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published.
+static int mqtt_queue_dropped = 0;
+static int mqtt_queue_peakBytes = 0;
+// Items are queued from HTTP, script and main tasks and published from main loop.
+// Head, tail and counters are only changed under this, publish is done without it.
+static SemaphoreHandle_t g_mqttQueueMutex = 0;
+
+static void MQTT_Queue_Lock() {
+	while (xSemaphoreTake(g_mqttQueueMutex, 1000) != pdTRUE) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT queue mutex wait is too long");
+	}
+}
+static void MQTT_Queue_Unlock() {
+	xSemaphoreGive(g_mqttQueueMutex);
+}
+
+static int MQTT_Queue_RecordSize(const mqttQueueRecord_t *rec) {
+	return MQTT_RX_ALIGN(sizeof(mqttQueueRecord_t) + rec->topicLen + 1 + rec->channelLen + 1 + rec->valueLen + 1);
+}
+static int MQTT_Queue_Used() {
+	if (g_MqttPublishItemsQueued == 0) {
+		return 0;
+	}
+	return (g_mqttQueueHead - g_mqttQueueTail + g_mqttQueueSize - 1) % g_mqttQueueSize + 1;
+}
+// returns offset to write record of given size, or -1 if there is no room
+static int MQTT_Queue_Reserve(int need, int *outWrap) {
+	int head = g_mqttQueueHead;
+	int tail = g_mqttQueueTail;
 
-MqttPublishItem_t* g_MqttPublishQueueHead = NULL;
-int g_MqttPublishItemsQueued = 0;   //Items in the queue waiting to be published. This is not the queue length.
+	*outWrap = 0;
+	if (g_MqttPublishItemsQueued == 0) {
+		// empty - start from the beginning
+		g_mqttQueueHead = g_mqttQueueTail = 0;
+		return need <= g_mqttQueueSize ? 0 : -1;
+	}
+	if (tail < head) {
+		if (head + need <= g_mqttQueueSize) {
+			return head;
+		}
+		// wrap to the beginning
+		if (need <= tail) {
+			*outWrap = 1;
+			return 0;
+		}
+		return -1;
+	}
+	// head has wrapped, or queue is full (head == tail)
+	if (need <= tail - head) {
+		return head;
+	}
+	return -1;
+}
+// oldest record, or 0 if queue is empty
+static mqttQueueRecord_t *MQTT_Queue_Peek() {
+	mqttQueueRecord_t *rec;
+
+	if (g_MqttPublishItemsQueued == 0) {
+		return 0;
+	}
+	rec = (mqttQueueRecord_t*)(g_mqttQueue + g_mqttQueueTail);
+	if (rec->topicLen == MQTT_QUEUE_WRAP_MARKER) {
+		g_mqttQueueTail = 0;
+		rec = (mqttQueueRecord_t*)g_mqttQueue;
+	}
+	return rec;
+}
+static void MQTT_Queue_Pop(mqttQueueRecord_t *rec) {
+	int at;
+
+	at = (unsigned char*)rec - g_mqttQueue;
+	g_mqttQueueTail = (at + MQTT_Queue_RecordSize(rec)) % g_mqttQueueSize;
+	g_MqttPublishItemsQueued--;
+	if (g_MqttPublishItemsQueued == 0) {
+		g_mqttQueueLast = -1;
+	}
+}
+int MQTT_GetQueueDropCounter(void) {
+	return mqtt_queue_dropped;
+}
+int MQTT_GetQueuePeakBytes(void) {
+	return mqtt_queue_peakBytes;
+}
+int MQTT_GetQueueUsedBytes(void) {
+	return MQTT_Queue_Used();
+}
+int MQTT_GetQueuedCount(void) {
+	return g_MqttPublishItemsQueued;
+}
+int MQTT_GetQueueSize(void) {
+	return g_mqttQueueSize;
+}
 
 // from mqtt.c
 extern void mqtt_disconnect(mqtt_client_t* client);
@@ -205,8 +388,42 @@ typedef struct mqtt_callback_tag {
 #define MAX_MQTT_CALLBACKS 32
 static mqtt_callback_t* callbacks[MAX_MQTT_CALLBACKS];
 static int numCallbacks = 0;
+
+// Topics that broker has us subscribed to. They are compared with subscription topics
+// of callbacks, so that changes are sent on live connection, without reconnect.
+static char *g_mqttSubscribed[MAX_MQTT_CALLBACKS];
+// set when callbacks have changed and subscriptions need to be compared again
+static bool g_mqttSubscriptionsDirty = true;
+// set by connection callback in tcp_thread, list is only touched by main thread under MQTT mutex
+static volatile bool g_mqttForgetSubscriptions = false;
+static int g_mqttSubscribePackets = 0;
+
+// WiFi up to first publish time, in ms. Timer is started by MQTT_OnWiFiConnected
+// and advanced by quick tick, -1 if not running.
+static int g_wifiToPublishTimerMS = -1;
+static int g_wifiToPublishLastMS = -1;
+
+// Subscription filters of all callbacks, stored as a tree of topic levels.
+// Each node is one level of a filter ("obk", "+", "#", "set"...), children are
+// kept in a sibling list. Node holds a bitmask of callback slots whose filter ends there,
+// so a lookup walks the topic once and ORs the masks of all matching filters.
+typedef struct mqttTopicNode_s {
+	struct mqttTopicNode_s *child;
+	struct mqttTopicNode_s *next;
+	unsigned int subscribers;
+	unsigned short levelLen;
+	char level[2];
+} mqttTopicNode_t;
+
+static mqttTopicNode_t *g_mqttTopicTrie = 0;
+// Tries are walked by tcp_thread and quick tick while callbacks can be registered
+// from any task, so root swap and every walk are done under this mutex.
+// It's held only for the walk itself, so it's safe to take in tcp_thread.
+static SemaphoreHandle_t g_mqttTrieMutex = 0;
 // note: only one incomming can be processed at a time.
 static obk_mqtt_request_t g_mqtt_request;
+// topic of incoming publish, filled in tcp_thread
+static char g_mqtt_incomingTopic[128];
 static obk_mqtt_request_t g_mqtt_request_cb;
 
 #define LOOPS_WITH_DISCONNECTED 15
@@ -215,26 +432,84 @@ int mqtt_reconnect = 0;
 // set for the device to broadcast self state on start
 int g_bPublishAllStatesNow = 0;
 int g_publishItemIndex = PUBLISHITEM_ALL_INDEX_FIRST;
-static bool g_firstFullBroadcast = true;  //Flag indicating that we need to do a full broadcast
+// if set, current broadcast sends only items that are marked dirty
+static bool g_bPublishOnlyDirty = false;
+
+// One bit per publish item, from PUBLISHITEM_ALL_INDEX_FIRST up to the last channel.
+// Set when item value changes, cleared when broadcast has sent it.
+// Static items are set once per connection and are sent retained.
+#define MQTT_PUBLISHITEMS_COUNT		(CHANNEL_MAX - PUBLISHITEM_ALL_INDEX_FIRST)
+static unsigned int g_mqttDirtyItems[(MQTT_PUBLISHITEMS_COUNT + 31) / 32];
+// hash of last sent value of self items, so delta broadcast can tell if they have changed
+static unsigned int g_mqttSelfItemHash[PUBLISHITEM_SELF_DYNAMIC_LIGHTSTATE - PUBLISHITEM_ALL_INDEX_FIRST];
+// items skipped by delta broadcasts, that full broadcast would have sent
+static int mqtt_broadcast_saved = 0;
+static int mqtt_broadcast_savedThisHour = 0;
+static int mqtt_broadcast_savedLastHour = -1;
+static int g_broadcastHourSeconds = 0;
 
 int g_memoryErrorsThisSession = 0;
 int g_mqtt_bBaseTopicDirty = 0;
 
+void MQTT_SetItemDirty(int idx)
+{
+	idx -= PUBLISHITEM_ALL_INDEX_FIRST;
+	if (idx < 0 || idx >= MQTT_PUBLISHITEMS_COUNT)
+		return;
+	g_mqttDirtyItems[idx >> 5] |= 1u << (idx & 31);
+}
+static bool MQTT_IsItemDirty(int idx)
+{
+	idx -= PUBLISHITEM_ALL_INDEX_FIRST;
+	return (g_mqttDirtyItems[idx >> 5] >> (idx & 31)) & 1;
+}
+static void MQTT_ClearItemDirty(int idx)
+{
+	idx -= PUBLISHITEM_ALL_INDEX_FIRST;
+	g_mqttDirtyItems[idx >> 5] &= ~(1u << (idx & 31));
+}
+static void MQTT_SetStaticItemsDirty()
+{
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_HOSTNAME);
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_BUILD);
+	MQTT_SetItemDirty(PUBLISHITEM_SELF_MAC);
+}
+int MQTT_GetBroadcastSavedCounter(void) {
+	return mqtt_broadcast_saved;
+}
+// publishes saved in last full hour, or so far if first hour has not passed yet
+int MQTT_GetBroadcastSavedPerHour(void) {
+	if (mqtt_broadcast_savedLastHour < 0) {
+		return mqtt_broadcast_savedThisHour;
+	}
+	return mqtt_broadcast_savedLastHour;
+}
+
 void MQTT_PublishWholeDeviceState_Internal(bool bAll)
 {
 	g_bPublishAllStatesNow = 1;
+	g_bPublishOnlyDirty = false;
+	// static items are only sent when dirty, so they are skipped quickly if not needed
+	g_publishItemIndex = PUBLISHITEM_ALL_INDEX_FIRST;
 	if (bAll) {
-		g_publishItemIndex = PUBLISHITEM_ALL_INDEX_FIRST;
-	}
-	else {
-		g_publishItemIndex = PUBLISHITEM_DYNAMIC_INDEX_FIRST;
+		MQTT_SetStaticItemsDirty();
 	}
 }
 
 void MQTT_PublishWholeDeviceState()
 {
-	//Publish all status items once. Publish only dynamic items after that.
-	MQTT_PublishWholeDeviceState_Internal(g_firstFullBroadcast);
+	//Publish all status items. Static items are published once per connection.
+	MQTT_PublishWholeDeviceState_Internal(false);
+}
+
+// Publishes only items that have changed since last broadcast
+void MQTT_PublishChangedDeviceState()
+{
+	if (g_bPublishAllStatesNow == 1)
+		return;
+	g_bPublishAllStatesNow = 1;
+	g_bPublishOnlyDirty = true;
+	g_publishItemIndex = PUBLISHITEM_ALL_INDEX_FIRST;
 }
 
 void MQTT_PublishOnlyDeviceChannelsIfPossible()
@@ -242,6 +517,7 @@ void MQTT_PublishOnlyDeviceChannelsIfPossible()
 	if (g_bPublishAllStatesNow == 1)
 		return;
 	g_bPublishAllStatesNow = 1;
+	g_bPublishOnlyDirty = false;
 	//Start with light channels
 	g_publishItemIndex = PUBLISHITEM_SELF_DYNAMIC_LIGHTSTATE;
 }
@@ -266,6 +542,12 @@ static struct mqtt_connect_client_info_t mqtt_client_info =
 int channelSet(obk_mqtt_request_t* request);
 int channelGet(obk_mqtt_request_t* request);
 static void MQTT_do_connect(mqtt_client_t* client);
+commandResult_t MQTT_SetQueueConfig(const void* context, const char* cmd, const char* args, int cmdFlags);
+// from new_mqtt_deduper.c
+commandResult_t MQTT_SetDeduper(const void* context, const char* cmd, const char* args, int cmdFlags);
+#ifdef ENABLE_LITTLEFS
+commandResult_t MQTT_SetJournal(const void* context, const char* cmd, const char* args, int cmdFlags);
+#endif
 static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection_status_t status);
 
 int MQTT_GetConnectEvents(void)
@@ -355,6 +637,152 @@ char* MQTT_GetStatusMessage(void)
 	return mqtt_status_message;
 }
 
+static void MQTT_TopicTrie_Free(mqttTopicNode_t *n) {
+	mqttTopicNode_t *next;
+	while (n) {
+		next = n->next;
+		MQTT_TopicTrie_Free(n->child);
+		os_free(n);
+		n = next;
+	}
+}
+static int MQTT_TopicTrie_Insert(mqttTopicNode_t **root, const char *filter, int slot) {
+	mqttTopicNode_t **list, *n;
+	const char *end;
+	int len;
+
+	list = root;
+	while (1) {
+		end = strchr(filter, '/');
+		len = end ? (end - filter) : strlen(filter);
+		for (n = *list; n; n = n->next) {
+			if (n->levelLen == len && !strncmp(n->level, filter, len)) {
+				break;
+			}
+		}
+		if (n == 0) {
+			n = (mqttTopicNode_t*)os_malloc(sizeof(mqttTopicNode_t) + len);
+			if (n == 0) {
+				return 0;
+			}
+			memset(n, 0, sizeof(mqttTopicNode_t));
+			memcpy(n->level, filter, len);
+			n->level[len] = 0;
+			n->levelLen = len;
+			n->next = *list;
+			*list = n;
+		}
+		if (end == 0) {
+			n->subscribers |= (1u << slot);
+			return 1;
+		}
+		filter = end + 1;
+		list = &n->child;
+	}
+}
+// topic is the remaining part of incoming topic, starting at current level
+static unsigned int MQTT_TopicTrie_Match(const mqttTopicNode_t *n, const char *topic, int bRoot) {
+	const mqttTopicNode_t *c;
+	unsigned int mask = 0;
+	const char *end;
+	int len;
+
+	end = strchr(topic, '/');
+	len = end ? (end - topic) : strlen(topic);
+	for (; n; n = n->next) {
+		if (n->level[0] == '#' && n->levelLen == 1) {
+			// topics starting with $ are not matched by wildcards at first level
+			if (!(bRoot && topic[0] == '$')) {
+				mask |= n->subscribers;
+			}
+			continue;
+		}
+		if (n->level[0] == '+' && n->levelLen == 1) {
+			if (bRoot && topic[0] == '$') {
+				continue;
+			}
+		}
+		else if (n->levelLen != len || strncmp(n->level, topic, len)) {
+			continue;
+		}
+		if (end) {
+			mask |= MQTT_TopicTrie_Match(n->child, end + 1, 0);
+		}
+		else {
+			mask |= n->subscribers;
+			// "a/#" also matches "a"
+			for (c = n->child; c; c = c->next) {
+				if (c->level[0] == '#' && c->levelLen == 1) {
+					mask |= c->subscribers;
+				}
+			}
+		}
+	}
+	return mask;
+}
+// mutex is created by MQTT_init, before any other task can use MQTT
+static void MQTT_TopicTrie_Lock() {
+	if (g_mqttTrieMutex == 0) {
+		g_mqttTrieMutex = xSemaphoreCreateMutex();
+	}
+	// nothing is done under it except walking the trie, so it's never held for long
+	while (xSemaphoreTake(g_mqttTrieMutex, 1000) != pdTRUE) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT topic trie mutex wait is too long");
+	}
+}
+static void MQTT_TopicTrie_Unlock() {
+	xSemaphoreGive(g_mqttTrieMutex);
+}
+// old root is freed only after swap, when no walk can still be in it
+static void MQTT_TopicTrie_Swap(mqttTopicNode_t **trie, mqttTopicNode_t *root) {
+	mqttTopicNode_t *old;
+
+	MQTT_TopicTrie_Lock();
+	old = *trie;
+	*trie = root;
+	MQTT_TopicTrie_Unlock();
+	MQTT_TopicTrie_Free(old);
+}
+static void MQTT_TopicTrie_Rebuild() {
+	mqttTopicNode_t *root = 0;
+	char tmp[CGF_MQTT_CLIENT_ID_SIZE + 64];
+	int i;
+
+	for (i = 0; i < numCallbacks; i++) {
+		if (callbacks[i] == 0)
+			continue;
+		if (callbacks[i]->subscriptionTopic && callbacks[i]->subscriptionTopic[0]) {
+			MQTT_TopicTrie_Insert(&root, callbacks[i]->subscriptionTopic, i);
+		}
+		else if (callbacks[i]->topic) {
+			// no subscription given - take everything below base topic
+			snprintf(tmp, sizeof(tmp), "%s#", callbacks[i]->topic);
+			MQTT_TopicTrie_Insert(&root, tmp, i);
+		}
+	}
+	MQTT_TopicTrie_Swap(&g_mqttTopicTrie, root);
+}
+// returns bitmask of callback slots subscribed to given topic
+static unsigned int MQTT_GetSubscribersMask(const char *topic) {
+	unsigned int mask;
+
+	MQTT_TopicTrie_Lock();
+	mask = MQTT_TopicTrie_Match(g_mqttTopicTrie, topic, 1);
+	MQTT_TopicTrie_Unlock();
+	return mask;
+}
+int MQTT_GetSubscribersCount(const char *topic) {
+	unsigned int mask;
+	int count = 0;
+
+	mask = MQTT_GetSubscribersMask(topic);
+	while (mask) {
+		mask &= mask - 1;
+		count++;
+	}
+	return count;
+}
+
 void MQTT_ClearCallbacks() {
 	int i;
 	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
@@ -365,6 +793,9 @@ void MQTT_ClearCallbacks() {
 			callbacks[i] = 0;
 		}
 	}
+	numCallbacks = 0;
+	MQTT_TopicTrie_Rebuild();
+	g_mqttSubscriptionsDirty = true;
 }
 // this can REPLACE callbacks, since we MAY wish to change the root topic....
 // in which case we would re-resigster all callbacks?
@@ -447,15 +878,16 @@ int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic,
 		}
 	}
 
+	callbacks[index]->ID = ID;
 	callbacks[index]->callback = callback;
 	if (index == numCallbacks) {
 		numCallbacks++;
 	}
+	MQTT_TopicTrie_Rebuild();
 
+	// new topic is subscribed on live connection, see MQTT_SyncSubscriptions
 	if (subscribechange) {
-		if (mqtt_client) {
-			mqtt_reconnect = 8;
-		}
+		g_mqttSubscriptionsDirty = true;
 	}
 	// success
 	return 0;
@@ -477,9 +909,8 @@ int MQTT_RemoveCallback(int ID) {
 				}
 				os_free(callbacks[index]);
 				callbacks[index] = NULL;
-				if (mqtt_client) {
-					mqtt_reconnect = 8;
-				}
+				MQTT_TopicTrie_Rebuild();
+				g_mqttSubscriptionsDirty = true;
 				return 1;
 			}
 		}
@@ -619,7 +1050,7 @@ int channelSet(obk_mqtt_request_t* request) {
 	p = strchr(p, '/');
 
 	// if not /set, then stop here
-	if (strcmp(p, "/set")) {
+	if (p == NULL || strcmp(p, "/set")) {
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "channelSet NOT 'set'");
 		return 0;
 	}
@@ -670,35 +1101,48 @@ void MQTT_PublishPrinterContentsToTele(obk_mqtt_publishReplyPrinter_t *printer,
 		toUse = printer->stackBuffer;
 	MQTT_PublishTele(statName, toUse);
 }
+int MQTT_Printer_Append(obk_mqtt_publishReplyPrinter_t* request, const char* s, int len) {
+	char *dst;
+
+	if (request->allocated == 0 && request->curLen + (len + 2) >= MQTT_STACK_BUFFER_SIZE) {
+		// init alloced if needed
+		request->allocated = malloc(MQTT_TOTAL_BUFFER_SIZE);
+		if (request->allocated == 0) {
+			return 0;
+		}
+		memcpy(request->allocated, request->stackBuffer, request->curLen + 1);
+	}
+	if (request->allocated) {
+		if (request->curLen + (len + 2) >= MQTT_TOTAL_BUFFER_SIZE) {
+			// TODO: realloc
+			return 0;
+		}
+		dst = request->allocated;
+	}
+	else {
+		dst = request->stackBuffer;
+	}
+	// length is tracked, so there is no need to strcat over whole reply
+	memcpy(dst + request->curLen, s, len);
+	request->curLen += len;
+	dst[request->curLen] = 0;
+	return 0;
+}
 int mqtt_printf255(obk_mqtt_publishReplyPrinter_t* request, const char* fmt, ...) {
 	va_list argList;
 	char tmp[256];
 	int myLen;
 
-	memset(tmp, 0, sizeof(tmp));
 	va_start(argList, fmt);
-	vsnprintf(tmp, 255, fmt, argList);
+	myLen = vsnprintf(tmp, sizeof(tmp), fmt, argList);
 	va_end(argList);
-
-	myLen = strlen(tmp);
-
-	if (request->curLen + (myLen + 2) >= MQTT_STACK_BUFFER_SIZE) {
-		if (request->curLen + (myLen + 2) >= MQTT_TOTAL_BUFFER_SIZE) {
-			// TODO: realloc
-			return 0;
-		}
-		// init alloced if needed
-		if (request->allocated == 0) {
-			request->allocated = malloc(MQTT_TOTAL_BUFFER_SIZE);
-			strcpy(request->allocated, request->stackBuffer);
-		}
-		strcat(request->allocated, tmp);
+	if (myLen < 0) {
+		return 0;
 	}
-	else {
-		strcat(request->stackBuffer, tmp);
+	if (myLen >= sizeof(tmp)) {
+		myLen = sizeof(tmp) - 1;
 	}
-	request->curLen += myLen;
-	return 0;
+	return MQTT_Printer_Append(request, tmp, myLen);
 }
 void MQTT_ProcessCommandReplyJSON(const char *cmd, const char *args, int flags) {
 	obk_mqtt_publishReplyPrinter_t replyBuilder;
@@ -727,8 +1171,8 @@ int tasCmnd(obk_mqtt_request_t* request) {
 
 #if 1
 	args = (const char *)request->received;
-	// I think that our function get_received always ensured that
-	// there is a NULL terminating character after payload of MQTT
+	// the receive ring always stores a NULL terminating character
+	// after payload of MQTT
 	// So we can feed it directly as command
 	CMD_ExecuteCommandArgs(p, args, COMMAND_FLAG_SOURCE_MQTT);
 	MQTT_ProcessCommandReplyJSON(p, args, COMMAND_FLAG_SOURCE_MQTT);
@@ -780,9 +1224,155 @@ static void MQTT_disconnect(mqtt_client_t* client)
 
 }
 
+// QoS used for each publish category. Telemetry is published often and next
+// value replaces the lost one anyway, so it skips the QoS handshake by default.
+static byte g_mqttQoSByCategory[MQTT_QOS_CAT_MAX] = { 0, 1, 1, 1 };
+static const char *g_mqttQoSCategoryNames[MQTT_QOS_CAT_MAX] = { "telemetry", "state", "reply", "discovery" };
+
+// per-topic overrides, checked before category
+#define MAX_MQTT_QOS_OVERRIDES 8
+typedef struct mqttQoSOverride_s {
+	char filter[MQTT_PUBLISH_ITEM_TOPIC_LENGTH];
+	byte qos;
+} mqttQoSOverride_t;
+static mqttQoSOverride_t g_mqttQoSOverrides[MAX_MQTT_QOS_OVERRIDES];
+static int g_mqttQoSOverridesCount = 0;
+
+// override filters in the same trie as subscriptions, slot is index in g_mqttQoSOverrides
+static mqttTopicNode_t *g_mqttQoSTrie = 0;
+
+// Publish requests handed to lwIP and not yet completed. Started ones are counted
+// by publishing thread under MQTT mutex, completed ones by tcp_thread, so each
+// counter has one writer and request callback doesn't need the mutex.
+static volatile unsigned int mqtt_pub_started = 0;
+static volatile unsigned int mqtt_pub_completed = 0;
+static int mqtt_in_flight_peak = 0;
+
+int MQTT_GetInFlightCounter(void) {
+	return (int)(mqtt_pub_started - mqtt_pub_completed);
+}
+int MQTT_GetInFlightPeak(void) {
+	return mqtt_in_flight_peak;
+}
+
+static void MQTT_QoSTrie_Rebuild() {
+	mqttTopicNode_t *root = 0;
+	int i;
+
+	for (i = 0; i < g_mqttQoSOverridesCount; i++) {
+		MQTT_TopicTrie_Insert(&root, g_mqttQoSOverrides[i].filter, i);
+	}
+	MQTT_TopicTrie_Swap(&g_mqttQoSTrie, root);
+}
+int MQTT_GetPublishQoS(const char *topic, int category) {
+	unsigned int mask;
+	int i;
+
+	MQTT_TopicTrie_Lock();
+	mask = MQTT_TopicTrie_Match(g_mqttQoSTrie, topic, 1);
+	MQTT_TopicTrie_Unlock();
+	// last added override wins
+	for (i = g_mqttQoSOverridesCount - 1; mask && i >= 0; i--) {
+		if (mask & (1u << i)) {
+			return g_mqttQoSOverrides[i].qos;
+		}
+	}
+	if (category < 0 || category >= MQTT_QOS_CAT_MAX) {
+		category = MQTT_QOS_CAT_STATE;
+	}
+	return g_mqttQoSByCategory[category];
+}
+static int MQTT_GetPublishCategory(const char *sTopic, const char *sChannel, int flags, bool appendGet) {
+	const char *p;
+
+	if (flags & OBK_PUBLISH_FLAG_DISCOVERY) {
+		return MQTT_QOS_CAT_DISCOVERY;
+	}
+	if (flags & OBK_PUBLISH_FLAG_TELEMETRY) {
+		return MQTT_QOS_CAT_TELEMETRY;
+	}
+	if (!strncmp(sTopic, "tele/", 5)) {
+		return MQTT_QOS_CAT_TELEMETRY;
+	}
+	if (!strncmp(sTopic, "stat/", 5)) {
+		return MQTT_QOS_CAT_REPLY;
+	}
+	if (appendGet) {
+		return MQTT_QOS_CAT_TELEMETRY;
+	}
+	p = strrchr(sChannel, '/');
+	if (p && !strcmp(p, "/get")) {
+		return MQTT_QOS_CAT_TELEMETRY;
+	}
+	return MQTT_QOS_CAT_STATE;
+}
+// mqtt_qos [Category|TopicFilter] [QoS]
+commandResult_t MQTT_SetQoS(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	const char *name;
+	int qos, i;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 2) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Requires 2 args");
+		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
+	}
+	name = Tokenizer_GetArg(0);
+	qos = Tokenizer_GetArgInteger(1);
+	if (qos > 2) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	for (i = 0; i < MQTT_QOS_CAT_MAX; i++) {
+		if (!stricmp(name, g_mqttQoSCategoryNames[i])) {
+			if (qos < 0) {
+				return CMD_RES_BAD_ARGUMENT;
+			}
+			g_mqttQoSByCategory[i] = qos;
+			return CMD_RES_OK;
+		}
+	}
+	// otherwise it's a topic filter, replace existing one
+	// publishes read overrides under mutex
+	if (MQTT_Mutex_Take(500) == 0) {
+		return CMD_RES_ERROR;
+	}
+	for (i = 0; i < g_mqttQoSOverridesCount; i++) {
+		if (!strcmp(g_mqttQoSOverrides[i].filter, name)) {
+			break;
+		}
+	}
+	if (qos < 0) {
+		// negative QoS removes override
+		if (i < g_mqttQoSOverridesCount) {
+			g_mqttQoSOverridesCount--;
+			memmove(&g_mqttQoSOverrides[i], &g_mqttQoSOverrides[i + 1], (g_mqttQoSOverridesCount - i) * sizeof(mqttQoSOverride_t));
+		}
+	}
+	else {
+		if (i == g_mqttQoSOverridesCount) {
+			if (g_mqttQoSOverridesCount >= MAX_MQTT_QOS_OVERRIDES) {
+				MQTT_Mutex_Free();
+				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Too many QoS overrides");
+				return CMD_RES_ERROR;
+			}
+			g_mqttQoSOverridesCount++;
+		}
+		strcpy_safe(g_mqttQoSOverrides[i].filter, name, sizeof(g_mqttQoSOverrides[i].filter));
+		g_mqttQoSOverrides[i].qos = qos;
+	}
+	MQTT_QoSTrie_Rebuild();
+	MQTT_Mutex_Free();
+	return CMD_RES_OK;
+}
+
 /* Called when publish is complete either with sucess or failure */
 static void mqtt_pub_request_cb(void* arg, err_t result)
 {
+	// requests of closed connection were already forgotten
+	if (mqtt_pub_completed != mqtt_pub_started) {
+		mqtt_pub_completed++;
+	}
 	if (result != ERR_OK)
 	{
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publish result: %d(%s)\n", result, get_error_name(result));
@@ -790,17 +1380,165 @@ static void mqtt_pub_request_cb(void* arg, err_t result)
 	}
 }
 
+// "<clientId>/" cached, so channel topics are not rebuilt from config on every publish
+static char g_mqttClientTopicPrefix[CGF_MQTT_CLIENT_ID_SIZE + 2];
+static int g_mqttClientTopicPrefixLen = 0;
+
+static void MQTT_UpdateClientTopicPrefix() {
+	snprintf(g_mqttClientTopicPrefix, sizeof(g_mqttClientTopicPrefix), "%s/", CFG_GetMQTTClientId());
+	g_mqttClientTopicPrefixLen = strlen(g_mqttClientTopicPrefix);
+}
+
+void MQTT_OnWiFiConnected() {
+	g_wifiToPublishTimerMS = 0;
+}
+static void MQTT_StopWiFiToPublishTimer() {
+	if (g_wifiToPublishTimerMS < 0) {
+		return;
+	}
+	g_wifiToPublishLastMS = g_wifiToPublishTimerMS;
+	g_wifiToPublishTimerMS = -1;
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "First publish %i ms after WiFi connected\n", g_wifiToPublishLastMS);
+}
+int MQTT_GetWiFiToFirstPublishMS() {
+	return g_wifiToPublishLastMS;
+}
+int MQTT_GetSubscribePacketsCounter() {
+	return g_mqttSubscribePackets;
+}
+
+// Publishes given full topic, client must be connected and mutex taken by caller.
+static OBK_Publish_Result MQTT_PublishRaw(mqtt_client_t* client, const char* pub_topic, const char* sVal, int sVal_len, u8_t qos, u8_t retain)
+{
+	err_t err;
+
+	LOCK_TCPIP_CORE();
+	// counted before the call, because request callback may come at once
+	mqtt_pub_started++;
+	if (MQTT_GetInFlightCounter() > mqtt_in_flight_peak) {
+		mqtt_in_flight_peak = MQTT_GetInFlightCounter();
+	}
+	err = mqtt_publish(client, pub_topic, sVal, sVal_len, qos, retain, mqtt_pub_request_cb, 0);
+	if (err != ERR_OK) {
+		mqtt_pub_started--;
+	}
+	UNLOCK_TCPIP_CORE();
+
+	if (err != ERR_OK)
+	{
+		if (err == ERR_CONN)
+		{
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_CONN aka %d\n", err);
+		}
+		else if (err == ERR_MEM) {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_MEM aka %d\n", err);
+			g_memoryErrorsThisSession++;
+		}
+		else {
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
+		}
+		mqtt_publish_errors++;
+		return OBK_PUBLISH_MEM_FAIL;
+	}
+	mqtt_published_events++;
+	MQTT_StopWiFiToPublishTimer();
+	return OBK_PUBLISH_OK;
+}
+#ifdef ENABLE_LITTLEFS
+// Replayed value goes to its topic with 'get' replaced by 'journal', so it doesn't
+// overwrite current state, as {"t":timestamp,"v":value}. Timestamp is NTP time of the
+// original publish, or 0 if time was not known. Numbers are kept raw, other values are JSON strings.
+// strict JSON number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool MQTT_IsJSONNumber(const char *s) {
+	if (*s == '-')
+		s++;
+	if (*s == '0') {
+		s++;
+	}
+	else if (*s >= '1' && *s <= '9') {
+		while (*s >= '0' && *s <= '9')
+			s++;
+	}
+	else {
+		return false;
+	}
+	if (*s == '.') {
+		s++;
+		if (*s < '0' || *s > '9')
+			return false;
+		while (*s >= '0' && *s <= '9')
+			s++;
+	}
+	if (*s == 'e' || *s == 'E') {
+		s++;
+		if (*s == '+' || *s == '-')
+			s++;
+		if (*s < '0' || *s > '9')
+			return false;
+		while (*s >= '0' && *s <= '9')
+			s++;
+	}
+	return *s == 0;
+}
+// called by journal replay without MQTT mutex
+static int MQTT_Journal_PublishCb(const char *topic, const char *value, unsigned int timestamp)
+{
+	char journalTopic[128];
+	char payload[160];
+	const char *base;
+	int baseLen, len, i, res;
+
+	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Journal replay of %s to %s (time %u)\n", value, topic, timestamp);
+	base = topic;
+	baseLen = strlen(topic);
+	if (baseLen >= 4 && !strcmp(topic + baseLen - 4, "/get")) {
+		baseLen -= 4;
+	}
+	snprintf(journalTopic, sizeof(journalTopic), "%.*s/journal", baseLen, base);
+
+	if (MQTT_IsJSONNumber(value)) {
+		len = snprintf(payload, sizeof(payload), "{\"t\":%u,\"v\":%s}", timestamp, value);
+	}
+	else {
+		len = snprintf(payload, sizeof(payload), "{\"t\":%u,\"v\":\"", timestamp);
+		for (i = 0; value[i] && len < (int)sizeof(payload) - 9; i++) {
+			if ((byte)value[i] < 0x20) {
+				len += sprintf(payload + len, "\\u%04x", (byte)value[i]);
+				continue;
+			}
+			if (value[i] == '"' || value[i] == '\\') {
+				payload[len++] = '\\';
+			}
+			payload[len++] = value[i];
+		}
+		strcpy(payload + len, "\"}");
+		len += 2;
+	}
+	if (MQTT_Mutex_Take(100) == 0) {
+		return 0;
+	}
+	res = MQTT_PublishRaw(mqtt_client, journalTopic, payload, len,
+		MQTT_GetPublishQoS(journalTopic, MQTT_QOS_CAT_TELEMETRY), 0) == OBK_PUBLISH_OK;
+	MQTT_Mutex_Free();
+	return res;
+}
+#endif
+
 // This publishes value to the specified topic/channel.
 static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const char* sTopic, const char* sChannel, const char* sVal, int flags, bool appendGet)
 {
-	err_t err;
-	u8_t qos = 2; /* 0 1 or 2, see MQTT specification */
+	OBK_Publish_Result ret;
+	u8_t qos; /* 0 1 or 2, see MQTT specification */
 	u8_t retain = 0; /* No don't retain such crappy payload... */
 	size_t sVal_len;
+	char topicBuffer[128];
 	char* pub_topic;
+	int need;
 
 	if (client == 0)
 		return OBK_PUBLISH_WAS_DISCONNECTED;
+	if (sVal == NULL)
+		return OBK_PUBLISH_MEM_FAIL;
 
 	if (flags & OBK_PUBLISH_FLAG_MUTEX_SILENT)
 	{
@@ -810,84 +1548,239 @@ static OBK_Publish_Result MQTT_PublishTopicToClient(mqtt_client_t* client, const
 		}
 	}
 	else {
-		if (MQTT_Mutex_Take(500) == 0)
-		{
-			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_PublishTopicToClient: mutex failed for %s=%s\r\n", sChannel, sVal);
-			return OBK_PUBLISH_MUTEX_FAIL;
-		}
-	}
-	if (flags & OBK_PUBLISH_FLAG_RETAIN)
-	{
-		retain = 1;
-	}
-	// global tool
-	if (CFG_HasFlag(OBK_FLAG_MQTT_ALWAYSSETRETAIN))
-	{
-		retain = 1;
-	}
-	if (flags & OBK_PUBLISH_FLAG_FORCE_REMOVE_GET)
-	{
-		appendGet = false;
+		if (MQTT_Mutex_Take(500) == 0)
+		{
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_PublishTopicToClient: mutex failed for %s=%s\r\n", sChannel, sVal);
+			return OBK_PUBLISH_MUTEX_FAIL;
+		}
+	}
+	if (flags & OBK_PUBLISH_FLAG_RETAIN)
+	{
+		retain = 1;
+	}
+	// global tool
+	if (CFG_HasFlag(OBK_FLAG_MQTT_ALWAYSSETRETAIN))
+	{
+		retain = 1;
+	}
+	if (flags & OBK_PUBLISH_FLAG_FORCE_REMOVE_GET)
+	{
+		appendGet = false;
+	}
+
+
+	LOCK_TCPIP_CORE();
+	int res = mqtt_client_is_connected(client);
+	UNLOCK_TCPIP_CORE();
+
+	if (res == 0)
+	{
+		g_my_reconnect_mqtt_after_time = 5;
+#ifdef ENABLE_LITTLEFS
+		// keep channel and sensor values, broadcast items are sent again anyway
+		if (appendGet && (flags & OBK_PUBLISH_FLAG_MUTEX_SILENT) == 0) {
+			snprintf(topicBuffer, sizeof(topicBuffer), "%s/%s/get", sTopic, sChannel);
+			MQTT_Journal_Append(topicBuffer, sVal);
+		}
+#endif
+		MQTT_Mutex_Free();
+		return OBK_PUBLISH_WAS_DISCONNECTED;
+	}
+
+	g_timeSinceLastMQTTPublish = 0;
+
+	// short topics are built on stack
+	need = strlen(sTopic) + 1 + strlen(sChannel) + 4 + 1; //4 for /get
+	if (need <= sizeof(topicBuffer)) {
+		pub_topic = topicBuffer;
+	}
+	else {
+		pub_topic = (char*)os_malloc(need);
+		if (pub_topic == NULL) {
+			MQTT_Mutex_Free();
+			return OBK_PUBLISH_MEM_FAIL;
+		}
+	}
+	sVal_len = strlen(sVal);
+	sprintf(pub_topic, "%s/%s%s", sTopic, sChannel, (appendGet == true ? "/get" : ""));
+	qos = MQTT_GetPublishQoS(pub_topic, MQTT_GetPublishCategory(sTopic, sChannel, flags, appendGet));
+	if (sVal_len < 128)
+	{
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i qos=%i\n", sVal, pub_topic, retain, qos);
+	}
+	else {
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i qos=%i\n", sVal_len, pub_topic, retain, qos);
+	}
+
+	ret = MQTT_PublishRaw(client, pub_topic, sVal, sVal_len, qos, retain);
+	if (pub_topic != topicBuffer) {
+		os_free(pub_topic);
+	}
+	MQTT_Mutex_Free();
+	return ret;
+}
+
+// Channel changes made during one quick tick are collected here and published
+// together at the end of tick. Channel is the key, so only the latest value
+// of a channel that changed many times is sent.
+// Channels change from many tasks, so batch is guarded by MQTT mutex.
+#define MQTT_BATCH_MAX_ITEMS	16
+// enough for "%f" of any channel value, like old direct publish
+#define MQTT_BATCH_VALUE_SIZE	32
+typedef struct mqttBatchItem_s {
+	byte channel;
+	byte retain;
+	char value[MQTT_BATCH_VALUE_SIZE];
+} mqttBatchItem_t;
+
+static mqttBatchItem_t g_mqttBatch[MQTT_BATCH_MAX_ITEMS];
+static int g_mqttBatchCount = 0;
+// index in g_mqttBatch + 1, 0 if channel is not queued
+static byte g_mqttBatchIndexByChannel[CHANNEL_MAX];
+static int mqtt_batch_flushes = 0;
+static int mqtt_batch_coalesced = 0;
+static int mqtt_batch_lastItems = 0;
+static int mqtt_batch_lastBytes = 0;
+
+int MQTT_GetBatchQueuedCount(void) {
+	return g_mqttBatchCount;
+}
+int MQTT_GetBatchFlushCounter(void) {
+	return mqtt_batch_flushes;
+}
+int MQTT_GetBatchCoalescedCounter(void) {
+	return mqtt_batch_coalesced;
+}
+int MQTT_GetBatchLastFlushBytes(void) {
+	return mqtt_batch_lastBytes;
+}
+int MQTT_GetBatchLastFlushItems(void) {
+	return mqtt_batch_lastItems;
+}
+
+static void MQTT_ChannelValueToString(int channel, char *out, int outSize) {
+	if (CFG_HasFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES)) {
+		snprintf(out, outSize, "%f", CHANNEL_GetFinalValue(channel));
+	}
+	else {
+		snprintf(out, outSize, "%i", CHANNEL_Get(channel));
 	}
+}
+static void MQTT_Batch_Clear() {
+	int i;
 
+	for (i = 0; i < g_mqttBatchCount; i++) {
+		g_mqttBatchIndexByChannel[g_mqttBatch[i].channel] = 0;
+	}
+	g_mqttBatchCount = 0;
+}
+// publishes and clears all queued channels, MQTT mutex must be taken by caller
+static OBK_Publish_Result MQTT_Batch_FlushLocked() {
+	mqttBatchItem_t *it;
+	char topic[CGF_MQTT_CLIENT_ID_SIZE + 2 + 8];
+	int i, len, bytes, res;
+	u8_t qos;
+	OBK_Publish_Result ret;
 
+	if (mqtt_client == 0) {
+		MQTT_Batch_Clear();
+		return OBK_PUBLISH_WAS_DISCONNECTED;
+	}
 	LOCK_TCPIP_CORE();
-	int res = mqtt_client_is_connected(client);
+	res = mqtt_client_is_connected(mqtt_client);
 	UNLOCK_TCPIP_CORE();
-
-	if (res == 0)
-	{
+	if (res == 0) {
 		g_my_reconnect_mqtt_after_time = 5;
-		MQTT_Mutex_Free();
+#ifdef ENABLE_LITTLEFS
+		for (i = 0; i < g_mqttBatchCount; i++) {
+			it = &g_mqttBatch[i];
+			len = g_mqttClientTopicPrefixLen;
+			memcpy(topic, g_mqttClientTopicPrefix, len);
+			sprintf(topic + len, "%i/get", it->channel);
+			MQTT_Journal_Append(topic, it->value);
+		}
+#endif
+		// unless journal keeps them, full state is published after reconnect anyway
+		MQTT_Batch_Clear();
 		return OBK_PUBLISH_WAS_DISCONNECTED;
 	}
-
 	g_timeSinceLastMQTTPublish = 0;
 
-	pub_topic = (char*)os_malloc(strlen(sTopic) + 1 + strlen(sChannel) + 5 + 1); //5 for /get
-	if ((pub_topic != NULL) && (sVal != NULL))
-	{
-		sVal_len = strlen(sVal);
-		sprintf(pub_topic, "%s/%s%s", sTopic, sChannel, (appendGet == true ? "/get" : ""));
-		if (sVal_len < 128)
-		{
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i\n", sVal, pub_topic, retain);
-		}
-		else {
-			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Publishing val (%d bytes) to %s retain=%i\n", sVal_len, pub_topic, retain);
+	ret = OBK_PUBLISH_OK;
+	bytes = 0;
+	memcpy(topic, g_mqttClientTopicPrefix, g_mqttClientTopicPrefixLen);
+	for (i = 0; i < g_mqttBatchCount; i++) {
+		it = &g_mqttBatch[i];
+		len = g_mqttClientTopicPrefixLen;
+		len += sprintf(topic + len, "%i/get", it->channel);
+		qos = MQTT_GetPublishQoS(topic, MQTT_QOS_CAT_TELEMETRY);
+		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "Publishing val %s to %s retain=%i qos=%i\n", it->value, topic, it->retain, qos);
+		if (MQTT_PublishRaw(mqtt_client, topic, it->value, strlen(it->value), qos, it->retain) != OBK_PUBLISH_OK) {
+			ret = OBK_PUBLISH_MEM_FAIL;
 		}
+		bytes += len + strlen(it->value);
+	}
+	mqtt_batch_flushes++;
+	mqtt_batch_lastItems = g_mqttBatchCount;
+	mqtt_batch_lastBytes = bytes;
+	MQTT_Batch_Clear();
+	return ret;
+}
+// publishes all queued channels under one mutex section
+OBK_Publish_Result MQTT_Batch_Flush() {
+	OBK_Publish_Result ret;
 
+	if (g_mqttBatchCount == 0) {
+		return OBK_PUBLISH_WAS_NOT_REQUIRED;
+	}
+	if (MQTT_Mutex_Take(100) == 0) {
+		// try again on next tick
+		return OBK_PUBLISH_MUTEX_FAIL;
+	}
+	ret = MQTT_Batch_FlushLocked();
+	MQTT_Mutex_Free();
 
-		LOCK_TCPIP_CORE();
-		err = mqtt_publish(client, pub_topic, sVal, strlen(sVal), qos, retain, mqtt_pub_request_cb, 0);
-		UNLOCK_TCPIP_CORE();
-		os_free(pub_topic);
+	if (ret != OBK_PUBLISH_WAS_DISCONNECTED) {
+		// one Tasmota state per flush, not per channel
+		MQTT_BroadcastTasmotaTeleSTATE();
+	}
+	return ret;
+}
+// Queues channel value publish, it will be sent at the end of current quick tick
+void MQTT_QueueChannelPublish(int channel) {
+	mqttBatchItem_t *it;
+	int idx;
 
-		if (err != ERR_OK)
-		{
-			if (err == ERR_CONN)
-			{
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_CONN aka %d\n", err);
-			}
-			else if (err == ERR_MEM) {
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: ERR_MEM aka %d\n", err);
-				g_memoryErrorsThisSession++;
-			}
-			else {
-				addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Publish err: %d\n", err);
-			}
-			mqtt_publish_errors++;
-			MQTT_Mutex_Free();
-			return OBK_PUBLISH_MEM_FAIL;
-		}
-		mqtt_published_events++;
-		MQTT_Mutex_Free();
-		return OBK_PUBLISH_OK;
+	if (channel < 0 || channel >= CHANNEL_MAX) {
+		return;
+	}
+	if (MQTT_Mutex_Take(500) == 0) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "MQTT_QueueChannelPublish: mutex failed for channel %i\r\n", channel);
+		return;
+	}
+	idx = g_mqttBatchIndexByChannel[channel];
+	if (idx) {
+		it = &g_mqttBatch[idx - 1];
+		mqtt_batch_coalesced++;
 	}
 	else {
-		MQTT_Mutex_Free();
-		return OBK_PUBLISH_MEM_FAIL;
+		if (g_mqttBatchCount >= MQTT_BATCH_MAX_ITEMS) {
+			// sent from this task, batch is always empty after that
+			MQTT_Batch_FlushLocked();
+		}
+		it = &g_mqttBatch[g_mqttBatchCount];
+		it->channel = channel;
+		g_mqttBatchCount++;
+		g_mqttBatchIndexByChannel[channel] = g_mqttBatchCount;
+		QuickTick_RequestWakeup();
+	}
+	it->retain = CFG_HasFlag(OBK_FLAG_MQTT_ALWAYSSETRETAIN);
+	// This will set RETAIN flag for all channels that are used for RELAY
+	if (CFG_HasFlag(OBK_FLAG_MQTT_RETAIN_POWER_CHANNELS) && CHANNEL_IsPowerRelayChannel(channel)) {
+		it->retain = 1;
 	}
+	MQTT_ChannelValueToString(channel, it->value, sizeof(it->value));
+	MQTT_Mutex_Free();
 }
 
 // This is used to publish channel values in "obk0696FB33/1/get" format with numerical value,
@@ -929,74 +1822,60 @@ void MQTT_OBK_Printf(char* s) {
 // we should do callbacks from one of our threads?
 static void mqtt_incoming_data_cb(void* arg, const u8_t* data, u16_t len, u8_t flags)
 {
-	int i;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
 	// if we stored a topic in g_mqtt_request, then we found a matching callback, so use it.
-	if (g_mqtt_request.topic[0])
+	if (g_mqtt_incomingTopic[0])
 	{
 		// note: data is NOT terminated (it may be binary...).
 		g_mqtt_request.received = data;
 		g_mqtt_request.receivedLen = len;
 
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", g_mqtt_request.topic);
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT in topic %s", g_mqtt_incomingTopic);
 		mqtt_received_events++;
 
-		for (i = 0; i < numCallbacks; i++)
-		{
-			if (callbacks[i] == 0)
-				continue;
-			char* cbtopic = callbacks[i]->topic;
-			if (!strncmp(g_mqtt_request.topic, cbtopic, strlen(cbtopic)))
-			{
-				MQTT_Post_Received(g_mqtt_request.topic, strlen(g_mqtt_request.topic), data, len);
-				// if ANYONE is interested, store it.
-				break;
-				// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-				// i.e. multiple people can get each topic if required.
-				//if (callbacks[i]->callback(&g_mqtt_request))
-				//{
-				//	return;
-				//}
-			}
-		}
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", g_mqtt_request.topic);
+		// topic was already matched against subscriptions in mqtt_incoming_publish_cb,
+		// so someone is interested, store it.
+		MQTT_Post_Received(g_mqtt_incomingTopic, strlen(g_mqtt_incomingTopic), data, len);
 	}
 }
 
 
 // run from userland (quicktick or wakeable thread)
 int MQTT_process_received(){
-	char *topic;
-	int topiclen;
-	unsigned char *data;
-	int datalen;
-	int found = 0;
+	mqttRxRecord_t *rec;
+	const char *topic;
+	const unsigned char *data;
+	unsigned int mask;
 	int count = 0;
-	do{
-		found = get_received(&topic, &topiclen, &data, &datalen);
-		if (found){
-			count++;
-			strncpy(g_mqtt_request_cb.topic, topic, sizeof(g_mqtt_request_cb.topic));
-			g_mqtt_request_cb.received = data;
-			g_mqtt_request_cb.receivedLen = datalen;
-			for (int i = 0; i < numCallbacks; i++)
+	int i;
+
+	while ((rec = MQTT_RxPeek(&topic, &data)) != 0) {
+		count++;
+		// callbacks get the topic and data in place, record is released after them
+		g_mqtt_request_cb.topic = topic;
+		g_mqtt_request_cb.received = data;
+		g_mqtt_request_cb.receivedLen = rec->dataLen;
+		// every subscriber with matching filter gets it, in registration order
+		mask = MQTT_GetSubscribersMask(topic);
+		if (mask == 0) {
+			addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT topic not handled: %s", topic);
+		}
+		for (i = 0; mask && i < numCallbacks; i++)
+		{
+			if (!(mask & (1u << i)) || callbacks[i] == 0)
+				continue;
+			mask &= ~(1u << i);
+			// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
+			if (callbacks[i]->callback(&g_mqtt_request_cb))
 			{
-				char* cbtopic = callbacks[i]->topic;
-				if (!strncmp(topic, cbtopic, strlen(cbtopic)))
-				{
-					// note - callback must return 1 to say it ate the mqtt, else further processing can be performed.
-					// i.e. multiple people can get each topic if required.
-					if (callbacks[i]->callback(&g_mqtt_request_cb))
-					{
-						// if no further processing, then break this loop.
-						break;
-					}
-				}
+				// if no further processing, then break this loop.
+				break;
 			}
 		}
-	} while (found);
+		MQTT_RxCommit(rec);
+	}
 
 	return count;
 }
@@ -1007,21 +1886,15 @@ int MQTT_process_received(){
 static void mqtt_incoming_publish_cb(void* arg, const char* topic, u32_t tot_len)
 {
 	//const char *p;
-	int i;
 	// unused - left here as example
 	//const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
 
-	// look for a callback with this URL and method, or HTTP_ANY
-	g_mqtt_request.topic[0] = '\0';
-	for (i = 0; i < numCallbacks; i++)
+	// look for any subscription matching this topic
+	g_mqtt_incomingTopic[0] = '\0';
+	if (MQTT_GetSubscribersMask(topic))
 	{
-		char* cbtopic = callbacks[i]->topic;
-		if (strncmp(topic, cbtopic, strlen(cbtopic)))
-		{
-			strncpy(g_mqtt_request.topic, topic, sizeof(g_mqtt_request.topic) - 1);
-			g_mqtt_request.topic[sizeof(g_mqtt_request.topic) - 1] = 0;
-			break;
-		}
+		strncpy(g_mqtt_incomingTopic, topic, sizeof(g_mqtt_incomingTopic) - 1);
+		g_mqtt_incomingTopic[sizeof(g_mqtt_incomingTopic) - 1] = 0;
 	}
 	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "MQTT client in mqtt_incoming_publish_cb topic %s\n", topic);
 }
@@ -1034,16 +1907,107 @@ static void mqtt_request_cb(void* arg, err_t err)
 	}
 }
 
+static bool MQTT_IsSubscribed(const char *topic) {
+	int i;
+
+	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
+		if (g_mqttSubscribed[i] && !strcmp(g_mqttSubscribed[i], topic)) {
+			return true;
+		}
+	}
+	return false;
+}
+static bool MQTT_IsSubscriptionWanted(const char *topic) {
+	int i;
+
+	for (i = 0; i < numCallbacks; i++) {
+		if (callbacks[i] && callbacks[i]->subscriptionTopic && !strcmp(callbacks[i]->subscriptionTopic, topic)) {
+			return true;
+		}
+	}
+	return false;
+}
+// broker has dropped our session, so everything has to be subscribed again
+static void MQTT_ForgetSubscriptions() {
+	int i;
+
+	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
+		if (g_mqttSubscribed[i]) {
+			free(g_mqttSubscribed[i]);
+			g_mqttSubscribed[i] = 0;
+		}
+	}
+	g_mqttSubscriptionsDirty = true;
+}
+// sends SUBSCRIBE or UNSUBSCRIBE packet for a topic and updates list of subscribed topics
+static void MQTT_SendSubUnsub(mqtt_client_t* client, const char *topic, u8_t sub) {
+	err_t err;
+	int j;
+
+	LOCK_TCPIP_CORE();
+	err = mqtt_sub_unsub(client, topic, 1, mqtt_request_cb, LWIP_CONST_CAST(void*, &mqtt_client_info), sub);
+	UNLOCK_TCPIP_CORE();
+	if (err != ERR_OK) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_%s of %s return: %d\n", sub ? "subscribe" : "unsubscribe", topic, err);
+		// try again later
+		g_mqttSubscriptionsDirty = true;
+		return;
+	}
+	g_mqttSubscribePackets++;
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_%s to %s\n", sub ? "subscribed" : "unsubscribed", topic);
+	for (j = 0; j < MAX_MQTT_CALLBACKS; j++) {
+		if (sub) {
+			if (g_mqttSubscribed[j] == 0) {
+				g_mqttSubscribed[j] = strdup(topic);
+				break;
+			}
+		}
+		else if (g_mqttSubscribed[j] && !strcmp(g_mqttSubscribed[j], topic)) {
+			free(g_mqttSubscribed[j]);
+			g_mqttSubscribed[j] = 0;
+			break;
+		}
+	}
+}
+// Compares subscription topics of callbacks with the ones broker knows and sends
+// only the difference. Client must be connected.
+// Called from main thread with MQTT mutex taken.
+static void MQTT_SyncSubscriptions(mqtt_client_t* client) {
+	const char *topic;
+	int i;
+
+	if (g_mqttSubscriptionsDirty == false) {
+		return;
+	}
+	g_mqttSubscriptionsDirty = false;
+
+	// unsubscribe topics that no callback uses now
+	for (i = 0; i < MAX_MQTT_CALLBACKS; i++) {
+		if (g_mqttSubscribed[i] && !MQTT_IsSubscriptionWanted(g_mqttSubscribed[i])) {
+			MQTT_SendSubUnsub(client, g_mqttSubscribed[i], 0);
+		}
+	}
+	// subscribe new ones, each topic once even if many callbacks use it
+	for (i = 0; i < numCallbacks; i++) {
+		if (callbacks[i] == 0 || callbacks[i]->subscriptionTopic == 0 || callbacks[i]->subscriptionTopic[0] == 0) {
+			continue;
+		}
+		topic = callbacks[i]->subscriptionTopic;
+		if (MQTT_IsSubscribed(topic)) {
+			continue;
+		}
+		MQTT_SendSubUnsub(client, topic, 1);
+	}
+}
+
 /////////////////////////////////////////////
 // should be called in tcp_thread context.
 static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection_status_t status)
 {
-	int i;
 	char tmp[CGF_MQTT_CLIENT_ID_SIZE + 16];
 	const char* clientId;
 	err_t err = ERR_OK;
-	const struct mqtt_connect_client_info_t* client_info = (const struct mqtt_connect_client_info_t*)arg;
-	LWIP_UNUSED_ARG(client);
+	LWIP_UNUSED_ARG(arg);
 
 	//   addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"MQTT client < removed name > connection cb: status %d\n",  (int)status);
 	 //  addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"MQTT client \"%s\" connection cb: status %d\n", client_info->client_id, (int)status);
@@ -1051,6 +2015,8 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 	if (status == MQTT_CONNECT_ACCEPTED)
 	{
 		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_connection_cb: Successfully connected\n");
+		// requests of previous connection were dropped with it
+		mqtt_pub_completed = mqtt_pub_started;
 
 		//LOCK_TCPIP_CORE();
 		mqtt_set_inpub_callback(mqtt_client,
@@ -1059,25 +2025,9 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 			LWIP_CONST_CAST(void*, &mqtt_client_info));
 		//UNLOCK_TCPIP_CORE();
 
-		// subscribe to all callback subscription topics
-		// this makes a BIG assumption that we can subscribe multiple times to the same one?
-		// TODO - check that subscribing multiple times to the same topic is not BAD
-		for (i = 0; i < numCallbacks; i++) {
-			if (callbacks[i]) {
-				if (callbacks[i]->subscriptionTopic && callbacks[i]->subscriptionTopic[0]) {
-					err = mqtt_sub_unsub(client,
-						callbacks[i]->subscriptionTopic, 1,
-						mqtt_request_cb, LWIP_CONST_CAST(void*, client_info),
-						1);
-					if (err != ERR_OK) {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribe to %s return: %d\n", callbacks[i]->subscriptionTopic, err);
-					}
-					else {
-						addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "mqtt_subscribed to %s\n", callbacks[i]->subscriptionTopic);
-					}
-				}
-			}
-		}
+		// clean session, so broker has no subscriptions of previous connection.
+		// They are sent again from main thread, see MQTT_RunEverySecondUpdate
+		g_mqttForgetSubscriptions = true;
 
 		clientId = CFG_GetMQTTClientId();
 
@@ -1091,6 +2041,9 @@ static void mqtt_connection_cb(mqtt_client_t* client, void* arg, mqtt_connection
 				// g_my_reconnect_mqtt_after_time = 5;
 			}
 		}
+		else {
+			MQTT_StopWiFiToPublishTimer();
+		}
 
 		g_just_connected = 1;
 
@@ -1237,20 +2190,10 @@ OBK_Publish_Result MQTT_PublishMain_StringString(const char* sChannel, const cha
 OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags)
 {
 	char channelNameStr[8];
-	char valueStr[16];
+	char valueStr[MQTT_BATCH_VALUE_SIZE];
 
-	if (CFG_HasFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES)) {
-		float dVal = CHANNEL_GetFinalValue(channel);
-		// Float value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %f to channel %i \n", dVal, channel);
-		sprintf(valueStr, "%f", dVal);
-	}
-	else {
-		int iVal = CHANNEL_Get(channel);
-		// Integer value
-		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %i to channel %i \n", iVal, channel);
-		sprintf(valueStr, "%i", iVal);
-	}
+	MQTT_ChannelValueToString(channel, valueStr, sizeof(valueStr));
+	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Channel has changed! Publishing %s to channel %i \n", valueStr, channel);
 
 	MQTT_BroadcastTasmotaTeleSTATE();
 
@@ -1461,6 +2404,13 @@ commandResult_t MQTT_SetBroadcastInterval(const void* context, const char* cmd,
 		return CMD_RES_NOT_ENOUGH_ARGUMENTS;
 	}
 	g_intervalBetweenMQTTBroadcasts = Tokenizer_GetArgInteger(0);
+	if (Tokenizer_GetArgsCount() > 1) {
+		g_broadcastFullRefreshEvery = Tokenizer_GetArgInteger(1);
+		g_broadcastsSinceFullRefresh = 0;
+	}
+	if (g_secondsBeforeNextBroadcast > g_intervalBetweenMQTTBroadcasts) {
+		g_secondsBeforeNextBroadcast = g_intervalBetweenMQTTBroadcasts;
+	}
 
 	return CMD_RES_OK;
 }
@@ -1551,6 +2501,7 @@ void MQTT_InitCallbacks() {
 
 	MQTT_ClearCallbacks();
 	g_mqtt_bBaseTopicDirty = 0;
+	MQTT_UpdateClientTopicPrefix();
 
 	clientId = CFG_GetMQTTClientId();
 	groupId = CFG_GetMQTTGroupTopic();
@@ -1617,8 +2568,21 @@ void MQTT_init()
 #ifdef WINDOWS
 	mqtt_client = 0;
 #endif
+	if (g_mqttTrieMutex == 0) {
+		g_mqttTrieMutex = xSemaphoreCreateMutex();
+	}
+	if (g_mqttQueueMutex == 0) {
+		g_mqttQueueMutex = xSemaphoreCreateMutex();
+	}
+#ifdef ENABLE_LITTLEFS
+	MQTT_Journal_Init();
+#endif
 
 	MQTT_InitCallbacks();
+	MQTT_Dedup_Clear();
+	// new client has no subscriptions
+	g_mqttForgetSubscriptions = false;
+	MQTT_ForgetSubscriptions();
 
 	mqtt_initialised = 1;
 
@@ -1657,8 +2621,8 @@ void MQTT_init()
 	//cmddetail:"fn":"MQTT_StartMQTTTestThread","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("publishBenchmark", MQTT_StartMQTTTestThread, NULL);
-	//cmddetail:{"name":"mqtt_broadcastInterval","args":"[ValueSeconds]",
-	//cmddetail:"descr":"If broadcast self state every 60 seconds/minute is enabled in flags, this value allows you to change the delay, change this 60 seconds to any other value in seconds. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:{"name":"mqtt_broadcastInterval","args":"[ValueSeconds] [FullRefreshEvery]",
+	//cmddetail:"descr":"If broadcast self state every 60 seconds/minute is enabled in flags, this value allows you to change the delay, change this 60 seconds to any other value in seconds. Broadcast sends only items that have changed since the previous one, and every FullRefreshEvery broadcast (default 10, 1 means always) sends all of them. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
 	//cmddetail:"fn":"MQTT_SetBroadcastInterval","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("mqtt_broadcastInterval", MQTT_SetBroadcastInterval, NULL);
@@ -1667,11 +2631,84 @@ void MQTT_init()
 	//cmddetail:"fn":"MQTT_SetMaxBroadcastItemsPublishedPerSecond","file":"mqtt/new_mqtt.c","requires":"",
 	//cmddetail:"examples":""}
 	CMD_RegisterCommand("mqtt_broadcastItemsPerSec", MQTT_SetMaxBroadcastItemsPublishedPerSecond, NULL);
+	//cmddetail:{"name":"mqtt_qos","args":"[Category|TopicFilter] [QoS]",
+	//cmddetail:"descr":"Sets QoS used for publishes. Category can be telemetry (channel values, sensors, tele/, default 0), state (default 1), reply (stat/, default 1) or discovery (default 1). Otherwise first argument is a topic filter, with + and # wildcards, that overrides category for matching topics; QoS -1 removes such override. This value is not saved, you must use autoexec.bat or short startup command to execute it on every reboot.",
+	//cmddetail:"fn":"MQTT_SetQoS","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_qos telemetry 1<br>mqtt_qos obk/+/power/get 2"}
+	CMD_RegisterCommand("mqtt_qos", MQTT_SetQoS, NULL);
+	//cmddetail:{"name":"mqtt_queue","args":"[SizeBytes] [DropOldest]",
+	//cmddetail:"descr":"Configures queue of larger publishes (like HASS discovery). SizeBytes is arena size, default 8192, it can be changed only when queue is empty. DropOldest 1 makes full queue drop oldest items instead of rejecting new ones. Without arguments, prints queue statistics.",
+	//cmddetail:"fn":"MQTT_SetQueueConfig","file":"mqtt/new_mqtt.c","requires":"",
+	//cmddetail:"examples":"mqtt_queue 4096 1"}
+	CMD_RegisterCommand("mqtt_queue", MQTT_SetQueueConfig, NULL);
+	//cmddetail:{"name":"mqtt_deduper","args":"[MinIntervalMS] [FloatEpsilon]",
+	//cmddetail:"descr":"Configures deduper of LED state publishes. Publishes of the same name that come faster than MinIntervalMS (default 1000) are delayed and only the latest value is sent. Float values closer than FloatEpsilon (default 0.001) to the last sent one are not republished. Without arguments, prints deduper statistics.",
+	//cmddetail:"fn":"MQTT_SetDeduper","file":"mqtt/new_mqtt_deduper.c","requires":"",
+	//cmddetail:"examples":"mqtt_deduper 250"}
+	CMD_RegisterCommand("mqtt_deduper", MQTT_SetDeduper, NULL);
+#ifdef ENABLE_LITTLEFS
+	//cmddetail:{"name":"mqtt_journal","args":"[Enable|clear] [ReplayPerSecond] [Segments] [SegmentBytes]",
+	//cmddetail:"descr":"Offline journal. When enabled, channel and sensor values that can't be published because MQTT is disconnected are stored on LittleFS and replayed after reconnect, ReplayPerSecond (default 10) at once. Replayed value of [Client]/[Name]/get is published to [Client]/[Name]/journal as {\"t\":[UnixTime or 0],\"v\":[Value]}. Journal has Segments files (default 4) of SegmentBytes (default 2048), when it's full, oldest segment is dropped. Changing layout clears the journal. LittleFS must be already formatted. Without arguments, prints journal statistics.",
+	//cmddetail:"fn":"MQTT_SetJournal","file":"mqtt/new_mqtt_journal.c","requires":"",
+	//cmddetail:"examples":"mqtt_journal 1 20"}
+	CMD_RegisterCommand("mqtt_journal", MQTT_SetJournal, NULL);
+#endif
 }
 
 OBK_Publish_Result MQTT_DoItemPublishString(const char* sChannel, const char* valueStr)
 {
-	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, OBK_PUBLISH_FLAG_MUTEX_SILENT, false);
+	return MQTT_PublishMain(mqtt_client, sChannel, valueStr, OBK_PUBLISH_FLAG_MUTEX_SILENT | OBK_PUBLISH_FLAG_TELEMETRY, false);
+}
+static void MQTT_Broadcast_CountSaved()
+{
+	mqtt_broadcast_saved++;
+	mqtt_broadcast_savedThisHour++;
+}
+// in delta broadcast, items that have not changed are skipped
+static bool MQTT_Broadcast_SkipUnchanged(int idx)
+{
+	if (g_bPublishOnlyDirty && MQTT_IsItemDirty(idx) == false) {
+		MQTT_Broadcast_CountSaved();
+		return true;
+	}
+	return false;
+}
+static OBK_Publish_Result MQTT_Broadcast_Sent(int idx, OBK_Publish_Result res)
+{
+	if (res == OBK_PUBLISH_OK) {
+		MQTT_ClearItemDirty(idx);
+	}
+	return res;
+}
+// retained, so it's enough to send it once per connection
+static OBK_Publish_Result MQTT_DoStaticItemPublish(int idx, const char* sChannel, const char* valueStr)
+{
+	if (MQTT_IsItemDirty(idx) == false) {
+		return OBK_PUBLISH_WAS_NOT_REQUIRED;
+	}
+	return MQTT_Broadcast_Sent(idx, MQTT_PublishMain(mqtt_client, sChannel, valueStr,
+		OBK_PUBLISH_FLAG_MUTEX_SILENT | OBK_PUBLISH_FLAG_TELEMETRY | OBK_PUBLISH_FLAG_RETAIN, false));
+}
+// self items have no change notification, so last sent value is compared
+static OBK_Publish_Result MQTT_DoSelfItemPublish(int idx, const char* sChannel, const char* valueStr)
+{
+	OBK_Publish_Result res;
+	unsigned int hash;
+	const char *p;
+
+	// FNV-1a
+	hash = 2166136261u;
+	for (p = valueStr; *p; p++) {
+		hash = (hash ^ (byte)*p) * 16777619u;
+	}
+	if (g_mqttSelfItemHash[idx - PUBLISHITEM_ALL_INDEX_FIRST] == hash && MQTT_Broadcast_SkipUnchanged(idx)) {
+		return OBK_PUBLISH_WAS_NOT_REQUIRED;
+	}
+	res = MQTT_Broadcast_Sent(idx, MQTT_DoItemPublishString(sChannel, valueStr));
+	if (res == OBK_PUBLISH_OK) {
+		g_mqttSelfItemHash[idx - PUBLISHITEM_ALL_INDEX_FIRST] = hash;
+	}
+	return res;
 }
 
 OBK_Publish_Result MQTT_DoItemPublish(int idx)
@@ -1691,38 +2728,52 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 	case PUBLISHITEM_SELF_DYNAMIC_LIGHTSTATE:
 	{
 		if (LED_IsLEDRunning()) {
-			return LED_SendEnableAllState();
+			if (MQTT_Broadcast_SkipUnchanged(idx)) {
+				return OBK_PUBLISH_WAS_NOT_REQUIRED;
+			}
+			return MQTT_Broadcast_Sent(idx, LED_SendEnableAllState());
 		}
 		return OBK_PUBLISH_WAS_NOT_REQUIRED;
 	}
 	case PUBLISHITEM_SELF_DYNAMIC_LIGHTMODE:
 	{
 		if (LED_IsLEDRunning()) {
-			return LED_SendCurrentLightModeParam_TempOrColor();
+			if (MQTT_Broadcast_SkipUnchanged(idx)) {
+				return OBK_PUBLISH_WAS_NOT_REQUIRED;
+			}
+			return MQTT_Broadcast_Sent(idx, LED_SendCurrentLightModeParam_TempOrColor());
 		}
 		return OBK_PUBLISH_WAS_NOT_REQUIRED;
 	}
 	case PUBLISHITEM_SELF_DYNAMIC_DIMMER:
 	{
 		if (LED_IsLEDRunning()) {
-			return LED_SendDimmerChange();
+			if (MQTT_Broadcast_SkipUnchanged(idx)) {
+				return OBK_PUBLISH_WAS_NOT_REQUIRED;
+			}
+			return MQTT_Broadcast_Sent(idx, LED_SendDimmerChange());
 		}
 		return OBK_PUBLISH_WAS_NOT_REQUIRED;
 	}
 
 	case PUBLISHITEM_SELF_HOSTNAME:
-		return MQTT_DoItemPublishString("host", CFG_GetShortDeviceName());
+		return MQTT_DoStaticItemPublish(idx, "host", CFG_GetShortDeviceName());
 
 	case PUBLISHITEM_SELF_BUILD:
-		return MQTT_DoItemPublishString("build", g_build_str);
+		return MQTT_DoStaticItemPublish(idx, "build", g_build_str);
 
 	case PUBLISHITEM_SELF_MAC:
-		return MQTT_DoItemPublishString("mac", HAL_GetMACStr(dataStr));
+		return MQTT_DoStaticItemPublish(idx, "mac", HAL_GetMACStr(dataStr));
 
 	case PUBLISHITEM_SELF_DATETIME:
 		//Drivers are only built on BK7231 chips
 #ifndef OBK_DISABLE_ALL_DRIVERS
 		if (DRV_IsRunning("NTP")) {
+			// changes every time, it's only sent in full refresh
+			if (g_bPublishOnlyDirty) {
+				MQTT_Broadcast_CountSaved();
+				return OBK_PUBLISH_WAS_NOT_REQUIRED;
+			}
 			sprintf(dataStr, "%d", NTP_GetCurrentTime());
 			return MQTT_DoItemPublishString("datetime", dataStr);
 		}
@@ -1735,23 +2786,27 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 
 	case PUBLISHITEM_SELF_SOCKETS:
 		sprintf(dataStr, "%d", LWIP_GetActiveSockets());
-		return MQTT_DoItemPublishString("sockets", dataStr);
+		return MQTT_DoSelfItemPublish(idx, "sockets", dataStr);
 
 	case PUBLISHITEM_SELF_RSSI:
 		sprintf(dataStr, "%d", HAL_GetWifiStrength());
-		return MQTT_DoItemPublishString("rssi", dataStr);
+		return MQTT_DoSelfItemPublish(idx, "rssi", dataStr);
 
 	case PUBLISHITEM_SELF_UPTIME:
+		// changes every time, it's only sent in full refresh
+		if (g_bPublishOnlyDirty) {
+			MQTT_Broadcast_CountSaved();
+			return OBK_PUBLISH_WAS_NOT_REQUIRED;
+		}
 		sprintf(dataStr, "%d", Time_getUpTimeSeconds());
 		return MQTT_DoItemPublishString("uptime", dataStr);
 
 	case PUBLISHITEM_SELF_FREEHEAP:
 		sprintf(dataStr, "%d", xPortGetFreeHeapSize());
-		return MQTT_DoItemPublishString("freeheap", dataStr);
+		return MQTT_DoSelfItemPublish(idx, "freeheap", dataStr);
 
 	case PUBLISHITEM_SELF_IP:
-		g_firstFullBroadcast = false; //We published the last status item, disable full broadcast
-		return MQTT_DoItemPublishString("ip", HAL_GetMyIPString());
+		return MQTT_DoSelfItemPublish(idx, "ip", HAL_GetMyIPString());
 
 	default:
 		break;
@@ -1775,18 +2830,26 @@ OBK_Publish_Result MQTT_DoItemPublish(int idx)
 	// TODO
 	//type = CHANNEL_GetType(idx);
 	if (bWantsToPublish) {
-		return MQTT_ChannelPublish(g_publishItemIndex, OBK_PUBLISH_FLAG_MUTEX_SILENT);
+		if (MQTT_Broadcast_SkipUnchanged(idx)) {
+			return OBK_PUBLISH_WAS_NOT_REQUIRED;
+		}
+		return MQTT_Broadcast_Sent(idx, MQTT_ChannelPublish(idx, OBK_PUBLISH_FLAG_MUTEX_SILENT));
 	}
 
 	return OBK_PUBLISH_WAS_NOT_REQUIRED; // didnt publish
 }
 
 // from 5ms quicktick
-int MQTT_RunQuickTick(){
+int MQTT_RunQuickTick(int deltaMS){
+	if (g_wifiToPublishTimerMS >= 0) {
+		g_wifiToPublishTimerMS += deltaMS;
+	}
 #ifndef PLATFORM_BEKEN
 	// on Beken, we use a one-shot timer for this.
 	MQTT_process_received();
 #endif
+	// channel changes from this tick, including ones caused by received messages
+	MQTT_Batch_Flush();
 	return 0;
 }
 
@@ -1821,6 +2884,17 @@ int MQTT_RunEverySecondUpdate()
 	if (!mqtt_initialised)
 		return 0;
 
+	g_broadcastHourSeconds++;
+	if (g_broadcastHourSeconds >= 3600) {
+		g_broadcastHourSeconds = 0;
+		mqtt_broadcast_savedLastHour = mqtt_broadcast_savedThisHour;
+		mqtt_broadcast_savedThisHour = 0;
+	}
+#ifdef ENABLE_LITTLEFS
+	// flash I/O, done without MQTT mutex
+	MQTT_Journal_RunEverySecond();
+#endif
+
 	if (Main_HasWiFiConnected() == 0)
 	{
 		mqtt_reconnect = 0;
@@ -1853,6 +2927,7 @@ int MQTT_RunEverySecondUpdate()
 	}
 
 	int res = 0;
+	bool bClearDedup = false;
 	if (mqtt_client){
 		LOCK_TCPIP_CORE();
 		res = mqtt_client_is_connected(mqtt_client);
@@ -1916,6 +2991,13 @@ int MQTT_RunEverySecondUpdate()
 		// things to do in our threads on connection accepted.
 		if (g_just_connected){
 			g_just_connected = 0;
+			// retained ones, once per connection
+			MQTT_SetStaticItemsDirty();
+			// broker might have missed last values
+			memset(g_mqttSelfItemHash, 0, sizeof(g_mqttSelfItemHash));
+			// don't skip them as duplicates in deduper either,
+			// but only after MQTT mutex is released
+			bClearDedup = true;
 			// publish TELE
 			MQTT_BroadcastTasmotaTeleSTATE();
 			// publish all values on state
@@ -1926,9 +3008,26 @@ int MQTT_RunEverySecondUpdate()
 				//MQTT_PublishOnlyDeviceChannelsIfPossible();
 			}
 		}
+		// new connection, or callbacks changed on live connection
+		if (g_mqttForgetSubscriptions) {
+			g_mqttForgetSubscriptions = false;
+			MQTT_ForgetSubscriptions();
+		}
+		if (g_mqttSubscriptionsDirty) {
+			MQTT_SyncSubscriptions(mqtt_client);
+		}
 
 		MQTT_Mutex_Free();
 		// below mutex is not required any more
+		if (bClearDedup) {
+			MQTT_Dedup_Clear();
+		}
+#ifdef ENABLE_LITTLEFS
+		// values kept while offline, few per second, callback takes mutex for each
+		if (MQTT_Journal_GetPendingCount() > 0) {
+			MQTT_Journal_Replay(MQTT_Journal_PublishCb);
+		}
+#endif
 
 		// it is connected
 		g_timeSinceLastTasmotaTeleSent++;
@@ -2025,11 +3124,18 @@ int MQTT_RunEverySecondUpdate()
 			if (CFG_HasFlag(OBK_FLAG_MQTT_BROADCASTSELFSTATEPERMINUTE))
 			{
 				// this is called every second
-				g_secondsBeforeNextFullBroadcast--;
-				if (g_secondsBeforeNextFullBroadcast <= 0)
+				g_secondsBeforeNextBroadcast--;
+				if (g_secondsBeforeNextBroadcast <= 0)
 				{
-					g_secondsBeforeNextFullBroadcast = g_intervalBetweenMQTTBroadcasts;
-					MQTT_PublishWholeDeviceState();
+					g_secondsBeforeNextBroadcast = g_intervalBetweenMQTTBroadcasts;
+					g_broadcastsSinceFullRefresh++;
+					if (g_broadcastsSinceFullRefresh >= g_broadcastFullRefreshEvery) {
+						g_broadcastsSinceFullRefresh = 0;
+						MQTT_PublishWholeDeviceState();
+					}
+					else {
+						MQTT_PublishChangedDeviceState();
+					}
 				}
 			}
 		}
@@ -2037,25 +3143,6 @@ int MQTT_RunEverySecondUpdate()
 	return 1;
 }
 
-MqttPublishItem_t* get_queue_tail(MqttPublishItem_t* head) {
-	if (head == NULL) { return NULL; }
-
-	while (head->next != NULL) {
-		head = head->next;
-	}
-	return head;
-}
-
-MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
-	while (head != NULL) {
-		if (MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {
-			return head;
-		}
-		head = head->next;
-	}
-	return head;
-}
-
 /// @brief Queue an entry for publish and execute a command after the publish.
 /// @param topic 
 /// @param channel 
@@ -2063,57 +3150,88 @@ MqttPublishItem_t* find_queue_reusable_item(MqttPublishItem_t* head) {
 /// @param flags
 /// @param command Command to execute after the publish
 void MQTT_QueuePublishWithCommand(const char* topic, const char* channel, const char* value, int flags, PostPublishCommands command) {
-	MqttPublishItem_t* newItem;
-	if (g_MqttPublishItemsQueued >= MQTT_MAX_QUEUE_SIZE) {
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", g_MqttPublishItemsQueued);
-		return;
-	}
-
-	if ((strlen(topic) > MQTT_PUBLISH_ITEM_TOPIC_LENGTH) ||
-		(strlen(channel) > MQTT_PUBLISH_ITEM_CHANNEL_LENGTH) ||
-		(strlen(value) > MQTT_PUBLISH_ITEM_VALUE_LENGTH)) {
+	mqttQueueRecord_t *rec;
+	char *p;
+	int topicLen, channelLen, valueLen;
+	int need, at, wrap, used, count;
+
+	topicLen = strlen(topic);
+	channelLen = strlen(channel);
+	valueLen = strlen(value);
+	need = MQTT_RX_ALIGN(sizeof(mqttQueueRecord_t) + topicLen + 1 + channelLen + 1 + valueLen + 1);
+	// record of up to half of the arena always fits after dropping older ones
+	if (topicLen >= MQTT_QUEUE_WRAP_MARKER || channelLen >= MQTT_QUEUE_WRAP_MARKER
+		|| valueLen >= MQTT_QUEUE_WRAP_MARKER || need > g_mqttQueueSize / 2) {
 		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! Topic (%i), channel (%i) or value (%i) exceeds size limit\r\n",
-			strlen(topic), strlen(channel), strlen(value));
+			topicLen, channelLen, valueLen);
+		mqtt_queue_dropped++;
 		return;
 	}
-
-	//Queue data for publish. This might be a new item in the queue or an existing item. This is done to prevent
-	//memory fragmentation. The total queue length is limited to MQTT_MAX_QUEUE_SIZE.
-
-	if (g_MqttPublishQueueHead == NULL) {
-		g_MqttPublishQueueHead = newItem = os_malloc(sizeof(MqttPublishItem_t));
-		newItem->next = NULL;
-	}
-	else {
-		newItem = find_queue_reusable_item(g_MqttPublishQueueHead);
-
-		if (newItem == NULL) {
-			newItem = os_malloc(sizeof(MqttPublishItem_t));
-			newItem->next = NULL;
-			get_queue_tail(g_MqttPublishQueueHead)->next = newItem; //Append new item
+	MQTT_Queue_Lock();
+	if (g_mqttQueue == 0) {
+		g_mqttQueue = (unsigned char*)os_malloc(g_mqttQueueSize);
+		if (g_mqttQueue == 0) {
+			mqtt_queue_dropped++;
+			MQTT_Queue_Unlock();
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! No memory for %i bytes\r\n", g_mqttQueueSize);
+			return;
 		}
 	}
 
-	//os_strcpy does copy ending null character.
-	os_strcpy(newItem->topic, topic);
-	os_strcpy(newItem->channel, channel);
-	os_strcpy(newItem->value, value);
-	newItem->command = command;
-	newItem->flags = flags;
-
+	while ((at = MQTT_Queue_Reserve(need, &wrap)) < 0) {
+		// the one being published can't be dropped, and the rest are behind it
+		if (g_mqttQueueDropOldest == 0 || g_mqttQueuePublishing) {
+			mqtt_queue_dropped++;
+			count = g_MqttPublishItemsQueued;
+			MQTT_Queue_Unlock();
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Unable to queue! %i items already present\r\n", count);
+			return;
+		}
+		MQTT_Queue_Pop(MQTT_Queue_Peek());
+		mqtt_queue_dropped++;
+	}
+	if (wrap) {
+		rec = (mqttQueueRecord_t*)(g_mqttQueue + g_mqttQueueHead);
+		rec->topicLen = MQTT_QUEUE_WRAP_MARKER;
+	}
+	rec = (mqttQueueRecord_t*)(g_mqttQueue + at);
+	rec->topicLen = topicLen;
+	rec->channelLen = channelLen;
+	rec->valueLen = valueLen;
+	rec->flags = flags;
+	rec->command = command;
+	p = (char*)(rec + 1);
+	memcpy(p, topic, topicLen + 1);
+	p += topicLen + 1;
+	memcpy(p, channel, channelLen + 1);
+	p += channelLen + 1;
+	memcpy(p, value, valueLen + 1);
+	g_mqttQueueHead = (at + need) % g_mqttQueueSize;
+	g_mqttQueueLast = at;
 	g_MqttPublishItemsQueued++;
-	addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", newItem->topic, newItem->channel, g_MqttPublishItemsQueued);
+	count = g_MqttPublishItemsQueued;
+
+	used = MQTT_Queue_Used();
+	if (used > mqtt_queue_peakBytes) {
+		mqtt_queue_peakBytes = used;
+	}
+	MQTT_Queue_Unlock();
+	addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Queued topic=%s/%s, %i items in queue", topic, channel, count);
 }
 
 /// @brief Add the specified command to the last entry in the queue.
 /// @param command 
 void MQTT_InvokeCommandAtEnd(PostPublishCommands command) {
-	MqttPublishItem_t* tail = get_queue_tail(g_MqttPublishQueueHead);
-	if (tail == NULL){
-		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
+	bool bEmpty;
+
+	MQTT_Queue_Lock();
+	bEmpty = g_mqttQueueLast < 0;
+	if (!bEmpty) {
+		((mqttQueueRecord_t*)(g_mqttQueue + g_mqttQueueLast))->command = command;
 	}
-	else {
-		tail->command = command;
+	MQTT_Queue_Unlock();
+	if (bEmpty) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "InvokeCommandAtEnd invoked but queue is empty");
 	}
 }
 
@@ -2131,43 +3249,89 @@ void MQTT_QueuePublish(const char* topic, const char* channel, const char* value
 /// @return 
 OBK_Publish_Result PublishQueuedItems() {
 	OBK_Publish_Result result = OBK_PUBLISH_WAS_NOT_REQUIRED;
-
+	mqttQueueRecord_t *rec;
+	const char *topic, *channel, *value;
 	int count = 0;
-	MqttPublishItem_t* head = g_MqttPublishQueueHead;
-
-	//The next actionable item might not be at the front. The queue size is limited to MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE
-	//so this traversal is fast.
-	//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems g_MqttPublishItemsQueued=%i",g_MqttPublishItemsQueued );
-	while ((head != NULL) && (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) && (g_MqttPublishItemsQueued > 0)) {
-		if (!MQTT_QUEUE_ITEM_IS_REUSABLE(head)) {  //Skip reusable entries
-			count++;
-			result = MQTT_PublishTopicToClient(mqtt_client, head->topic, head->channel, head->value, head->flags, false);
-			MQTT_QUEUE_ITEM_SET_REUSABLE(head); //Flag item as reusable
-			g_MqttPublishItemsQueued--;   //decrement queued count
-
-			//Stop if last publish failed
-			if (result != OBK_PUBLISH_OK) break;
-
-			switch (head->command) {
-			case None:
-				break;
-			case PublishAll:
-				MQTT_PublishWholeDeviceState_Internal(true);
-				break;
-			case PublishChannels:
-				MQTT_PublishOnlyDeviceChannelsIfPossible();
-				break;
-			}
+	int command;
+
+	while (count < MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE) {
+		// while publishing flag is set, oldest record is not dropped and
+		// arena is not reset, so it can be read without the lock
+		MQTT_Queue_Lock();
+		rec = MQTT_Queue_Peek();
+		if (rec == 0) {
+			MQTT_Queue_Unlock();
+			break;
 		}
-		else {
-			//addLogAdv(LOG_INFO,LOG_FEATURE_MQTT,"PublishQueuedItems item skipped reusable");
+		g_mqttQueuePublishing = 1;
+		MQTT_Queue_Unlock();
+		count++;
+		topic = (const char*)(rec + 1);
+		channel = topic + rec->topicLen + 1;
+		value = channel + rec->channelLen + 1;
+		result = MQTT_PublishTopicToClient(mqtt_client, topic, channel, value, rec->flags, false);
+		// item is removed even if publish failed
+		MQTT_Queue_Lock();
+		// command could have been changed by MQTT_InvokeCommandAtEnd meanwhile
+		command = rec->command;
+		MQTT_Queue_Pop(rec);
+		g_mqttQueuePublishing = 0;
+		MQTT_Queue_Unlock();
+
+		//Stop if last publish failed
+		if (result != OBK_PUBLISH_OK) break;
+
+		switch (command) {
+		case None:
+			break;
+		case PublishAll:
+			MQTT_PublishWholeDeviceState_Internal(true);
+			break;
+		case PublishChannels:
+			MQTT_PublishOnlyDeviceChannelsIfPossible();
+			break;
 		}
-
-		head = head->next;
 	}
 
 	return result;
 }
+// mqtt_queue [SizeBytes] [DropOldest]
+commandResult_t MQTT_SetQueueConfig(const void* context, const char* cmd, const char* args, int cmdFlags)
+{
+	int size;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Queue: %i items, %i/%i bytes, peak %i, dropped %i, policy %s",
+			g_MqttPublishItemsQueued, MQTT_Queue_Used(), g_mqttQueueSize, mqtt_queue_peakBytes, mqtt_queue_dropped,
+			g_mqttQueueDropOldest ? "drop oldest" : "drop newest");
+		return CMD_RES_OK;
+	}
+	size = MQTT_RX_ALIGN(Tokenizer_GetArgInteger(0));
+	if (size < 256) {
+		return CMD_RES_BAD_ARGUMENT;
+	}
+	if (Tokenizer_GetArgsCount() > 1) {
+		g_mqttQueueDropOldest = Tokenizer_GetArgInteger(1) ? 1 : 0;
+	}
+	if (size != g_mqttQueueSize) {
+		MQTT_Queue_Lock();
+		if (g_MqttPublishItemsQueued) {
+			MQTT_Queue_Unlock();
+			addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Queue is not empty, can't resize now");
+			return CMD_RES_ERROR;
+		}
+		if (g_mqttQueue) {
+			os_free(g_mqttQueue);
+			g_mqttQueue = 0;
+		}
+		g_mqttQueueSize = size;
+		g_mqttQueueHead = g_mqttQueueTail = 0;
+		MQTT_Queue_Unlock();
+	}
+	return CMD_RES_OK;
+}
 
 
 /// @brief Is MQTT sub system ready and connected?
@@ -17,7 +17,7 @@ extern ip_addr_t mqtt_ip;
 extern mqtt_client_t* mqtt_client;
 
 void MQTT_init();
-int MQTT_RunQuickTick();
+int MQTT_RunQuickTick(int deltaMS);
 int MQTT_RunEverySecondUpdate();
 void MQTT_BroadcastTasmotaTeleSTATE();
 void MQTT_BroadcastTasmotaTeleSENSOR();
@@ -60,15 +60,28 @@ enum OBK_Publish_Result_e {
 #define OBK_PUBLISH_FLAG_MUTEX_SILENT			1
 #define OBK_PUBLISH_FLAG_RETAIN					2
 #define OBK_PUBLISH_FLAG_FORCE_REMOVE_GET		4
+// QoS category hints, see MQTT_GetPublishQoS
+#define OBK_PUBLISH_FLAG_TELEMETRY				8
+#define OBK_PUBLISH_FLAG_DISCOVERY				16
+
+// publish categories with separate QoS setting
+typedef enum mqttQoSCategory_e {
+	MQTT_QOS_CAT_TELEMETRY,	// channel values, sensor readings, tele/ and .../get
+	MQTT_QOS_CAT_STATE,		// everything else published on demand
+	MQTT_QOS_CAT_REPLY,		// stat/ replies to Tasmota commands
+	MQTT_QOS_CAT_DISCOVERY,	// Home Assistant discovery
+	MQTT_QOS_CAT_MAX,
+} mqttQoSCategory_t;
 
 #include "new_mqtt_deduper.h"
+#include "new_mqtt_journal.h"
 
 
 // ability to register callbacks for MQTT data
 typedef struct obk_mqtt_request_tag {
 	const unsigned char* received; // note: NOT terminated, may be binary
 	int receivedLen;
-	char topic[128];
+	const char* topic;
 } obk_mqtt_request_t;
 
 #define MQTT_PUBLISH_ITEM_TOPIC_LENGTH    64
@@ -82,32 +95,20 @@ typedef enum PostPublishCommands_e {
 } PostPublishCommands;
 
 
-/// @brief Publish queue item
-typedef struct MqttPublishItem
-{
-	char topic[MQTT_PUBLISH_ITEM_TOPIC_LENGTH];
-	char channel[MQTT_PUBLISH_ITEM_CHANNEL_LENGTH];
-	char value[MQTT_PUBLISH_ITEM_VALUE_LENGTH];
-	int flags;
-	struct MqttPublishItem* next;
-	PostPublishCommands command;
-} MqttPublishItem_t;
-
 
 // Maximum length to log data parameters
 #define MQTT_MAX_DATA_LOG_LENGTH					12
 
 // Count of queued items published at once.
 #define MQTT_QUEUED_ITEMS_PUBLISHED_AT_ONCE	3
-#define MQTT_MAX_QUEUE_SIZE	                7
 
 // callback function for mqtt.
 // return 0 to allow the incoming topic/data to be processed by others/channel set.
 // return 1 to 'eat the packet and terminate further processing.
 typedef int (*mqtt_callback_fn)(obk_mqtt_request_t* request);
 
-// topics must be unique (i.e. you can't have /about and /aboutme or /about/me)
-// ALL topics currently must start with main device topic root.
+// callbacks are matched by their subscription topic, which may use + and # wildcards.
+// Many callbacks may match the same topic, they are called in registration order.
 // ID is unique and non-zero - so that callbacks can be replaced....
 int MQTT_GetConnectEvents(void);
 const char* get_error_name(int err);
@@ -116,12 +117,42 @@ char* MQTT_GetStatusMessage(void);
 int MQTT_GetPublishEventCounter(void);
 int MQTT_GetPublishErrorCounter(void);
 int MQTT_GetReceivedEventCounter(void);
+int MQTT_GetRxDropCounter(void);
+int MQTT_GetRxHighWatermark(void);
+int MQTT_GetRxBufferSize(void);
+int MQTT_GetInFlightCounter(void);
+int MQTT_GetInFlightPeak(void);
+int MQTT_GetPublishQoS(const char *topic, int category);
+int MQTT_GetQueueDropCounter(void);
+int MQTT_GetQueuePeakBytes(void);
+int MQTT_GetQueueUsedBytes(void);
+int MQTT_GetQueueSize(void);
+int MQTT_GetQueuedCount(void);
+int MQTT_GetBatchQueuedCount(void);
+int MQTT_GetBatchFlushCounter(void);
+int MQTT_GetBatchCoalescedCounter(void);
+int MQTT_GetBatchLastFlushBytes(void);
+int MQTT_GetBatchLastFlushItems(void);
+int MQTT_GetBroadcastSavedCounter(void);
+int MQTT_GetBroadcastSavedPerHour(void);
+// marks item (channel index or PUBLISHITEM_*) as changed for next periodic broadcast
+void MQTT_SetItemDirty(int idx);
+int MQTT_GetSubscribePacketsCounter(void);
+// starts WiFi up to first publish timer
+void MQTT_OnWiFiConnected(void);
+// time between last WiFi connect and first publish after it, -1 if not known yet
+int MQTT_GetWiFiToFirstPublishMS(void);
 
 OBK_Publish_Result PublishQueuedItems();
 OBK_Publish_Result MQTT_ChannelPublish(int channel, int flags);
+// batched version for channel changes, sent at the end of current quick tick
+void MQTT_QueueChannelPublish(int channel);
+OBK_Publish_Result MQTT_Batch_Flush();
 void MQTT_ClearCallbacks();
 int MQTT_RegisterCallback(const char* basetopic, const char* subscriptiontopic, int ID, mqtt_callback_fn callback);
 int MQTT_RemoveCallback(int ID);
+// returns how many registered callbacks are subscribed to given topic
+int MQTT_GetSubscribersCount(const char *topic);
 
 // this is called from tcp_thread context to queue received mqtt,
 // and then we'll retrieve them from our own thread for processing.
@@ -159,6 +190,9 @@ typedef struct obk_mqtt_publishReplyPrinter_s {
 	int curLen;
 } obk_mqtt_publishReplyPrinter_t;
 
+int mqtt_printf255(obk_mqtt_publishReplyPrinter_t* request, const char* fmt, ...);
+// appends text as it is, without formatting
+int MQTT_Printer_Append(obk_mqtt_publishReplyPrinter_t* request, const char* s, int len);
 void MQTT_PublishPrinterContentsToStat(obk_mqtt_publishReplyPrinter_t *printer, const char *statName);
 void MQTT_PublishPrinterContentsToTele(obk_mqtt_publishReplyPrinter_t *printer, const char *statName);
 
@@ -1,4 +1,3 @@
-
 #include "new_mqtt.h"
 #include "../new_common.h"
 #include "../new_pins.h"
@@ -12,142 +11,364 @@
 
 // Maximum lenght of both string value and publish name in MQTT deduper
 #define DEDUPER_MAX_STRING_LEN 32
+// number of different publishes that can be deduped, power of two
+#define DEDUPER_TABLE_SIZE 16
 // put 1 to enable deduper of fast changing values
 // This is used to avoid sending, let's say, 20 packets per second for a led_dimmer that
 // is increased by one 20 times per second
 #define DEDUPER_ENABLE_DELAY_SEND_OF_FAST_CHANGING_VALUES 1
-// If option above is enabled,
-// do not send the same publish (even with differnt value) more often that this:
-#define MIN_INTERVAL_BETWEEN_SENDS 1
 
-// TODO: diferriate between string and int types, do not malloc buffer for int type
+typedef enum dedupType_e {
+	DEDUP_TYPE_NONE,
+	DEDUP_TYPE_STRING,
+	DEDUP_TYPE_INT,
+	DEDUP_TYPE_FLOAT,
+} dedupType_t;
+
+// Slots are found by hash of publish name, with linear probing.
+// Numbers are kept as numbers, string is only needed for string publishes.
 typedef struct mqtt_dedup_slot_s {
+	unsigned int hash;
+	byte type;
+	// if dirty, then it needs to be resend manually
+	byte bValueDirty;
 	int flags;
+	// time of last send, in deduper ms clock
+	int lastSendTime;
 	char name[DEDUPER_MAX_STRING_LEN];
-	char value[DEDUPER_MAX_STRING_LEN];
-	// if dirty, then it needs to be resend manually
-	bool bValueDirty;
-	int timeSinceLastSend;
+	union {
+		int i;
+		float f;
+		char s[DEDUPER_MAX_STRING_LEN];
+	} value;
 } mqtt_dedup_slot_t;
 
-static mqtt_dedup_slot_t *mqtt_dedups[DEDUP_MAX];
+static mqtt_dedup_slot_t *mqtt_dedups = 0;
+// ms clock, advanced from quick tick
+static int g_dedupTimeMS = 0;
+// do not send the same publish (even with differnt value) more often that this
+static int g_dedupMinIntervalMS = 1000;
+// float values closer than this to last sent one are duplicates
+static float g_dedupDefaultEpsilon = 0.001f;
+static int g_dedupDirtyCount = 0;
+
+// table is used from quick tick and from publishers in other threads
+static SemaphoreHandle_t g_dedupMutex = 0;
 
 static int stat_deduper_send = 0;
 static int stat_deduper_culled_duplicates = 0;
 static int stat_deduper_culled_tooFast = 0;
 
-static SemaphoreHandle_t g_mutex = 0;
-
-
-static bool DD_Mutex_Take(int del) {
-    int taken;
+static bool DD_Lock(int waitMS) {
+	if (g_dedupMutex == 0) {
+		g_dedupMutex = xSemaphoreCreateMutex();
+	}
+	return xSemaphoreTake(g_dedupMutex, waitMS) == pdTRUE;
+}
+static void DD_Unlock() {
+	xSemaphoreGive(g_dedupMutex);
+}
+static unsigned int DD_Hash(const char *s) {
+	// FNV-1a
+	unsigned int h = 2166136261u;
+	while (*s) {
+		h ^= (byte)*s;
+		h *= 16777619u;
+		s++;
+	}
+	return h;
+}
+// returns slot for given name, allocates it if needed, or 0 if table is full
+static mqtt_dedup_slot_t *DD_FindSlot(const char *name) {
+	mqtt_dedup_slot_t *slot;
+	unsigned int hash;
+	int i, idx;
 
-    if (g_mutex == 0)
-    {
-        g_mutex = xSemaphoreCreateMutex();
-    }
-    taken = xSemaphoreTake(g_mutex, del);
-    if (taken == pdTRUE) {
-        return true;
-    }
-    return false;
+	// alloc only when it's required
+	if (mqtt_dedups == 0) {
+		mqtt_dedups = malloc(sizeof(mqtt_dedup_slot_t) * DEDUPER_TABLE_SIZE);
+		if (mqtt_dedups == 0) {
+			return 0;
+		}
+		memset(mqtt_dedups, 0, sizeof(mqtt_dedup_slot_t) * DEDUPER_TABLE_SIZE);
+	}
+	hash = DD_Hash(name);
+	idx = hash & (DEDUPER_TABLE_SIZE - 1);
+	for (i = 0; i < DEDUPER_TABLE_SIZE; i++) {
+		slot = &mqtt_dedups[idx];
+		if (slot->type == DEDUP_TYPE_NONE) {
+			slot->hash = hash;
+			strcpy_safe(slot->name, name, sizeof(slot->name));
+			// so first send is never 'too fast'
+			slot->lastSendTime = g_dedupTimeMS - g_dedupMinIntervalMS - 1;
+			return slot;
+		}
+		if (slot->hash == hash && !strcmp(slot->name, name)) {
+			return slot;
+		}
+		idx = (idx + 1) & (DEDUPER_TABLE_SIZE - 1);
+	}
+	return 0;
+}
+static void DD_ValueToString(mqtt_dedup_slot_t *slot, char *out) {
+	switch (slot->type) {
+	case DEDUP_TYPE_INT:
+		sprintf(out, "%i", slot->value.i);
+		break;
+	case DEDUP_TYPE_FLOAT:
+		snprintf(out, DEDUPER_MAX_STRING_LEN, "%f", slot->value.f);
+		break;
+	default:
+		strcpy(out, slot->value.s);
+		break;
+	}
 }
+// Publishing takes MQTT mutex, and deduper is also used under it,
+// so value is copied out under deduper lock and published without it.
+typedef struct dedupSend_s {
+	mqtt_dedup_slot_t *slot;
+	char name[DEDUPER_MAX_STRING_LEN];
+	char value[DEDUPER_MAX_STRING_LEN];
+	int flags;
+	bool bWasDirty;
+} dedupSend_t;
 
-static void DD_Mutex_Free()
-{
-    xSemaphoreGive(g_mutex);
+// must be called with lock held
+static void DD_BeginSend(mqtt_dedup_slot_t *slot, dedupSend_t *s) {
+	s->slot = slot;
+	strcpy(s->name, slot->name);
+	DD_ValueToString(slot, s->value);
+	s->flags = slot->flags;
+	s->bWasDirty = slot->bValueDirty;
+	// also on failure, so a dirty value is retried after min interval and not on every tick
+	slot->lastSendTime = g_dedupTimeMS;
+	if (slot->bValueDirty) {
+		slot->bValueDirty = false;
+		g_dedupDirtyCount--;
+	}
 }
+// must be called without lock
+static OBK_Publish_Result DD_FinishSend(dedupSend_t *s) {
+	OBK_Publish_Result res;
 
-void MQTT_Dedup_Tick() {
+	res = MQTT_PublishMain_StringString(s->name, s->value, s->flags);
+	if (DD_Lock(100) == false) {
+		return res;
+	}
+	if (res == OBK_PUBLISH_OK) {
+		stat_deduper_send++;
+	}
+	else if (s->bWasDirty && s->slot->type != DEDUP_TYPE_NONE && !strcmp(s->slot->name, s->name)) {
+		// not sent, so keep it for later, unless table was cleared meanwhile
+		if (s->slot->bValueDirty == false) {
+			s->slot->bValueDirty = true;
+			g_dedupDirtyCount++;
+		}
+	}
+	DD_Unlock();
+	return res;
+}
+// sends all delayed values that are due, lock is taken for each one separately
+static void DD_SendDirty(bool bOnlyDue, int waitMS) {
+	dedupSend_t send;
+	mqtt_dedup_slot_t *slot;
+	bool bSend;
 	int i;
 
-	//if(DD_Mutex_Take(10)) {
-	//	return;
-	///}
-	for(i = 0; i < DEDUP_MAX; i++) {
-		if(mqtt_dedups[i]) {
-			mqtt_dedups[i]->timeSinceLastSend++;
-#if DEDUPER_ENABLE_DELAY_SEND_OF_FAST_CHANGING_VALUES
-			if(mqtt_dedups[i]->timeSinceLastSend > MIN_INTERVAL_BETWEEN_SENDS && mqtt_dedups[i]->bValueDirty) {
-				// Some values of this publish were not published, because we had too many publish requests in one second or so.
-				// Now the cooldown has passed, so we can send the LATEST, most up-to-date value of this publish.
-				MQTT_PublishMain_StringString(mqtt_dedups[i]->name,mqtt_dedups[i]->value,mqtt_dedups[i]->flags);
-				mqtt_dedups[i]->bValueDirty = false;
-				mqtt_dedups[i]->timeSinceLastSend = 0;
+	for (i = 0; g_dedupDirtyCount && i < DEDUPER_TABLE_SIZE; i++) {
+		if (DD_Lock(waitMS) == false) {
+			return;
+		}
+		slot = &mqtt_dedups[i];
+		// Some values of this publish were not published, because we had too many publish requests in short time.
+		// Now the cooldown has passed, so we can send the LATEST, most up-to-date value of this publish.
+		bSend = slot->bValueDirty && (!bOnlyDue || g_dedupTimeMS - slot->lastSendTime >= g_dedupMinIntervalMS);
+		if (bSend) {
+			DD_BeginSend(slot, &send);
+		}
+		DD_Unlock();
+		if (bSend) {
+			DD_FinishSend(&send);
+		}
+	}
+}
+// sends delayed values whose cooldown has passed
+void MQTT_Dedup_RunQuickTick(int deltaMS) {
+	g_dedupTimeMS += deltaMS;
+	if (g_dedupDirtyCount == 0) {
+		return;
+	}
+	// don't wait in quick tick, try again on next one
+	DD_SendDirty(true, 0);
+}
+// ms until next delayed value is due, -1 if none
+int MQTT_Dedup_GetNextWakeMS() {
+	int i, r, left;
+
+	if (g_dedupDirtyCount == 0) {
+		return -1;
+	}
+	// lock is never held for long, but if it's busy, just check again soon
+	if (DD_Lock(10) == false) {
+		return 0;
+	}
+	r = -1;
+	for (i = 0; g_dedupDirtyCount && i < DEDUPER_TABLE_SIZE; i++) {
+		if (mqtt_dedups[i].bValueDirty) {
+			left = g_dedupMinIntervalMS - (g_dedupTimeMS - mqtt_dedups[i].lastSendTime);
+			if (left < 0) {
+				left = 0;
+			}
+			if (r < 0 || left < r) {
+				r = left;
 			}
-#endif
 		}
 	}
-//	DD_Mutex_Free();
+	DD_Unlock();
+	return r;
+}
+// sends all delayed values now
+void MQTT_Dedup_Flush() {
+	DD_SendDirty(false, 100);
+}
+// forget all last sent values, so everything is sent again, for example after reconnect.
+// Lock is never held while publishing, so this is safe under MQTT mutex as well.
+void MQTT_Dedup_Clear() {
+	if (DD_Lock(100) == false) {
+		ADDLOG_ERROR(LOG_FEATURE_MQTT, "MQTT deduper clear failed to take mutex");
+		return;
+	}
+	if (mqtt_dedups) {
+		memset(mqtt_dedups, 0, sizeof(mqtt_dedup_slot_t) * DEDUPER_TABLE_SIZE);
+	}
+	g_dedupDirtyCount = 0;
+	DD_Unlock();
+}
+void MQTT_Dedup_Tick() {
 	if (CFG_HasLoggerFlag(LOGGER_FLAG_MQTT_DEDUPER)) {
 		ADDLOG_DEBUG(LOG_FEATURE_MQTT, "MQTT deduper sent %i, culled duplicates %i, culled too fast %i",
 			stat_deduper_send, stat_deduper_culled_duplicates, stat_deduper_culled_tooFast);
 	}
-
 }
-OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int slotCode, int expireTime, const char* sChannel, int val, int flags) {
-	char buffer[16];
-	sprintf(buffer,"%i",val);
-	return MQTT_PublishMain_StringString_DeDuped(slotCode,expireTime,sChannel,buffer,flags);
+void MQTT_Dedup_GetStats(int *sent, int *culledDuplicates, int *culledTooFast) {
+	*sent = stat_deduper_send;
+	*culledDuplicates = stat_deduper_culled_duplicates;
+	*culledTooFast = stat_deduper_culled_tooFast;
 }
-OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expireTime, const char* sChannel, const char* valueStr, int flags) {
-	mqtt_dedup_slot_t *slot;
-	OBK_Publish_Result res;
-
-	// for simulator, we don't currently need dups removal
-#ifdef WINDOWS
-	return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
-#endif
-
-	// alloc only when it's required
-	if(mqtt_dedups[slotCode] == 0) {
-		mqtt_dedups[slotCode] = malloc(sizeof(mqtt_dedup_slot_t));
-		// just in case malloc fails..
-		if (mqtt_dedups[slotCode] == 0) {
-			 return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
-		}
-		memset(mqtt_dedups[slotCode],0,sizeof(mqtt_dedup_slot_t));
-		mqtt_dedups[slotCode]->timeSinceLastSend = 999;
-	}
-
-	slot = mqtt_dedups[slotCode];
-
+// returns true if value has to be sent now, then it's copied out to send
+static bool DD_Publish(mqtt_dedup_slot_t *slot, bool bSame, int expireTimeMS, int type, const char *sValue, int iValue, float fValue, int flags, dedupSend_t *send) {
 	// is value the same?
-	if(!strcmp(slot->value,valueStr)) {
+	if (bSame) {
 		// has minimal time to republish passed?
-		if(expireTime > slot->timeSinceLastSend) {
+		if (expireTimeMS > g_dedupTimeMS - slot->lastSendTime) {
 			stat_deduper_culled_duplicates++;
-			return OBK_PUBLISH_OK; // do not resend if just few seconds passed
+			return false; // do not resend if just few seconds passed
 		}
 	}
+	// keep latest value, either for sending now or later
+	slot->type = type;
+	slot->flags = flags;
+	if (type == DEDUP_TYPE_INT) {
+		slot->value.i = iValue;
+	}
+	else if (type == DEDUP_TYPE_FLOAT) {
+		slot->value.f = fValue;
+	}
+	else {
+		strcpy_safe(slot->value.s, sValue, sizeof(slot->value.s));
+	}
 #if DEDUPER_ENABLE_DELAY_SEND_OF_FAST_CHANGING_VALUES
 	// has minimal time to republish passed?
-	// 'slot->timeSinceLastSend' is increased ONCE per second
-	// So we check if it was just sent this second or previous second
-	if(MIN_INTERVAL_BETWEEN_SENDS >= slot->timeSinceLastSend) {
-		// It was sent in last second, don't resend just again
-
-		// Just save values for later
-
-		// save previous value
-		strcpy_safe(slot->value,valueStr, DEDUPER_MAX_STRING_LEN);
-		strcpy_safe(slot->name,sChannel, DEDUPER_MAX_STRING_LEN);
+	if (g_dedupTimeMS - slot->lastSendTime < g_dedupMinIntervalMS) {
+		// It was sent just now, don't resend just again
 		// mark as 'have to republish later'
-		slot->bValueDirty = true;
-		slot->flags = flags;
+		if (slot->bValueDirty == false) {
+			slot->bValueDirty = true;
+			g_dedupDirtyCount++;
+		}
 		stat_deduper_culled_tooFast++;
-		return OBK_PUBLISH_OK; // do not resend if just few seconds passed
+		return false;
 	}
 #endif
 	// send futher
-	res = MQTT_PublishMain_StringString(sChannel,valueStr,flags);
-	if(res == OBK_PUBLISH_OK) {
-		slot->bValueDirty = false;
-		// mark as sent
-		slot->timeSinceLastSend = 0;
-		// save previous value
-		strcpy_safe(slot->value,valueStr, DEDUPER_MAX_STRING_LEN);
+	DD_BeginSend(slot, send);
+	return true;
+}
+OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int expireTimeMS, const char* sChannel, int val, int flags) {
+	mqtt_dedup_slot_t *slot;
+	dedupSend_t send;
+	bool bSend;
+	char buffer[16];
+
+	if (DD_Lock(100)) {
+		slot = DD_FindSlot(sChannel);
+		if (slot) {
+			bSend = DD_Publish(slot, slot->type == DEDUP_TYPE_INT && slot->value.i == val, expireTimeMS,
+				DEDUP_TYPE_INT, 0, val, 0, flags, &send);
+			DD_Unlock();
+			return bSend ? DD_FinishSend(&send) : OBK_PUBLISH_OK;
+		}
+		DD_Unlock();
 	}
-	stat_deduper_send++;
-	return res;
+	snprintf(buffer, sizeof(buffer), "%i", val);
+	return MQTT_PublishMain_StringString(sChannel, buffer, flags);
+}
+OBK_Publish_Result MQTT_PublishMain_StringFloat_DeDuped(int expireTimeMS, const char* sChannel, float val, float epsilon, int flags) {
+	mqtt_dedup_slot_t *slot;
+	dedupSend_t send;
+	bool bSend;
+	char buffer[DEDUPER_MAX_STRING_LEN];
+	float diff;
+
+	if (epsilon < 0) {
+		epsilon = g_dedupDefaultEpsilon;
+	}
+	if (DD_Lock(100)) {
+		slot = DD_FindSlot(sChannel);
+		if (slot) {
+			diff = slot->value.f - val;
+			if (diff < 0) {
+				diff = -diff;
+			}
+			bSend = DD_Publish(slot, slot->type == DEDUP_TYPE_FLOAT && diff <= epsilon, expireTimeMS,
+				DEDUP_TYPE_FLOAT, 0, 0, val, flags, &send);
+			DD_Unlock();
+			return bSend ? DD_FinishSend(&send) : OBK_PUBLISH_OK;
+		}
+		DD_Unlock();
+	}
+	snprintf(buffer, sizeof(buffer), "%f", val);
+	return MQTT_PublishMain_StringString(sChannel, buffer, flags);
+}
+OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int expireTimeMS, const char* sChannel, const char* valueStr, int flags) {
+	mqtt_dedup_slot_t *slot;
+	dedupSend_t send;
+	bool bSend;
+
+	if (DD_Lock(100)) {
+		slot = DD_FindSlot(sChannel);
+		if (slot) {
+			bSend = DD_Publish(slot, slot->type == DEDUP_TYPE_STRING && !strcmp(slot->value.s, valueStr), expireTimeMS,
+				DEDUP_TYPE_STRING, valueStr, 0, 0, flags, &send);
+			DD_Unlock();
+			return bSend ? DD_FinishSend(&send) : OBK_PUBLISH_OK;
+		}
+		DD_Unlock();
+	}
+	return MQTT_PublishMain_StringString(sChannel, valueStr, flags);
+}
+// mqtt_deduper [MinIntervalMS] [FloatEpsilon]
+commandResult_t MQTT_SetDeduper(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		ADDLOG_INFO(LOG_FEATURE_MQTT, "MQTT deduper sent %i, culled duplicates %i, culled too fast %i",
+			stat_deduper_send, stat_deduper_culled_duplicates, stat_deduper_culled_tooFast);
+		return CMD_RES_OK;
+	}
+	g_dedupMinIntervalMS = Tokenizer_GetArgInteger(0);
+	if (Tokenizer_GetArgsCount() > 1) {
+		g_dedupDefaultEpsilon = Tokenizer_GetArgFloat(1);
+	}
+	return CMD_RES_OK;
 }
@@ -1,21 +1,16 @@
+// Deduper keeps last sent value of a publish, found by hash of its name.
+// Publish of the same value is skipped until expireTime passes, and publishes
+// that come faster than minimal interval are delayed, so only the latest value is sent.
+#define DEDUP_EXPIRE_TIME 5000
 
-
-// i didn't choose the "automatic, per string name" approach because it would be slower
-// I think we only need to dedup the built-in MQTT publishes, which can be listed here and defined as constants
-typedef enum MQTT_Dedup_Slot_e {
-	DEDUP_LED_BASECOLOR_RGB,
-	DEDUP_LED_FINALCOLOR_RGB,
-	DEDUP_LED_DIMMER,
-	DEDUP_LED_TEMPERATURE,
-	DEDUP_LED_ENABLEALL,
-	// not enabled by default, but a user requested ability also to broadcast full RGBCW format
-	DEDUP_LED_FINALCOLOR_RGBCW,
-	DEDUP_MAX,
-} MQTT_Dedup_Slot_t;
-
-#define DEDUP_EXPIRE_TIME 5
-
-// This will not republish given value if value is the same as in previous publish and if the time passed since last publish is lower than expireTime
-OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int slotCode, int expireTime, const char* sChannel, const char* valueStr, int flags);
-OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int slotCode, int expireTime, const char* sChannel, int val, int flags);
+// This will not republish given value if value is the same as in previous publish and if the time passed since last publish is lower than expireTimeMS
+OBK_Publish_Result MQTT_PublishMain_StringString_DeDuped(int expireTimeMS, const char* sChannel, const char* valueStr, int flags);
+OBK_Publish_Result MQTT_PublishMain_StringInt_DeDuped(int expireTimeMS, const char* sChannel, int val, int flags);
+// values within epsilon of last sent one are the same, negative epsilon uses default one
+OBK_Publish_Result MQTT_PublishMain_StringFloat_DeDuped(int expireTimeMS, const char* sChannel, float val, float epsilon, int flags);
 void MQTT_Dedup_Tick();
+void MQTT_Dedup_RunQuickTick(int deltaMS);
+int MQTT_Dedup_GetNextWakeMS();
+void MQTT_Dedup_Flush();
+void MQTT_Dedup_Clear();
+void MQTT_Dedup_GetStats(int *sent, int *culledDuplicates, int *culledTooFast);
@@ -0,0 +1,551 @@
+#include "new_mqtt.h"
+#include "../new_common.h"
+#include "../new_cfg.h"
+#include "../logging/logging.h"
+#include "../obk_config.h"
+// Commands register, execution API and cmd tokenizer
+#include "../cmnds/cmd_public.h"
+#include "../driver/drv_public.h"
+#include "../driver/drv_ntp.h"
+
+#ifdef ENABLE_LITTLEFS
+
+#include "../littlefs/our_lfs.h"
+
+// Journal is a ring of segment files, mqtt_journal_0 ... mqtt_journal_N.
+// Segment file starts with its 4 byte sequence number, followed by records:
+// - topic definition: 0xFF, id, length, topic
+// - value: id, length, 4 byte timestamp (NTP time or 0), value
+// Topics are defined again in every segment, so each one can be read alone.
+//
+// Appended records are only staged in RAM (topic, value and timestamp), because
+// publishes come also from quick tick and other threads. Main thread moves them
+// to the segment buffer every second and that one is written in chunks, to save flash writes.
+//
+// Locking: stage mutex guards only the stage and is never held while taking
+// anything else, so Append can be called under MQTT mutex. Journal mutex guards
+// segments state and flash I/O, and is never taken with MQTT mutex held.
+// Segments are never rewritten - each one is filled once, replayed and removed,
+// and next one is a new file, so LittleFS puts it on other blocks.
+// If journal is full, the oldest segment is dropped.
+#define JOURNAL_MAX_SEGMENTS		16
+#define JOURNAL_MAX_TOPICS			16
+#define JOURNAL_MAX_TOPIC_LEN		64
+#define JOURNAL_MAX_VALUE_LEN		64
+#define JOURNAL_BUFFER_SIZE			256
+// staged record: topic length, value length, 4 byte timestamp, topic, value
+#define JOURNAL_STAGE_SIZE			1024
+#define JOURNAL_STAGE_HEADER		6
+#define JOURNAL_REC_TOPIC			0xFF
+#define JOURNAL_SEGMENT_HEADER		4
+#define JOURNAL_VALUE_HEADER		6
+
+static int g_journalEnabled = 0;
+static int g_journalSegments = 4;
+// below block size, so a segment with LittleFS overhead fits in one block
+static int g_journalSegmentSize = LFS_BLOCK_SIZE / 2;
+static int g_journalReplayPerSecond = 10;
+// seconds before buffered records are written to flash
+static int g_journalFlushSeconds = 5;
+
+static bool g_journalLoaded = false;
+static unsigned int g_journalReadSeq = 0;
+static unsigned int g_journalWriteSeq = 0;
+// position in oldest segment
+static int g_journalReadOffset = 0;
+// bytes already on flash in newest segment
+static int g_journalWriteSize = 0;
+// records not replayed yet, by seq % g_journalSegments
+static int g_journalSegRecords[JOURNAL_MAX_SEGMENTS];
+static int g_journalPending = 0;
+
+// RAM buffer, followed by write side and read side topic tables
+static byte *g_journalBuffer = 0;
+static int g_journalBufferLen = 0;
+static int g_journalBufferAge = 0;
+static byte *g_journalStage = 0;
+static int g_journalStageLen = 0;
+// records in stage, not counted in g_journalPending yet
+static int g_journalStaged = 0;
+static char (*g_journalTopics)[JOURNAL_MAX_TOPIC_LEN] = 0;
+static char (*g_journalReadTopics)[JOURNAL_MAX_TOPIC_LEN] = 0;
+// topics defined in newest segment
+static unsigned int g_journalTopicsDefined = 0;
+static int g_journalNextTopicSlot = 0;
+static lfs_file_t g_journalFile;
+// second stage buffer, stage is swapped with it and written without stage lock
+static byte *g_journalStageSpare = 0;
+
+static SemaphoreHandle_t g_journalMutex = 0;
+static SemaphoreHandle_t g_journalStageMutex = 0;
+
+static int journal_appended = 0;
+static int journal_replayed = 0;
+static int journal_dropped = 0;
+static int journal_bytes = 0;
+
+void MQTT_Journal_Init() {
+	if (g_journalMutex == 0) {
+		g_journalMutex = xSemaphoreCreateMutex();
+	}
+	if (g_journalStageMutex == 0) {
+		g_journalStageMutex = xSemaphoreCreateMutex();
+	}
+}
+static void Journal_TakeMutex(SemaphoreHandle_t m) {
+	while (xSemaphoreTake(m, 1000) != pdTRUE) {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Journal: mutex wait is too long");
+	}
+}
+int MQTT_Journal_GetPendingCount() {
+	return g_journalPending + g_journalStaged;
+}
+void MQTT_Journal_GetStats(int *appended, int *replayed, int *dropped, int *bytes) {
+	*appended = journal_appended;
+	*replayed = journal_replayed;
+	*dropped = journal_dropped;
+	*bytes = journal_bytes;
+}
+static void Journal_SegmentName(char *s, unsigned int seq) {
+	sprintf(s, "mqtt_journal_%i", seq % g_journalSegments);
+}
+// reads records from given offset, calls publish for values (if given),
+// returns number of values read or -1 if segment is missing
+static int Journal_ReadSegment(unsigned int seq, int *offset, int maxRecords, mqttJournalPublish_t publish) {
+	char name[24];
+	byte hdr[JOURNAL_VALUE_HEADER];
+	char value[JOURNAL_MAX_VALUE_LEN];
+	unsigned int fileSeq, timestamp;
+	int done;
+
+	Journal_SegmentName(name, seq);
+	if (lfs_file_open(&lfs, &g_journalFile, name, LFS_O_RDONLY) < 0) {
+		return -1;
+	}
+	if (*offset == 0) {
+		if (lfs_file_read(&lfs, &g_journalFile, &fileSeq, 4) != 4 || fileSeq != seq) {
+			lfs_file_close(&lfs, &g_journalFile);
+			return -1;
+		}
+		*offset = JOURNAL_SEGMENT_HEADER;
+		memset(g_journalReadTopics, 0, JOURNAL_MAX_TOPICS * JOURNAL_MAX_TOPIC_LEN);
+	}
+	else {
+		lfs_file_seek(&lfs, &g_journalFile, *offset, LFS_SEEK_SET);
+	}
+	done = 0;
+	while (done < maxRecords) {
+		// a record cut by power loss ends the segment
+		if (lfs_file_read(&lfs, &g_journalFile, hdr, 2) != 2) {
+			break;
+		}
+		if (hdr[0] == JOURNAL_REC_TOPIC) {
+			if (hdr[1] >= JOURNAL_MAX_TOPICS || lfs_file_read(&lfs, &g_journalFile, hdr + 2, 1) != 1
+				|| hdr[2] >= JOURNAL_MAX_TOPIC_LEN
+				|| lfs_file_read(&lfs, &g_journalFile, g_journalReadTopics[hdr[1]], hdr[2]) != hdr[2]) {
+				break;
+			}
+			g_journalReadTopics[hdr[1]][hdr[2]] = 0;
+			*offset += 3 + hdr[2];
+			continue;
+		}
+		if (hdr[0] >= JOURNAL_MAX_TOPICS || hdr[1] >= JOURNAL_MAX_VALUE_LEN
+			|| lfs_file_read(&lfs, &g_journalFile, &timestamp, 4) != 4
+			|| lfs_file_read(&lfs, &g_journalFile, value, hdr[1]) != hdr[1]) {
+			break;
+		}
+		value[hdr[1]] = 0;
+		if (publish && g_journalReadTopics[hdr[0]][0]) {
+			if (publish(g_journalReadTopics[hdr[0]], value, timestamp) == 0) {
+				break;
+			}
+		}
+		*offset += JOURNAL_VALUE_HEADER + hdr[1];
+		done++;
+	}
+	lfs_file_close(&lfs, &g_journalFile);
+	return done;
+}
+static void Journal_EndReadSegment();
+// finds segments left from previous boot
+static bool Journal_Load() {
+	char name[24];
+	unsigned int seq, minSeq, maxSeq;
+	int i, offset, count;
+	bool bFound;
+
+	if (lfs_present() == 0) {
+		// unmounted, so state has to be read again
+		g_journalLoaded = false;
+		// don't format, flash may just be not mounted yet
+		init_lfs(0);
+		if (lfs_present() == 0) {
+			return false;
+		}
+	}
+	if (g_journalLoaded) {
+		return true;
+	}
+	if (g_journalBuffer == 0) {
+		g_journalBuffer = (byte*)malloc(JOURNAL_BUFFER_SIZE + 2 * JOURNAL_MAX_TOPICS * JOURNAL_MAX_TOPIC_LEN);
+		if (g_journalBuffer == 0) {
+			return false;
+		}
+		g_journalTopics = (char(*)[JOURNAL_MAX_TOPIC_LEN])(g_journalBuffer + JOURNAL_BUFFER_SIZE);
+		g_journalReadTopics = g_journalTopics + JOURNAL_MAX_TOPICS;
+		memset(g_journalTopics, 0, JOURNAL_MAX_TOPICS * JOURNAL_MAX_TOPIC_LEN);
+	}
+	bFound = false;
+	minSeq = maxSeq = 0;
+	for (i = 0; i < g_journalSegments; i++) {
+		sprintf(name, "mqtt_journal_%i", i);
+		if (lfs_file_open(&lfs, &g_journalFile, name, LFS_O_RDONLY) < 0) {
+			continue;
+		}
+		count = lfs_file_read(&lfs, &g_journalFile, &seq, 4);
+		lfs_file_close(&lfs, &g_journalFile);
+		if (count != 4 || seq % g_journalSegments != i) {
+			// made with different settings
+			lfs_remove(&lfs, name);
+			continue;
+		}
+		if (bFound == false || seq < minSeq) {
+			minSeq = seq;
+		}
+		if (bFound == false || seq > maxSeq) {
+			maxSeq = seq;
+		}
+		bFound = true;
+	}
+	memset(g_journalSegRecords, 0, sizeof(g_journalSegRecords));
+	g_journalPending = 0;
+	g_journalWriteSize = 0;
+	g_journalBufferLen = 0;
+	g_journalTopicsDefined = 0;
+	g_journalReadOffset = 0;
+	g_journalReadSeq = g_journalWriteSeq = minSeq;
+	if (bFound) {
+		for (seq = minSeq; seq <= maxSeq; seq++) {
+			offset = 0;
+			count = Journal_ReadSegment(seq, &offset, 0x7fffffff, 0);
+			if (count > 0) {
+				g_journalSegRecords[seq % g_journalSegments] = count;
+				g_journalPending += count;
+			}
+		}
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Journal: %i records to replay in segments %u-%u", g_journalPending, minSeq, maxSeq);
+		// last one may end with a cut record, so don't append to it
+		g_journalWriteSeq = maxSeq + 1;
+		if (g_journalWriteSeq - g_journalReadSeq >= g_journalSegments) {
+			Journal_EndReadSegment();
+		}
+	}
+	g_journalLoaded = true;
+	return true;
+}
+static void Journal_FlushBuffer() {
+	char name[24];
+
+	if (g_journalBufferLen == 0) {
+		return;
+	}
+	Journal_SegmentName(name, g_journalWriteSeq);
+	if (lfs_file_open(&lfs, &g_journalFile, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) >= 0) {
+		if (g_journalWriteSize == 0) {
+			lfs_file_write(&lfs, &g_journalFile, &g_journalWriteSeq, 4);
+			g_journalWriteSize = JOURNAL_SEGMENT_HEADER;
+			journal_bytes += JOURNAL_SEGMENT_HEADER;
+		}
+		lfs_file_write(&lfs, &g_journalFile, g_journalBuffer, g_journalBufferLen);
+		lfs_file_close(&lfs, &g_journalFile);
+	}
+	else {
+		addLogAdv(LOG_ERROR, LOG_FEATURE_MQTT, "Journal: can't open %s", name);
+	}
+	g_journalWriteSize += g_journalBufferLen;
+	journal_bytes += g_journalBufferLen;
+	g_journalBufferLen = 0;
+	g_journalBufferAge = 0;
+}
+// oldest segment is done, either replayed or dropped
+static void Journal_EndReadSegment() {
+	char name[24];
+	int idx;
+
+	idx = g_journalReadSeq % g_journalSegments;
+	Journal_SegmentName(name, g_journalReadSeq);
+	lfs_remove(&lfs, name);
+	journal_dropped += g_journalSegRecords[idx];
+	g_journalPending -= g_journalSegRecords[idx];
+	g_journalSegRecords[idx] = 0;
+	if (g_journalReadSeq == g_journalWriteSeq) {
+		g_journalWriteSeq++;
+		g_journalWriteSize = 0;
+		g_journalTopicsDefined = 0;
+	}
+	g_journalReadSeq++;
+	g_journalReadOffset = 0;
+}
+static void Journal_NextSegment() {
+	Journal_FlushBuffer();
+	g_journalWriteSeq++;
+	g_journalWriteSize = 0;
+	g_journalTopicsDefined = 0;
+	if (g_journalWriteSeq - g_journalReadSeq >= g_journalSegments) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Journal: full, dropping %i oldest records",
+			g_journalSegRecords[g_journalReadSeq % g_journalSegments]);
+		Journal_EndReadSegment();
+	}
+}
+static int Journal_GetTopicId(const char *topic) {
+	int i;
+
+	for (i = 0; i < JOURNAL_MAX_TOPICS; i++) {
+		if (!strcmp(g_journalTopics[i], topic)) {
+			return i;
+		}
+	}
+	// reuse slots in turn, it will be defined again in the segment
+	i = g_journalNextTopicSlot;
+	g_journalNextTopicSlot = (g_journalNextTopicSlot + 1) % JOURNAL_MAX_TOPICS;
+	strcpy(g_journalTopics[i], topic);
+	g_journalTopicsDefined &= ~(1u << i);
+	return i;
+}
+// encodes record into segment buffer, may write to flash, so only main thread
+static void Journal_Write(const char *topic, int topicLen, const char *value, int valueLen, unsigned int timestamp) {
+	int id, need;
+	byte *p;
+
+	id = Journal_GetTopicId(topic);
+	need = JOURNAL_VALUE_HEADER + valueLen;
+	if ((g_journalTopicsDefined & (1u << id)) == 0) {
+		need += 3 + topicLen;
+	}
+	if ((g_journalWriteSize ? g_journalWriteSize : JOURNAL_SEGMENT_HEADER) + g_journalBufferLen + need > g_journalSegmentSize) {
+		Journal_NextSegment();
+		need = JOURNAL_VALUE_HEADER + valueLen + 3 + topicLen;
+	}
+	if (g_journalBufferLen + need > JOURNAL_BUFFER_SIZE) {
+		Journal_FlushBuffer();
+	}
+	p = g_journalBuffer + g_journalBufferLen;
+	if ((g_journalTopicsDefined & (1u << id)) == 0) {
+		*p++ = JOURNAL_REC_TOPIC;
+		*p++ = id;
+		*p++ = topicLen;
+		memcpy(p, topic, topicLen);
+		p += topicLen;
+		g_journalTopicsDefined |= 1u << id;
+	}
+	*p++ = id;
+	*p++ = valueLen;
+	memcpy(p, &timestamp, 4);
+	p += 4;
+	memcpy(p, value, valueLen);
+	g_journalBufferLen += need;
+	g_journalSegRecords[g_journalWriteSeq % g_journalSegments]++;
+}
+// moves staged records to segments, with journal mutex taken
+static void Journal_WriteStaged() {
+	char topic[JOURNAL_MAX_TOPIC_LEN];
+	char value[JOURNAL_MAX_VALUE_LEN];
+	unsigned int timestamp;
+	int pos, stageLen, staged;
+	byte *stage;
+	byte *p;
+
+	if (g_journalStageLen == 0) {
+		return;
+	}
+	if (g_journalStageSpare == 0) {
+		g_journalStageSpare = (byte*)malloc(JOURNAL_STAGE_SIZE);
+		if (g_journalStageSpare == 0) {
+			return;
+		}
+	}
+	// take the stage out, so Append can go on while it's written to flash
+	Journal_TakeMutex(g_journalStageMutex);
+	stage = g_journalStage;
+	stageLen = g_journalStageLen;
+	staged = g_journalStaged;
+	g_journalStage = g_journalStageSpare;
+	g_journalStageSpare = stage;
+	g_journalStageLen = 0;
+	g_journalStaged = 0;
+	xSemaphoreGive(g_journalStageMutex);
+
+	if (Journal_Load() == false) {
+		// nowhere to keep them
+		journal_dropped += staged;
+		return;
+	}
+	for (pos = 0; pos < stageLen; pos += JOURNAL_STAGE_HEADER + p[0] + p[1]) {
+		p = stage + pos;
+		memcpy(&timestamp, p + 2, 4);
+		memcpy(topic, p + JOURNAL_STAGE_HEADER, p[0]);
+		topic[p[0]] = 0;
+		memcpy(value, p + JOURNAL_STAGE_HEADER + p[0], p[1]);
+		value[p[1]] = 0;
+		Journal_Write(topic, p[0], value, p[1], timestamp);
+	}
+	g_journalPending += staged;
+}
+// only stages record in RAM, so it's safe to call from quick tick
+void MQTT_Journal_Append(const char *topic, const char *value) {
+	unsigned int timestamp;
+	int topicLen, valueLen, need;
+	byte *p;
+
+	if (g_journalEnabled == 0) {
+		return;
+	}
+	topicLen = strlen(topic);
+	valueLen = strlen(value);
+	if (topicLen >= JOURNAL_MAX_TOPIC_LEN || valueLen >= JOURNAL_MAX_VALUE_LEN) {
+		return;
+	}
+	timestamp = 0;
+#ifndef OBK_DISABLE_ALL_DRIVERS
+	if (DRV_IsRunning("NTP")) {
+		timestamp = NTP_GetCurrentTime();
+	}
+#endif
+	need = JOURNAL_STAGE_HEADER + topicLen + valueLen;
+	Journal_TakeMutex(g_journalStageMutex);
+	if (g_journalStage == 0) {
+		g_journalStage = (byte*)malloc(JOURNAL_STAGE_SIZE);
+		if (g_journalStage == 0) {
+			xSemaphoreGive(g_journalStageMutex);
+			return;
+		}
+	}
+	if (g_journalStageLen + need > JOURNAL_STAGE_SIZE) {
+		// main thread did not catch up
+		journal_dropped++;
+		xSemaphoreGive(g_journalStageMutex);
+		addLogAdv(LOG_DEBUG, LOG_FEATURE_MQTT, "Journal: stage full, dropped %s", topic);
+		return;
+	}
+	p = g_journalStage + g_journalStageLen;
+	*p++ = topicLen;
+	*p++ = valueLen;
+	memcpy(p, &timestamp, 4);
+	p += 4;
+	memcpy(p, topic, topicLen);
+	p += topicLen;
+	memcpy(p, value, valueLen);
+	g_journalStageLen += need;
+	g_journalStaged++;
+	journal_appended++;
+	xSemaphoreGive(g_journalStageMutex);
+}
+int MQTT_Journal_Replay(mqttJournalPublish_t publish) {
+	int total, n, idx, guard;
+
+	if (MQTT_Journal_GetPendingCount() == 0) {
+		return 0;
+	}
+	Journal_TakeMutex(g_journalMutex);
+	Journal_WriteStaged();
+	if (g_journalPending == 0 || Journal_Load() == false) {
+		xSemaphoreGive(g_journalMutex);
+		return 0;
+	}
+	Journal_FlushBuffer();
+	total = 0;
+	for (guard = 0; guard <= g_journalSegments && g_journalPending > 0 && total < g_journalReplayPerSecond; guard++) {
+		idx = g_journalReadSeq % g_journalSegments;
+		n = Journal_ReadSegment(g_journalReadSeq, &g_journalReadOffset, g_journalReplayPerSecond - total, publish);
+		if (n > 0) {
+			total += n;
+			journal_replayed += n;
+			g_journalSegRecords[idx] -= n;
+			g_journalPending -= n;
+		}
+		// stopped by rate limit or failed publish
+		if (n >= 0 && g_journalSegRecords[idx] > 0) {
+			break;
+		}
+		Journal_EndReadSegment();
+	}
+	xSemaphoreGive(g_journalMutex);
+	return total;
+}
+void MQTT_Journal_RunEverySecond() {
+	if (g_journalStageLen == 0 && g_journalBufferLen == 0) {
+		return;
+	}
+	Journal_TakeMutex(g_journalMutex);
+	Journal_WriteStaged();
+	if (g_journalBufferLen > 0) {
+		g_journalBufferAge++;
+		if (g_journalBufferAge >= g_journalFlushSeconds && Journal_Load()) {
+			Journal_FlushBuffer();
+		}
+	}
+	xSemaphoreGive(g_journalMutex);
+}
+// with journal mutex taken
+static void Journal_Clear() {
+	char name[24];
+	int i;
+
+	Journal_TakeMutex(g_journalStageMutex);
+	g_journalStageLen = 0;
+	g_journalStaged = 0;
+	xSemaphoreGive(g_journalStageMutex);
+	if (lfs_present()) {
+		for (i = 0; i < JOURNAL_MAX_SEGMENTS; i++) {
+			sprintf(name, "mqtt_journal_%i", i);
+			lfs_remove(&lfs, name);
+		}
+	}
+	g_journalLoaded = false;
+	g_journalBufferLen = 0;
+	g_journalPending = 0;
+	memset(g_journalSegRecords, 0, sizeof(g_journalSegRecords));
+}
+// mqtt_journal [Enable|clear] [ReplayPerSecond] [Segments] [SegmentBytes]
+commandResult_t MQTT_SetJournal(const void* context, const char* cmd, const char* args, int cmdFlags) {
+	int segments, size;
+
+	Tokenizer_TokenizeString(args, 0);
+
+	if (Tokenizer_GetArgsCount() < 1) {
+		addLogAdv(LOG_INFO, LOG_FEATURE_MQTT, "Journal %s: %i pending, %i appended, %i replayed, %i dropped, %i bytes",
+			g_journalEnabled ? "on" : "off", MQTT_Journal_GetPendingCount(), journal_appended, journal_replayed, journal_dropped, journal_bytes);
+		return CMD_RES_OK;
+	}
+	if (!stricmp(Tokenizer_GetArg(0), "clear")) {
+		Journal_TakeMutex(g_journalMutex);
+		Journal_Clear();
+		xSemaphoreGive(g_journalMutex);
+		return CMD_RES_OK;
+	}
+	g_journalEnabled = Tokenizer_GetArgInteger(0);
+	if (Tokenizer_GetArgsCount() > 1) {
+		g_journalReplayPerSecond = Tokenizer_GetArgInteger(1);
+	}
+	if (Tokenizer_GetArgsCount() > 2) {
+		segments = Tokenizer_GetArgInteger(2);
+		size = g_journalSegmentSize;
+		if (Tokenizer_GetArgsCount() > 3) {
+			size = Tokenizer_GetArgInteger(3);
+		}
+		if (segments < 2 || segments > JOURNAL_MAX_SEGMENTS || size < 512) {
+			return CMD_RES_BAD_ARGUMENT;
+		}
+		if (segments != g_journalSegments || size != g_journalSegmentSize) {
+			// existing records can't be found with other layout
+			Journal_TakeMutex(g_journalMutex);
+			Journal_Clear();
+			g_journalSegments = segments;
+			g_journalSegmentSize = size;
+			xSemaphoreGive(g_journalMutex);
+		}
+	}
+	return CMD_RES_OK;
+}
+
+#endif
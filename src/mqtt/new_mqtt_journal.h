@@ -0,0 +1,16 @@
+// Offline journal keeps values that could not be published because MQTT was
+// disconnected, in a few segment files on LittleFS, and replays them after reconnect.
+// It's disabled by default, see mqtt_journal command.
+
+// returns 1 if record was sent, 0 to try it again later
+typedef int (*mqttJournalPublish_t)(const char *topic, const char *value, unsigned int timestamp);
+
+void MQTT_Journal_Init();
+// only stages the record in RAM, can be called with MQTT mutex taken
+void MQTT_Journal_Append(const char *topic, const char *value);
+// replays up to configured number of records, returns how many were sent.
+// Does flash I/O, so MQTT mutex must not be taken, publish has to take it.
+int MQTT_Journal_Replay(mqttJournalPublish_t publish);
+void MQTT_Journal_RunEverySecond();
+int MQTT_Journal_GetPendingCount();
+void MQTT_Journal_GetStats(int *appended, int *replayed, int *dropped, int *bytes);
@@ -173,6 +173,7 @@ typedef long portTickType;
 #define portTICK_PERIOD_MS 1
 #define configTICK_RATE_HZ 1
 typedef int SemaphoreHandle_t;
+void *xTaskGetCurrentTaskHandle();
 #define pdTRUE 1
 #define pdFALSE 0
 typedef int OSStatus;
@@ -444,6 +445,14 @@ extern int g_pingWatchDog_intervalMs;
 
 typedef int(*jsonCb_t)(void *userData, const char *fmt, ...);
 int JSON_ProcessCommandReply(const char *cmd, const char *args, void *request, jsonCb_t printer, int flags);
+// streaming JSON writer, see json_interface.c
+void JSON_Write(void *request, jsonCb_t printer, const char *s, int len);
+#define JSON_WriteLiteral(request, printer, s) JSON_Write(request, printer, s, sizeof(s) - 1)
+void JSON_WriteStr(void *request, jsonCb_t printer, const char *s);
+void JSON_WriteInt(void *request, jsonCb_t printer, int value);
+void JSON_WriteFloat(void *request, jsonCb_t printer, float value);
+int JSON_FormatInt(char *out, int value);
+int JSON_FormatFloat(char *out, float value);
 void ScheduleDriverStart(const char *name, int delay);
 bool isWhiteSpace(char ch);
 
@@ -182,6 +182,7 @@ extern void BUTTON_TriggerRead();
 // THIS IS AN ISR.
 void PIN_IntHandler(unsigned char index) {
 	BUTTON_TriggerRead();
+	QuickTick_RequestWakeup();
 }
 
 // this will be from hal_bk....
@@ -934,7 +935,8 @@ static void Channel_OnChanged(int ch, int prevValue, int iFlags) {
 	}
 	if ((iFlags & CHANNEL_SET_FLAG_SKIP_MQTT) == 0) {
 		if (bCallCb) {
-			MQTT_ChannelPublish(ch,0);
+			MQTT_QueueChannelPublish(ch);
+			MQTT_SetItemDirty(ch);
 		}
 	}
 	// Simple event - it just says that there was a change
@@ -1519,7 +1521,7 @@ void PIN_ticks(void* param)
 #if defined(PLATFORM_BEKEN) || defined(WINDOWS)
 	g_time = rtos_get_time();
 #else
-	g_time += PIN_TMR_DURATION;
+	g_time += g_quickTickSleepMS;
 #endif
 	uint32_t t_diff = g_time - g_last_time;
 	// cope with wrap
@@ -1716,6 +1718,95 @@ void PIN_ticks(void* param)
 	}
 
 }
+// without interrupts pins are sampled this often when nothing happens on them,
+// press must last longer than that to be seen
+#define PIN_IDLE_POLL_MS		50
+
+static bool PIN_IsButtonRole(int role) {
+	switch (role) {
+	case IOR_Button:
+	case IOR_Button_n:
+	case IOR_Button_ToggleAll:
+	case IOR_Button_ToggleAll_n:
+	case IOR_Button_NextColor:
+	case IOR_Button_NextColor_n:
+	case IOR_Button_NextDimmer:
+	case IOR_Button_NextDimmer_n:
+	case IOR_Button_NextTemperature:
+	case IOR_Button_NextTemperature_n:
+	case IOR_Button_ScriptOnly:
+	case IOR_Button_ScriptOnly_n:
+	case IOR_SmartButtonForLEDs:
+	case IOR_SmartButtonForLEDs_n:
+		return true;
+	}
+	return false;
+}
+static bool PIN_IsDigitalInputRole(int role) {
+	switch (role) {
+	case IOR_DigitalInput:
+	case IOR_DigitalInput_n:
+	case IOR_DigitalInput_NoPup:
+	case IOR_DigitalInput_NoPup_n:
+	case IOR_DoorSensorWithDeepSleep:
+	case IOR_DoorSensorWithDeepSleep_NoPup:
+	case IOR_DoorSensorWithDeepSleep_pd:
+		return true;
+	}
+	return false;
+}
+static int PIN_MinWake(int a, int b) {
+	if (a < 0)
+		return b;
+	if (b < 0)
+		return a;
+	return a < b ? a : b;
+}
+// ms until PIN_ticks must run again, -1 if it can sleep
+// Pins in the middle of a press or debounce need every tick, idle ones
+// are only sampled every PIN_IDLE_POLL_MS.
+// PWMs are not counted, they are already updated on channel change
+int PIN_GetNextWakeMS() {
+	pinButton_s* bt;
+	int i, role, r;
+
+	if (activepoll_time) {
+		return 0;
+	}
+	r = -1;
+	for (i = 0; i < PLATFORM_GPIO_MAX; i++) {
+		role = g_cfg.pins.roles[i];
+		if (PIN_IsButtonRole(role)) {
+			bt = &g_buttons[i];
+			if (bt->state != 0 || bt->debounce_cnt != 0) {
+				return 0;
+			}
+			if (bt->hal_button_Level != 0 && bt->hal_button_Level(bt) != bt->button_level) {
+				return 0;
+			}
+			r = PIN_MinWake(r, PIN_IDLE_POLL_MS);
+		}
+		else if (PIN_IsDigitalInputRole(role)) {
+			if (PIN_ReadDigitalInputValue_WithInversionIncluded(i) != g_lastValidState[i]) {
+				return 0;
+			}
+			r = PIN_MinWake(r, PIN_IDLE_POLL_MS);
+		}
+		else if (role == IOR_ToggleChannelOnToggle) {
+			if (g_times[i] > 0) {
+				// toggle is locked for debounce time
+				r = PIN_MinWake(r, g_times[i]);
+			}
+			else if (PIN_ReadDigitalInputValue_WithInversionIncluded(i) != g_lastValidState[i]) {
+				return 0;
+			}
+			else {
+				r = PIN_MinWake(r, PIN_IDLE_POLL_MS);
+			}
+		}
+	}
+	return r;
+}
 const char* g_channelTypeNames[] = {
 	"Default",
 	"Error",
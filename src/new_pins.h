@@ -1011,6 +1011,7 @@ void PIN_SetupPins();
 void PIN_OnReboot();
 void CFG_ClearPins();
 int PIN_CountPinsWithRole(int role);
+int PIN_GetNextWakeMS();
 int PIN_CountPinsWithRoleOrRole(int role, int role2);
 int PIN_GetPinRoleForPinIndex(int index);
 int PIN_GetPinChannelForPinIndex(int index);
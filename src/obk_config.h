@@ -79,5 +79,18 @@
 
 
 
+// Log calls of less important levels than this are removed at build time,
+// together with their format strings. Arguments of removed calls are not evaluated.
+// 1 - Error, 2 - Warn, 3 - Info, 4 - Debug, 5 - ExtraDebug (everything is kept).
+// Runtime loglevel still filters what is left. To see what each level costs, run
+// scripts/log_level_size.sh
+#ifndef OBK_LOG_MIN_LEVEL
+#define OBK_LOG_MIN_LEVEL		5
+#endif
+// Bit per LOG_FEATURE_ index, features with cleared bit have all their ADDLOG_ calls removed
+#ifndef OBK_LOG_FEATURES
+#define OBK_LOG_FEATURES		0xFFFFFFFF
+#endif
+
 // closing OBK_CONFIG_H
 #endif
@@ -1,7 +1,20 @@
 
 
 #define QUICK_TMR_DURATION      25 // Delay (in ms) between button scan iterations
+// Longest sleep of quick tick when nothing is pending. Wakeup requests
+// end the sleep early on Beken, BL602 and W600/W800.
+#define QUICK_TMR_MAX_IDLE      100
 
 // define this to use edge based GPI interrupts to drive Pin_ticks()
 //#define BEKEN_PIN_GPI_INTERRUPTS
 
+// time (in ms) since previous quick tick on platforms without a time source
+extern int g_quickTickSleepMS;
+// ms until quick tick has to run, 0 if on next regular tick, -1 if nothing is pending
+int QuickTick_GetNextWakeMS();
+// how long quick tick thread should sleep, between QUICK_TMR_DURATION and QUICK_TMR_MAX_IDLE
+int QuickTick_GetSleepMS();
+// ends current quick tick sleep, next tick runs within QUICK_TMR_DURATION
+// safe from interrupts on Beken, other platforms call it from tasks
+void QuickTick_RequestWakeup();
+
@@ -105,4 +105,63 @@ void Test_ChangeHandlers() {
 }
 
 
+void Test_ChangeHandlers_Buckets() {
+	int fires, matches, scanned;
+	int fires2, matches2, scanned2;
+	int i;
+
+	// reset whole device
+	SIM_ClearOBK();
+
+	// many handlers for one event code, added out of order
+	for (i = 20; i > 0; i--) {
+		char tmp[64];
+		sprintf(tmp, "addEventHandler OnClick %i addChannel 1 %i", i, i);
+		CMD_ExecuteCommand(tmp, 0);
+	}
+	// two handlers with the same argument - both run, the newest first
+	CMD_ExecuteCommand("addEventHandler OnClick 5 setChannel 2 1", 0);
+	CMD_ExecuteCommand("addEventHandler OnClick 5 setChannel 2 2", 0);
+	// handlers for other codes must not be scanned at all
+	CMD_ExecuteCommand("addEventHandler OnRelease 1 addChannel 3 1", 0);
+	CMD_ExecuteCommand("addChangeHandler Channel4 > 10 addChannel 3 1", 0);
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 24);
+
+	EventHandlers_GetStats(&fires, &matches, &scanned);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 5);
+	EventHandlers_GetStats(&fires2, &matches2, &scanned2);
+	SELFTEST_ASSERT_CHANNEL(1, 5);
+	// the older handler ran last
+	SELFTEST_ASSERT_CHANNEL(2, 1);
+	SELFTEST_ASSERT_CHANNEL(3, 0);
+	SELFTEST_ASSERT(fires2 - fires >= 1);
+	SELFTEST_ASSERT(matches2 - matches == 3);
+	// sorted, so the walk stops after the first handler with bigger argument
+	SELFTEST_ASSERT(scanned2 - scanned == 8);
+
+	// no handler for this argument, but still only a short walk
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 1);
+	EventHandlers_GetStats(&fires, &matches, &scanned);
+	SELFTEST_ASSERT_CHANNEL(1, 6);
+	SELFTEST_ASSERT(scanned - scanned2 == 2);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 0);
+	EventHandlers_GetStats(&fires2, &matches2, &scanned2);
+	SELFTEST_ASSERT_CHANNEL(1, 6);
+	SELFTEST_ASSERT(matches2 == matches);
+	SELFTEST_ASSERT(scanned2 - scanned == 1);
+
+	// other codes still work
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONRELEASE, 1);
+	SELFTEST_ASSERT_CHANNEL(3, 1);
+	CMD_ExecuteCommand("setChannel 4 15", 0);
+	SELFTEST_ASSERT_CHANNEL(3, 2);
+
+	CMD_ExecuteCommand("listEventHandlers", 0);
+	CMD_ExecuteCommand("clearAllHandlers", 0);
+	SELFTEST_ASSERT(EventHandlers_GetActiveCount() == 0);
+	EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 5);
+	SELFTEST_ASSERT_CHANNEL(1, 6);
+}
+
+
 #endif
@@ -0,0 +1,85 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+
+void Test_Command_Compiled() {
+	compiledCommand_t c;
+	int i;
+	int done, avoided;
+
+	// reset whole device
+	SIM_ClearOBK();
+
+	// basic compile and execute
+	SELFTEST_ASSERT(CMD_Compile(&c, "   addChannel 1 5"));
+	SELFTEST_ASSERT_STRING(c.text, "addChannel");
+	SELFTEST_ASSERT_STRING(c.args, "1 5");
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_OK);
+	SELFTEST_ASSERT_CHANNEL(1, 5);
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_OK);
+	SELFTEST_ASSERT_CHANNEL(1, 10);
+	CMD_FreeCompiled(&c);
+
+	// empty strings are not compiled
+	SELFTEST_ASSERT(CMD_Compile(&c, "   ") == false);
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_EMPTY_STRING);
+
+	// command without args
+	SELFTEST_ASSERT(CMD_Compile(&c, "clearAllHandlers"));
+	SELFTEST_ASSERT_STRING(c.args, "");
+	CMD_FreeCompiled(&c);
+
+	// name with trailing number still resolves to the base command (POWER1 -> POWER)
+	SELFTEST_ASSERT(CMD_Compile(&c, "POWER1 1"));
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_OK);
+	SELFTEST_ASSERT(c.cmd != 0);
+	CMD_FreeCompiled(&c);
+
+	// unknown command becomes valid once it's registered (here, as alias)
+	SELFTEST_ASSERT(CMD_Compile(&c, "myCompiledAlias"));
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_UNKNOWN_COMMAND);
+	CMD_ExecuteCommand("alias myCompiledAlias addChannel 2 3", 0);
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_OK);
+	SELFTEST_ASSERT_CHANNEL(2, 3);
+	CMD_FreeCompiled(&c);
+
+	// benchmark - count how many lookups are saved for the same string executed many times
+	SELFTEST_ASSERT(CMD_Compile(&c, "addChannel 3 1"));
+	done = g_cmd_lookupsDone;
+	avoided = g_cmd_lookupsAvoided;
+	for (i = 0; i < 1000; i++) {
+		CMD_ExecuteCompiled(&c, 0);
+	}
+	SELFTEST_ASSERT_CHANNEL(3, 1000);
+	// only the first execution has to resolve
+	SELFTEST_ASSERT(g_cmd_lookupsDone - done <= 2);
+	SELFTEST_ASSERT(g_cmd_lookupsAvoided - avoided >= 999);
+	SELFTEST_BENCHMARK_PRINTF("Test_Command_Compiled: compiled path did %i lookups and avoided %i\n",
+		g_cmd_lookupsDone - done, g_cmd_lookupsAvoided - avoided);
+	done = g_cmd_lookupsDone;
+	for (i = 0; i < 1000; i++) {
+		CMD_ExecuteCommand("addChannel 3 1", 0);
+	}
+	SELFTEST_ASSERT_CHANNEL(3, 2000);
+	SELFTEST_ASSERT(g_cmd_lookupsDone - done >= 1000);
+	SELFTEST_BENCHMARK_PRINTF("Test_Command_Compiled: string path did %i lookups\n", g_cmd_lookupsDone - done);
+	CMD_FreeCompiled(&c);
+
+	// repeating events and event handlers use compiled commands
+	avoided = g_cmd_lookupsAvoided;
+	CMD_ExecuteCommand("addRepeatingEvent 1 -1 addChannel 4 1", 0);
+	Sim_RunSeconds(10.5f, false);
+	SELFTEST_ASSERT_CHANNEL(4, 10);
+	SELFTEST_ASSERT(g_cmd_lookupsAvoided - avoided >= 9);
+
+	avoided = g_cmd_lookupsAvoided;
+	CMD_ExecuteCommand("addEventHandler OnClick 7 addChannel 5 2", 0);
+	for (i = 0; i < 10; i++) {
+		EventHandlers_FireEvent(CMD_EVENT_PIN_ONCLICK, 7);
+	}
+	SELFTEST_ASSERT_CHANNEL(5, 20);
+	SELFTEST_ASSERT(g_cmd_lookupsAvoided - avoided >= 9);
+}
+
+
+#endif
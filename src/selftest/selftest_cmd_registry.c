@@ -0,0 +1,68 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../logging/logging.h"
+
+void Test_Command_Registry() {
+	cmdRegistryStats_t st;
+	int hashed;
+	compiledCommand_t c;
+	command_t *a, *b;
+
+	// reset whole device
+	SIM_ClearOBK();
+
+	// logger registers its commands on first print, which is now after boot freeze
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Test_Command_Registry");
+	CMD_FreezeRegistry();
+	CMD_GetRegistryStats(&st);
+	// everything is packed into sorted array
+	SELFTEST_ASSERT(st.frozen > 50);
+	SELFTEST_ASSERT(st.hashed == 0);
+	SELFTEST_ASSERT(st.longestChain == 0);
+	SELFTEST_ASSERT(st.frozenProbes <= 10);
+
+	// lookups are case insensitive
+	a = CMD_Find("addChannel");
+	b = CMD_Find("ADDCHANNEL");
+	SELFTEST_ASSERT(a != 0);
+	SELFTEST_ASSERT(a == b);
+	SELFTEST_ASSERT(CMD_Find("addChannelX") == 0);
+	SELFTEST_ASSERT(CMD_Find("") == 0);
+
+	// frozen commands still work
+	CMD_ExecuteCommand("addChannel 1 5", 0);
+	SELFTEST_ASSERT_CHANNEL(1, 5);
+
+	// late registration goes to hash chains
+	// (logger may also add its commands on first print)
+	CMD_GetRegistryStats(&st);
+	hashed = st.hashed;
+	SELFTEST_ASSERT(CMD_Compile(&c, "myLateAlias"));
+	CMD_ExecuteCommand("alias myLateAlias addChannel 1 2", 0);
+	CMD_GetRegistryStats(&st);
+	SELFTEST_ASSERT(st.hashed == hashed + 1);
+	SELFTEST_ASSERT(st.longestChain >= 1);
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_OK);
+	SELFTEST_ASSERT_CHANNEL(1, 7);
+	// duplicates are still rejected
+	CMD_ExecuteCommand("alias addChannel echo test", 0);
+	CMD_GetRegistryStats(&st);
+	SELFTEST_ASSERT(st.hashed == hashed + 1);
+
+	// freezing again packs the late ones as well, compiled command must re-resolve
+	CMD_FreezeRegistry();
+	CMD_GetRegistryStats(&st);
+	SELFTEST_ASSERT(st.hashed == 0);
+	SELFTEST_ASSERT(CMD_Find("MYLATEALIAS") != 0);
+	SELFTEST_ASSERT(CMD_ExecuteCompiled(&c, 0) == CMD_RES_OK);
+	SELFTEST_ASSERT_CHANNEL(1, 9);
+	CMD_ExecuteCommand("myLateAlias", 0);
+	SELFTEST_ASSERT_CHANNEL(1, 11);
+	CMD_FreeCompiled(&c);
+
+	SELFTEST_ASSERT(CMD_ExecuteCommand("listCmds", 0) == CMD_RES_OK);
+}
+
+
+#endif
@@ -238,4 +238,49 @@ void Test_Expressions_RunTests_Basic() {
 	//SELFTEST_ASSERT_EXPRESSION("1.50/$CH18+1000\n\r", 0.1f + 1000);
 }
 
+void Test_Expressions_RunTests_Cache() {
+	int hits, misses;
+	int i;
+	const char *e;
+
+	// reset whole device
+	SIM_ClearOBK();
+
+	// compiled expression must still read current values
+	CHANNEL_Set(1, 2, 0);
+	CHANNEL_Set(2, 3, 0);
+	SELFTEST_ASSERT_EXPRESSION("$CH1*10+$CH2", 23);
+	CHANNEL_Set(1, 5, 0);
+	SELFTEST_ASSERT_EXPRESSION("$CH1*10+$CH2", 53);
+	SELFTEST_ASSERT_EXPRESSION("!$CH1", 0);
+	SELFTEST_ASSERT_EXPRESSION("!$CH3", 1);
+	SELFTEST_ASSERT_EXPRESSION("$CH1>4 && $CH2<4", 1);
+	SELFTEST_ASSERT_EXPRESSION("$CH1>4 && $CH2<3", 0);
+	SELFTEST_ASSERT_EXPRESSION("$led_dimmer+1", LED_GetDimmer() + 1);
+	// bounded by stop pointer
+	e = "$CH1+1 ignored";
+	SELFTEST_ASSERT(Float_Equals(CMD_EvaluateExpression(e, e + 6), 6));
+
+	// repeated evaluation must not parse again
+	hits = g_expr_cacheHits;
+	misses = g_expr_cacheMisses;
+	for (i = 0; i < 1000; i++) {
+		CHANNEL_Set(2, i, 0);
+		SELFTEST_ASSERT(Float_Equals(CMD_EvaluateExpression("$CH2*2+$CH1 > 100", 0), (i * 2 + 5 > 100)));
+	}
+	SELFTEST_ASSERT(g_expr_cacheMisses - misses <= 1);
+	SELFTEST_ASSERT(g_expr_cacheHits - hits >= 999);
+	SELFTEST_BENCHMARK_PRINTF("Test_Expressions_RunTests_Cache: %i hits, %i misses\n",
+		g_expr_cacheHits - hits, g_expr_cacheMisses - misses);
+
+	// the same through 'if' command
+	CMD_ExecuteCommand("setChannel 3 0", 0);
+	hits = g_expr_cacheHits;
+	for (i = 0; i < 100; i++) {
+		CMD_ExecuteCommand("if $CH3<50 then \"addChannel 3 1\"", 0);
+	}
+	SELFTEST_ASSERT_CHANNEL(3, 50);
+	SELFTEST_ASSERT(g_expr_cacheHits - hits >= 99);
+}
+
 #endif
@@ -0,0 +1,281 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../httpserver/new_http.h"
+#include "../httpserver/http_connection.h"
+
+static char g_sent[32768];
+static int g_sentLen;
+static char g_body[32768];
+static char g_file[3001];
+static char g_request[8192];
+
+static int Test_HTTP_KeepAlive_Send(int fd, const char *data, int len) {
+	SELFTEST_ASSERT(g_sentLen + len < sizeof(g_sent));
+	memcpy(g_sent + g_sentLen, data, len);
+	g_sentLen += len;
+	g_sent[g_sentLen] = 0;
+	return len;
+}
+// what client sent, but server didn't read yet
+static const char *g_pending;
+static int g_pendingLen;
+
+static int Test_HTTP_KeepAlive_Recv(int fd, char *data, int maxLen, int timeoutMS) {
+	int len = g_pendingLen < maxLen ? g_pendingLen : maxLen;
+
+	if (len == 0) {
+		// nothing more will come
+		return -1;
+	}
+	memcpy(data, g_pending, len);
+	g_pending += len;
+	g_pendingLen -= len;
+	return len;
+}
+static void Test_HTTP_KeepAlive_ClearSent() {
+	g_sentLen = 0;
+	g_sent[0] = 0;
+}
+static int Test_HTTP_KeepAlive_Feed(httpConnection_t *c, const char *data) {
+	char *buf;
+	int maxLen, len;
+
+	buf = HTTP_Conn_GetReceiveBuffer(c, &maxLen);
+	len = strlen(data);
+	SELFTEST_ASSERT(len <= maxLen);
+	memcpy(buf, data, len);
+	return HTTP_Conn_OnReceived(c, len);
+}
+// like server does, reads as much as fits, big body may be read by handler itself
+static int Test_HTTP_KeepAlive_FeedAll(httpConnection_t *c, const char *data, int len) {
+	char *buf;
+	int maxLen, res;
+
+	g_pending = data;
+	g_pendingLen = len;
+	res = HTTP_CONN_KEEP;
+	while (g_pendingLen > 0 && res == HTTP_CONN_KEEP) {
+		buf = HTTP_Conn_GetReceiveBuffer(c, &maxLen);
+		res = HTTP_Conn_OnReceived(c, Test_HTTP_KeepAlive_Recv(c->fd, buf, maxLen, 0));
+	}
+	return res;
+}
+static int Test_HTTP_KeepAlive_Count(const char *what) {
+	const char *p = g_sent;
+	int count = 0;
+
+	while ((p = strstr(p, what)) != 0) {
+		count++;
+		p++;
+	}
+	return count;
+}
+// joins chunks of reply starting at given point, returns where reply ends
+static const char *Test_HTTP_KeepAlive_Dechunk(const char *p) {
+	char *o = g_body;
+	int len;
+
+	p = strstr(p, "\r\n\r\n");
+	SELFTEST_ASSERT(p != 0);
+	p += 4;
+	while (1) {
+		len = strtol(p, 0, 16);
+		p = strstr(p, "\r\n") + 2;
+		if (len == 0) {
+			break;
+		}
+		memcpy(o, p, len);
+		o += len;
+		p += len;
+		SELFTEST_ASSERT(p[0] == '\r' && p[1] == '\n');
+		p += 2;
+	}
+	*o = 0;
+	SELFTEST_ASSERT(p[0] == '\r' && p[1] == '\n');
+	return p + 2;
+}
+void Test_HTTP_KeepAlive() {
+	httpConnection_t *c;
+	httpConnection_t *others[HTTP_MAX_CONNECTIONS];
+	httpConnStats_t stats, stats2;
+	const char *p;
+	int i;
+
+	SIM_ClearOBK();
+	Test_HTTP_KeepAlive_ClearSent();
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+	SELFTEST_ASSERT(c != 0);
+
+	// single request, reply is chunked and connection stays
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "GET /cm?cmnd=addChannel%201%205 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 5);
+	SELFTEST_ASSERT(strstr(g_sent, "Transfer-Encoding: chunked\r\n") != 0);
+	SELFTEST_ASSERT(strstr(g_sent, "Connection: keep-alive\r\n") != 0);
+	p = Test_HTTP_KeepAlive_Dechunk(g_sent);
+	SELFTEST_ASSERT(*p == 0);
+
+	// two pipelined requests in one read
+	Test_HTTP_KeepAlive_ClearSent();
+	HTTP_Conn_GetStats(&stats);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c,
+		"GET /cm?cmnd=addChannel%201%205 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n"
+		"GET /cm?cmnd=addChannel%201%203 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 13);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Count("HTTP/1.1 200") == 2);
+	p = Test_HTTP_KeepAlive_Dechunk(g_sent);
+	p = Test_HTTP_KeepAlive_Dechunk(p);
+	SELFTEST_ASSERT(*p == 0);
+	HTTP_Conn_GetStats(&stats2);
+	SELFTEST_ASSERT(stats2.requests == stats.requests + 2);
+	SELFTEST_ASSERT(stats2.reusedRequests == stats.reusedRequests + 2);
+
+	// request split across reads, second one starts in the same read as end of first
+	Test_HTTP_KeepAlive_ClearSent();
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "GET /cm?cmnd=addChannel%201%201 HTTP/1.1\r\nHo") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT(g_sentLen == 0);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "st: 127.0.0.1\r\n\r\nGET /cm?cmnd=addChannel%201%201 HTTP/1.1\r\n") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 14);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "\r\n") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 15);
+
+	// POST body is waited for
+	Test_HTTP_KeepAlive_ClearSent();
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "POST /api/cmnd HTTP/1.1\r\nContent-Length: 14\r\n\r\naddChan") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT(g_sentLen == 0);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "nel 1 5") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 20);
+
+	// reply bigger than reply buffer is sent in more chunks
+	Test_HTTP_KeepAlive_ClearSent();
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "GET /index HTTP/1.1\r\n\r\n") == HTTP_CONN_KEEP);
+	p = Test_HTTP_KeepAlive_Dechunk(g_sent);
+	SELFTEST_ASSERT(*p == 0);
+	SELFTEST_ASSERT(strlen(g_body) > HTTP_REPLY_BUFFER_SIZE);
+	SELFTEST_ASSERT(strstr(g_body, "<!DOCTYPE html>") == g_body);
+	SELFTEST_ASSERT(strstr(g_body, "</html>") != 0);
+
+	// chunked body, split across reads, with chunk extension and trailer
+	Test_HTTP_KeepAlive_ClearSent();
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "POST /api/cmnd HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n7\r\naddCh") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "an\r\n7;ext=1\r\nnel 1 5\r") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "\n0\r\nX-Trailer: 1\r\n") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT(g_sentLen == 0);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "\r\nGET /cm?cmnd=addChannel%201%201 HTTP/1.1\r\n\r\n") == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 26);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Count("HTTP/1.1 200") == 2);
+
+	// broken chunk size
+	HTTP_Conn_GetStats(&stats);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "POST /api/cmnd HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n") == HTTP_CONN_CLOSE);
+	HTTP_Conn_GetStats(&stats2);
+	SELFTEST_ASSERT(stats2.badRequests == stats.badRequests + 1);
+	HTTP_Conn_Free(c);
+
+	// body bigger than buffer is read by handler, then next request on the same connection is served
+	CMD_ExecuteCommand("lfs_format", 0);
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+	for (i = 0; i < 3000; i++) {
+		g_file[i] = 'a' + i % 26;
+	}
+	g_file[i] = 0;
+	sprintf(g_request, "POST /api/lfs/big.txt HTTP/1.1\r\nContent-Length: %i\r\n\r\n%sGET /cm?cmnd=addChannel%%201%%201 HTTP/1.1\r\n\r\n", i, g_file);
+	Test_HTTP_KeepAlive_ClearSent();
+	HTTP_Conn_GetStats(&stats);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_FeedAll(c, g_request, strlen(g_request)) == HTTP_CONN_KEEP);
+	HTTP_Conn_GetStats(&stats2);
+	SELFTEST_ASSERT(stats2.streamedBodies == stats.streamedBodies + 1);
+	SELFTEST_ASSERT_CHANNEL(1, 27);
+	SELFTEST_ASSERT(strstr(g_sent, "\"size\":3000") != 0);
+	Test_FakeHTTPClientPacket_GET("api/lfs/big.txt");
+	SELFTEST_ASSERT_HTML_REPLY(g_file);
+
+	// the same in chunks of 100 bytes
+	CMD_ExecuteCommand("lfs_format", 0);
+	strcpy(g_request, "POST /api/lfs/big.txt HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+	for (i = 0; i < 3000; i += 100) {
+		sprintf(g_request + strlen(g_request), "64\r\n%.100s\r\n", g_file + i);
+	}
+	strcat(g_request, "0\r\n\r\nGET /cm?cmnd=addChannel%201%201 HTTP/1.1\r\n\r\n");
+	Test_HTTP_KeepAlive_ClearSent();
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_FeedAll(c, g_request, strlen(g_request)) == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 28);
+	SELFTEST_ASSERT(strstr(g_sent, "\"size\":3000") != 0);
+	Test_FakeHTTPClientPacket_GET("api/lfs/big.txt");
+	SELFTEST_ASSERT_HTML_REPLY(g_file);
+
+	// body that handler didn't read is skipped, unless it's too big to wait for
+	// (6000 is over HTTP_SKIP_BODY_MAX)
+	g_file[2000] = 0;
+	sprintf(g_request, "POST /cm?cmnd=addChannel%%201%%201 HTTP/1.1\r\nContent-Length: 2000\r\n\r\n%sGET /cm?cmnd=addChannel%%201%%201 HTTP/1.1\r\n\r\n", g_file);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_FeedAll(c, g_request, strlen(g_request)) == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT_CHANNEL(1, 30);
+	for (i = 0; i < 3000; i++) {
+		g_file[i] = 'a' + i % 26;
+	}
+	g_file[i] = 0;
+	sprintf(g_request, "POST /cm?cmnd=addChannel%%201%%201 HTTP/1.1\r\nContent-Length: %i\r\n\r\n%s%s",
+		2 * 3000, g_file, g_file);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_FeedAll(c, g_request, strlen(g_request)) == HTTP_CONN_CLOSE);
+	SELFTEST_ASSERT_CHANNEL(1, 31);
+	HTTP_Conn_Free(c);
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+
+	// client asks to close
+	Test_HTTP_KeepAlive_ClearSent();
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "GET /cm?cmnd=addChannel%201%201 HTTP/1.1\r\nConnection: close\r\n\r\n") == HTTP_CONN_CLOSE);
+	SELFTEST_ASSERT(strstr(g_sent, "Connection: close\r\n") != 0);
+	SELFTEST_ASSERT(strstr(g_sent, "Transfer-Encoding") == 0);
+	HTTP_Conn_Free(c);
+
+	// HTTP/1.0 client can't read chunks
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "GET /cm?cmnd=addChannel%201%201 HTTP/1.0\r\n\r\n") == HTTP_CONN_CLOSE);
+	HTTP_Conn_Free(c);
+
+	// server that can't keep connections
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 0);
+	SELFTEST_ASSERT(Test_HTTP_KeepAlive_Feed(c, "GET /cm?cmnd=addChannel%201%201 HTTP/1.1\r\n\r\n") == HTTP_CONN_CLOSE);
+	SELFTEST_ASSERT_CHANNEL(1, 34);
+	HTTP_Conn_Free(c);
+
+	// idle timeout
+	HTTP_Conn_GetStats(&stats);
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+	SELFTEST_ASSERT(HTTP_Conn_OnIdle(c, HTTP_KEEPALIVE_TIMEOUT_MS - 100) == HTTP_CONN_KEEP);
+	SELFTEST_ASSERT(HTTP_Conn_OnIdle(c, 100) == HTTP_CONN_CLOSE);
+	HTTP_Conn_GetStats(&stats2);
+	SELFTEST_ASSERT(stats2.idleTimeouts == stats.idleTimeouts + 1);
+	HTTP_Conn_Free(c);
+
+	// connection cap, then idle connections are asked to make room
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		others[i] = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+		SELFTEST_ASSERT(others[i] != 0);
+	}
+	SELFTEST_ASSERT(HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1) == 0);
+	HTTP_Conn_CloseIdle();
+	for (i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+		SELFTEST_ASSERT(HTTP_Conn_OnIdle(others[i], 0) == HTTP_CONN_CLOSE);
+		HTTP_Conn_Free(others[i]);
+	}
+	HTTP_Conn_GetStats(&stats);
+	SELFTEST_ASSERT(stats.active == 0);
+
+	// per second values
+	HTTP_Conn_RunEverySecond();
+	c = HTTP_Conn_Alloc(1, Test_HTTP_KeepAlive_Send, Test_HTTP_KeepAlive_Recv, 1);
+	for (i = 0; i < 10; i++) {
+		Test_HTTP_KeepAlive_Feed(c, "GET /cm?cmnd=addChannel%202%201 HTTP/1.1\r\n\r\n");
+	}
+	HTTP_Conn_RunEverySecond();
+	HTTP_Conn_Free(c);
+	HTTP_Conn_GetStats(&stats);
+	SELFTEST_ASSERT_CHANNEL(2, 10);
+	SELFTEST_ASSERT(stats.requestsPerSecond == 10);
+	SELFTEST_ASSERT(stats.connectionsPerSecond == 1);
+	CMD_ExecuteCommand("httpstats", 0);
+}
+
+
+#endif
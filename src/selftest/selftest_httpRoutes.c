@@ -0,0 +1,148 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../httpserver/new_http.h"
+
+static char g_request[1024];
+static char g_reply[8192];
+static int g_replyLen;
+static const char *g_lastCallback;
+static char g_lastAuthorization[64];
+static char g_lastConnection[64];
+static int g_lastContentLength;
+
+static void Test_HTTP_Routes_Remember(http_request_t *request, const char *name) {
+	g_lastCallback = name;
+	strcpy_safe(g_lastAuthorization, request->authorization ? request->authorization : "", sizeof(g_lastAuthorization));
+	strcpy_safe(g_lastConnection, request->connection ? request->connection : "", sizeof(g_lastConnection));
+	g_lastContentLength = request->contentLength;
+	http_setup(request, httpMimeTypeText);
+	poststr(request, name);
+	poststr(request, NULL);
+}
+static int Test_HTTP_Routes_Get(http_request_t *request) {
+	Test_HTTP_Routes_Remember(request, "get");
+	return 0;
+}
+static int Test_HTTP_Routes_Post(http_request_t *request) {
+	Test_HTTP_Routes_Remember(request, "post");
+	return 0;
+}
+static int Test_HTTP_Routes_Deeper(http_request_t *request) {
+	Test_HTTP_Routes_Remember(request, "deeper");
+	return 0;
+}
+// sends raw request, returns reply
+static const char *Test_HTTP_Routes_Send(const char *raw) {
+	http_request_t request;
+
+	strcpy(g_request, raw);
+	memset(&request, 0, sizeof(request));
+	request.received = g_request;
+	request.receivedLen = strlen(g_request);
+	request.reply = g_reply;
+	request.replymaxlen = sizeof(g_reply);
+	request.responseCode = HTTP_RESPONSE_OK;
+	g_reply[0] = 0;
+	g_lastCallback = "";
+	HTTP_ProcessPacket(&request);
+	g_replyLen = request.replylen;
+	g_reply[request.replylen] = 0;
+	return g_reply;
+}
+static void Test_HTTP_Routes_Test_Asset(const char *path, const char *type, const unsigned char *data, int len, const char *etag) {
+	char tmp[128];
+	const char *body;
+
+	snprintf(tmp, sizeof(tmp), "GET %s?v=%s HTTP/1.1\r\nHost: x\r\n\r\n", path, etag);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send(tmp), "HTTP/1.1 200") == g_reply);
+	SELFTEST_ASSERT(strstr(g_reply, type) != 0);
+	SELFTEST_ASSERT(strstr(g_reply, "Content-Encoding: gzip\r\n") != 0);
+	SELFTEST_ASSERT(strstr(g_reply, "Cache-Control: public, max-age=31536000, immutable\r\n") != 0);
+	snprintf(tmp, sizeof(tmp), "ETag: \"%s\"\r\n", etag);
+	SELFTEST_ASSERT(strstr(g_reply, tmp) != 0);
+	snprintf(tmp, sizeof(tmp), "Content-Length: %i\r\n", len);
+	SELFTEST_ASSERT(strstr(g_reply, tmp) != 0);
+	// body is stored gzip stream, as it is
+	body = strstr(g_reply, "\r\n\r\n") + 4;
+	SELFTEST_ASSERT(g_reply + g_replyLen - body == len);
+	SELFTEST_ASSERT(!memcmp(body, data, len));
+	SELFTEST_ASSERT((byte)body[0] == 0x1f && (byte)body[1] == 0x8b);
+
+	// browser already has it
+	snprintf(tmp, sizeof(tmp), "GET %s?v=%s HTTP/1.1\r\nIf-None-Match: \"%s\"\r\n\r\n", path, etag, etag);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send(tmp), "HTTP/1.1 304") == g_reply);
+	SELFTEST_ASSERT(strstr(g_reply, "Content-Length: 0\r\n") != 0);
+	SELFTEST_ASSERT(strstr(g_reply, "Content-Encoding") == 0);
+	SELFTEST_ASSERT(g_replyLen == strstr(g_reply, "\r\n\r\n") + 4 - g_reply);
+	// old version
+	snprintf(tmp, sizeof(tmp), "GET %s HTTP/1.1\r\nIf-None-Match: \"0123456789abcdef\"\r\n\r\n", path);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send(tmp), "HTTP/1.1 200") == g_reply);
+}
+void Test_HTTP_Routes() {
+	const char *value;
+
+	SIM_ClearOBK();
+
+	HTTP_RegisterCallback("/rtest/", HTTP_GET, Test_HTTP_Routes_Get);
+	HTTP_RegisterCallback("/rtest/", HTTP_POST, Test_HTTP_Routes_Post);
+	HTTP_RegisterCallback("/rtest/deeper/", HTTP_ANY, Test_HTTP_Routes_Deeper);
+	// registering again changes nothing
+	HTTP_RegisterCallback("/rtest/", HTTP_GET, Test_HTTP_Routes_Get);
+
+	// registered prefix, method picks callback
+	Test_HTTP_Routes_Send("GET /rtest/abc?x=1 HTTP/1.1\r\n\r\n");
+	SELFTEST_ASSERT_STRING(g_lastCallback, "get");
+	Test_HTTP_Routes_Send("POST /rtest/abc HTTP/1.1\r\nContent-Length: 0\r\n\r\n");
+	SELFTEST_ASSERT_STRING(g_lastCallback, "post");
+	Test_HTTP_Routes_Send("GET /rtest/ HTTP/1.1\r\n\r\n");
+	SELFTEST_ASSERT_STRING(g_lastCallback, "get");
+	// longest prefix wins
+	Test_HTTP_Routes_Send("PUT /rtest/deeper/x HTTP/1.1\r\n\r\n");
+	SELFTEST_ASSERT_STRING(g_lastCallback, "deeper");
+	Test_HTTP_Routes_Send("GET /rtest/deepe HTTP/1.1\r\n\r\n");
+	SELFTEST_ASSERT_STRING(g_lastCallback, "get");
+	// path is there, but not for this method
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("PUT /rtest/abc HTTP/1.1\r\n\r\n"), "HTTP/1.1 405") != 0);
+	SELFTEST_ASSERT_STRING(g_lastCallback, "");
+	// not a prefix
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /rtes HTTP/1.1\r\n\r\n"), "Not found") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /rtestx HTTP/1.1\r\n\r\n"), "Not found") != 0);
+
+	// built-in pages are matched by whole path
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /cfg_mqtt HTTP/1.1\r\n\r\n"), "MQTT") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /cfg_mqt HTTP/1.1\r\n\r\n"), "Not found") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /cfg_mqtt_sett HTTP/1.1\r\n\r\n"), "Not found") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /index?state=1 HTTP/1.1\r\n\r\n"), "HTTP/1.1 200") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET / HTTP/1.1\r\n\r\n"), "Location: /index") != 0);
+	// style and scripts are gzipped assets that browser can cache
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /index HTTP/1.1\r\n\r\n"), "<link rel=\"stylesheet\" href=\"/style.css?v=") != 0);
+	SELFTEST_ASSERT(strstr(g_reply, "<script src=\"/script.js?v=") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /ha_cfg HTTP/1.1\r\n\r\n"), "<script src=\"/ha_discovery.js?v=") != 0);
+	Test_HTTP_Routes_Test_Asset("/style.css", "text/css", htmlHeadStyle, htmlHeadStyle_len, htmlHeadStyle_etag);
+	Test_HTTP_Routes_Test_Asset("/script.js", "application/javascript", pageScript, pageScript_len, pageScript_etag);
+	Test_HTTP_Routes_Test_Asset("/ha_discovery.js", "application/javascript", ha_discovery_script, ha_discovery_script_len, ha_discovery_script_etag);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("POST /style.css HTTP/1.1\r\n\r\n"), "HTTP/1.1 405") != 0);
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /style.cs HTTP/1.1\r\n\r\n"), "Not found") != 0);
+
+	// registered by REST interface
+	SELFTEST_ASSERT(strstr(Test_HTTP_Routes_Send("GET /api/info HTTP/1.1\r\n\r\n"), "\"uptime_s\"") != 0);
+
+	// headers handlers need
+	Test_HTTP_Routes_Send("POST /rtest/ HTTP/1.1\r\nHost: x\r\nauthorization: Basic YWRtaW46YWRtaW4=\r\n"
+		"CONTENT-LENGTH:   4\r\nConnection: keep-alive\r\n\r\nbody");
+	SELFTEST_ASSERT_STRING(g_lastCallback, "post");
+	SELFTEST_ASSERT_STRING(g_lastAuthorization, "Basic YWRtaW46YWRtaW4=");
+	SELFTEST_ASSERT_STRING(g_lastConnection, "keep-alive");
+	SELFTEST_ASSERT(g_lastContentLength == 4);
+	Test_HTTP_Routes_Send("GET /rtest/ HTTP/1.1\r\nHost: x\r\n\r\n");
+	SELFTEST_ASSERT_STRING(g_lastAuthorization, "");
+	SELFTEST_ASSERT(g_lastContentLength == -1);
+
+	SELFTEST_ASSERT(HTTP_GetHeaderId("Content-Type: text/html", &value) == HTTP_HEADER_OTHER);
+	SELFTEST_ASSERT(HTTP_GetHeaderId("Transfer-Encoding: chunked", &value) == HTTP_HEADER_TRANSFER_ENCODING);
+	SELFTEST_ASSERT_STRING(value, "chunked");
+}
+
+
+#endif
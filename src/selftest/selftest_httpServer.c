@@ -0,0 +1,133 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../httpserver/new_http.h"
+#include "../httpserver/http_connection.h"
+#include "../httpserver/http_tcp_server.h"
+#include <timeapi.h>
+
+// Local load generator, talks to real server over loopback and pumps it from here
+// like simulator does, so requests per second can be compared.
+
+#define TEST_HTTP_SERVER_REQUESTS		96
+// requests sent at once on kept connection
+#define TEST_HTTP_SERVER_PIPELINE		4
+#define TEST_HTTP_SERVER_TIMEOUT_MS		5000
+
+extern int g_port;
+
+static char g_received[65536];
+static int g_receivedLen;
+
+static const char *g_keepAliveRequest = "GET /cm?cmnd=addChannel%203%201 HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+static const char *g_closeRequest = "GET /cm?cmnd=addChannel%203%201 HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+
+static int Test_HTTP_Server_Connect() {
+	struct sockaddr_in addr;
+	SOCKET s;
+	u_long argp;
+
+	s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = htons(g_port);
+	if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		closesocket(s);
+		return -1;
+	}
+	// server runs in this thread, so client must not block
+	argp = 1;
+	ioctlsocket(s, FIONBIO, &argp);
+	return (int)s;
+}
+static int Test_HTTP_Server_CountReplies() {
+	const char *p = g_received;
+	int count = 0;
+
+	// end of chunked reply
+	while ((p = strstr(p, "\r\n0\r\n\r\n")) != 0) {
+		count++;
+		p++;
+	}
+	return count;
+}
+// runs server until client gets expected number of replies or connection is closed
+// returns number of replies, or -1 if closed
+static int Test_HTTP_Server_Pump(int s, int replies) {
+	long start = timeGetTime();
+	int len;
+
+	while (timeGetTime() - start < TEST_HTTP_SERVER_TIMEOUT_MS) {
+		HTTPServer_RunQuickTick();
+		len = recv((SOCKET)s, g_received + g_receivedLen, sizeof(g_received) - 1 - g_receivedLen, 0);
+		if (len == 0) {
+			return -1;
+		}
+		if (len > 0) {
+			g_receivedLen += len;
+			g_received[g_receivedLen] = 0;
+			if (replies && Test_HTTP_Server_CountReplies() >= replies) {
+				return replies;
+			}
+		}
+	}
+	return Test_HTTP_Server_CountReplies();
+}
+static void Test_HTTP_Server_Clear() {
+	g_receivedLen = 0;
+	g_received[0] = 0;
+}
+void Test_HTTP_Server() {
+	httpConnStats_t stats, stats2;
+	long start, keepAliveMS, closeMS;
+	int s, i, j;
+
+	SIM_ClearOBK();
+	s = Test_HTTP_Server_Connect();
+	SELFTEST_ASSERT(s >= 0);
+	if (s < 0) {
+		return;
+	}
+	HTTP_Conn_GetStats(&stats);
+
+	// keep-alive, pipelined requests
+	start = timeGetTime();
+	for (i = 0; i < TEST_HTTP_SERVER_REQUESTS; i += TEST_HTTP_SERVER_PIPELINE) {
+		Test_HTTP_Server_Clear();
+		for (j = 0; j < TEST_HTTP_SERVER_PIPELINE; j++) {
+			send((SOCKET)s, g_keepAliveRequest, strlen(g_keepAliveRequest), 0);
+		}
+		SELFTEST_ASSERT(Test_HTTP_Server_Pump(s, TEST_HTTP_SERVER_PIPELINE) == TEST_HTTP_SERVER_PIPELINE);
+	}
+	keepAliveMS = timeGetTime() - start;
+	closesocket((SOCKET)s);
+	SELFTEST_ASSERT_CHANNEL(3, TEST_HTTP_SERVER_REQUESTS);
+
+	// new connection for each request
+	start = timeGetTime();
+	for (i = 0; i < TEST_HTTP_SERVER_REQUESTS; i++) {
+		Test_HTTP_Server_Clear();
+		s = Test_HTTP_Server_Connect();
+		SELFTEST_ASSERT(s >= 0);
+		send((SOCKET)s, g_closeRequest, strlen(g_closeRequest), 0);
+		// server closes it after reply
+		SELFTEST_ASSERT(Test_HTTP_Server_Pump(s, 0) == -1);
+		SELFTEST_ASSERT(strstr(g_received, "HTTP/1.1 200") == g_received);
+		closesocket((SOCKET)s);
+	}
+	closeMS = timeGetTime() - start;
+	SELFTEST_ASSERT_CHANNEL(3, 2 * TEST_HTTP_SERVER_REQUESTS);
+
+	HTTP_Conn_GetStats(&stats2);
+	SELFTEST_ASSERT(stats2.connections == stats.connections + 1 + TEST_HTTP_SERVER_REQUESTS);
+	SELFTEST_ASSERT(stats2.reusedRequests == stats.reusedRequests + TEST_HTTP_SERVER_REQUESTS - 1);
+
+	SELFTEST_BENCHMARK_PRINTF("Test_HTTP_Server: keep-alive %i requests in %i ms, %i req/s\n", TEST_HTTP_SERVER_REQUESTS,
+		(int)keepAliveMS, (int)(TEST_HTTP_SERVER_REQUESTS * 1000 / (keepAliveMS + 1)));
+	SELFTEST_BENCHMARK_PRINTF("Test_HTTP_Server: connection per request %i requests in %i ms, %i req/s\n", TEST_HTTP_SERVER_REQUESTS,
+		(int)closeMS, (int)(TEST_HTTP_SERVER_REQUESTS * 1000 / (closeMS + 1)));
+}
+
+
+#endif
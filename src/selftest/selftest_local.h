@@ -36,6 +36,15 @@ void SelfTest_Failed(const char *file, const char *function, int line, const cha
 #define SELFTEST_ASSERT_HAS_MQTT_JSON_SENT(topic, bPrefixMode) SELFTEST_ASSERT(!SIM_BeginParsingMQTTJSON(topic, bPrefixMode));
 #define SELFTEST_ASSERT_HAS_MQTT_JSON_SENT_ANY(topic, bPrefixMode, object1, object2, key, value) SELFTEST_ASSERT(SIM_HasMQTTHistoryStringWithJSONPayload(topic, bPrefixMode, object1, object2, key, value));
 
+// Timings and counters of benchmark-like tests are printed only if this is defined,
+// so normal selftest output stays the same from run to run
+//#define SELFTEST_BENCHMARK
+#ifdef SELFTEST_BENCHMARK
+#define SELFTEST_BENCHMARK_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define SELFTEST_BENCHMARK_PRINTF(...)
+#endif
+
 
 //#define FLOAT_EQUALS (a,b) (fabs(a-b)<0.001f)
 inline bool Float_Equals(float a, float b) {
@@ -70,11 +79,19 @@ void Test_TuyaMCU_Basic();
 void Test_Command_If();
 void Test_Command_If_Else();
 void Test_LFS();
+void Test_Logging();
+void Test_HTTP_KeepAlive();
+void Test_HTTP_Server();
+void Test_HTTP_Routes();
 void Test_Tokenizer();
 void Test_Commands_Alias();
+void Test_Command_Compiled();
+void Test_Command_Registry();
+void Test_Expressions_RunTests_Cache();
 void Test_ExpandConstant();
 void Test_Scripting();
 void Test_RepeatingEvents();
+void Test_QuickTick();
 void Test_HTTP_Client();
 void Test_DeviceGroups();
 void Test_NTP();
@@ -93,6 +110,7 @@ void Test_Role_ToggleAll();
 void Test_Demo_SimpleShuttersScript();
 void Test_Commands_Generic();
 void Test_ChangeHandlers_MQTT();
+void Test_ChangeHandlers_Buckets();
 void Test_Commands_Calendar();
 void Test_CFG_Via_HTTP();
 void Test_Demo_ButtonScrollingChannelValues();
@@ -123,10 +141,16 @@ void SIM_SendFakeMQTTAndRunSimFrame_CMND_ViaGroupTopic(const char *command, cons
 void SIM_SendFakeMQTTRawChannelSet(int channelIndex, const char *arguments);
 void SIM_SendFakeMQTTRawChannelSet_ViaGroupTopic(int channelIndex, const char *arguments);
 void SIM_ClearMQTTHistory();
+void SIM_FlushPendingMQTTPublishes();
 bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bRetain);
 bool SIM_HasMQTTHistoryStringWithJSONPayload(const char *topic, bool bPrefixMode, const char *object1, const char *object2, const char *key, const char *value);
 bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain);
 const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode);
+int SIM_GetMQTTHistoryQoS(const char *topic);
+void SIM_SetMQTTOffline(bool bOffline);
+long SIM_GetTime();
+void SIM_GetMQTTSubscribeStats(int *packets, int *subscribed, int *unsubscribed);
+void SIM_SimulateMQTTConnAck();
 bool SIM_BeginParsingMQTTJSON(const char *topic, bool bPrefixMode);
 
 void SIM_SimulateUserClickOnPin(int pin);
@@ -0,0 +1,196 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../logging/logging.h"
+
+static int Test_Logging_CountInReply(const char *what) {
+	const char *p = Test_GetLastHTMLReply();
+	int count = 0;
+
+	while ((p = strstr(p, what)) != 0) {
+		count++;
+		p++;
+	}
+	return count;
+}
+// logs given number of short lines and returns how many of them are still in log memory
+static int Test_Logging_Capacity(int lines) {
+	int i;
+
+	// read everything so far
+	Test_FakeHTTPClientPacket_GET("lograw");
+	for (i = 0; i < lines; i++) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "capacity line %i of %s", i, "test");
+	}
+	Test_FakeHTTPClientPacket_GET("lograw");
+	return Test_Logging_CountInReply("capacity line ");
+}
+static void Test_Logging_Deferred() {
+	char buf[64];
+	char fmt[64];
+	char expected[512];
+	char longArg[400];
+	int deferred, formatted;
+	int deferred2, formatted2;
+	int withText, withDeferred;
+
+	SIM_ClearOBK();
+	// log commands are registered with first log line
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Test_Logging_Deferred");
+	CMD_ExecuteCommand("logdeferred 1", 0);
+
+	// string argument is copied, so it can change before line is formatted
+	strcpy(buf, "first");
+	LOG_GetDeferredStats(&deferred, &formatted);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "deferred %s %i %.2f 0x%04X [%5s|%-3d|%lld|%u] %%", buf, 42, 3.14159, 0xAB, "ab", 7, 1234567890123LL, 4000000000u);
+	strcpy(buf, "XXXXX");
+	LOG_GetDeferredStats(&deferred2, &formatted2);
+	SELFTEST_ASSERT(deferred2 == deferred + 1);
+	SELFTEST_ASSERT(formatted2 == formatted);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	sprintf(expected, "Info:CMD:deferred %s %i %.2f 0x%04X [%5s|%-3d|%lld|%u] %%\r\n", "first", 42, 3.14159, 0xAB, "ab", 7, 1234567890123LL, 4000000000u);
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), expected) != 0);
+
+	// width and precision from arguments
+	ADDLOG_INFO(LOG_FEATURE_CMD, "stars [%*d] [%.*s] [%*.*f]", 6, 12, 3, "abcdef", 8, 1, 2.25);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	sprintf(expected, "Info:CMD:stars [%*d] [%.*s] [%*.*f]\r\n", 6, 12, 3, "abcdef", 8, 1, 2.25);
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), expected) != 0);
+	// each reader gets the line only once
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "stars [") == 0);
+
+	// too long for a deferred record, so it's formatted at once
+	memset(longArg, 'a', sizeof(longArg) - 1);
+	longArg[sizeof(longArg) - 1] = 0;
+	LOG_GetDeferredStats(&deferred, &formatted);
+	ADDLOG_INFO(LOG_FEATURE_CMD, "long %s end", longArg);
+	LOG_GetDeferredStats(&deferred2, &formatted2);
+	SELFTEST_ASSERT(deferred2 == deferred);
+	SELFTEST_ASSERT(formatted2 == formatted + 1);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	sprintf(expected, "Info:CMD:long %s end\r\n", longArg);
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), expected) != 0);
+
+	// format that is not static is always formatted at once
+	strcpy(fmt, "dynamic %i");
+	addLogAdv(LOG_INFO, LOG_FEATURE_CMD, fmt, 5);
+	strcpy(fmt, "XXXXXXXXXX");
+	LOG_GetDeferredStats(&deferred, &formatted);
+	SELFTEST_ASSERT(deferred == deferred2);
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "Info:CMD:dynamic 5\r\n") != 0);
+
+	// deferred records take less space, so more lines fit in the same memory
+	withDeferred = Test_Logging_Capacity(400);
+	CMD_ExecuteCommand("logdeferred 0", 0);
+	withText = Test_Logging_Capacity(400);
+	SELFTEST_BENCHMARK_PRINTF("Test_Logging_Deferred: log memory keeps %i deferred lines and %i text lines\n",
+		withDeferred, withText);
+	SELFTEST_ASSERT(withText > 0);
+	SELFTEST_ASSERT(withDeferred > withText * 3 / 2);
+	// newest line is there and oldest was dropped
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "capacity line 399 of test\r\n") != 0);
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "capacity line 0 of test\r\n") == 0);
+}
+static void Test_Logging_DrainReaders_Except(int skip) {
+	char buf[128];
+	int i;
+
+	for (i = 0; i < LOG_READER_MAX; i++) {
+		if (i != skip) {
+			while (LOG_GetReaderData(i, buf, sizeof(buf))) {
+			}
+		}
+	}
+}
+static void Test_Logging_DrainReaders() {
+	Test_Logging_DrainReaders_Except(-1);
+}
+static void Test_Logging_LostMarker() {
+	unsigned int lag, maxLag, lost, read;
+	int i;
+
+	SIM_ClearOBK();
+	ADDLOG_INFO(LOG_FEATURE_CMD, "Test_Logging_LostMarker");
+	Test_Logging_DrainReaders();
+	LOG_GetReaderStats(LOG_READER_HTTP, &lag, &maxLag, &lost, &read);
+	SELFTEST_ASSERT(lag == 0);
+	SELFTEST_ASSERT(lost == 0);
+
+	// HTTP reader is not reading, so it falls behind more than log memory can keep
+	for (i = 0; i < 300; i++) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "lost marker line %i", i);
+		Test_Logging_DrainReaders_Except(LOG_READER_HTTP);
+	}
+	LOG_GetReaderStats(LOG_READER_HTTP, &lag, &maxLag, &lost, &read);
+	SELFTEST_ASSERT(lag > 4096);
+	LOG_GetReaderStats(LOG_READER_SERIAL, &lag, &maxLag, &lost, &read);
+	SELFTEST_ASSERT(lag == 0);
+	SELFTEST_ASSERT(lost == 0);
+
+	Test_FakeHTTPClientPacket_GET("lograw");
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "[lost ") != 0);
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "lost marker line 299\r\n") != 0);
+	SELFTEST_ASSERT(strstr(Test_GetLastHTMLReply(), "lost marker line 0\r\n") == 0);
+	LOG_GetReaderStats(LOG_READER_HTTP, &lag, &maxLag, &lost, &read);
+	SELFTEST_ASSERT(lost > 0);
+	SELFTEST_ASSERT(maxLag > 4096);
+
+	// stats are on REST API as well
+	Test_FakeHTTPClientPacket_JSON("api/logconfig");
+	SELFTEST_ASSERT(Test_GetJSONValue_Integer_Nested2("readers", "http", "lost") == lost);
+	SELFTEST_ASSERT(Test_GetJSONValue_Integer_Nested2("readers", "serial", "lost") == 0);
+}
+// how many lines per second can be logged while serial, TCP and HTTP readers take them all
+static void Test_Logging_Benchmark(int bDeferred) {
+	unsigned int lost[LOG_READER_MAX];
+	unsigned int lag, maxLag, lostNow, read;
+	long start, withReaders;
+	int i, lines;
+#ifdef SELFTEST_BENCHMARK
+	long writerOnly;
+#endif
+
+	CMD_ExecuteCommand(bDeferred ? "logdeferred 1" : "logdeferred 0", 0);
+	Test_Logging_DrainReaders();
+	for (i = 0; i < LOG_READER_MAX; i++) {
+		LOG_GetReaderStats(i, &lag, &maxLag, &lost[i], &read);
+	}
+	lines = 5000;
+	start = SIM_GetTime();
+	for (i = 0; i < lines; i++) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "benchmark line %i value %i name %s", i, i * 3, "abc");
+		if (i % 10 == 9) {
+			Test_Logging_DrainReaders();
+		}
+	}
+	Test_Logging_DrainReaders();
+	withReaders = SIM_GetTime() - start;
+	for (i = 0; i < LOG_READER_MAX; i++) {
+		LOG_GetReaderStats(i, &lag, &maxLag, &lostNow, &read);
+		SELFTEST_ASSERT(lag == 0);
+		SELFTEST_ASSERT(lostNow == lost[i]);
+	}
+#ifdef SELFTEST_BENCHMARK
+	// the same without readers, it's the cost of a log call
+	start = SIM_GetTime();
+	for (i = 0; i < lines; i++) {
+		ADDLOG_INFO(LOG_FEATURE_CMD, "benchmark line %i value %i name %s", i, i * 3, "abc");
+	}
+	writerOnly = SIM_GetTime() - start;
+	Test_Logging_DrainReaders();
+	printf("Test_Logging_Benchmark: %s, %i lines/s with %i readers, %i lines/s without readers\n",
+		bDeferred ? "deferred" : "formatted", (int)(lines * 1000 / (withReaders + 1)), LOG_READER_MAX,
+		(int)(lines * 1000 / (writerOnly + 1)));
+#endif
+}
+void Test_Logging() {
+	Test_Logging_Deferred();
+	Test_Logging_LostMarker();
+	Test_Logging_Benchmark(1);
+	Test_Logging_Benchmark(0);
+}
+
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "selftest_local.h"
 #include "../hal/hal_wifi.h"
+#include "../mqtt/new_mqtt.h"
 
 void SIM_ClearAndPrepareForMQTTTesting(const char *clientName, const char *groupName) {
 	SIM_ClearOBK();
@@ -149,13 +150,14 @@ void Test_MQTT_LED_CW() {
 
 	CMD_ExecuteCommand("led_enableAll 1", 0);
 	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/led_enableAll/get", "1", false);
+	// enabling also sends current dimmer
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/led_dimmer/get", "100", false);
 	// if assert has passed, we can clear SIM MQTT history, it's no longer needed
 	SIM_ClearMQTTHistory();
 
+	// same dimmer again is a duplicate and is not resent
 	CMD_ExecuteCommand("led_dimmer 100", 0);
-	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/led_dimmer/get", "100", false);
-	// if assert has passed, we can clear SIM MQTT history, it's no longer needed
-	SIM_ClearMQTTHistory();
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/led_dimmer/get", false) == 0);
 
 	CMD_ExecuteCommand("led_temperature 153", 0);
 	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/led_temperature/get", "153", false);
@@ -403,6 +405,687 @@ void Test_MQTT_Topic_With_Slash() {
 }
 
 
+void Test_MQTT_RX_Ring() {
+	char buffer[64];
+	char big[1900];
+	int dropped, i, posted;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	// burst of messages without processing, like retained ones on reconnect
+	dropped = MQTT_GetRxDropCounter();
+	posted = 0;
+	for (i = 0; i < 300; i++) {
+		sprintf(buffer, "%i", i);
+		posted += MQTT_Post_Received_Str("myTestDevice/1/set", buffer);
+	}
+	// some did not fit
+	SELFTEST_ASSERT(posted < 300);
+	SELFTEST_ASSERT(MQTT_GetRxDropCounter() - dropped == 300 - posted);
+	SELFTEST_ASSERT(MQTT_GetRxHighWatermark() > MQTT_GetRxBufferSize() - 64);
+	SELFTEST_ASSERT(MQTT_GetRxHighWatermark() < MQTT_GetRxBufferSize());
+	// all queued ones are processed in order
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(1, posted - 1);
+
+	// ring wraps many times, with different record sizes
+	for (i = 0; i < 500; i++) {
+		sprintf(buffer, "%i", i * 997);
+		SELFTEST_ASSERT(MQTT_Post_Received_Str("myTestDevice/2/set", buffer));
+		if (i % 3 == 0) {
+			SELFTEST_ASSERT(MQTT_Post_Received_Str("myTestDevice/3/set", "123456789"));
+		}
+		Sim_RunFrames(1, false);
+		SELFTEST_ASSERT_CHANNEL(2, i * 997);
+	}
+	SELFTEST_ASSERT_CHANNEL(3, 123456789);
+
+	// payload up to half of the ring always fits when ring is empty, and is zero terminated in place
+	memset(big, 'a', sizeof(big) - 1);
+	big[sizeof(big) - 1] = 0;
+	SELFTEST_ASSERT(MQTT_Post_Received_Str("myTestDevice/unknown", big));
+	SELFTEST_ASSERT(MQTT_Post_Received_Str("myTestDevice/4/set", "44") == 1);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(4, 44);
+}
+static int g_trieTestHits[4];
+static int Test_MQTT_TrieCallbackA(obk_mqtt_request_t* request) {
+	g_trieTestHits[0]++;
+	return 0;
+}
+static int Test_MQTT_TrieCallbackB(obk_mqtt_request_t* request) {
+	g_trieTestHits[1]++;
+	return 0;
+}
+static int Test_MQTT_TrieCallbackC(obk_mqtt_request_t* request) {
+	g_trieTestHits[2]++;
+	// eats the packet
+	return 1;
+}
+static int Test_MQTT_TrieCallbackD(obk_mqtt_request_t* request) {
+	g_trieTestHits[3]++;
+	return 0;
+}
+void Test_MQTT_Topic_Trie() {
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	// default callbacks: exact levels only, no prefix matches
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("myTestDevice/1/set") == 1);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("myTestDevice/1/get") == 1);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("bekens/5/set") == 1);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("cmnd/myTestDevice/POWER") == 1);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("cmnd/myTestDevice/POWER/x") == 0);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("myTestDevice/1/other") == 0);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("myTestDevice/unknown") == 0);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("myTestDeviceX/1/set") == 0);
+
+	// several subscribers on the same topic
+	memset(g_trieTestHits, 0, sizeof(g_trieTestHits));
+	MQTT_RegisterCallback("trie/", "trie/+/state", 101, Test_MQTT_TrieCallbackA);
+	MQTT_RegisterCallback("trie/", "trie/#", 102, Test_MQTT_TrieCallbackB);
+	MQTT_RegisterCallback("trie/", "trie/lamp/state", 103, Test_MQTT_TrieCallbackC);
+	MQTT_RegisterCallback("trie/", "trie/lamp/state", 104, Test_MQTT_TrieCallbackD);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/lamp/state") == 4);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/fan/state") == 2);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/fan/state/x") == 1);
+	// parent level matches "#"
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie") == 1);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("$SYS/trie") == 0);
+
+	// called in registration order, third one eats the packet so fourth is not reached
+	MQTT_Post_Received_Str("trie/lamp/state", "1");
+	MQTT_Post_Received_Str("trie/fan/state", "1");
+	MQTT_Post_Received_Str("trie/fan/other", "1");
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(g_trieTestHits[0] == 2);
+	SELFTEST_ASSERT(g_trieTestHits[1] == 3);
+	SELFTEST_ASSERT(g_trieTestHits[2] == 1);
+	SELFTEST_ASSERT(g_trieTestHits[3] == 0);
+
+	// replacing by ID changes subscription, removing drops it
+	MQTT_RegisterCallback("trie/", "trie/lamp/+", 103, Test_MQTT_TrieCallbackC);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/lamp/power") == 2);
+	MQTT_RemoveCallback(102);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/lamp/power") == 1);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/lamp/state") == 3);
+	MQTT_RemoveCallback(101);
+	MQTT_RemoveCallback(103);
+	MQTT_RemoveCallback(104);
+	SELFTEST_ASSERT(MQTT_GetSubscribersCount("trie/lamp/state") == 0);
+
+	// default ones still work
+	SIM_SendFakeMQTTRawChannelSet(1, "12");
+	SELFTEST_ASSERT_CHANNEL(1, 12);
+}
+void Test_MQTT_QoS() {
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	// defaults - QoS 0 for telemetry, 1 for the rest
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("myTestDevice/1/get", MQTT_QOS_CAT_TELEMETRY) == 0);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("myTestDevice/abc", MQTT_QOS_CAT_STATE) == 1);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("stat/myTestDevice/RESULT", MQTT_QOS_CAT_REPLY) == 1);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("homeassistant/x/config", MQTT_QOS_CAT_DISCOVERY) == 1);
+
+	// channel values are telemetry
+	PIN_SetPinRoleForPinIndex(24, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(24, 1);
+	SIM_ClearMQTTHistory();
+	SIM_SendFakeMQTTRawChannelSet(1, "1");
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "1", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("myTestDevice/1/get") == 0);
+	// Tasmota command replies
+	SIM_SendFakeMQTTAndRunSimFrame_CMND("POWER", "");
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("stat/myTestDevice/RESULT") == 1);
+
+	// category change
+	CMD_ExecuteCommand("mqtt_qos telemetry 1", 0);
+	SIM_ClearMQTTHistory();
+	SIM_SendFakeMQTTRawChannelSet(1, "0");
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("myTestDevice/1/get") == 1);
+
+	// per-topic override, with wildcards
+	CMD_ExecuteCommand("mqtt_qos myTestDevice/+/get 2", 0);
+	CMD_ExecuteCommand("mqtt_qos stat/# 0", 0);
+	SIM_ClearMQTTHistory();
+	SIM_SendFakeMQTTRawChannelSet(1, "1");
+	SIM_SendFakeMQTTAndRunSimFrame_CMND("POWER", "");
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("myTestDevice/1/get") == 2);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryQoS("stat/myTestDevice/RESULT") == 0);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("myTestDevice/1/2/get", MQTT_QOS_CAT_TELEMETRY) == 1);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("stat", MQTT_QOS_CAT_STATE) == 0);
+
+	// removing overrides restores category
+	CMD_ExecuteCommand("mqtt_qos myTestDevice/+/get -1", 0);
+	CMD_ExecuteCommand("mqtt_qos stat/# -1", 0);
+	CMD_ExecuteCommand("mqtt_qos telemetry 0", 0);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("myTestDevice/1/get", MQTT_QOS_CAT_TELEMETRY) == 0);
+	SELFTEST_ASSERT(MQTT_GetPublishQoS("stat/myTestDevice/RESULT", MQTT_QOS_CAT_REPLY) == 1);
+
+	// simulator acknowledges publishes at once
+	SELFTEST_ASSERT(MQTT_GetInFlightCounter() == 0);
+	SELFTEST_ASSERT(MQTT_GetInFlightPeak() >= 1);
+}
+void Test_MQTT_Publish_Batch() {
+	int flushes, coalesced;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	PIN_SetPinRoleForPinIndex(24, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(24, 1);
+	PIN_SetPinRoleForPinIndex(26, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(26, 2);
+	SIM_ClearMQTTHistory();
+
+	flushes = MQTT_GetBatchFlushCounter();
+	coalesced = MQTT_GetBatchCoalescedCounter();
+	// many changes within one tick
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	SELFTEST_ASSERT(MQTT_GetBatchQueuedCount() == 2);
+	SELFTEST_ASSERT(MQTT_GetBatchCoalescedCounter() - coalesced == 2);
+	// sent at the end of tick, once
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(MQTT_GetBatchQueuedCount() == 0);
+	SELFTEST_ASSERT(MQTT_GetBatchFlushCounter() - flushes == 1);
+	SELFTEST_ASSERT(MQTT_GetBatchLastFlushItems() == 2);
+	SELFTEST_ASSERT(MQTT_GetBatchLastFlushBytes() == 2 * (strlen("myTestDevice/1/get") + 1));
+	// only latest value of each channel
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "1", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "1", false);
+	SELFTEST_ASSERT(SIM_CheckMQTTHistoryForString("myTestDevice/1/get", "0", false) == false);
+	SIM_ClearMQTTHistory();
+
+	// nothing changed, nothing flushed
+	flushes = MQTT_GetBatchFlushCounter();
+	Sim_RunFrames(10, false);
+	SELFTEST_ASSERT(MQTT_GetBatchFlushCounter() == flushes);
+
+	// more channels than batch holds are still all published
+	for (int i = 0; i < 20; i++) {
+		CHANNEL_SetType(10 + i, ChType_Temperature);
+		CHANNEL_Set(10 + i, 5 + i, CHANNEL_SET_FLAG_FORCE);
+	}
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/10/get", "5", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/29/get", "24", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "0", false);
+	SIM_ClearMQTTHistory();
+
+	// long float values fit, like energy counters
+	CFG_SetFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES, true);
+	CHANNEL_Set(10, 12345678, CHANNEL_SET_FLAG_FORCE);
+	CHANNEL_Set(11, -1234567, CHANNEL_SET_FLAG_FORCE);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/10/get", "12345678.000000", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/11/get", "-1234567.000000", false);
+	CFG_SetFlag(OBK_FLAG_PUBLISH_MULTIPLIED_VALUES, false);
+}
+static void Test_MQTT_Queue_MakeValue(char *buf, int id) {
+	int len, i;
+
+	// variable record sizes, so arena wraps at different places
+	len = sprintf(buf, "%i:", id);
+	for (i = (id * 37) % 700; i > 0; i--) {
+		buf[len++] = 'a' + id % 26;
+	}
+	buf[len] = 0;
+}
+// publishes one step of queue and checks it's what we expect, in order
+static int Test_MQTT_Queue_Drain(int *expected, int *expHead, int expTail) {
+	char topic[32], value[1024];
+	const char *got;
+	int i, n;
+
+	SIM_ClearMQTTHistory();
+	n = MQTT_GetQueuedCount();
+	PublishQueuedItems();
+	n -= MQTT_GetQueuedCount();
+	for (i = 0; i < n; i++) {
+		SELFTEST_ASSERT(*expHead != expTail);
+		sprintf(topic, "hammer/item%i", expected[*expHead % 1024]);
+		Test_MQTT_Queue_MakeValue(value, expected[*expHead % 1024]);
+		got = SIM_GetMQTTHistoryString(topic, false);
+		SELFTEST_ASSERT(got != 0);
+		SELFTEST_ASSERT(got && !strcmp(got, value));
+		(*expHead)++;
+	}
+	return n;
+}
+static void Test_MQTT_Queue_Hammer(int bDropOldest) {
+	char channel[16], value[1024], cmd[32];
+	int expected[1024];
+	int expHead = 0, expTail = 0;
+	int i, id, dropped, published, burst;
+
+	sprintf(cmd, "mqtt_queue 4096 %i", bDropOldest);
+	CMD_ExecuteCommand(cmd, 0);
+	dropped = MQTT_GetQueueDropCounter();
+	published = 0;
+	id = 0;
+	for (i = 0; i < 500; i++) {
+		// bursts bigger than we drain, so queue fills up and drops
+		for (burst = 1 + i % 11; burst > 0; burst--) {
+			int before = MQTT_GetQueueDropCounter();
+			sprintf(channel, "item%i", id);
+			Test_MQTT_Queue_MakeValue(value, id);
+			MQTT_QueuePublish("hammer", channel, value, 0);
+			if (bDropOldest) {
+				// oldest expected ones are gone, new one is always there
+				expHead += MQTT_GetQueueDropCounter() - before;
+				expected[expTail++ % 1024] = id;
+			}
+			else if (MQTT_GetQueueDropCounter() == before) {
+				expected[expTail++ % 1024] = id;
+			}
+			id++;
+			SELFTEST_ASSERT(MQTT_GetQueuedCount() == expTail - expHead);
+			SELFTEST_ASSERT(MQTT_GetQueueUsedBytes() <= MQTT_GetQueueSize());
+		}
+		published += Test_MQTT_Queue_Drain(expected, &expHead, expTail);
+	}
+	while (MQTT_GetQueuedCount()) {
+		published += Test_MQTT_Queue_Drain(expected, &expHead, expTail);
+	}
+	SELFTEST_ASSERT(expHead == expTail);
+	SELFTEST_ASSERT(MQTT_GetQueueDropCounter() > dropped);
+	SELFTEST_ASSERT(published + MQTT_GetQueueDropCounter() - dropped == id);
+	SELFTEST_ASSERT(MQTT_GetQueuePeakBytes() > 4096 - 1024);
+	SELFTEST_BENCHMARK_PRINTF("Test_MQTT_Queue_Hammer: policy %i, %i queued, %i published, %i dropped\n",
+		bDropOldest, id, published, MQTT_GetQueueDropCounter() - dropped);
+}
+void Test_MQTT_Publish_Queue() {
+	int i;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	Test_MQTT_Queue_Hammer(0);
+	Test_MQTT_Queue_Hammer(1);
+	// too big for arena
+	CMD_ExecuteCommand("mqtt_queue 256", 0);
+	i = MQTT_GetQueueDropCounter();
+	MQTT_QueuePublish("hammer", "big", "0123456789012345678901234567890123456789012345678901234567890123456789"
+		"0123456789012345678901234567890123456789012345678901234567890123456789", 0);
+	SELFTEST_ASSERT(MQTT_GetQueueDropCounter() == i + 1);
+	SELFTEST_ASSERT(MQTT_GetQueuedCount() == 0);
+	CMD_ExecuteCommand("mqtt_queue 8192 0", 0);
+
+	// command attached to last record runs after it's published
+	PIN_SetPinRoleForPinIndex(24, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(24, 1);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	SIM_ClearMQTTHistory();
+	MQTT_QueuePublish("homeassistant", "a", "1", 0);
+	MQTT_QueuePublish("homeassistant", "b", "2", 0);
+	MQTT_InvokeCommandAtEnd(PublishChannels);
+	for (i = 0; i < 5; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("homeassistant/a", "1", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("homeassistant/b", "2", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "1", false);
+}
+void Test_MQTT_Deduper() {
+	int sent, dups, tooFast;
+	int sent2, dups2, tooFast2;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	CMD_ExecuteCommand("mqtt_deduper 1000 0.001", 0);
+
+	MQTT_Dedup_GetStats(&sent, &dups, &tooFast);
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 5, 0);
+	// same value again, culled
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 5, 0);
+	MQTT_PublishMain_StringFloat_DeDuped(DEDUP_EXPIRE_TIME, "myFloat", 1.0f, 0.1f, 0);
+	// within epsilon, culled
+	MQTT_PublishMain_StringFloat_DeDuped(DEDUP_EXPIRE_TIME, "myFloat", 1.05f, 0.1f, 0);
+	// default epsilon is much smaller, so that's a change, but too fast
+	MQTT_PublishMain_StringFloat_DeDuped(DEDUP_EXPIRE_TIME, "myFloat", 1.05f, -1, 0);
+	// new value but too fast, only latest one will be sent later
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 6, 0);
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 7, 0);
+	MQTT_Dedup_GetStats(&sent2, &dups2, &tooFast2);
+	SELFTEST_ASSERT(sent2 - sent == 2);
+	SELFTEST_ASSERT(dups2 - dups == 2);
+	SELFTEST_ASSERT(tooFast2 - tooFast == 3);
+	SELFTEST_ASSERT(MQTT_Dedup_GetNextWakeMS() > 0);
+	SELFTEST_ASSERT(MQTT_Dedup_GetNextWakeMS() <= 1000);
+
+	// cooldown passes in quick tick, delayed values are sent
+	Sim_RunFrames(250, false);
+	MQTT_Dedup_GetStats(&sent2, &dups2, &tooFast2);
+	SELFTEST_ASSERT(sent2 - sent == 4);
+	SELFTEST_ASSERT(MQTT_Dedup_GetNextWakeMS() == -1);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myInt/get", "7", false);
+	SELFTEST_ASSERT(SIM_CheckMQTTHistoryForString("myTestDevice/myInt/get", "6", false) == false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_FLOAT("myTestDevice/myFloat/get", 1.05f, false);
+	SIM_ClearMQTTHistory();
+
+	// string values
+	MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME, "myStr", "abc", 0);
+	MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME, "myStr", "abc", 0);
+	MQTT_Dedup_GetStats(&sent, &dups, &tooFast);
+	SELFTEST_ASSERT(dups - dups2 == 1);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myStr/get", "abc", false);
+	SIM_ClearMQTTHistory();
+
+	// after expire time, same value is sent again
+	Sim_RunFrames(DEDUP_EXPIRE_TIME / 5 + 10, false);
+	MQTT_PublishMain_StringString_DeDuped(DEDUP_EXPIRE_TIME, "myStr", "abc", 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myStr/get", "abc", false);
+	SIM_ClearMQTTHistory();
+
+	// without min interval, every change goes out at once
+	CMD_ExecuteCommand("mqtt_deduper 0", 0);
+	MQTT_Dedup_GetStats(&sent, &dups, &tooFast);
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 8, 0);
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 9, 0);
+	MQTT_Dedup_GetStats(&sent2, &dups2, &tooFast2);
+	SELFTEST_ASSERT(sent2 - sent == 2);
+	SELFTEST_ASSERT(tooFast2 == tooFast);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myInt/get", "9", false);
+	SIM_ClearMQTTHistory();
+
+	// delayed value that can't be sent is retried after min interval, not on every tick
+	CMD_ExecuteCommand("mqtt_deduper 1000 0.001", 0);
+	MQTT_PublishMain_StringInt_DeDuped(DEDUP_EXPIRE_TIME, "myInt", 10, 0);
+	SELFTEST_ASSERT(MQTT_Dedup_GetNextWakeMS() > 0);
+	SIM_SetMQTTOffline(true);
+	MQTT_Dedup_GetStats(&sent, &dups, &tooFast);
+	Sim_RunFrames(250, false);
+	MQTT_Dedup_GetStats(&sent2, &dups2, &tooFast2);
+	SELFTEST_ASSERT(sent2 == sent);
+	SELFTEST_ASSERT(MQTT_Dedup_GetNextWakeMS() > 0);
+	SIM_SetMQTTOffline(false);
+	Sim_RunFrames(250, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/myInt/get", "10", false);
+	SIM_ClearMQTTHistory();
+}
+extern int g_bPublishAllStatesNow;
+// starts next periodic broadcast and runs it to the end
+static void Test_MQTT_RunBroadcast() {
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT(g_bPublishAllStatesNow);
+	while (g_bPublishAllStatesNow) {
+		MQTT_RunEverySecondUpdate();
+	}
+}
+void Test_MQTT_Broadcast_Delta() {
+	int saved;
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+
+	PIN_SetPinRoleForPinIndex(24, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(24, 1);
+	PIN_SetPinRoleForPinIndex(26, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(26, 2);
+	CFG_SetFlag(OBK_FLAG_MQTT_BROADCASTSELFSTATEPERMINUTE, true);
+	CMD_ExecuteCommand("mqtt_broadcastItemsPerSec 100", 0);
+	CMD_ExecuteCommand("mqtt_broadcastInterval 1 3", 0);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	CMD_ExecuteCommand("setChannel 2 1", 0);
+
+	// full publish, static items are retained
+	CMD_ExecuteCommand("publishAll", 0);
+	while (g_bPublishAllStatesNow) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/host", CFG_GetShortDeviceName(), true);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "1", false);
+	SIM_ClearMQTTHistory();
+
+	// only changed channel is sent
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	SIM_ClearMQTTHistory();
+	saved = MQTT_GetBroadcastSavedCounter();
+	Test_MQTT_RunBroadcast();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "0", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/host", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/uptime", false) == 0);
+	// channel 2 and uptime at least
+	SELFTEST_ASSERT(MQTT_GetBroadcastSavedCounter() - saved >= 2);
+	SIM_ClearMQTTHistory();
+
+	// nothing has changed
+	saved = MQTT_GetBroadcastSavedCounter();
+	Test_MQTT_RunBroadcast();
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/1/get", false) == 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/2/get", false) == 0);
+	SELFTEST_ASSERT(MQTT_GetBroadcastSavedCounter() - saved >= 3);
+	SIM_ClearMQTTHistory();
+
+	// every third one is a full refresh, but static items were already sent on this connection
+	saved = MQTT_GetBroadcastSavedCounter();
+	Test_MQTT_RunBroadcast();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/get", "0", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/2/get", "1", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/uptime", false) != 0);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/host", false) == 0);
+	SELFTEST_ASSERT(MQTT_GetBroadcastSavedCounter() == saved);
+	SELFTEST_ASSERT(MQTT_GetBroadcastSavedPerHour() > 0);
+	SIM_ClearMQTTHistory();
+
+	CFG_SetFlag(OBK_FLAG_MQTT_BROADCASTSELFSTATEPERMINUTE, false);
+	CMD_ExecuteCommand("mqtt_broadcastItemsPerSec 1", 0);
+	CMD_ExecuteCommand("mqtt_broadcastInterval 60 10", 0);
+}
+// from our_lfs.h
+int LFS_GetBytesWritten();
+void Test_MQTT_Journal() {
+	int appended, replayed, dropped, bytes;
+	int appended2, replayed2, dropped2, bytes2;
+	int flashBytes, i, seconds;
+	char buffer[32];
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("myTestDevice", "bekens");
+	PIN_SetPinRoleForPinIndex(24, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(24, 1);
+	// journal doesn't format flash on its own
+	CMD_ExecuteCommand("lfs_format", 0);
+	CMD_ExecuteCommand("mqtt_journal clear", 0);
+	CMD_ExecuteCommand("mqtt_journal 1 20 4 1024", 0);
+
+	// while offline, sensor and channel values go to journal
+	SIM_SetMQTTOffline(true);
+	MQTT_Journal_GetStats(&appended, &replayed, &dropped, &bytes);
+	flashBytes = LFS_GetBytesWritten();
+	for (i = 0; i < 50; i++) {
+		sprintf(buffer, "%i", 2200 + i);
+		MQTT_PublishMain_StringString("voltage", buffer, 0);
+		sprintf(buffer, "setChannel 1 %i", (i + 1) & 1);
+		CMD_ExecuteCommand(buffer, 0);
+		MQTT_Batch_Flush();
+		// records are only staged until main thread writes them to journal
+		if (i % 10 == 9) {
+			MQTT_RunEverySecondUpdate();
+		}
+	}
+	SIM_ClearMQTTHistory();
+	SELFTEST_ASSERT(MQTT_Journal_GetPendingCount() == 100);
+	// buffered records are written to flash after few seconds
+	for (i = 0; i < 6; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	MQTT_Journal_GetStats(&appended2, &replayed2, &dropped2, &bytes2);
+	flashBytes = LFS_GetBytesWritten() - flashBytes;
+	SELFTEST_ASSERT(appended2 - appended == 100);
+	SELFTEST_ASSERT(dropped2 == dropped);
+	SELFTEST_ASSERT(flashBytes >= bytes2 - bytes);
+	SELFTEST_BENCHMARK_PRINTF("Test_MQTT_Journal: 100 records, %i journal bytes, %i bytes written to flash, %i per record\n",
+		bytes2 - bytes, flashBytes, flashBytes / 100);
+	SELFTEST_ASSERT(flashBytes / 100 < 64);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/voltage/get", false) == 0);
+
+	// back online, replayed oldest first, with rate limit, to journal topics with timestamp
+	SIM_SetMQTTOffline(false);
+	MQTT_RunEverySecondUpdate();
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/voltage/journal", "{\"t\":0,\"v\":2200}", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/1/journal", "{\"t\":0,\"v\":1}", false);
+	SELFTEST_ASSERT(SIM_GetMQTTHistoryString("myTestDevice/voltage/get", false) == 0);
+	SELFTEST_ASSERT(MQTT_Journal_GetPendingCount() == 80);
+	seconds = 1;
+	while (MQTT_Journal_GetPendingCount() > 0 && seconds < 100) {
+		MQTT_RunEverySecondUpdate();
+		seconds++;
+	}
+	SELFTEST_ASSERT(MQTT_Journal_GetPendingCount() == 0);
+	SELFTEST_ASSERT(seconds == 5);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/voltage/journal", "{\"t\":0,\"v\":2249}", false);
+	MQTT_Journal_GetStats(&appended2, &replayed2, &dropped2, &bytes2);
+	SELFTEST_ASSERT(replayed2 - replayed == 100);
+	SELFTEST_BENCHMARK_PRINTF("Test_MQTT_Journal: replayed %i records in %i seconds\n", replayed2 - replayed, seconds);
+	SIM_ClearMQTTHistory();
+
+	// journal is bounded, when it's full, oldest segment is dropped
+	SIM_SetMQTTOffline(true);
+	MQTT_Journal_GetStats(&appended, &replayed, &dropped, &bytes);
+	for (i = 0; i < 500; i++) {
+		sprintf(buffer, "%i", 1000 + i);
+		MQTT_PublishMain_StringString("energy", buffer, 0);
+		if (i % 10 == 9) {
+			MQTT_RunEverySecondUpdate();
+		}
+	}
+	MQTT_Journal_GetStats(&appended2, &replayed2, &dropped2, &bytes2);
+	SELFTEST_ASSERT(appended2 - appended == 500);
+	SELFTEST_ASSERT(dropped2 > dropped);
+	SELFTEST_ASSERT(MQTT_Journal_GetPendingCount() + dropped2 - dropped == 500);
+	SIM_SetMQTTOffline(false);
+	seconds = 0;
+	while (MQTT_Journal_GetPendingCount() > 0 && seconds < 100) {
+		MQTT_RunEverySecondUpdate();
+		seconds++;
+	}
+	SELFTEST_ASSERT(MQTT_Journal_GetPendingCount() == 0);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/energy/journal", "{\"t\":0,\"v\":1499}", false);
+	SIM_ClearMQTTHistory();
+
+	// only valid JSON numbers are sent raw, the rest as escaped strings
+	SIM_SetMQTTOffline(true);
+	MQTT_PublishMain_StringString("plus", "+5", 0);
+	MQTT_PublishMain_StringString("dotFirst", ".5", 0);
+	MQTT_PublishMain_StringString("dotLast", "5.", 0);
+	MQTT_PublishMain_StringString("exp", "-0.5e3", 0);
+	MQTT_PublishMain_StringString("ctrl", "a\tb\"", 0);
+	SIM_SetMQTTOffline(false);
+	for (i = 0; i < 3; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/plus/journal", "{\"t\":0,\"v\":\"+5\"}", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/dotFirst/journal", "{\"t\":0,\"v\":\".5\"}", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/dotLast/journal", "{\"t\":0,\"v\":\"5.\"}", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/exp/journal", "{\"t\":0,\"v\":-0.5e3}", false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("myTestDevice/ctrl/journal", "{\"t\":0,\"v\":\"a\\u0009b\\\"\"}", false);
+	SIM_ClearMQTTHistory();
+
+	CMD_ExecuteCommand("mqtt_journal 0", 0);
+	CMD_ExecuteCommand("mqtt_journal clear", 0);
+}
+static int Test_MQTT_SubscribeCallback(obk_mqtt_request_t* request) {
+	return 0;
+}
+void Test_MQTT_Subscriptions() {
+	int packets, subscribed, unsubscribed;
+	int basePackets, baseSubscribed, baseUnsubscribed;
+	int connects, firstPublishMS;
+	char oldHost[64];
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("subDevice", "bekens");
+
+	// default topics are subscribed on connect
+	SIM_GetMQTTSubscribeStats(&basePackets, &baseSubscribed, &baseUnsubscribed);
+	SELFTEST_ASSERT(baseSubscribed >= 5);
+	SELFTEST_ASSERT(baseUnsubscribed == 0);
+
+	// new topics are subscribed on live connection, each once, without reconnect
+	connects = MQTT_GetConnectEvents();
+	MQTT_RegisterCallback("sub/", "sub/a/+", 201, Test_MQTT_SubscribeCallback);
+	MQTT_RegisterCallback("sub/", "sub/b/+", 202, Test_MQTT_SubscribeCallback);
+	MQTT_RegisterCallback("sub/", "sub/b/+", 203, Test_MQTT_SubscribeCallback);
+	MQTT_RunEverySecondUpdate();
+	SIM_GetMQTTSubscribeStats(&packets, &subscribed, &unsubscribed);
+	SELFTEST_ASSERT(packets == basePackets + 2);
+	SELFTEST_ASSERT(subscribed == baseSubscribed + 2);
+	// nothing changed, nothing sent
+	MQTT_RunEverySecondUpdate();
+	SIM_GetMQTTSubscribeStats(&packets, &subscribed, &unsubscribed);
+	SELFTEST_ASSERT(packets == basePackets + 2);
+	// topic is still used by other callback
+	MQTT_RemoveCallback(202);
+	MQTT_RunEverySecondUpdate();
+	SIM_GetMQTTSubscribeStats(&packets, &subscribed, &unsubscribed);
+	SELFTEST_ASSERT(packets == basePackets + 2);
+	SELFTEST_ASSERT(unsubscribed == 0);
+	MQTT_RemoveCallback(201);
+	MQTT_RemoveCallback(203);
+	MQTT_RunEverySecondUpdate();
+	SIM_GetMQTTSubscribeStats(&packets, &subscribed, &unsubscribed);
+	SELFTEST_ASSERT(packets == basePackets + 4);
+	SELFTEST_ASSERT(unsubscribed == 2);
+	for (int i = 0; i < 20; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SELFTEST_ASSERT(MQTT_GetConnectEvents() == connects);
+
+	// force a connect with host set, so connection callback can be simulated
+	strcpy_safe(oldHost, CFG_GetMQTTHost(), sizeof(oldHost));
+	CFG_SetMQTTHost("127.0.0.1");
+	SIM_SetMQTTOffline(true);
+	for (int i = 0; i < 20; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+	SIM_SetMQTTOffline(false);
+	SELFTEST_ASSERT(MQTT_GetConnectEvents() > connects);
+	SIM_GetMQTTSubscribeStats(&basePackets, &baseSubscribed, &baseUnsubscribed);
+	// clean session, so everything is subscribed again, including change made while offline
+	MQTT_RegisterCallback("sub/", "sub/c/+", 204, Test_MQTT_SubscribeCallback);
+	SIM_SimulateMQTTConnAck();
+	// nothing is sent from connection callback, main thread does it on next update
+	SIM_GetMQTTSubscribeStats(&packets, &subscribed, &unsubscribed);
+	SELFTEST_ASSERT(packets == basePackets);
+	MQTT_RunEverySecondUpdate();
+	SIM_GetMQTTSubscribeStats(&packets, &subscribed, &unsubscribed);
+	SELFTEST_ASSERT(subscribed - baseSubscribed >= 6);
+	SELFTEST_ASSERT(packets - basePackets == subscribed - baseSubscribed);
+	SELFTEST_ASSERT(unsubscribed == baseUnsubscribed);
+	MQTT_RemoveCallback(204);
+	CFG_SetMQTTHost(oldHost);
+	// let the things done on connect pass
+	for (int i = 0; i < 3; i++) {
+		MQTT_RunEverySecondUpdate();
+	}
+
+	// WiFi up to first publish, in simulated ms
+	Main_OnWiFiStatusChange(WIFI_STA_DISCONNECTED);
+	Sim_RunSeconds(2, false);
+	SIM_ClearMQTTHistory();
+	Main_OnWiFiStatusChange(WIFI_STA_CONNECTED);
+	// first one is sent by next once per second update at latest
+	Sim_RunMiliseconds(1100, false);
+	firstPublishMS = MQTT_GetWiFiToFirstPublishMS();
+	SELFTEST_ASSERT(firstPublishMS >= 0);
+	SELFTEST_ASSERT(firstPublishMS <= 1100);
+	// later ones are not measured
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+	Sim_RunSeconds(1, false);
+	SELFTEST_ASSERT_HAD_MQTT_PUBLISH_STR("subDevice/1/get", "1", false);
+	SELFTEST_ASSERT(MQTT_GetWiFiToFirstPublishMS() == firstPublishMS);
+	SELFTEST_BENCHMARK_PRINTF("Test_MQTT_Subscriptions: first publish %i ms after WiFi\n", firstPublishMS);
+}
 void Test_MQTT(){
 	Test_MQTT_Get_And_Reply();
 	Test_MQTT_Misc();
@@ -411,6 +1094,15 @@ void Test_MQTT(){
 	Test_MQTT_LED_RGB();
 	Test_MQTT_Topic_With_Slash();
 	Test_MQTT_Topic_With_Slashes();
+	Test_MQTT_RX_Ring();
+	Test_MQTT_Topic_Trie();
+	Test_MQTT_QoS();
+	Test_MQTT_Publish_Batch();
+	Test_MQTT_Publish_Queue();
+	Test_MQTT_Deduper();
+	Test_MQTT_Broadcast_Delta();
+	Test_MQTT_Journal();
+	Test_MQTT_Subscriptions();
 }
 
 #endif
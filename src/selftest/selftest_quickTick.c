@@ -0,0 +1,63 @@
+#ifdef WINDOWS
+
+#include "selftest_local.h"
+#include "../quicktick.h"
+
+void Test_QuickTick() {
+	int perMinute;
+
+	// reset whole device
+	SIM_ClearOBK();
+
+	// idle device has nothing to poll
+	Sim_RunSeconds(1.0f, false);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == -1);
+	SIM_ResetQuickTickWakeups();
+	Sim_RunSeconds(60.0f, false);
+	perMinute = SIM_GetQuickTickWakeupsPerMinute();
+	SELFTEST_BENCHMARK_PRINTF("Test_QuickTick: idle device had %i wakeups per minute\n", perMinute);
+	SELFTEST_ASSERT(perMinute <= 60000 / QUICK_TMR_MAX_IDLE + 1);
+	SELFTEST_ASSERT(QuickTick_GetSleepMS() == QUICK_TMR_MAX_IDLE);
+
+	// repeating event is still run on time, and wakes only for itself
+	CMD_ExecuteCommand("addRepeatingEvent 0.25 -1 addChannel 1 1", 0);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == 250);
+	SELFTEST_ASSERT(QuickTick_GetSleepMS() == QUICK_TMR_MAX_IDLE);
+	Sim_RunSeconds(10.1f, false);
+	SELFTEST_ASSERT_CHANNEL(1, 40);
+	CMD_ExecuteCommand("clearRepeatingEvents", 0);
+
+	// idle button is only sampled, so press is still seen
+	SIM_SetSimulatedPinValue(9, true);
+	PIN_SetPinRoleForPinIndex(9, IOR_Button);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() > 0);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() < QUICK_TMR_MAX_IDLE);
+	SIM_ResetQuickTickWakeups();
+	Sim_RunSeconds(10.0f, false);
+	perMinute = SIM_GetQuickTickWakeupsPerMinute();
+	SELFTEST_BENCHMARK_PRINTF("Test_QuickTick: device with button had %i wakeups per minute\n", perMinute);
+	SELFTEST_ASSERT(perMinute < 60000 / QUICK_TMR_DURATION);
+	// pressed button is polled every tick until click is done
+	SIM_SetSimulatedPinValue(9, false);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == 0);
+	Sim_RunSeconds(0.2f, false);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == 0);
+	SIM_SetSimulatedPinValue(9, true);
+	Sim_RunSeconds(2.0f, false);
+	SELFTEST_ASSERT_CHANNEL(1, 1);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() > 0);
+	PIN_SetPinRoleForPinIndex(9, IOR_None);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == -1);
+
+	// incoming data requests an immediate tick
+	QuickTick_RequestWakeup();
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT(QuickTick_GetNextWakeMS() == -1);
+}
+
+
+#endif
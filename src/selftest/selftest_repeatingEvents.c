@@ -20,6 +20,36 @@ void Test_RepeatingEvents() {
 	SELFTEST_ASSERT_CHANNEL(11, 2);
 	Sim_RunSeconds(6.0f, false);
 	SELFTEST_ASSERT_CHANNEL(11, 2);
+
+	// everything is done, so there is nothing to wake up for
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() == -1);
+	CMD_ExecuteCommand("addRepeatingEventID 5 -1 123 addChannel 12 1", 0);
+	CMD_ExecuteCommand("addRepeatingEventID 2 -1 124 addChannel 13 1", 0);
+	SELFTEST_ASSERT(Timers_GetActiveCount() == 2);
+	// the closest one is due in 2 seconds
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() == 2000);
+	Sim_RunSeconds(10.1f, false);
+	SELFTEST_ASSERT_CHANNEL(12, 2);
+	SELFTEST_ASSERT_CHANNEL(13, 5);
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() > 0);
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() <= 2000);
+	CMD_ExecuteCommand("cancelRepeatingEvent 124", 0);
+	SELFTEST_ASSERT(Timers_GetActiveCount() == 1);
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() > 2000);
+	CMD_ExecuteCommand("clearRepeatingEvents", 0);
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() == -1);
+
+	// sleeping script thread is a single timer too
+	CMD_ExecuteCommand("lfs_format", 0);
+	Test_FakeHTTPClientPacket_POST("api/lfs/delayTest.txt", "addChannel 14 1\ndelay_s 3\naddChannel 14 1\n");
+	CMD_ExecuteCommand("startScript delayTest.txt", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_CHANNEL(14, 1);
+	SELFTEST_ASSERT(Timers_GetActiveCount() == 1);
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() > 2000);
+	Sim_RunSeconds(4.0f, false);
+	SELFTEST_ASSERT_CHANNEL(14, 2);
+	SELFTEST_ASSERT(Timers_GetNextDeadlineMS() == -1);
 }
 
 
@@ -108,10 +108,80 @@ void Test_Scripting_Loop3() {
 	SELFTEST_ASSERT_CHANNEL(20, 0);
 	//system("pause");
 }
+const char *demo_labels =
+"// comment lines and empty lines are not counted\r\n"
+"\r\n"
+"setChannel 30 0\r\n"
+"goto second\r\n"
+"first:\r\n"
+"    // first label\r\n"
+"    addChannel 30 1\r\n"
+"    return\r\n"
+"second:\r\n"
+"    addChannel 30 10\r\n"
+"    goto first\r\n"
+"second:\r\n"
+"    addChannel 30 100\r\n";
+
+const char *demo_budget =
+"setChannel 31 0\r\n"
+"again:\r\n"
+"    addChannel 31 1\r\n"
+"    if $CH31<40 then goto again\r\n"
+"    setChannel 32 1\r\n";
+
+void Test_Scripting_LabelsAndBudget() {
+	// reset whole device
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("lfs_format", 0);
+
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_labels.txt", demo_labels);
+	Test_FakeHTTPClientPacket_POST("api/lfs/demo_budget.txt", demo_budget);
+
+	// first occurence of label is used
+	CMD_ExecuteCommand("startScript demo_labels.txt", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(30, 11);
+
+	// start at label
+	CMD_ExecuteCommand("startScript demo_labels.txt first", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(30, 12);
+
+	// missing label means end of file
+	CMD_ExecuteCommand("setChannel 30 0", 0);
+	CMD_ExecuteCommand("startScript demo_labels.txt noSuchLabel", 0);
+	Sim_RunFrames(5, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(30, 0);
+
+	// default budget of 10 lines per tick - loop needs 80 lines
+	CMD_ExecuteCommand("startScript demo_budget.txt * 5", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 1);
+	SELFTEST_ASSERT_CHANNEL(31, 5);
+	// raise the budget for running thread
+	CMD_ExecuteCommand("setScriptBudget 5 100", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(31, 40);
+	SELFTEST_ASSERT_CHANNEL(32, 1);
+
+	// budget given at start
+	CMD_ExecuteCommand("setChannel 32 0", 0);
+	CMD_ExecuteCommand("startScript demo_budget.txt * 6 100", 0);
+	Sim_RunFrames(1, false);
+	SELFTEST_ASSERT_INTEGER(CMD_GetCountActiveScriptThreads(), 0);
+	SELFTEST_ASSERT_CHANNEL(31, 40);
+	SELFTEST_ASSERT_CHANNEL(32, 1);
+}
 void Test_Scripting() {
 	Test_Scripting_Loop1();
 	Test_Scripting_Loop2();
 	Test_Scripting_Loop3();
+	Test_Scripting_LabelsAndBudget();
 }
 
 #endif
@@ -1,6 +1,7 @@
 #ifdef WINDOWS
 
 #include "selftest_local.h".
+#include "../mqtt/new_mqtt.h"
 
 void Test_Tasmota_MQTT_Switch() {
 	SIM_ClearOBK();
@@ -615,9 +616,122 @@ void Test_Tasmota_MQTT_RGBCW() {
 	SELFTEST_ASSERT_JSON_VALUE_STRING(0, "POWER", "ON");
 	SIM_ClearMQTTHistory();
 }
+// printer working like the one used before streaming writer,
+// every fragment is formatted into stack buffer and then strcat'ed
+static char g_legacyReply[4096];
+static int Test_Tasmota_LegacyPrinter(void *request, const char *fmt, ...) {
+	va_list argList;
+	char tmp[256];
+
+	memset(tmp, 0, sizeof(tmp));
+	va_start(argList, fmt);
+	vsnprintf(tmp, 255, fmt, argList);
+	va_end(argList);
+	if (strlen(g_legacyReply) + strlen(tmp) + 2 >= sizeof(g_legacyReply)) {
+		return 0;
+	}
+	strcat(g_legacyReply, tmp);
+	return 0;
+}
+static const char *Test_Tasmota_StreamReply(obk_mqtt_publishReplyPrinter_t *printer, const char *cmd, const char *args) {
+	if (printer->allocated) {
+		free(printer->allocated);
+	}
+	memset(printer, 0, sizeof(*printer));
+	JSON_ProcessCommandReply(cmd, args, printer, (jsonCb_t)mqtt_printf255, 0);
+	return printer->allocated ? printer->allocated : printer->stackBuffer;
+}
+static const char *Test_Tasmota_LegacyReply(const char *cmd, const char *args) {
+	g_legacyReply[0] = 0;
+	JSON_ProcessCommandReply(cmd, args, 0, Test_Tasmota_LegacyPrinter, 0);
+	return g_legacyReply;
+}
+void Test_Tasmota_JSON_Writer() {
+	static const float floats[] = { 0, -0.0f, 1, 0.5f, -1.25f, 3.14159f, 230.1f, 0.0078125f, 1e-7f, 123456.789f, 99999999.0f, -5e8f, 2e9f, -3e10f };
+	static const int ints[] = { 0, 1, -1, 9, 10, 2147483647, -2147483647 - 1, 123456 };
+	static const char *cmds[] = { "STATUS", "", "STATUS", "5", "STATUS", "2", "STATUS", "4", "STATUS", "8", "STATE", "", "SENSOR", "", "POWER", "", "Dimmer", "" };
+	obk_mqtt_publishReplyPrinter_t printer;
+	char a[64], b[64];
+	const char *reply;
+	char *copy;
+	int i;
+#ifdef SELFTEST_BENCHMARK
+	int loops, bytes;
+	long start, streamMS, legacyMS;
+#endif
+
+	// fast paths print the same as printf
+	for (i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+		JSON_FormatFloat(a, floats[i]);
+		sprintf(b, "%f", floats[i]);
+		SELFTEST_ASSERT_STRING(a, b);
+	}
+	for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+		JSON_FormatInt(a, ints[i]);
+		sprintf(b, "%i", ints[i]);
+		SELFTEST_ASSERT_STRING(a, b);
+	}
+
+	SIM_ClearOBK();
+	SIM_ClearAndPrepareForMQTTTesting("jsonDevice", "bekens");
+	PIN_SetPinRoleForPinIndex(9, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(9, 1);
+	PIN_SetPinRoleForPinIndex(10, IOR_Relay);
+	PIN_SetPinChannelForPinIndex(10, 2);
+	CMD_ExecuteCommand("setChannel 1 1", 0);
+
+	// streaming output is the same as one printed fragment by fragment
+	memset(&printer, 0, sizeof(printer));
+	for (i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i += 2) {
+		reply = Test_Tasmota_StreamReply(&printer, cmds[i], cmds[i + 1]);
+		copy = strdup(reply);
+		SELFTEST_ASSERT_STRING(copy, Test_Tasmota_LegacyReply(cmds[i], cmds[i + 1]));
+		free(copy);
+	}
+	reply = Test_Tasmota_StreamReply(&printer, "STATUS", "");
+	SELFTEST_ASSERT(strstr(reply, "\"FriendlyName\":[\"") != 0);
+	SELFTEST_ASSERT(strstr(reply, "\"Power\":1,") != 0);
+	SELFTEST_ASSERT(strstr(reply, "\"StatusFWR\":{\"Version\":\"") != 0);
+
+	// StatusNET is cached, but follows device name
+	CFG_SetShortDeviceName("jsonNetA");
+	reply = Test_Tasmota_StreamReply(&printer, "STATUS", "5");
+	SELFTEST_ASSERT(strstr(reply, "\"Hostname\":\"jsonNetA\"") != 0);
+	CFG_SetShortDeviceName("jsonNetB");
+	reply = Test_Tasmota_StreamReply(&printer, "STATUS", "5");
+	SELFTEST_ASSERT(strstr(reply, "\"Hostname\":\"jsonNetB\"") != 0);
+
+#ifdef SELFTEST_BENCHMARK
+	// benchmark, STATUS 0 through both paths
+	loops = 2000;
+	bytes = 0;
+	start = SIM_GetTime();
+	for (i = 0; i < loops; i++) {
+		bytes += strlen(Test_Tasmota_StreamReply(&printer, "STATUS", ""));
+	}
+	streamMS = SIM_GetTime() - start;
+	start = SIM_GetTime();
+	for (i = 0; i < loops; i++) {
+		Test_Tasmota_LegacyReply("STATUS", "");
+	}
+	legacyMS = SIM_GetTime() - start;
+	if (streamMS < 1) {
+		streamMS = 1;
+	}
+	if (legacyMS < 1) {
+		legacyMS = 1;
+	}
+	printf("Test_Tasmota_JSON_Writer: STATUS 0 is %i bytes, streaming %.1f bytes/us, printf path %.1f bytes/us\n",
+		bytes / loops, bytes / (streamMS * 1000.0f), bytes / (legacyMS * 1000.0f));
+#endif
+	if (printer.allocated) {
+		free(printer.allocated);
+	}
+}
 void Test_Tasmota() {
 	Test_Tasmota_MQTT_Switch();
 	Test_Tasmota_MQTT_Switch_Double();
 	Test_Tasmota_MQTT_RGBCW();
+	Test_Tasmota_JSON_Writer();
 }
 #endif
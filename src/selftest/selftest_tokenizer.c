@@ -107,6 +107,49 @@ void Test_Tokenizer() {
 	SELFTEST_ASSERT_ARGUMENT_INTEGER(3, 4);
 	SELFTEST_ASSERT_ARGUMENT_INTEGER(4, 77);// $CH3
 
+	// arguments past the end are not stale from previous call
+	Tokenizer_TokenizeString("", 0);
+	SELFTEST_ASSERT_ARGUMENTS_COUNT(0);
+	SELFTEST_ASSERT(Tokenizer_GetArgInteger(0) == 0);
+	SELFTEST_ASSERT(Tokenizer_GetArg(0) == 0);
+
+	// separate contexts do not clobber each other
+	{
+		tokenizer_t a, b;
+		const char *src = "first 2,3 \"quoted arg\"";
+		const char *slice;
+		int len;
+
+		Tokenizer_Ctx_TokenizeString(&a, src, TOKENIZER_ALLOW_QUOTES);
+		Tokenizer_Ctx_TokenizeString(&b, "other 10", 0);
+		SELFTEST_ASSERT(Tokenizer_Ctx_GetArgsCount(&a) == 4);
+		SELFTEST_ASSERT(Tokenizer_Ctx_GetArgsCount(&b) == 2);
+		SELFTEST_ASSERT_STRING(Tokenizer_Ctx_GetArg(&a, 0), "first");
+		SELFTEST_ASSERT(Tokenizer_Ctx_GetArgInteger(&a, 1) == 2);
+		SELFTEST_ASSERT(Tokenizer_Ctx_GetArgInteger(&a, 2) == 3);
+		SELFTEST_ASSERT_STRING(Tokenizer_Ctx_GetArg(&a, 3), "quoted arg");
+		SELFTEST_ASSERT_STRING(Tokenizer_Ctx_GetArg(&b, 0), "other");
+		SELFTEST_ASSERT(Tokenizer_Ctx_GetArgInteger(&b, 1) == 10);
+		SELFTEST_ASSERT_STRING(Tokenizer_Ctx_GetArgFrom(&a, 1), "2,3 \"quoted arg\"");
+
+		// slices point into the original string, nothing is copied
+		slice = Tokenizer_Ctx_GetArgSlice(&a, 0, &len);
+		SELFTEST_ASSERT(slice == src);
+		SELFTEST_ASSERT(len == 5);
+		slice = Tokenizer_Ctx_GetArgSlice(&a, 3, &len);
+		SELFTEST_ASSERT(slice == src + 11);
+		SELFTEST_ASSERT(len == 10);
+		SELFTEST_ASSERT(Tokenizer_Ctx_GetArgSlice(&a, 4, &len) == 0);
+	}
+
+	// nested command must not clobber the arguments of the caller
+	SIM_ClearOBK();
+	CMD_ExecuteCommand("setChannel 1 0", 0);
+	CMD_ExecuteCommand("alias tokNested setChannel 2 123", 0);
+	CMD_ExecuteCommand("if 1 then tokNested", 0);
+	SELFTEST_ASSERT_CHANNEL(2, 123);
+	CMD_ExecuteCommand("backlog setChannel 3 5; tokNested; addChannel 3 1", 0);
+	SELFTEST_ASSERT_CHANNEL(3, 6);
 
 	//system("pause");
 }
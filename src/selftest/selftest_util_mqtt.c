@@ -49,12 +49,23 @@ mqttHistoryEntry_t mqtt_history[MAX_MQTT_HISTORY];
 int history_head = 0;
 int history_tail = 0;
 
+// channel changes are published at the end of quick tick, and fast changing
+// values are delayed by deduper, send them now so checks done right after
+// a command can see them
+void SIM_FlushPendingMQTTPublishes() {
+	MQTT_Batch_Flush();
+	MQTT_Dedup_Flush();
+}
 void SIM_ClearMQTTHistory() {
+	// pending ones belong to what was done before the clear
+	SIM_FlushPendingMQTTPublishes();
 	history_head = history_tail = 0;
 }
 bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bRetain) {
 	mqttHistoryEntry_t *ne;
 	int cur = history_tail;
+
+	SIM_FlushPendingMQTTPublishes();
 	while (cur != history_head) {
 		ne = &mqtt_history[cur];
 		if (!strcmp(ne->topic, topic) && !strcmp(ne->value, value) && ne->bRetain == bRetain) {
@@ -68,6 +79,8 @@ bool SIM_CheckMQTTHistoryForString(const char *topic, const char *value, bool bR
 bool SIM_HasMQTTHistoryStringWithJSONPayload(const char *topic, bool bPrefixMode, const char *object1, const char *object2, const char *key, const char *value) {
 	mqttHistoryEntry_t *ne;
 	int cur = history_tail;
+
+	SIM_FlushPendingMQTTPublishes();
 	while (cur != history_head) {
 		bool bMatch = false;
 		ne = &mqtt_history[cur];
@@ -116,6 +129,8 @@ bool SIM_HasMQTTHistoryStringWithJSONPayload(const char *topic, bool bPrefixMode
 const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode) {
 	mqttHistoryEntry_t *ne;
 	int cur = history_tail;
+
+	SIM_FlushPendingMQTTPublishes();
 	while (cur != history_head) {
 		ne = &mqtt_history[cur];
 		if (bPrefixMode) {
@@ -133,9 +148,26 @@ const char *SIM_GetMQTTHistoryString(const char *topic, bool bPrefixMode) {
 	}
 	return 0;
 }
+int SIM_GetMQTTHistoryQoS(const char *topic) {
+	mqttHistoryEntry_t *ne;
+	int cur = history_tail;
+
+	SIM_FlushPendingMQTTPublishes();
+	while (cur != history_head) {
+		ne = &mqtt_history[cur];
+		if (!strcmp(ne->topic, topic)) {
+			return ne->qos;
+		}
+		cur++;
+		cur %= MAX_MQTT_HISTORY;
+	}
+	return -1;
+}
 bool SIM_CheckMQTTHistoryForFloat(const char *topic, float value, bool bRetain) {
 	mqttHistoryEntry_t *ne;
 	int cur = history_tail;
+
+	SIM_FlushPendingMQTTPublishes();
 	while (cur != history_head) {
 		ne = &mqtt_history[cur];
 		float neVal = atof(ne->value);
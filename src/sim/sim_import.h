@@ -19,6 +19,9 @@ extern "C" {
 	void SIM_ClearOBK();
 	bool SIM_IsFlashModified();
 	float SIM_GetDeltaTimeSeconds();
+	// quick tick statistics
+	void SIM_ResetQuickTickWakeups();
+	int SIM_GetQuickTickWakeupsPerMinute();
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,7 @@
 #include "new_cfg.h"
 #include "logging/logging.h"
 #include "httpserver/http_tcp_server.h"
+#include "httpserver/http_connection.h"
 #include "httpserver/rest_interface.h"
 #include "mqtt/new_mqtt.h"
 #include "ota/ota.h"
@@ -225,6 +226,7 @@ void Main_OnWiFiStatusChange(int code)
 	case WIFI_STA_CONNECTED:
 		g_bHasWiFiConnected = 1;
 		ADDLOGF_INFO("Main_OnWiFiStatusChange - WIFI_STA_CONNECTED - %i\r\n", code);
+		MQTT_OnWiFiConnected();
 
 		if (bSafeMode == 0) {
 			if (strlen(CFG_DeviceGroups_GetName()) > 0) {
@@ -397,6 +399,7 @@ void Main_OnEverySecond()
 	g_noMQTTTime = i;
 
 	MQTT_Dedup_Tick();
+	HTTP_Conn_RunEverySecond();
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_OnEverySecond();
 #endif
@@ -662,6 +665,111 @@ static int g_wifi_ledState = 0;
 static uint32_t g_time = 0;
 static uint32_t g_last_time = 0;
 int g_bWantPinDeepSleep;
+int g_quickTickSleepMS = QUICK_TMR_DURATION;
+static volatile int g_quickTickWakeupRequested = 0;
+
+#ifdef WINDOWS
+int NewTuyaMCUSimulator_GetNextWakeMS();
+#endif
+#if PLATFORM_BEKEN
+void QuickTick_WakeTimer();
+#elif PLATFORM_BL602 || PLATFORM_W600 || PLATFORM_W800
+// given on wakeup request, quick tick thread waits on it instead of plain delay
+static SemaphoreHandle_t g_quickTickWakeSem = 0;
+#endif
+
+void QuickTick_RequestWakeup() {
+	if (g_quickTickWakeupRequested) {
+		return;
+	}
+	g_quickTickWakeupRequested = 1;
+	// cut current sleep short, simulator checks the flag every frame
+#if PLATFORM_BEKEN
+	QuickTick_WakeTimer();
+#elif PLATFORM_BL602 || PLATFORM_W600 || PLATFORM_W800
+	if (g_quickTickWakeSem) {
+		xSemaphoreGive(g_quickTickWakeSem);
+	}
+#endif
+}
+// -1 means nothing pending
+static int QuickTick_MinWake(int a, int b) {
+	if (a < 0)
+		return b;
+	if (b < 0)
+		return a;
+	return a < b ? a : b;
+}
+static int QuickTick_GetWiFiLedNextWakeMS() {
+	int duration;
+
+	if (PIN_CountPinsWithRoleOrRole(IOR_LED_WIFI, IOR_LED_WIFI_n) == 0) {
+		return -1;
+	}
+	if (Main_IsOpenAccessPointMode()) {
+		duration = WIFI_LED_FAST_BLINK_DURATION;
+	}
+	else if (Main_IsConnectedToWiFi()) {
+		// steady
+		return -1;
+	}
+	else {
+		duration = WIFI_LED_SLOW_BLINK_DURATION;
+	}
+	if (g_wifiLedToggleTime >= duration) {
+		return 0;
+	}
+	return duration - g_wifiLedToggleTime;
+}
+int QuickTick_GetNextWakeMS() {
+	int r;
+
+	if (g_quickTickWakeupRequested || g_bWantPinDeepSleep) {
+		return 0;
+	}
+	// repeating events and sleeping scripts
+	r = Timers_GetNextDeadlineMS();
+#if (defined WINDOWS) || (defined PLATFORM_BEKEN)
+	r = QuickTick_MinWake(r, SVM_GetNextWakeMS());
+#endif
+#if defined(PLATFORM_BEKEN) && defined(BEKEN_PIN_GPI_INTERRUPTS)
+	// pin interrupts trigger their own poll
+#else
+	r = QuickTick_MinWake(r, PIN_GetNextWakeMS());
+#endif
+#ifndef OBK_DISABLE_ALL_DRIVERS
+	r = QuickTick_MinWake(r, DRV_GetNextWakeMS());
+#endif
+#ifdef WINDOWS
+	r = QuickTick_MinWake(r, NewTuyaMCUSimulator_GetNextWakeMS());
+#endif
+#if PLATFORM_BEKEN
+	if (CFG_HasFlag(OBK_FLAG_CMD_ACCEPT_UART_COMMANDS)) {
+		r = 0;
+	}
+#endif
+	if (CFG_HasFlag(OBK_FLAG_LED_SMOOTH_TRANSITIONS) == true && LED_IsRunningQuickColorLerp()) {
+		r = 0;
+	}
+	r = QuickTick_MinWake(r, QuickTick_GetWiFiLedNextWakeMS());
+	r = QuickTick_MinWake(r, MQTT_Dedup_GetNextWakeMS());
+	return r;
+}
+int QuickTick_GetSleepMS() {
+	int r;
+
+	r = QuickTick_GetNextWakeMS();
+	if (r < 0 || r > QUICK_TMR_MAX_IDLE) {
+		r = QUICK_TMR_MAX_IDLE;
+	}
+	if (r < QUICK_TMR_DURATION) {
+		r = QUICK_TMR_DURATION;
+	}
+	return r;
+}
+#if PLATFORM_BEKEN
+void QuickTick_UpdatePeriod();
+#endif
 
 /////////////////////////////////////////////////////
 // this is what we do in a qucik tick
@@ -672,6 +780,7 @@ void QuickTick(void* param)
 		PINS_BeginDeepSleepWithPinWakeUp();
 		return;
 	}
+	g_quickTickWakeupRequested = 0;
 
 #if defined(PLATFORM_BEKEN) && defined(BEKEN_PIN_GPI_INTERRUPTS)
 	// if using interrupt driven GPI for pins, don't call PIN_ticks() in QuickTick
@@ -682,7 +791,7 @@ void QuickTick(void* param)
 #if defined(PLATFORM_BEKEN) || defined(WINDOWS)
 	g_time = rtos_get_time();
 #else
-	g_time += QUICK_TMR_DURATION;
+	g_time += g_quickTickSleepMS;
 #endif
 	uint32_t t_diff = g_time - g_last_time;
 	// cope with wrap
@@ -695,7 +804,8 @@ void QuickTick(void* param)
 #if (defined WINDOWS) || (defined PLATFORM_BEKEN)
 	SVM_RunThreads(t_diff);
 #endif
-	RepeatingEvents_RunUpdate(t_diff*0.001f);
+	// repeating events and script delays, after threads, so a woken thread runs next tick
+	Timers_RunQuickTick(t_diff);
 #ifndef OBK_DISABLE_ALL_DRIVERS
 	DRV_RunQuickTick();
 #endif
@@ -705,7 +815,9 @@ void QuickTick(void* param)
 	CMD_RunUartCmndIfRequired();
 
 	// process recieved messages here..
-	MQTT_RunQuickTick();
+	MQTT_RunQuickTick(t_diff);
+	// delayed publishes of fast changing values
+	MQTT_Dedup_RunQuickTick(t_diff);
 
 	if (CFG_HasFlag(OBK_FLAG_LED_SMOOTH_TRANSITIONS) == true) {
 		LED_RunQuickColorLerp(t_diff);
@@ -735,6 +847,9 @@ void QuickTick(void* param)
 		}
 	}
 
+#if PLATFORM_BEKEN
+	QuickTick_UpdatePeriod();
+#endif
 }
 
 
@@ -746,23 +861,60 @@ void QuickTick(void* param)
 #elif PLATFORM_BL602
 void quick_timer_thread(void* param)
 {
+	portTickType start;
+
 	while (1) {
-		vTaskDelay(QUICK_TMR_DURATION);
+		start = xTaskGetTickCount();
+		xSemaphoreTake(g_quickTickWakeSem, QuickTick_GetSleepMS());
+		// wakeup request may end sleep early, so count the time actually slept
+		g_quickTickSleepMS = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
 		QuickTick(0);
 	}
 }
 #elif PLATFORM_W600 || PLATFORM_W800
 void quick_timer_thread(void* param)
 {
+	portTickType start;
+
 	while (1) {
-		vTaskDelay(QUICK_TMR_DURATION);
+		start = xTaskGetTickCount();
+		xSemaphoreTake(g_quickTickWakeSem, QuickTick_GetSleepMS());
+		// wakeup request may end sleep early, so count the time actually slept
+		g_quickTickSleepMS = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
 		QuickTick(0);
 	}
 }
 #elif PLATFORM_XR809
+// periodic timer, always QUICK_TMR_DURATION
 OS_Timer_t g_quick_timer;
 #else
 beken_timer_t g_quick_timer;
+static int g_quickTimerPeriod = QUICK_TMR_DURATION;
+
+// called at the end of QuickTick, from timer context
+void QuickTick_UpdatePeriod() {
+	int period;
+
+	period = QuickTick_GetSleepMS();
+	if (period != g_quickTimerPeriod) {
+		g_quickTimerPeriod = period;
+		rtos_change_period(&g_quick_timer, period);
+	}
+}
+OSStatus OBK_rtos_callback_in_timer_thread(PendedFunction_t xFunctionToPend, void* pvParameter1, uint32_t ulParameter2, uint32_t delay_ms);
+// from timer thread, like QuickTick_UpdatePeriod
+static void QuickTick_ShortenPeriod(void* a, uint32_t b) {
+	if (g_quickTimerPeriod > QUICK_TMR_DURATION) {
+		g_quickTimerPeriod = QUICK_TMR_DURATION;
+		rtos_change_period(&g_quick_timer, QUICK_TMR_DURATION);
+	}
+}
+// safe from interrupts, restarts long sleeping timer with short period
+void QuickTick_WakeTimer() {
+	if (g_quickTimerPeriod > QUICK_TMR_DURATION) {
+		OBK_rtos_callback_in_timer_thread(QuickTick_ShortenPeriod, 0, 0, 0);
+	}
+}
 #endif
 void QuickTick_StartThread(void)
 {
@@ -770,9 +922,11 @@ void QuickTick_StartThread(void)
 
 #elif PLATFORM_BL602
 
+	vSemaphoreCreateBinary(g_quickTickWakeSem);
 	xTaskCreate(quick_timer_thread, "quick", 1024, NULL, 15, NULL);
 #elif PLATFORM_W600 || PLATFORM_W800
 
+	vSemaphoreCreateBinary(g_quickTickWakeSem);
 	xTaskCreate(quick_timer_thread, "quick", 1024, NULL, 15, NULL);
 #elif PLATFORM_XR809
 
@@ -981,6 +1135,12 @@ void Main_Init_BeforeDelay_Unsafe(bool bAutoRunScripts) {
 	g_enable_pins = 1;
 	// this actually sets the pins, moved out so we could avoid if necessary
 	PIN_SetupPins();
+	// core commands are in and nothing else can execute commands yet
+	// (no quick tick, HTTP or main timer), so it's safe to pack them now.
+	// Forced unsafe init later in safe mode runs with HTTP up, so skip it there.
+	if (bAutoRunScripts) {
+		CMD_FreezeRegistry();
+	}
 	QuickTick_StartThread();
 
 	NewLED_RestoreSavedStateIfNeeded();
@@ -58,6 +58,20 @@ extern int g_bDoingUnitTestsNow;
 bool MQTT_IsFakingOnlineMQTT() {
 	return g_bDoingUnitTestsNow;
 }
+// lets unit tests simulate broker connection loss
+static bool g_simFakeMQTTOffline = false;
+void SIM_SetMQTTOffline(bool bOffline) {
+	g_simFakeMQTTOffline = bOffline;
+}
+// lets unit tests count SUBSCRIBE/UNSUBSCRIBE packets sent while faking online
+static int g_simSubscribePackets = 0;
+static int g_simSubscribedTopics = 0;
+static int g_simUnsubscribedTopics = 0;
+void SIM_GetMQTTSubscribeStats(int *packets, int *subscribed, int *unsubscribed) {
+	*packets = g_simSubscribePackets;
+	*subscribed = g_simSubscribedTopics;
+	*unsubscribed = g_simUnsubscribedTopics;
+}
 /**
  * MQTT connect flags, only used in CONNECT message
  */
@@ -378,8 +392,12 @@ err_t mqtt_client_connect(mqtt_client_t *client, const ip_addr_t *ip_addr, u16_t
 	u16_t client_user_len = 0, client_pass_len = 0;
 
 
-	if (MQTT_IsFakingOnlineMQTT())
+	if (MQTT_IsFakingOnlineMQTT()) {
+		// kept so unit tests can simulate CONNACK
+		client->connect_arg = arg;
+		client->connect_cb = cb;
 		return 0;
+	}
 
 	LWIP_ASSERT_CORE_LOCKED();
 	LWIP_ASSERT("mqtt_client_connect: client != NULL", client != NULL);
@@ -742,7 +760,7 @@ mqtt_client_t *mqtt_client_new(void) {
 /** Check connection status */
 u8_t mqtt_client_is_connected(mqtt_client_t *client) {
 	if (MQTT_IsFakingOnlineMQTT())
-		return 1;
+		return g_simFakeMQTTOffline ? 0 : 1;
 	return client->conn_state == MQTT_CONNECTED;
 }
 
@@ -873,9 +891,6 @@ mqtt_create_request(struct mqtt_request_t *r_objs, size_t r_objs_len, u16_t pkt_
 }
 /** Common function for subscribe and unsubscribe */
 err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_request_cb_t cb, void *arg, u8_t sub) {
-
-	if (MQTT_IsFakingOnlineMQTT())
-		return;
 	size_t topic_strlen;
 	size_t total_len;
 	u16_t topic_len;
@@ -883,6 +898,20 @@ err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_re
 	u16_t pkt_id;
 	struct mqtt_request_t *r;
 
+	if (MQTT_IsFakingOnlineMQTT()) {
+		g_simSubscribePackets++;
+		if (sub) {
+			g_simSubscribedTopics++;
+		}
+		else {
+			g_simUnsubscribedTopics++;
+		}
+		if (cb) {
+			cb(arg, ERR_OK);
+		}
+		return ERR_OK;
+	}
+
 	LWIP_ASSERT_CORE_LOCKED();
 	LWIP_ASSERT("mqtt_sub_unsub: client != NULL", client);
 	LWIP_ASSERT("mqtt_sub_unsub: topic != NULL", topic);
@@ -928,6 +957,15 @@ err_t mqtt_sub_unsub(mqtt_client_t *client, const char *topic, u8_t qos, mqtt_re
 	mqtt_output_send(&client->output, client->conn);
 	return ERR_OK;
 }
+// calls connection callback as if broker accepted the connection
+void SIM_SimulateMQTTConnAck() {
+	for (int i = 0; i < g_numClients; i++) {
+		mqtt_client_t *client = g_clients[i];
+		if (client && client->connect_cb) {
+			client->connect_cb(client, client->connect_arg, MQTT_CONNECT_ACCEPTED);
+		}
+	}
+}
 
 void SIM_OnMQTTPublish(const char *topic, const char *value, int len, int qos, bool bRetain);
 
@@ -946,6 +984,10 @@ err_t mqtt_publish(mqtt_client_t *client, const char *topic, const void *payload
 	if (MQTT_IsFakingOnlineMQTT()) {
 		// on Windows simulator, forward MQTT publish for unit testing
 		SIM_OnMQTTPublish(topic, payload, payload_length, qos, retain);
+		// acknowledged at once
+		if (cb) {
+			cb(arg, ERR_OK);
+		}
 		return 0;
 	}
 
@@ -1425,6 +1467,10 @@ void WIN_ResetMQTT() {
 	}
 	memset(g_clients, 0, sizeof(g_clients));
 	g_numClients = 0;
+	g_simFakeMQTTOffline = false;
+	g_simSubscribePackets = 0;
+	g_simSubscribedTopics = 0;
+	g_simUnsubscribedTopics = 0;
 }
 void WIN_RunMQTTFrame() {
 	for (int i = 0; i < g_numClients; i++) {
@@ -26,6 +26,9 @@ int delay_ms(int sec) {
 int xTaskGetTickCount() {
 	return 9999;
 }
+void *xTaskGetCurrentTaskHandle() {
+	return (void*)(size_t)GetCurrentThreadId();
+}
 
 int xPortGetFreeHeapSize() {
 	return 100 * 1000;
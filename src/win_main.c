@@ -15,6 +15,7 @@
 #include "httpserver\new_http.h"
 #include "hal\hal_flashVars.h"
 #include "new_pins.h"
+#include "quicktick.h"
 #include <timeapi.h>
 
 #define OFFSETOF(TYPE, ELEMENT) ((size_t)&(((TYPE *)0)->ELEMENT))
@@ -31,6 +32,39 @@ int g_simulatedTimeNow = 0;
 extern int g_port;
 #define DEFAULT_FRAME_TIME 5
 
+// quick tick is only run when something is pending, like on devices
+static int g_quickTickAccum = 0;
+// for wakeups per minute statistic
+static int g_quickTickWakeups = 0;
+static int g_quickTickWakeupsTime = 0;
+
+void SIM_ResetQuickTickWakeups() {
+	g_quickTickWakeups = 0;
+	g_quickTickWakeupsTime = 0;
+}
+int SIM_GetQuickTickWakeupsPerMinute() {
+	if (g_quickTickWakeupsTime <= 0)
+		return 0;
+	return (int)((long long)g_quickTickWakeups * 60000 / g_quickTickWakeupsTime);
+}
+static void Sim_RunQuickTickIfNeeded(int frameTime) {
+	int wake;
+
+	g_quickTickAccum += frameTime;
+	g_quickTickWakeupsTime += frameTime;
+	// relative to previous quick tick, 0 means every frame
+	wake = QuickTick_GetNextWakeMS();
+	if (wake < 0 || wake > QUICK_TMR_MAX_IDLE) {
+		wake = QUICK_TMR_MAX_IDLE;
+	}
+	if (g_quickTickAccum < wake) {
+		return;
+	}
+	g_quickTickAccum = 0;
+	g_quickTickWakeups++;
+	QuickTick(0);
+}
+
 
 void strcat_safe_test(){
 	char tmpA[16];
@@ -72,7 +106,7 @@ void Sim_RunFrame(int frameTime) {
 	// this time counter is simulated, I need this for unit tests to work
 	g_simulatedTimeNow += frameTime;
 	accum_time += frameTime;
-	QuickTick(0);
+	Sim_RunQuickTickIfNeeded(frameTime);
 	WIN_RunMQTTFrame();
 	HTTPServer_RunQuickTick();
 	if (accum_time > 1000) {
@@ -152,12 +186,21 @@ void Win_DoUnitTests() {
 	Test_ExpandConstant();
 	Test_ChangeHandlers_MQTT();
 	Test_ChangeHandlers();
+	Test_ChangeHandlers_Buckets();
 	Test_RepeatingEvents();
+	Test_QuickTick();
 	Test_ButtonEvents();
 	Test_Commands_Alias();
+	Test_Command_Compiled();
+	Test_Command_Registry();
 	Test_Expressions_RunTests_Basic();
+	Test_Expressions_RunTests_Cache();
 	Test_LEDDriver();
 	Test_LFS();
+	Test_Logging();
+	Test_HTTP_KeepAlive();
+	Test_HTTP_Server();
+	Test_HTTP_Routes();
 	Test_Scripting();
 	Test_Commands_Channels();
 	Test_Command_If();
@@ -102,9 +102,10 @@ int __cdecl main(void)
                 else
                     addLogAdv(1,1,  ",%1.1f", 3.145f);
             }
-	SVM_StartScript("testScripts/testGoto.txt",0,0);
+	SVM_StartScript("testScripts/testGoto.txt",0,0,0);
 	while(1) {
 		SVM_RunThreads(5);
+		Timers_RunQuickTick(5);
 	}
 	system("pause");
     return 0;